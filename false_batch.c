@@ -0,0 +1,241 @@
+/* Multiple False Programming Language : Batch Compiler
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef MF_BATCH_NO_THREADS
+#include <pthread.h>
+#endif
+
+#include "multiple.h"
+#include "multiple_ir.h"
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+#include "mf_icg.h"
+#include "false_stub.h"
+#include "false_batch.h"
+
+static double mf_batch_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void mf_batch_item_init(struct mf_batch_item *item, char *pathname)
+{
+    item->pathname = pathname;
+    item->icode = NULL;
+    item->c_src = NULL;
+    item->c_src_len = 0;
+    item->threads = 1;
+    item->ret = 0;
+    item->err = NULL;
+    item->source_len = 0;
+    item->seconds = 0.0;
+}
+
+void mf_batch_item_uninit(struct mf_batch_item *item)
+{
+    if (item->icode != NULL) multiple_ir_destroy(item->icode);
+    if (item->c_src != NULL) free(item->c_src);
+    if (item->err != NULL) multiple_error_destroy(item->err);
+    item->icode = NULL;
+    item->c_src = NULL;
+    item->err = NULL;
+}
+
+static void mf_batch_compile_item(struct mf_batch_item *item, \
+        int target, int optimize)
+{
+    void *stub = NULL;
+    struct mf_stub *stub_ptr;
+    double time_start = mf_batch_now();
+
+    if ((item->err = multiple_error_new()) == NULL)
+    {
+        item->ret = -MULTIPLE_ERR_MALLOC;
+        goto done;
+    }
+
+    if ((item->ret = mf_stub_create(item->err, &stub, NULL, 0, \
+                    item->pathname, MULTIPLE_IO_PATHNAME)) != 0)
+    { goto done; }
+    stub_ptr = (struct mf_stub *)stub;
+    item->source_len = stub_ptr->len;
+    mf_stub_optimize_set(stub, optimize);
+    mf_stub_threads_set(stub, item->threads);
+
+    switch (target)
+    {
+        case MF_BATCH_TARGET_ICODE:
+            item->ret = mf_stub_irgen(item->err, &item->icode, stub);
+            break;
+
+        case MF_BATCH_TARGET_C:
+            if ((item->ret = mf_tokenize(item->err, &stub_ptr->tokens, \
+                            stub_ptr->code, stub_ptr->len)) != 0)
+            { goto done; }
+            item->ret = mf_aotgen_parallel(item->err, &item->c_src, &item->c_src_len, \
+                    stub_ptr->tokens, optimize, item->threads);
+            break;
+
+        default:
+            item->ret = -MULTIPLE_ERR_INTERNAL;
+            break;
+    }
+
+done:
+    if (stub != NULL) mf_stub_destroy(stub);
+    item->seconds = mf_batch_now() - time_start;
+}
+
+/* Pool */
+
+struct mf_batch_pool
+{
+    struct mf_batch_item *items;
+    size_t items_count;
+    int target;
+    int optimize;
+
+    /* Next item to be taken */
+    size_t next;
+#ifndef MF_BATCH_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+static void *mf_batch_worker(void *data)
+{
+    struct mf_batch_pool *pool = (struct mf_batch_pool *)data;
+    size_t idx;
+
+    for (;;)
+    {
+#ifndef MF_BATCH_NO_THREADS
+        pthread_mutex_lock(&pool->lock);
+#endif
+        idx = pool->next;
+        if (idx < pool->items_count) pool->next += 1;
+#ifndef MF_BATCH_NO_THREADS
+        pthread_mutex_unlock(&pool->lock);
+#endif
+        if (idx >= pool->items_count) break;
+
+        mf_batch_compile_item(&pool->items[idx], pool->target, pool->optimize);
+    }
+
+    return NULL;
+}
+
+int mf_batch_compile(struct mf_batch_item *items, size_t items_count, \
+        int target, int optimize, size_t threads, \
+        struct mf_batch_report *report)
+{
+    struct mf_batch_pool pool;
+    size_t idx;
+    double time_start;
+#ifndef MF_BATCH_NO_THREADS
+    pthread_t *workers = NULL;
+    size_t workers_count = 0;
+#endif
+
+    if (threads == 0) threads = 1;
+    if (threads > items_count) threads = (items_count == 0) ? 1 : items_count;
+#ifdef MF_BATCH_NO_THREADS
+    threads = 1;
+#endif
+
+    pool.items = items;
+    pool.items_count = items_count;
+    pool.target = target;
+    pool.optimize = optimize;
+    pool.next = 0;
+
+    time_start = mf_batch_now();
+
+#ifndef MF_BATCH_NO_THREADS
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) return -MULTIPLE_ERR_INTERNAL;
+    if (threads > 1)
+    {
+        workers = (pthread_t *)malloc(sizeof(pthread_t) * (threads - 1));
+        if (workers == NULL)
+        {
+            pthread_mutex_destroy(&pool.lock);
+            return -MULTIPLE_ERR_MALLOC;
+        }
+        /* Fewer workers if some could not be created */
+        for (idx = 0; idx != threads - 1; idx++)
+        {
+            if (pthread_create(&workers[workers_count], NULL, mf_batch_worker, &pool) != 0) break;
+            workers_count++;
+        }
+        threads = workers_count + 1;
+    }
+#endif
+
+    /* The calling thread works as well */
+    mf_batch_worker(&pool);
+
+#ifndef MF_BATCH_NO_THREADS
+    for (idx = 0; idx != workers_count; idx++) pthread_join(workers[idx], NULL);
+    if (workers != NULL) free(workers);
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    report->threads = threads;
+    report->items_count = items_count;
+    report->failed_count = 0;
+    report->source_bytes = 0;
+    report->seconds = mf_batch_now() - time_start;
+    report->seconds_items = 0.0;
+    for (idx = 0; idx != items_count; idx++)
+    {
+        if (items[idx].ret != 0) report->failed_count += 1;
+        report->source_bytes += items[idx].source_len;
+        report->seconds_items += items[idx].seconds;
+    }
+
+    return 0;
+}
+
+void mf_batch_report_print(FILE *fp, const struct mf_batch_report *report)
+{
+    double seconds = (report->seconds > 0.0) ? report->seconds : 1e-9;
+
+    fprintf(fp, "compiled %lu of %lu sources, %lu bytes in %.6f s with %lu thread(s)\n", \
+            (unsigned long)(report->items_count - report->failed_count), \
+            (unsigned long)report->items_count, \
+            (unsigned long)report->source_bytes, \
+            report->seconds, \
+            (unsigned long)report->threads);
+    fprintf(fp, "throughput: %.1f sources/s, %.3f MB/s, %.2fx concurrency\n", \
+            (double)report->items_count / seconds, \
+            (double)report->source_bytes / seconds / 1e6, \
+            report->seconds_items / seconds);
+}
+
@@ -0,0 +1,82 @@
+/* Multiple False Programming Language : Batch Compiler
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _FALSE_BATCH_H_
+#define _FALSE_BATCH_H_
+
+#include <stdio.h>
+
+#include "multiple_ir.h"
+#include "multiple_err.h"
+
+/* Compiles many sources on a pool of threads, every source with its 
+ * own stub and context, the results stay in the order of the items 
+ * whatever the number of threads. The host calls made on the threads 
+ * are the ones listed in 'mf_icg_par.h'. Without pthreads define 
+ * MF_BATCH_NO_THREADS and the items are compiled one after another */
+
+enum
+{
+    MF_BATCH_TARGET_ICODE = 0,  /* icode of the virtual machine */
+    MF_BATCH_TARGET_C,          /* see 'mf_aot_c' */
+};
+
+struct mf_batch_item
+{
+    char *pathname;
+
+    /* Result for the target */
+    struct multiple_ir *icode;
+    char *c_src;
+    size_t c_src_len;
+
+    /* Threads generating the lambdas of the item, 1 unless set */
+    size_t threads;
+
+    int ret;
+    struct multiple_error *err;
+
+    size_t source_len;
+    double seconds;
+};
+
+void mf_batch_item_init(struct mf_batch_item *item, char *pathname);
+void mf_batch_item_uninit(struct mf_batch_item *item);
+
+struct mf_batch_report
+{
+    size_t threads;
+    size_t items_count;
+    size_t failed_count;
+    size_t source_bytes;
+
+    /* Wall clock, and the sum of the time of every item */
+    double seconds;
+    double seconds_items;
+};
+
+/* Failures of the items are in 'ret' and 'err' of each one */
+int mf_batch_compile(struct mf_batch_item *items, size_t items_count, \
+        int target, int optimize, size_t threads, \
+        struct mf_batch_report *report);
+
+void mf_batch_report_print(FILE *fp, const struct mf_batch_report *report);
+
+#endif
+
@@ -0,0 +1,334 @@
+/* Multiple False Programming Language : Program Hot Reload
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef MF_RELOAD_NO_THREADS
+#include <pthread.h>
+#endif
+
+#include "multiple.h"
+#include "multiple_err.h"
+
+#include "mf_engine.h"
+#include "false_stub.h"
+#include "false_serve.h"
+#include "false_reload.h"
+
+#ifndef MF_RELOAD_NO_THREADS
+#define MF_RELOAD_LOCK(reload) pthread_mutex_lock(&(reload)->lock)
+#define MF_RELOAD_UNLOCK(reload) pthread_mutex_unlock(&(reload)->lock)
+#define MF_RELOAD_BROADCAST(reload) pthread_cond_broadcast(&(reload)->cond)
+#define MF_RELOAD_WAIT(reload) pthread_cond_wait(&(reload)->cond, &(reload)->lock)
+#else
+#define MF_RELOAD_LOCK(reload) do { } while (0)
+#define MF_RELOAD_UNLOCK(reload) do { } while (0)
+#define MF_RELOAD_BROADCAST(reload) do { } while (0)
+#define MF_RELOAD_WAIT(reload) do { } while (0)
+#endif
+
+struct mf_reload_buf
+{
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+struct mf_reload
+{
+    int image_flags;
+
+    struct mf_reload_version *current;
+    uint32_t generation;
+
+    /* Source given to the next reload, swapped with 'source' once it 
+     * starts so both buffers are reused */
+    struct mf_reload_buf pending;
+    int has_pending;
+
+    /* Only used by the reload compiling, over the same stub each time */
+    struct mf_reload_buf source;
+    void *stub;
+
+    int compiling;
+    /* Result of the last reload */
+    int status;
+
+#ifndef MF_RELOAD_NO_THREADS
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+static void mf_reload_version_destroy(struct mf_reload_version *version)
+{
+    mf_serve_program_destroy(version->program);
+    free(version);
+}
+
+/* The caller holds the lock and frees what is returned after it */
+static void mf_reload_version_unref(struct mf_reload_version *version, \
+        struct mf_reload_version **dead_out)
+{
+    *dead_out = NULL;
+    if (--version->refs == 0) *dead_out = version;
+}
+
+/* The stub compiles and the version is put in place */
+static int mf_reload_install(struct multiple_error *err, \
+        struct mf_reload *reload, void *stub)
+{
+    int ret;
+    struct mf_reload_version *new_version, *dead;
+
+    if ((new_version = (struct mf_reload_version *)malloc( \
+                    sizeof(struct mf_reload_version))) == NULL)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        return -MULTIPLE_ERR_MALLOC;
+    }
+    if ((ret = mf_serve_program_new(err, &new_version->program, \
+                    stub, reload->image_flags)) != 0)
+    {
+        free(new_version);
+        return ret;
+    }
+    new_version->refs = 1;
+
+    MF_RELOAD_LOCK(reload);
+    new_version->generation = ++reload->generation;
+    dead = NULL;
+    if (reload->current != NULL) mf_reload_version_unref(reload->current, &dead);
+    reload->current = new_version;
+    MF_RELOAD_UNLOCK(reload);
+    if (dead != NULL) mf_reload_version_destroy(dead);
+
+    return 0;
+}
+
+static int mf_reload_buf_set(struct mf_reload_buf *buf, const char *data, size_t len)
+{
+    char *new_data;
+
+    if ((len > buf->size) || (buf->data == NULL))
+    {
+        if ((new_data = (char *)malloc(len + 1)) == NULL) return -MULTIPLE_ERR_MALLOC;
+        if (buf->data != NULL) free(buf->data);
+        buf->data = new_data;
+        buf->size = len;
+    }
+    memcpy(buf->data, data, len);
+    buf->len = len;
+
+    return 0;
+}
+
+/* Compiles what is waiting until nothing is, the errors of each 
+ * reload are reported as it fails */
+static void *mf_reload_worker(void *data)
+{
+    struct mf_reload *reload = (struct mf_reload *)data;
+    struct mf_reload_buf buf;
+    struct multiple_error *err;
+    int ret;
+
+    MF_RELOAD_LOCK(reload);
+    while (reload->has_pending != 0)
+    {
+        buf = reload->source;
+        reload->source = reload->pending;
+        reload->pending = buf;
+        reload->has_pending = 0;
+        MF_RELOAD_UNLOCK(reload);
+
+        if ((err = multiple_error_new()) == NULL)
+        { ret = -MULTIPLE_ERR_MALLOC; }
+        else
+        {
+            if (((ret = mf_stub_reset(err, reload->stub, \
+                                reload->source.data, reload->source.len, NULL)) != 0) || \
+                    ((ret = mf_reload_install(err, reload, reload->stub)) != 0))
+            { multiple_error_final(err); }
+            multiple_error_destroy(err);
+        }
+
+        MF_RELOAD_LOCK(reload);
+        reload->status = ret;
+    }
+    reload->compiling = 0;
+    MF_RELOAD_BROADCAST(reload);
+    MF_RELOAD_UNLOCK(reload);
+
+    return NULL;
+}
+
+int mf_reload_new(struct multiple_error *err, \
+        struct mf_reload **reload_out, \
+        void *stub, int image_flags)
+{
+    int ret = 0;
+    struct mf_reload *new_reload = NULL;
+    struct mf_stub *stub_ptr = (struct mf_stub *)stub;
+
+    if ((new_reload = (struct mf_reload *)malloc(sizeof(struct mf_reload))) == NULL)
+    { MULTIPLE_ERROR_MALLOC(); return -MULTIPLE_ERR_MALLOC; }
+    new_reload->image_flags = image_flags;
+    new_reload->current = NULL;
+    new_reload->generation = 0;
+    new_reload->pending.data = NULL;
+    new_reload->pending.len = new_reload->pending.size = 0;
+    new_reload->has_pending = 0;
+    new_reload->source.data = NULL;
+    new_reload->source.len = new_reload->source.size = 0;
+    new_reload->stub = NULL;
+    new_reload->compiling = 0;
+    new_reload->status = 0;
+#ifndef MF_RELOAD_NO_THREADS
+    new_reload->thread_started = 0;
+    if (pthread_mutex_init(&new_reload->lock, NULL) != 0)
+    {
+        free(new_reload);
+        MULTIPLE_ERROR_INTERNAL();
+        return -MULTIPLE_ERR_INTERNAL;
+    }
+    if (pthread_cond_init(&new_reload->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&new_reload->lock);
+        free(new_reload);
+        MULTIPLE_ERROR_INTERNAL();
+        return -MULTIPLE_ERR_INTERNAL;
+    }
+#endif
+
+    /* The reloads own a stub of their own with the same options */
+    if ((ret = mf_stub_create_mem(err, &new_reload->stub, NULL, 0, NULL)) != 0)
+    { goto fail; }
+    mf_stub_optimize_set(new_reload->stub, stub_ptr->optimize);
+    mf_stub_threads_set(new_reload->stub, stub_ptr->threads);
+
+    if ((ret = mf_reload_install(err, new_reload, stub)) != 0)
+    { goto fail; }
+
+    *reload_out = new_reload;
+    goto done;
+fail:
+    mf_reload_destroy(new_reload);
+done:
+    return ret;
+}
+
+int mf_reload_destroy(struct mf_reload *reload)
+{
+    mf_reload_wait(reload);
+#ifndef MF_RELOAD_NO_THREADS
+    if (reload->thread_started != 0) pthread_join(reload->thread, NULL);
+#endif
+    if (reload->current != NULL) mf_reload_release(reload, reload->current);
+    if (reload->stub != NULL) mf_stub_destroy(reload->stub);
+    if (reload->pending.data != NULL) free(reload->pending.data);
+    if (reload->source.data != NULL) free(reload->source.data);
+#ifndef MF_RELOAD_NO_THREADS
+    pthread_cond_destroy(&reload->cond);
+    pthread_mutex_destroy(&reload->lock);
+#endif
+    free(reload);
+
+    return 0;
+}
+
+struct mf_reload_version *mf_reload_acquire(struct mf_reload *reload)
+{
+    struct mf_reload_version *version;
+
+    MF_RELOAD_LOCK(reload);
+    version = reload->current;
+    version->refs += 1;
+    MF_RELOAD_UNLOCK(reload);
+
+    return version;
+}
+
+void mf_reload_release(struct mf_reload *reload, \
+        struct mf_reload_version *version)
+{
+    struct mf_reload_version *dead;
+
+    MF_RELOAD_LOCK(reload);
+    mf_reload_version_unref(version, &dead);
+    MF_RELOAD_UNLOCK(reload);
+    if (dead != NULL) mf_reload_version_destroy(dead);
+}
+
+int mf_reload_start(struct mf_reload *reload, const char *code, size_t len)
+{
+    int ret;
+
+    MF_RELOAD_LOCK(reload);
+    if ((ret = mf_reload_buf_set(&reload->pending, code, len)) != 0)
+    {
+        MF_RELOAD_UNLOCK(reload);
+        return ret;
+    }
+    reload->has_pending = 1;
+    if (reload->compiling != 0)
+    {
+        /* Picked up once the one compiling is in place */
+        MF_RELOAD_UNLOCK(reload);
+        return 0;
+    }
+    reload->compiling = 1;
+#ifndef MF_RELOAD_NO_THREADS
+    /* The thread of the previous reload has already finished */
+    if (reload->thread_started != 0) pthread_join(reload->thread, NULL);
+    reload->thread_started = 0;
+    if (pthread_create(&reload->thread, NULL, mf_reload_worker, reload) != 0)
+    {
+        reload->has_pending = 0;
+        reload->compiling = 0;
+        MF_RELOAD_UNLOCK(reload);
+        return -MULTIPLE_ERR_INTERNAL;
+    }
+    reload->thread_started = 1;
+    MF_RELOAD_UNLOCK(reload);
+#else
+    MF_RELOAD_UNLOCK(reload);
+    mf_reload_worker(reload);
+#endif
+
+    return 0;
+}
+
+int mf_reload_wait(struct mf_reload *reload)
+{
+    int ret;
+
+    MF_RELOAD_LOCK(reload);
+    while (reload->compiling != 0) MF_RELOAD_WAIT(reload);
+    ret = reload->status;
+    MF_RELOAD_UNLOCK(reload);
+
+    return ret;
+}
+
@@ -0,0 +1,72 @@
+/* Multiple False Programming Language : Program Hot Reload
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _FALSE_RELOAD_H_
+#define _FALSE_RELOAD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "multiple_err.h"
+
+#include "false_serve.h"
+
+/* A shared program replaced while it is running. A run takes the 
+ * current version when it starts and keeps it to the end, a reload 
+ * compiles the new source on a thread of its own and puts it in 
+ * place between two runs, the runs already going finish on the old 
+ * version, freed with the last of them. Without pthreads define 
+ * MF_RELOAD_NO_THREADS and the reload compiles in place */
+
+struct mf_reload_version
+{
+    struct mf_serve_program *program;
+    /* 1 for the first, one more for each reload put in place */
+    uint32_t generation;
+
+    /* Runs holding it, one more while it is the current one */
+    size_t refs;
+};
+
+struct mf_reload;
+
+/* The first version from the stub, the reloads compile with its 
+ * options */
+int mf_reload_new(struct multiple_error *err, \
+        struct mf_reload **reload_out, \
+        void *stub, int image_flags);
+/* Waits for the reload going on, every version taken must have 
+ * been given back */
+int mf_reload_destroy(struct mf_reload *reload);
+
+/* The current version, held until given back */
+struct mf_reload_version *mf_reload_acquire(struct mf_reload *reload);
+void mf_reload_release(struct mf_reload *reload, \
+        struct mf_reload_version *version);
+
+/* Compile 'len' bytes at 'code', copied, in the background. If a 
+ * reload is still compiling, this source is the next one and any 
+ * other waiting is dropped */
+int mf_reload_start(struct mf_reload *reload, const char *code, size_t len);
+/* Wait until no reload is left, returns the result of the last one, 
+ * the version stays the same when it failed */
+int mf_reload_wait(struct mf_reload *reload);
+
+#endif
+
@@ -0,0 +1,680 @@
+/* Multiple False Programming Language : Standalone Runner
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "multiple.h"
+#include "multiple_err.h"
+#include "multiple_ir.h"
+
+#include "mf_lexer.h"
+#include "mf_icg.h"
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_rt.h"
+#include "mf_engine.h"
+#include "mf_snap.h"
+#include "false_stub.h"
+#include "false_batch.h"
+#include "false_serve.h"
+#include "false_sched.h"
+
+/* Runs False programs without the virtual machine of Multiple */
+
+enum
+{
+    MF_RUN_ENGINE_THREADED = 0,
+    MF_RUN_ENGINE_INTERPRETER,
+    MF_RUN_ENGINE_JIT,
+};
+
+static void mf_run_usage(const char *name)
+{
+    fprintf(stderr, \
+            "usage: %s [options] <file>\n" \
+            "       %s -c <dir> [options] <file>...\n" \
+            "       %s -x <rounds> [options] <file>...\n" \
+            "\n" \
+            "  -O <level>     optimization level (default 1)\n" \
+            "  -e <engine>    threaded (default), interpreter or jit\n" \
+            "  -s <elements>  size of the operand stack\n" \
+            "  -t             report the time spent running\n" \
+            "  -p             report the most frequent sequences of instructions\n" \
+            "  -S             no superinstructions\n" \
+            "  -T             run hot loops as traces\n" \
+            "  -f <fuel>      stop after <fuel> calls and loop iterations, only with\n" \
+            "                 the threaded engine and not with -c or -x\n" \
+            "  -k <file>      save the state into <file> when stopped by -f\n" \
+            "  -w <file>      go on from the state saved in <file>, the same\n" \
+            "                 source and options as when saving\n" \
+            "  -c <dir>       compile every source to C into <dir> instead of running\n" \
+            "  -l <list>      with -c or -x, also the sources listed one per line in <list>\n" \
+            "  -x <rounds>    compile every source on one thread, then <rounds> times\n" \
+            "                 more on -j threads, and check every result is the same\n" \
+            "  -r <list>      run the program once for each input listed one per\n" \
+            "                 line in <list>, writing <input>.out, compiled once\n" \
+            "  -y <slice>     with -r, run the inputs as green threads giving the\n" \
+            "                 thread up every <slice> calls and loop iterations\n" \
+            "  -j <threads>   threads compiling the sources with -c or -x, running\n" \
+            "                 the inputs with -r, or generating the lambdas (default 1)\n", \
+            name, name, name);
+}
+
+static double mf_run_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int mf_run_prog(const struct mf_prog *prog, int engine_type, \
+        size_t stack_size, int timing, int image_flags, uint64_t fuel, \
+        const char *snap_in, const char *snap_out)
+{
+    int ret;
+    int status;
+    struct mf_rt_io io;
+    struct mf_rt rt;
+    struct mf_engine_image *image = NULL;
+    struct mf_engine_profile *profile = NULL;
+    struct mf_engine engine;
+    double time_start = 0.0;
+    int profiling = ((image_flags & MF_ENGINE_IMAGE_FLAG_PROFILE) != 0) ? 1 : 0;
+
+    if ((ret = mf_rt_io_init(&io, 0, 1, \
+                    MF_RT_IO_INPUT_BUFFER_SIZE_DEFAULT, \
+                    MF_RT_IO_OUTPUT_BUFFER_SIZE_DEFAULT, \
+                    MF_RT_IO_FLAG_MMAP_INPUT)) != 0)
+    { return ret; }
+
+    if (engine_type == MF_RUN_ENGINE_THREADED)
+    {
+        if (profiling)
+        {
+            if ((ret = mf_engine_profile_new(&profile)) != 0) goto done;
+        }
+        if ((ret = mf_engine_image_new(&image, prog, image_flags)) != 0) goto done;
+        if ((ret = mf_engine_init(&engine, image, &io, stack_size)) != 0) goto done;
+        engine.profile = profile;
+        engine.fuel = fuel;
+        if ((snap_in != NULL) && ((status = mf_snap_load(&engine, snap_in)) != 0))
+        {
+            fprintf(stderr, "error: %s: %s\n", snap_in, mf_snap_error_str(status));
+            mf_engine_uninit(&engine);
+            ret = 1;
+            goto done;
+        }
+        if (timing) time_start = mf_run_now();
+        ret = mf_engine_run(&engine);
+        if (timing) fprintf(stderr, "time: %.6f s\n", mf_run_now() - time_start);
+        if ((snap_out != NULL) && (ret == MF_RT_FUEL))
+        {
+            if ((status = mf_snap_save(&engine, snap_out)) != 0)
+            { fprintf(stderr, "error: %s: %s\n", snap_out, mf_snap_error_str(status)); }
+            else
+            {
+                /* The rest of the output is written by the restored run */
+                io.buf_out_used = 0;
+                ret = MF_RT_OK;
+            }
+        }
+        mf_engine_uninit(&engine);
+        if (profiling) mf_engine_profile_report(stderr, profile, 16);
+    }
+    else
+    {
+        if ((ret = mf_rt_init(&rt, prog, &io, stack_size)) != 0) goto done;
+        if (timing) time_start = mf_run_now();
+        ret = mf_rt_run(&rt, (engine_type == MF_RUN_ENGINE_JIT) ? MF_RT_FLAG_JIT : 0);
+        if (timing) fprintf(stderr, "time: %.6f s\n", mf_run_now() - time_start);
+        mf_rt_uninit(&rt);
+    }
+    if (ret != MF_RT_OK)
+    {
+        fprintf(stderr, "error: %s\n", mf_rt_error_str(ret));
+        ret = 1;
+    }
+
+done:
+    if (image != NULL) mf_engine_image_destroy(image);
+    if (profile != NULL) mf_engine_profile_destroy(profile);
+    mf_rt_io_uninit(&io);
+    return ret;
+}
+
+/* Reads the pathnames in 'list', one per line, the buffer holds them */
+static int mf_run_list_read(const char *list, char **buf_out, \
+        char ***pathnames_in_out, size_t *pathnames_count_in_out)
+{
+    FILE *fp;
+    long size;
+    char *buf = NULL, *p, *line;
+    char **new_pathnames;
+    size_t count = *pathnames_count_in_out, len;
+
+    if ((fp = fopen(list, "rb")) == NULL) return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if ((size < 0) || ((buf = (char *)malloc((size_t)size + 1)) == NULL)) goto fail;
+    if ((size != 0) && (fread(buf, (size_t)size, 1, fp) < 1)) goto fail;
+    buf[size] = '\0';
+    fclose(fp);
+    fp = NULL;
+
+    p = buf;
+    while (*p != '\0')
+    {
+        line = p;
+        while ((*p != '\0') && (*p != '\n')) p++;
+        if (*p == '\n') *p++ = '\0';
+        len = strlen(line);
+        if ((len != 0) && (line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+
+        new_pathnames = (char **)realloc(*pathnames_in_out, sizeof(char *) * (count + 1));
+        if (new_pathnames == NULL) goto fail;
+        *pathnames_in_out = new_pathnames;
+        new_pathnames[count++] = line;
+    }
+
+    *pathnames_count_in_out = count;
+    *buf_out = buf;
+    return 0;
+fail:
+    if (fp != NULL) fclose(fp);
+    if (buf != NULL) free(buf);
+    return -1;
+}
+
+/* '<dir>/<name without extension>.c' */
+static char *mf_run_batch_output_pathname(const char *dir, const char *pathname)
+{
+    const char *name, *ext;
+    char *result;
+    size_t dir_len = strlen(dir), name_len;
+
+    name = strrchr(pathname, '/');
+    name = (name == NULL) ? pathname : name + 1;
+    ext = strrchr(name, '.');
+    name_len = ((ext != NULL) && (ext != name)) ? (size_t)(ext - name) : strlen(name);
+
+    if ((result = (char *)malloc(dir_len + 1 + name_len + 3)) == NULL) return NULL;
+    memcpy(result, dir, dir_len);
+    result[dir_len] = '/';
+    memcpy(result + dir_len + 1, name, name_len);
+    memcpy(result + dir_len + 1 + name_len, ".c", 3);
+    return result;
+}
+
+/* Compile the sources to C on 'threads' threads, the files are 
+ * written afterwards in the order given */
+static int mf_run_batch(char **pathnames, size_t pathnames_count, \
+        const char *dir, int optimize, size_t threads)
+{
+    int ret = 0;
+    struct mf_batch_item *items = NULL;
+    struct mf_batch_report report;
+    char *pathname_out;
+    FILE *fp;
+    size_t idx;
+
+    items = (struct mf_batch_item *)malloc(sizeof(struct mf_batch_item) * \
+            ((pathnames_count == 0) ? 1 : pathnames_count));
+    if (items == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+    for (idx = 0; idx != pathnames_count; idx++) mf_batch_item_init(&items[idx], pathnames[idx]);
+
+    if (mf_batch_compile(items, pathnames_count, MF_BATCH_TARGET_C, \
+                optimize, threads, &report) != 0)
+    {
+        fprintf(stderr, "error: can not start compiling\n");
+        ret = 1;
+        goto done;
+    }
+
+    for (idx = 0; idx != pathnames_count; idx++)
+    {
+        if (items[idx].ret != 0)
+        {
+            fprintf(stderr, "%s:\n", items[idx].pathname);
+            if (items[idx].err != NULL) multiple_error_final(items[idx].err);
+            ret = 1;
+            continue;
+        }
+        if ((pathname_out = mf_run_batch_output_pathname(dir, items[idx].pathname)) == NULL)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            ret = 1;
+            goto done;
+        }
+        if (((fp = fopen(pathname_out, "wb")) == NULL) || \
+                (fwrite(items[idx].c_src, items[idx].c_src_len, 1, fp) < 1))
+        {
+            fprintf(stderr, "error: writing %s failed\n", pathname_out);
+            ret = 1;
+        }
+        if (fp != NULL) fclose(fp);
+        free(pathname_out);
+    }
+
+    mf_batch_report_print(stderr, &report);
+
+done:
+    for (idx = 0; idx != pathnames_count; idx++) mf_batch_item_uninit(&items[idx]);
+    free(items);
+    return ret;
+}
+
+static int mf_run_icode_same(const struct multiple_ir *a, const struct multiple_ir *b)
+{
+    const struct multiple_ir_text_section_item *text_a, *text_b;
+    const struct multiple_ir_export_section_item *export_a, *export_b;
+
+    text_a = a->text_section->begin;
+    text_b = b->text_section->begin;
+    while ((text_a != NULL) && (text_b != NULL))
+    {
+        if ((text_a->opcode != text_b->opcode) || \
+                (text_a->operand != text_b->operand))
+        { return 0; }
+        text_a = text_a->next;
+        text_b = text_b->next;
+    }
+    if ((text_a != NULL) || (text_b != NULL)) return 0;
+
+    export_a = a->export_section->begin;
+    export_b = b->export_section->begin;
+    while ((export_a != NULL) && (export_b != NULL))
+    {
+        if ((export_a->name != export_b->name) || \
+                (export_a->instrument_number != export_b->instrument_number))
+        { return 0; }
+        export_a = export_a->next;
+        export_b = export_b->next;
+    }
+    return ((export_a == NULL) && (export_b == NULL)) ? 1 : 0;
+}
+
+static int mf_run_batch_item_same(const struct mf_batch_item *a, \
+        const struct mf_batch_item *b, int target)
+{
+    if (a->ret != b->ret) return 0;
+    if (a->ret != 0) return 1;
+    if (target == MF_BATCH_TARGET_ICODE) return mf_run_icode_same(a->icode, b->icode);
+    return ((a->c_src_len == b->c_src_len) && \
+            (memcmp(a->c_src, b->c_src, a->c_src_len) == 0)) ? 1 : 0;
+}
+
+/* Every source is compiled on one thread first, then 'rounds' times 
+ * more with 'threads' threads between the sources and between the 
+ * lambdas of each one, for the icode and for C. Each result has to be 
+ * the same as the first one. Built with -fsanitize=thread this is the 
+ * stress test of the front end, nothing is written */
+static int mf_run_batch_check(char **pathnames, size_t pathnames_count, \
+        int optimize, size_t threads, size_t rounds)
+{
+    int ret = 0;
+    struct mf_batch_item *items = NULL;
+    struct mf_batch_report report;
+    size_t count = pathnames_count * (rounds + 1), mismatches = 0, idx;
+    int target;
+
+    items = (struct mf_batch_item *)malloc(sizeof(struct mf_batch_item) * \
+            ((count == 0) ? 1 : count));
+    if (items == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+
+    for (target = MF_BATCH_TARGET_ICODE; target <= MF_BATCH_TARGET_C; target++)
+    {
+        for (idx = 0; idx != count; idx++)
+        {
+            mf_batch_item_init(&items[idx], pathnames[idx % pathnames_count]);
+            if (idx >= pathnames_count) items[idx].threads = threads;
+        }
+
+        if ((mf_batch_compile(items, pathnames_count, \
+                        target, optimize, 1, &report) != 0) || \
+                (mf_batch_compile(items + pathnames_count, count - pathnames_count, \
+                                  target, optimize, threads, &report) != 0))
+        {
+            fprintf(stderr, "error: can not start compiling\n");
+            ret = 1;
+        }
+        else
+        {
+            for (idx = pathnames_count; idx != count; idx++)
+            {
+                if (mf_run_batch_item_same(&items[idx % pathnames_count], &items[idx], target) != 0)
+                { continue; }
+                fprintf(stderr, "%s: %s differs in round %lu\n", \
+                        items[idx].pathname, \
+                        (target == MF_BATCH_TARGET_ICODE) ? "icode" : "C", \
+                        (unsigned long)(idx / pathnames_count));
+                mismatches++;
+                ret = 1;
+            }
+        }
+
+        for (idx = 0; idx != count; idx++) mf_batch_item_uninit(&items[idx]);
+    }
+
+    fprintf(stderr, "check: %lu source(s), %lu round(s) on %lu thread(s), %lu mismatch(es)\n", \
+            (unsigned long)pathnames_count, (unsigned long)rounds, \
+            (unsigned long)threads, (unsigned long)mismatches);
+
+    free(items);
+    return ret;
+}
+
+/* Run the program compiled once for every input, each run with its 
+ * own state on one of 'threads' threads, or all of them multiplexed on 
+ * the threads with a slice */
+static int mf_run_serve(struct multiple_error *err, void *stub, \
+        const char *list, size_t stack_size, size_t threads, int image_flags, \
+        uint32_t slice, uint64_t fuel)
+{
+    int ret = 0;
+    struct mf_serve_program *program = NULL;
+    struct mf_serve_request *requests = NULL;
+    struct mf_serve_report report;
+    char *list_buf = NULL, *pathname_out;
+    char **pathnames = NULL;
+    size_t pathnames_count = 0, len, idx;
+    int fd_in, fd_out;
+
+    if (mf_run_list_read(list, &list_buf, &pathnames, &pathnames_count) != 0)
+    {
+        fprintf(stderr, "error: can not read the list %s\n", list);
+        return 1;
+    }
+
+    if (mf_serve_program_new(err, &program, stub, image_flags) != 0)
+    {
+        multiple_error_final(err);
+        ret = 1;
+        goto done;
+    }
+
+    requests = (struct mf_serve_request *)malloc(sizeof(struct mf_serve_request) * \
+            ((pathnames_count == 0) ? 1 : pathnames_count));
+    if (requests == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        ret = 1;
+        goto done;
+    }
+    for (idx = 0; idx != pathnames_count; idx++) mf_serve_request_init(&requests[idx], -1, -1);
+    for (idx = 0; idx != pathnames_count; idx++)
+    {
+        len = strlen(pathnames[idx]);
+        if ((pathname_out = (char *)malloc(len + 5)) == NULL)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            ret = 1;
+            goto done;
+        }
+        memcpy(pathname_out, pathnames[idx], len);
+        memcpy(pathname_out + len, ".out", 5);
+        fd_in = open(pathnames[idx], O_RDONLY);
+        fd_out = open(pathname_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if ((fd_in < 0) || (fd_out < 0))
+        {
+            fprintf(stderr, "error: can not open %s\n", (fd_in < 0) ? pathnames[idx] : pathname_out);
+            if (fd_in >= 0) close(fd_in);
+            if (fd_out >= 0) close(fd_out);
+            free(pathname_out);
+            ret = 1;
+            goto done;
+        }
+        free(pathname_out);
+        mf_serve_request_init(&requests[idx], fd_in, fd_out);
+        requests[idx].fuel = fuel;
+    }
+
+    if (((slice == 0) && \
+                (mf_serve_run(program, requests, pathnames_count, \
+                              stack_size, threads, &report) != 0)) || \
+            ((slice != 0) && \
+             (mf_sched_serve(program, requests, pathnames_count, \
+                             stack_size, threads, slice, &report) != 0)))
+    {
+        fprintf(stderr, "error: can not start running\n");
+        ret = 1;
+        goto done;
+    }
+
+    for (idx = 0; idx != pathnames_count; idx++)
+    {
+        if (requests[idx].ret != MF_RT_OK)
+        {
+            fprintf(stderr, "%s: error: %s\n", pathnames[idx], \
+                    (requests[idx].ret < 0) ? "out of memory" : mf_rt_error_str(requests[idx].ret));
+            ret = 1;
+        }
+    }
+
+    mf_serve_report_print(stderr, &report);
+
+done:
+    if (requests != NULL)
+    {
+        for (idx = 0; idx != pathnames_count; idx++)
+        {
+            if (requests[idx].fd_in >= 0) close(requests[idx].fd_in);
+            if (requests[idx].fd_out >= 0) close(requests[idx].fd_out);
+        }
+        free(requests);
+    }
+    if (program != NULL) mf_serve_program_destroy(program);
+    if (pathnames != NULL) free(pathnames);
+    if (list_buf != NULL) free(list_buf);
+    return ret;
+}
+
+/* Decimal digits only, strtoull alone would take "-3" as a huge 
+ * number and the largest one means no limit at all */
+static int mf_run_fuel_parse(const char *str, uint64_t *fuel_out)
+{
+    char *end = NULL;
+    unsigned long long value;
+
+    if ((*str < '0') || (*str > '9')) return -1;
+    errno = 0;
+    value = strtoull(str, &end, 10);
+    if ((errno != 0) || (*end != '\0') || \
+            (value >= (unsigned long long)MF_ENGINE_FUEL_UNLIMITED))
+    { return -1; }
+    *fuel_out = (uint64_t)value;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+    struct multiple_error *err = NULL;
+    void *stub = NULL;
+    struct mf_stub *stub_ptr;
+    struct token_list *tokens = NULL;
+    struct mf_prog *prog = NULL;
+    char *pathname = NULL;
+    char **pathnames = NULL;
+    size_t pathnames_count = 0;
+    char *batch_dir = NULL, *batch_list = NULL, *batch_list_buf = NULL;
+    char *serve_list = NULL;
+    char *snap_in = NULL, *snap_out = NULL;
+    uint32_t slice = 0;
+    uint64_t fuel = MF_ENGINE_FUEL_UNLIMITED;
+    size_t threads = 1;
+    size_t check_rounds = 0;
+    int optimize = 1;
+    int engine_type = MF_RUN_ENGINE_THREADED;
+    size_t stack_size = 0;
+    int timing = 0;
+    int image_flags = 0;
+    int idx;
+
+    if ((pathnames = (char **)malloc(sizeof(char *) * (size_t)argc)) == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+
+    for (idx = 1; idx < argc; idx++)
+    {
+        if ((strcmp(argv[idx], "-O") == 0) && (idx + 1 < argc))
+        { optimize = atoi(argv[++idx]); }
+        else if ((strcmp(argv[idx], "-s") == 0) && (idx + 1 < argc))
+        { stack_size = (size_t)strtoul(argv[++idx], NULL, 10); }
+        else if ((strcmp(argv[idx], "-e") == 0) && (idx + 1 < argc))
+        {
+            idx++;
+            if (strcmp(argv[idx], "threaded") == 0) engine_type = MF_RUN_ENGINE_THREADED;
+            else if (strcmp(argv[idx], "interpreter") == 0) engine_type = MF_RUN_ENGINE_INTERPRETER;
+            else if (strcmp(argv[idx], "jit") == 0) engine_type = MF_RUN_ENGINE_JIT;
+            else { mf_run_usage(argv[0]); ret = 1; goto done_args; }
+        }
+        else if (strcmp(argv[idx], "-t") == 0)
+        { timing = 1; }
+        else if (strcmp(argv[idx], "-p") == 0)
+        { image_flags |= MF_ENGINE_IMAGE_FLAG_PROFILE; }
+        else if (strcmp(argv[idx], "-S") == 0)
+        { image_flags |= MF_ENGINE_IMAGE_FLAG_NO_SUPER; }
+        else if (strcmp(argv[idx], "-T") == 0)
+        { image_flags |= MF_ENGINE_IMAGE_FLAG_TRACE; }
+        else if ((strcmp(argv[idx], "-c") == 0) && (idx + 1 < argc))
+        { batch_dir = argv[++idx]; }
+        else if ((strcmp(argv[idx], "-l") == 0) && (idx + 1 < argc))
+        { batch_list = argv[++idx]; }
+        else if ((strcmp(argv[idx], "-r") == 0) && (idx + 1 < argc))
+        { serve_list = argv[++idx]; }
+        else if ((strcmp(argv[idx], "-f") == 0) && (idx + 1 < argc))
+        {
+            if (mf_run_fuel_parse(argv[++idx], &fuel) != 0)
+            { mf_run_usage(argv[0]); ret = 1; goto done_args; }
+        }
+        else if ((strcmp(argv[idx], "-k") == 0) && (idx + 1 < argc))
+        { snap_out = argv[++idx]; }
+        else if ((strcmp(argv[idx], "-w") == 0) && (idx + 1 < argc))
+        { snap_in = argv[++idx]; }
+        else if ((strcmp(argv[idx], "-y") == 0) && (idx + 1 < argc))
+        { slice = (uint32_t)strtoul(argv[++idx], NULL, 10); }
+        else if ((strcmp(argv[idx], "-j") == 0) && (idx + 1 < argc))
+        { threads = (size_t)strtoul(argv[++idx], NULL, 10); }
+        else if ((strcmp(argv[idx], "-x") == 0) && (idx + 1 < argc))
+        { check_rounds = (size_t)strtoul(argv[++idx], NULL, 10); }
+        else if (argv[idx][0] != '-')
+        { pathnames[pathnames_count++] = argv[idx]; }
+        else
+        { mf_run_usage(argv[0]); ret = 1; goto done_args; }
+    }
+
+    /* Fuel is only charged by the threaded engine, and -c or -x run nothing */
+    if ((fuel != MF_ENGINE_FUEL_UNLIMITED) && \
+            ((engine_type != MF_RUN_ENGINE_THREADED) || \
+             (batch_dir != NULL) || (check_rounds != 0)))
+    {
+        mf_run_usage(argv[0]);
+        ret = 1;
+        goto done_args;
+    }
+
+    if ((batch_dir != NULL) || (check_rounds != 0))
+    {
+        /* Sources given on the command line, then in the list */
+        if ((batch_list != NULL) && \
+                (mf_run_list_read(batch_list, &batch_list_buf, &pathnames, &pathnames_count) != 0))
+        {
+            fprintf(stderr, "error: can not read the list %s\n", batch_list);
+            ret = 1;
+            goto done_args;
+        }
+        if (check_rounds != 0)
+        { ret = mf_run_batch_check(pathnames, pathnames_count, optimize, threads, check_rounds); }
+        else
+        { ret = mf_run_batch(pathnames, pathnames_count, batch_dir, optimize, threads); }
+        goto done_args;
+    }
+    if ((pathnames_count != 1) || (batch_list != NULL) || \
+            (((snap_in != NULL) || (snap_out != NULL)) && \
+             ((engine_type != MF_RUN_ENGINE_THREADED) || (serve_list != NULL))))
+    {
+        mf_run_usage(argv[0]);
+        ret = 1;
+        goto done_args;
+    }
+    pathname = pathnames[0];
+
+    if ((err = multiple_error_new()) == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        ret = 1;
+        goto done_args;
+    }
+
+    if ((ret = mf_stub_create(err, &stub, NULL, 0, \
+                    pathname, MULTIPLE_IO_PATHNAME)) != 0)
+    { goto fail; }
+    stub_ptr = (struct mf_stub *)stub;
+    if (serve_list != NULL)
+    {
+        mf_stub_optimize_set(stub, optimize);
+        mf_stub_threads_set(stub, threads);
+        ret = mf_run_serve(err, stub, serve_list, stack_size, threads, image_flags, slice, fuel);
+        goto done;
+    }
+    if ((ret = mf_tokenize(err, &tokens, stub_ptr->code, stub_ptr->len)) != 0)
+    { goto fail; }
+    if ((ret = mf_progen_parallel(err, &prog, tokens, optimize, threads)) != 0)
+    { goto fail; }
+
+    ret = mf_run_prog(prog, engine_type, stack_size, timing, image_flags, fuel, \
+            snap_in, snap_out);
+
+    goto done;
+fail:
+    multiple_error_final(err);
+    ret = 1;
+done:
+    if (prog != NULL) mf_prog_destroy(prog);
+    if (tokens != NULL) token_list_destroy(tokens);
+    if (stub != NULL) mf_stub_destroy(stub);
+    multiple_error_destroy(err);
+done_args:
+    if (batch_list_buf != NULL) free(batch_list_buf);
+    free(pathnames);
+    return ret;
+}
+
@@ -0,0 +1,471 @@
+/* Multiple False Programming Language : Green Thread Scheduler
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#ifndef MF_SCHED_NO_THREADS
+#include <pthread.h>
+#endif
+
+#include "multiple_err.h"
+
+#include "mf_rt_io.h"
+#include "mf_rt.h"
+#include "mf_engine.h"
+#include "false_serve.h"
+#include "false_sched.h"
+
+#define MF_SCHED_EVENTS_MAX 64
+
+#ifndef MF_SCHED_NO_THREADS
+#define MF_SCHED_LOCK(sched) pthread_mutex_lock(&(sched)->lock)
+#define MF_SCHED_UNLOCK(sched) pthread_mutex_unlock(&(sched)->lock)
+#define MF_SCHED_SIGNAL(sched) pthread_cond_signal(&(sched)->cond)
+#define MF_SCHED_BROADCAST(sched) pthread_cond_broadcast(&(sched)->cond)
+#define MF_SCHED_WAIT(sched) pthread_cond_wait(&(sched)->cond, &(sched)->lock)
+#else
+#define MF_SCHED_LOCK(sched) do { } while (0)
+#define MF_SCHED_UNLOCK(sched) do { } while (0)
+#define MF_SCHED_SIGNAL(sched) do { } while (0)
+#define MF_SCHED_BROADCAST(sched) do { } while (0)
+#define MF_SCHED_WAIT(sched) do { } while (0)
+#endif
+
+struct mf_sched_task
+{
+    struct mf_serve_session session;
+    int fd_in;
+    int fd_out;
+
+    /* Added to epoll */
+    int polled_in;
+    int polled_out;
+
+    /* Only the output left to be written */
+    int finished;
+    int ret;
+
+    mf_sched_done_t done;
+    void *data;
+
+    struct mf_sched_task *next;
+};
+
+struct mf_sched
+{
+    size_t threads;
+    uint32_t slice;
+
+    int epfd;
+    /* Gets the thread out of epoll */
+    int wakefd;
+
+    /* Runs ready to go on, first in first out */
+    struct mf_sched_task *ready_head;
+    struct mf_sched_task *ready_tail;
+    /* Runs spawned and not finished */
+    size_t live;
+    /* One thread at most waits in epoll, the others on 'cond' */
+    int polling;
+#ifndef MF_SCHED_NO_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+int mf_sched_new(struct mf_sched **sched_out, size_t threads, uint32_t slice)
+{
+    struct mf_sched *new_sched;
+    struct epoll_event ev;
+
+    if ((new_sched = (struct mf_sched *)malloc(sizeof(struct mf_sched))) == NULL)
+    { return -MULTIPLE_ERR_MALLOC; }
+#ifdef MF_SCHED_NO_THREADS
+    threads = 1;
+#endif
+    new_sched->threads = (threads == 0) ? 1 : threads;
+    new_sched->slice = (slice == 0) ? MF_SCHED_SLICE_DEFAULT : slice;
+    new_sched->ready_head = new_sched->ready_tail = NULL;
+    new_sched->live = 0;
+    new_sched->polling = 0;
+    new_sched->wakefd = -1;
+
+    if ((new_sched->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) goto fail;
+    if ((new_sched->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) goto fail;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(new_sched->epfd, EPOLL_CTL_ADD, new_sched->wakefd, &ev) != 0) goto fail;
+#ifndef MF_SCHED_NO_THREADS
+    if (pthread_mutex_init(&new_sched->lock, NULL) != 0) goto fail;
+    if (pthread_cond_init(&new_sched->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&new_sched->lock);
+        goto fail;
+    }
+#endif
+
+    *sched_out = new_sched;
+    return 0;
+fail:
+    if (new_sched->wakefd >= 0) close(new_sched->wakefd);
+    if (new_sched->epfd >= 0) close(new_sched->epfd);
+    free(new_sched);
+    return -MULTIPLE_ERR_INTERNAL;
+}
+
+/* Every run should have finished */
+int mf_sched_destroy(struct mf_sched *sched)
+{
+#ifndef MF_SCHED_NO_THREADS
+    pthread_cond_destroy(&sched->cond);
+    pthread_mutex_destroy(&sched->lock);
+#endif
+    close(sched->wakefd);
+    close(sched->epfd);
+    free(sched);
+
+    return 0;
+}
+
+static void mf_sched_wake(struct mf_sched *sched)
+{
+    uint64_t one = 1;
+
+    while ((write(sched->wakefd, &one, sizeof(one)) < 0) && (errno == EINTR)) {}
+}
+
+/* Called with the lock held */
+static void mf_sched_push(struct mf_sched *sched, struct mf_sched_task *task)
+{
+    task->next = NULL;
+    if (sched->ready_tail == NULL) sched->ready_head = task;
+    else sched->ready_tail->next = task;
+    sched->ready_tail = task;
+    MF_SCHED_SIGNAL(sched);
+}
+
+static void mf_sched_ready(struct mf_sched *sched, struct mf_sched_task *task)
+{
+    MF_SCHED_LOCK(sched);
+    mf_sched_push(sched, task);
+    MF_SCHED_UNLOCK(sched);
+}
+
+static int mf_sched_nonblock(int fd)
+{
+    int flags;
+
+    if ((flags = fcntl(fd, F_GETFL)) < 0) return -1;
+    if ((flags & O_NONBLOCK) != 0) return 0;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int mf_sched_spawn(struct mf_sched *sched, \
+        const struct mf_serve_program *program, \
+        int fd_in, int fd_out, size_t stack_size, uint64_t fuel, \
+        mf_sched_done_t done, void *data)
+{
+    int ret;
+    struct mf_sched_task *new_task;
+
+    if ((mf_sched_nonblock(fd_in) != 0) || (mf_sched_nonblock(fd_out) != 0))
+    { return -MULTIPLE_ERR_INTERNAL; }
+
+    if ((new_task = (struct mf_sched_task *)malloc(sizeof(struct mf_sched_task))) == NULL)
+    { return -MULTIPLE_ERR_MALLOC; }
+    if ((ret = mf_serve_session_init(&new_task->session, program, fd_in, fd_out, \
+                    MF_RT_IO_FLAG_MMAP_INPUT | MF_RT_IO_FLAG_NONBLOCK, \
+                    stack_size)) != 0)
+    {
+        free(new_task);
+        return ret;
+    }
+    new_task->session.engine.slice = sched->slice;
+    new_task->session.engine.fuel = fuel;
+    new_task->fd_in = fd_in;
+    new_task->fd_out = fd_out;
+    new_task->polled_in = 0;
+    new_task->polled_out = 0;
+    new_task->finished = 0;
+    new_task->ret = MF_RT_OK;
+    new_task->done = done;
+    new_task->data = data;
+
+    MF_SCHED_LOCK(sched);
+    sched->live += 1;
+    mf_sched_push(sched, new_task);
+    if (sched->polling != 0) mf_sched_wake(sched);
+    MF_SCHED_UNLOCK(sched);
+
+    return 0;
+}
+
+static void mf_sched_finish(struct mf_sched *sched, struct mf_sched_task *task)
+{
+    if (task->polled_in != 0) epoll_ctl(sched->epfd, EPOLL_CTL_DEL, task->fd_in, NULL);
+    if ((task->polled_out != 0) && (task->fd_out != task->fd_in))
+    { epoll_ctl(sched->epfd, EPOLL_CTL_DEL, task->fd_out, NULL); }
+    mf_serve_session_uninit(&task->session);
+    if (task->done != NULL) task->done(task->data, task->ret);
+    free(task);
+
+    MF_SCHED_LOCK(sched);
+    sched->live -= 1;
+    if (sched->live == 0)
+    {
+        MF_SCHED_BROADCAST(sched);
+        if (sched->polling != 0) mf_sched_wake(sched);
+    }
+    MF_SCHED_UNLOCK(sched);
+}
+
+/* Park the run until the descriptor is ready, another thread may 
+ * take it on as soon as it is armed */
+static void mf_sched_wait(struct mf_sched *sched, struct mf_sched_task *task, \
+        int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    int *polled = (fd == task->fd_in) ? &task->polled_in : &task->polled_out;
+    int op = (*polled != 0) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    *polled = 1;
+    if (task->fd_in == task->fd_out) task->polled_in = task->polled_out = 1;
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = task;
+    if (epoll_ctl(sched->epfd, op, fd, &ev) == 0) return;
+
+    if (op == EPOLL_CTL_ADD)
+    {
+        *polled = 0;
+        if (task->fd_in == task->fd_out) task->polled_in = task->polled_out = 0;
+    }
+    /* Files are never waited for */
+    if (errno == EPERM)
+    {
+        mf_sched_ready(sched, task);
+        return;
+    }
+    task->ret = MF_RT_ERR_IO;
+    mf_sched_finish(sched, task);
+}
+
+/* Run a slice of the task, or write what it left */
+static void mf_sched_step(struct mf_sched *sched, struct mf_sched_task *task)
+{
+    struct mf_rt_io *io = &task->session.io;
+    int ret, status;
+
+    if (io->buf_out_used != 0)
+    {
+        status = mf_rt_io_flush(io);
+        if (status == MF_RT_IO_AGAIN)
+        {
+            mf_sched_wait(sched, task, task->fd_out, EPOLLOUT);
+            return;
+        }
+        if (status != 0)
+        {
+            if (task->ret == MF_RT_OK) task->ret = MF_RT_ERR_IO;
+            task->finished = 1;
+        }
+    }
+    if (task->finished != 0)
+    {
+        mf_sched_finish(sched, task);
+        return;
+    }
+
+    ret = mf_engine_run(&task->session.engine);
+    switch (ret)
+    {
+        case MF_RT_YIELD:
+            mf_sched_ready(sched, task);
+            break;
+        case MF_RT_WAIT_IN:
+            /* The prompt goes out first */
+            if (io->buf_out_used != 0) mf_sched_wait(sched, task, task->fd_out, EPOLLOUT);
+            else mf_sched_wait(sched, task, task->fd_in, EPOLLIN);
+            break;
+        case MF_RT_WAIT_OUT:
+            mf_sched_wait(sched, task, task->fd_out, EPOLLOUT);
+            break;
+        default:
+            task->ret = ret;
+            task->finished = 1;
+            if (io->buf_out_used != 0) mf_sched_wait(sched, task, task->fd_out, EPOLLOUT);
+            else mf_sched_finish(sched, task);
+            break;
+    }
+}
+
+static void *mf_sched_worker(void *data)
+{
+    struct mf_sched *sched = (struct mf_sched *)data;
+    struct mf_sched_task *task;
+    struct epoll_event events[MF_SCHED_EVENTS_MAX];
+    uint64_t count;
+    int n, idx;
+
+    MF_SCHED_LOCK(sched);
+    for (;;)
+    {
+        if (sched->ready_head != NULL)
+        {
+            task = sched->ready_head;
+            sched->ready_head = task->next;
+            if (sched->ready_head == NULL) sched->ready_tail = NULL;
+            MF_SCHED_UNLOCK(sched);
+            mf_sched_step(sched, task);
+            MF_SCHED_LOCK(sched);
+            continue;
+        }
+        if (sched->live == 0) break;
+
+        if (sched->polling == 0)
+        {
+            sched->polling = 1;
+            MF_SCHED_UNLOCK(sched);
+            n = epoll_wait(sched->epfd, events, MF_SCHED_EVENTS_MAX, -1);
+            MF_SCHED_LOCK(sched);
+            sched->polling = 0;
+            for (idx = 0; idx < n; idx++)
+            {
+                if (events[idx].data.ptr == NULL)
+                {
+                    while (read(sched->wakefd, &count, sizeof(count)) > 0) {}
+                    continue;
+                }
+                mf_sched_push(sched, (struct mf_sched_task *)events[idx].data.ptr);
+            }
+            /* Someone else may take the next turn in epoll */
+            MF_SCHED_BROADCAST(sched);
+            continue;
+        }
+
+        MF_SCHED_WAIT(sched);
+    }
+    MF_SCHED_UNLOCK(sched);
+
+    return NULL;
+}
+
+int mf_sched_run(struct mf_sched *sched)
+{
+#ifndef MF_SCHED_NO_THREADS
+    pthread_t *workers = NULL;
+    size_t workers_count = 0;
+    size_t idx;
+
+    if (sched->threads > 1)
+    {
+        workers = (pthread_t *)malloc(sizeof(pthread_t) * (sched->threads - 1));
+        if (workers == NULL) return -MULTIPLE_ERR_MALLOC;
+        /* Fewer workers if some could not be created */
+        for (idx = 0; idx != sched->threads - 1; idx++)
+        {
+            if (pthread_create(&workers[workers_count], NULL, mf_sched_worker, sched) != 0) break;
+            workers_count++;
+        }
+    }
+#endif
+
+    /* The calling thread works as well */
+    mf_sched_worker(sched);
+
+#ifndef MF_SCHED_NO_THREADS
+    for (idx = 0; idx != workers_count; idx++) pthread_join(workers[idx], NULL);
+    if (workers != NULL) free(workers);
+#endif
+
+    return 0;
+}
+
+/* Requests */
+
+static double mf_sched_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* 'seconds' holds the start until done */
+static void mf_sched_request_done(void *data, int ret)
+{
+    struct mf_serve_request *request = (struct mf_serve_request *)data;
+
+    request->ret = ret;
+    request->seconds = mf_sched_now() - request->seconds;
+}
+
+int mf_sched_serve(const struct mf_serve_program *program, \
+        struct mf_serve_request *requests, size_t requests_count, \
+        size_t stack_size, size_t threads, uint32_t slice, \
+        struct mf_serve_report *report)
+{
+    int ret;
+    struct mf_sched *sched = NULL;
+    size_t idx;
+    double time_start;
+
+    if ((ret = mf_sched_new(&sched, threads, slice)) != 0) return ret;
+
+    time_start = mf_sched_now();
+    for (idx = 0; idx != requests_count; idx++)
+    {
+        requests[idx].seconds = mf_sched_now();
+        if ((ret = mf_sched_spawn(sched, program, \
+                        requests[idx].fd_in, requests[idx].fd_out, \
+                        stack_size, requests[idx].fuel, \
+                        mf_sched_request_done, &requests[idx])) != 0)
+        {
+            requests[idx].ret = ret;
+            requests[idx].seconds = 0.0;
+        }
+    }
+    ret = mf_sched_run(sched);
+
+    report->threads = sched->threads;
+    report->requests_count = requests_count;
+    report->failed_count = 0;
+    report->seconds = mf_sched_now() - time_start;
+    report->seconds_requests = 0.0;
+    for (idx = 0; idx != requests_count; idx++)
+    {
+        if (requests[idx].ret != MF_RT_OK) report->failed_count += 1;
+        report->seconds_requests += requests[idx].seconds;
+    }
+
+    mf_sched_destroy(sched);
+
+    return ret;
+}
+
@@ -0,0 +1,65 @@
+/* Multiple False Programming Language : Green Thread Scheduler
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _FALSE_SCHED_H_
+#define _FALSE_SCHED_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "false_serve.h"
+
+/* Many runs of shared programs multiplexed on a few threads. A run 
+ * gives its thread up after a slice of calls and loop iterations, or 
+ * when its descriptors would block, and waits in epoll holding no 
+ * thread until they are ready. Nothing of a run is on a C stack 
+ * between two slices, the engine keeps all of it. Without pthreads 
+ * define MF_SCHED_NO_THREADS and the calling thread does everything */
+
+#define MF_SCHED_SLICE_DEFAULT 4096
+
+/* Called once a run has finished with MF_RT_OK, MF_RT_ERR_* or a 
+ * negative MULTIPLE_ERR_*, the descriptors are not used any more */
+typedef void (*mf_sched_done_t)(void *data, int ret);
+
+struct mf_sched;
+
+int mf_sched_new(struct mf_sched **sched_out, size_t threads, uint32_t slice);
+int mf_sched_destroy(struct mf_sched *sched);
+
+/* Start a run with a budget of 'fuel', see 'mf_engine', the 
+ * descriptors are made non-blocking. Any thread may spawn, 'done' 
+ * as well */
+int mf_sched_spawn(struct mf_sched *sched, \
+        const struct mf_serve_program *program, \
+        int fd_in, int fd_out, size_t stack_size, uint64_t fuel, \
+        mf_sched_done_t done, void *data);
+
+/* Serve on the threads, the calling one among them, until no run 
+ * is left */
+int mf_sched_run(struct mf_sched *sched);
+
+/* Same as 'mf_serve_run' with the requests as green threads */
+int mf_sched_serve(const struct mf_serve_program *program, \
+        struct mf_serve_request *requests, size_t requests_count, \
+        size_t stack_size, size_t threads, uint32_t slice, \
+        struct mf_serve_report *report);
+
+#endif
+
@@ -0,0 +1,285 @@
+/* Multiple False Programming Language : Shared Program Runner
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef MF_SERVE_NO_THREADS
+#include <pthread.h>
+#endif
+
+#include "multiple.h"
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+#include "mf_icg.h"
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_rt.h"
+#include "mf_engine.h"
+#include "false_stub.h"
+#include "false_serve.h"
+
+static double mf_serve_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Program */
+
+int mf_serve_program_new(struct multiple_error *err, \
+        struct mf_serve_program **program_out, \
+        void *stub, int image_flags)
+{
+    int ret = 0;
+    struct mf_stub *stub_ptr = (struct mf_stub *)stub;
+    struct mf_serve_program *new_program = NULL;
+    struct token_list *tokens = NULL;
+
+    /* Every session owns its profile, none is shared */
+    image_flags &= ~MF_ENGINE_IMAGE_FLAG_PROFILE;
+
+    new_program = (struct mf_serve_program *)malloc(sizeof(struct mf_serve_program));
+    if (new_program == NULL)
+    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    new_program->prog = NULL;
+    new_program->image = NULL;
+
+    if ((ret = mf_tokenize(err, &tokens, stub_ptr->code, stub_ptr->len)) != 0)
+    { goto fail; }
+    if ((ret = mf_progen_parallel(err, &new_program->prog, tokens, \
+                    stub_ptr->optimize, stub_ptr->threads)) != 0)
+    { goto fail; }
+    if ((ret = mf_engine_image_new(&new_program->image, \
+                    new_program->prog, image_flags)) != 0)
+    { MULTIPLE_ERROR_MALLOC(); goto fail; }
+
+    *program_out = new_program;
+    new_program = NULL;
+
+    goto done;
+fail:
+    if (new_program != NULL) mf_serve_program_destroy(new_program);
+done:
+    if (tokens != NULL) token_list_destroy(tokens);
+    return ret;
+}
+
+int mf_serve_program_destroy(struct mf_serve_program *program)
+{
+    if (program->image != NULL) mf_engine_image_destroy(program->image);
+    if (program->prog != NULL) mf_prog_destroy(program->prog);
+    free(program);
+
+    return 0;
+}
+
+/* Session */
+
+int mf_serve_session_init(struct mf_serve_session *session, \
+        const struct mf_serve_program *program, \
+        int fd_in, int fd_out, int io_flags, size_t stack_size)
+{
+    int ret;
+
+    session->program = program;
+    if ((ret = mf_rt_io_init(&session->io, fd_in, fd_out, \
+                    MF_RT_IO_INPUT_BUFFER_SIZE_DEFAULT, \
+                    MF_RT_IO_OUTPUT_BUFFER_SIZE_DEFAULT, \
+                    io_flags)) != 0)
+    { return ret; }
+    if ((ret = mf_engine_init(&session->engine, program->image, \
+                    &session->io, stack_size)) != 0)
+    {
+        mf_rt_io_uninit(&session->io);
+        return ret;
+    }
+
+    return 0;
+}
+
+int mf_serve_session_uninit(struct mf_serve_session *session)
+{
+    mf_engine_uninit(&session->engine);
+    mf_rt_io_uninit(&session->io);
+
+    return 0;
+}
+
+int mf_serve_session_run(struct mf_serve_session *session)
+{
+    return mf_engine_run(&session->engine);
+}
+
+/* Pool */
+
+void mf_serve_request_init(struct mf_serve_request *request, int fd_in, int fd_out)
+{
+    request->fd_in = fd_in;
+    request->fd_out = fd_out;
+    request->fuel = MF_ENGINE_FUEL_UNLIMITED;
+    request->ret = MF_RT_OK;
+    request->seconds = 0.0;
+}
+
+struct mf_serve_pool
+{
+    const struct mf_serve_program *program;
+    struct mf_serve_request *requests;
+    size_t requests_count;
+    size_t stack_size;
+
+    /* Next request to be taken */
+    size_t next;
+#ifndef MF_SERVE_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+static void mf_serve_request_run(struct mf_serve_pool *pool, \
+        struct mf_serve_request *request)
+{
+    struct mf_serve_session session;
+    double time_start = mf_serve_now();
+
+    if ((request->ret = mf_serve_session_init(&session, pool->program, \
+                    request->fd_in, request->fd_out, \
+                    MF_RT_IO_FLAG_MMAP_INPUT, pool->stack_size)) == 0)
+    {
+        session.engine.fuel = request->fuel;
+        request->ret = mf_serve_session_run(&session);
+        mf_serve_session_uninit(&session);
+    }
+    request->seconds = mf_serve_now() - time_start;
+}
+
+static void *mf_serve_worker(void *data)
+{
+    struct mf_serve_pool *pool = (struct mf_serve_pool *)data;
+    size_t idx;
+
+    for (;;)
+    {
+#ifndef MF_SERVE_NO_THREADS
+        pthread_mutex_lock(&pool->lock);
+#endif
+        idx = pool->next;
+        if (idx < pool->requests_count) pool->next += 1;
+#ifndef MF_SERVE_NO_THREADS
+        pthread_mutex_unlock(&pool->lock);
+#endif
+        if (idx >= pool->requests_count) break;
+
+        mf_serve_request_run(pool, &pool->requests[idx]);
+    }
+
+    return NULL;
+}
+
+int mf_serve_run(const struct mf_serve_program *program, \
+        struct mf_serve_request *requests, size_t requests_count, \
+        size_t stack_size, size_t threads, \
+        struct mf_serve_report *report)
+{
+    struct mf_serve_pool pool;
+    size_t idx;
+    double time_start;
+#ifndef MF_SERVE_NO_THREADS
+    pthread_t *workers = NULL;
+    size_t workers_count = 0;
+#endif
+
+    if (threads == 0) threads = 1;
+    if (threads > requests_count) threads = (requests_count == 0) ? 1 : requests_count;
+#ifdef MF_SERVE_NO_THREADS
+    threads = 1;
+#endif
+
+    pool.program = program;
+    pool.requests = requests;
+    pool.requests_count = requests_count;
+    pool.stack_size = stack_size;
+    pool.next = 0;
+
+    time_start = mf_serve_now();
+
+#ifndef MF_SERVE_NO_THREADS
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) return -MULTIPLE_ERR_INTERNAL;
+    if (threads > 1)
+    {
+        workers = (pthread_t *)malloc(sizeof(pthread_t) * (threads - 1));
+        if (workers == NULL)
+        {
+            pthread_mutex_destroy(&pool.lock);
+            return -MULTIPLE_ERR_MALLOC;
+        }
+        /* Fewer workers if some could not be created */
+        for (idx = 0; idx != threads - 1; idx++)
+        {
+            if (pthread_create(&workers[workers_count], NULL, mf_serve_worker, &pool) != 0) break;
+            workers_count++;
+        }
+        threads = workers_count + 1;
+    }
+#endif
+
+    /* The calling thread serves as well */
+    mf_serve_worker(&pool);
+
+#ifndef MF_SERVE_NO_THREADS
+    for (idx = 0; idx != workers_count; idx++) pthread_join(workers[idx], NULL);
+    if (workers != NULL) free(workers);
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    report->threads = threads;
+    report->requests_count = requests_count;
+    report->failed_count = 0;
+    report->seconds = mf_serve_now() - time_start;
+    report->seconds_requests = 0.0;
+    for (idx = 0; idx != requests_count; idx++)
+    {
+        if (requests[idx].ret != MF_RT_OK) report->failed_count += 1;
+        report->seconds_requests += requests[idx].seconds;
+    }
+
+    return 0;
+}
+
+void mf_serve_report_print(FILE *fp, const struct mf_serve_report *report)
+{
+    double seconds = (report->seconds > 0.0) ? report->seconds : 1e-9;
+
+    fprintf(fp, "served %lu of %lu requests in %.6f s with %lu thread(s)\n", \
+            (unsigned long)(report->requests_count - report->failed_count), \
+            (unsigned long)report->requests_count, \
+            report->seconds, \
+            (unsigned long)report->threads);
+    fprintf(fp, "throughput: %.1f requests/s, %.2fx concurrency\n", \
+            (double)report->requests_count / seconds, \
+            report->seconds_requests / seconds);
+}
+
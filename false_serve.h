@@ -0,0 +1,100 @@
+/* Multiple False Programming Language : Shared Program Runner
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _FALSE_SERVE_H_
+#define _FALSE_SERVE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_engine.h"
+
+/* Runs one program for many independent requests. The program is 
+ * lexed, generated and laid out once, then only read by the runs, 
+ * each with its own operand stack, variables and i/o buffers, so a 
+ * request costs the allocation of its state. Without pthreads define 
+ * MF_SERVE_NO_THREADS and the requests run one after another */
+
+struct mf_serve_program
+{
+    struct mf_prog *prog;
+    struct mf_engine_image *image;
+};
+
+/* Compile the source of the stub with its options */
+int mf_serve_program_new(struct multiple_error *err, \
+        struct mf_serve_program **program_out, \
+        void *stub, int image_flags);
+int mf_serve_program_destroy(struct mf_serve_program *program);
+
+/* Everything a single run writes */
+struct mf_serve_session
+{
+    const struct mf_serve_program *program;
+    struct mf_rt_io io;
+    struct mf_engine engine;
+};
+
+/* 'io_flags' are the MF_RT_IO_FLAG_* of the i/o */
+int mf_serve_session_init(struct mf_serve_session *session, \
+        const struct mf_serve_program *program, \
+        int fd_in, int fd_out, int io_flags, size_t stack_size);
+int mf_serve_session_uninit(struct mf_serve_session *session);
+/* Returns one of MF_RT_ERR_* */
+int mf_serve_session_run(struct mf_serve_session *session);
+
+struct mf_serve_request
+{
+    int fd_in;
+    int fd_out;
+    /* Budget of the run, see 'mf_engine' */
+    uint64_t fuel;
+
+    /* MF_RT_OK, MF_RT_ERR_* or a negative MULTIPLE_ERR_* 
+     * if the session could not be set up */
+    int ret;
+    double seconds;
+};
+
+void mf_serve_request_init(struct mf_serve_request *request, int fd_in, int fd_out);
+
+struct mf_serve_report
+{
+    size_t threads;
+    size_t requests_count;
+    size_t failed_count;
+
+    double seconds;
+    double seconds_requests;
+};
+
+/* Failures of the requests are in 'ret' of each one */
+int mf_serve_run(const struct mf_serve_program *program, \
+        struct mf_serve_request *requests, size_t requests_count, \
+        size_t stack_size, size_t threads, \
+        struct mf_serve_report *report);
+
+void mf_serve_report_print(FILE *fp, const struct mf_serve_report *report);
+
+#endif
+
@@ -37,6 +37,56 @@ static int mf_internal_tokens_print(struct token_list *list)
     return ret;
 }
 
+static struct mf_stub *mf_stub_new(void)
+{
+    struct mf_stub *new_stub;
+
+    if ((new_stub = (struct mf_stub *)malloc(sizeof(struct mf_stub))) == NULL)
+    { return NULL; }
+    new_stub->tokens = NULL;
+    new_stub->code = NULL;
+    new_stub->len = 0;
+    new_stub->code_borrowed = 0;
+    new_stub->debug_info = 0;
+    new_stub->optimize = 0;
+    new_stub->threads = 1;
+    new_stub->pathname = NULL;
+    new_stub->pathname_len = 0;
+    new_stub->pathname_size = 0;
+
+    new_stub->opt_internal_reconstruct = 0;
+
+    return new_stub;
+}
+
+/* The buffer of the pathname is grown only when too small */
+static int mf_stub_pathname_set(struct mf_stub *stub, const char *pathname)
+{
+    size_t pathname_len;
+    char *new_pathname;
+
+    if (pathname == NULL)
+    {
+        stub->pathname_len = 0;
+        if (stub->pathname != NULL) stub->pathname[0] = '\0';
+        return 0;
+    }
+    pathname_len = strlen(pathname);
+    if (pathname_len + 1 > stub->pathname_size)
+    {
+        if ((new_pathname = (char *)malloc(sizeof(char) * (pathname_len + 1))) == NULL)
+        { return -MULTIPLE_ERR_MALLOC; }
+        if (stub->pathname != NULL) free(stub->pathname);
+        stub->pathname = new_pathname;
+        stub->pathname_size = pathname_len + 1;
+    }
+    memcpy(stub->pathname, pathname, pathname_len);
+    stub->pathname[pathname_len] = '\0';
+    stub->pathname_len = pathname_len;
+
+    return 0;
+}
+
 int mf_stub_create(struct multiple_error *err, void **stub_out, \
         char *pathname_dst, int type_dst, \
         char *pathname_src, int type_src)
@@ -45,27 +95,17 @@ int mf_stub_create(struct multiple_error *err, void **stub_out, \
     struct mf_stub *new_stub = NULL;
     FILE *fp_src;
     long size_fp;
-    size_t pathname_src_len;
 
     (void)type_dst;
     (void)pathname_dst;
     *stub_out = NULL;
 
-    if ((new_stub = (struct mf_stub *)malloc(sizeof(struct mf_stub))) == NULL)
+    if ((new_stub = mf_stub_new()) == NULL)
     {
         MULTIPLE_ERROR_MALLOC();
         ret = -MULTIPLE_ERR_MALLOC;
         goto fail;
     }
-    new_stub->tokens = NULL;
-    new_stub->code = NULL;
-    new_stub->len = 0;
-    new_stub->debug_info = 0;
-    new_stub->optimize = 0;
-    new_stub->pathname = NULL;
-    new_stub->pathname_len = 0;
-
-    new_stub->opt_internal_reconstruct = 0;
 
     if (pathname_src == NULL)
     {
@@ -95,10 +135,11 @@ int mf_stub_create(struct multiple_error *err, void **stub_out, \
                 fseek(fp_src, 0, SEEK_END);
                 size_fp = ftell(fp_src);
                 fseek(fp_src, 0, SEEK_SET);
-                /* Allocate space */
-                new_stub->code = (char *)malloc(sizeof(char) * (size_t)size_fp);
+                /* Allocate space, terminated so diagnostics never read past it */
+                new_stub->code = (char *)malloc(sizeof(char) * ((size_t)size_fp + 1));
                 if (new_stub->code == NULL)
                 {
+                    fclose(fp_src);
                     MULTIPLE_ERROR_MALLOC();
                     ret = -MULTIPLE_ERR_MALLOC;
                     goto fail;
@@ -106,11 +147,13 @@ int mf_stub_create(struct multiple_error *err, void **stub_out, \
                 /* Read file */
                 if (fread(new_stub->code, (size_t)size_fp, 1, fp_src) < 1) 
                 {
+                    fclose(fp_src);
                     multiple_error_update(err, -MULTIPLE_ERR_STUB, "error: reading data from %s failed", pathname_src);
                     ret = -MULTIPLE_ERR_STUB;
                     goto fail;
                 }
                 fclose(fp_src);
+                new_stub->code[size_fp] = '\0';
 
                 new_stub->len = (size_t)size_fp;
                 break;
@@ -121,15 +164,11 @@ int mf_stub_create(struct multiple_error *err, void **stub_out, \
         }
     }
 
-    pathname_src_len = strlen(pathname_src);
-    if ((new_stub->pathname = (char *)malloc(sizeof(char) * (pathname_src_len + 1))) == NULL)
+    if ((ret = mf_stub_pathname_set(new_stub, pathname_src)) != 0)
     {
         MULTIPLE_ERROR_MALLOC();
-        ret = -MULTIPLE_ERR_MALLOC;
         goto fail; 
     }
-    memcpy(new_stub->pathname, pathname_src, pathname_src_len);
-    new_stub->pathname[pathname_src_len] = '\0';
 
     *stub_out = new_stub;
     ret = 0;
@@ -145,6 +184,64 @@ done:
     return ret;
 }
 
+int mf_stub_create_mem(struct multiple_error *err, void **stub_out, \
+        const char *code, size_t len, const char *pathname)
+{
+    int ret;
+    struct mf_stub *new_stub = NULL;
+
+    *stub_out = NULL;
+
+    if ((new_stub = mf_stub_new()) == NULL)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        return -MULTIPLE_ERR_MALLOC;
+    }
+    if ((ret = mf_stub_reset(err, new_stub, code, len, pathname)) != 0)
+    {
+        mf_stub_destroy(new_stub);
+        return ret;
+    }
+    *stub_out = new_stub;
+
+    return 0;
+}
+
+int mf_stub_reset(struct multiple_error *err, void *stub, \
+        const char *code, size_t len, const char *pathname)
+{
+    int ret;
+    struct mf_stub *stub_ptr = (struct mf_stub *)stub;
+
+    if ((stub_ptr == NULL) || ((code == NULL) && (len != 0)))
+    {
+        MULTIPLE_ERROR_NULL_PTR();
+        return -MULTIPLE_ERR_NULL_PTR;
+    }
+
+    if (stub_ptr->tokens != NULL)
+    {
+        token_list_destroy(stub_ptr->tokens);
+        stub_ptr->tokens = NULL;
+    }
+    if ((stub_ptr->code != NULL) && (stub_ptr->code_borrowed == 0))
+    { free(stub_ptr->code); }
+    /* Only ever read, the cast keeps the field usable by the 
+     * interfaces taking the text of a stub they own */
+    stub_ptr->code = (char *)code;
+    stub_ptr->len = len;
+    stub_ptr->code_borrowed = 1;
+    stub_ptr->opt_internal_reconstruct = 0;
+
+    if ((ret = mf_stub_pathname_set(stub_ptr, pathname)) != 0)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        return ret;
+    }
+
+    return 0;
+}
+
 int mf_stub_destroy(void *stub)
 {
     struct mf_stub *stub_ptr = (struct mf_stub *)stub;
@@ -155,7 +252,7 @@ int mf_stub_destroy(void *stub)
     }
     if (stub_ptr->tokens != NULL) token_list_destroy(stub_ptr->tokens);
     if (stub_ptr->pathname != NULL) free(stub_ptr->pathname);
-    if (stub_ptr->code != NULL) free(stub_ptr->code);
+    if ((stub_ptr->code != NULL) && (stub_ptr->code_borrowed == 0)) free(stub_ptr->code);
     free(stub_ptr);
 
     return 0;
@@ -175,6 +272,13 @@ int mf_stub_optimize_set(void *stub, int optimize)
     return 0;
 }
 
+int mf_stub_threads_set(void *stub, size_t threads)
+{
+    struct mf_stub *stub_ptr = (struct mf_stub *)stub;
+    stub_ptr->threads = threads;
+    return 0;
+}
+
 int mf_stub_irgen(struct multiple_error *err, struct multiple_ir **ir, void *stub)
 {
     struct mf_stub *stub_ptr = (struct mf_stub *)stub;
@@ -197,7 +301,7 @@ int mf_stub_irgen(struct multiple_error *err, struct multiple_ir **ir, void *stu
         *ir = NULL;
     }
     /* construct */
-    if ((ret = mf_irgen(err, ir, stub_ptr->tokens, stub_ptr->opt_internal_reconstruct)) != 0) return ret;
+    if ((ret = mf_irgen_parallel(err, ir, stub_ptr->tokens, stub_ptr->optimize, stub_ptr->opt_internal_reconstruct, stub_ptr->threads)) != 0) return ret;
     /* source code */
     if ((ret = multiple_ir_update_icode_source_code(*ir, stub_ptr->code, stub_ptr->len)) != 0) return ret;
     stub_ptr->opt_internal_reconstruct = 0;
@@ -229,7 +333,7 @@ int mf_stub_reconstruct(struct multiple_error *err, struct multiple_ir **ir, voi
     }
     /* construct */
     stub_ptr->opt_internal_reconstruct = 1;
-    if ((ret = mf_irgen(err, ir, stub_ptr->tokens, stub_ptr->opt_internal_reconstruct)) != 0) return ret;
+    if ((ret = mf_irgen_parallel(err, ir, stub_ptr->tokens, stub_ptr->optimize, stub_ptr->opt_internal_reconstruct, stub_ptr->threads)) != 0) return ret;
     /* source code */
     if ((ret = multiple_ir_update_icode_source_code(*ir, stub_ptr->code, stub_ptr->len)) != 0) return ret;
 
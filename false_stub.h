@@ -30,9 +30,10 @@
 
 struct mf_stub
 {
-    /* plain text of source code */
+    /* plain text of source code, the caller's when borrowed */
     char *code;
     size_t len;
+    int code_borrowed;
 
     /* debug info */
     int debug_info;
@@ -40,23 +41,42 @@ struct mf_stub
     /* optimize */
     int optimize;
 
+    /* threads generating the lambdas */
+    size_t threads;
+
     /* intermediate data */
     struct token_list *tokens;
 
     /* options */
     int opt_internal_reconstruct;
 
-    /* pathname */
+    /* pathname, NULL or empty for a source in memory given none */
     char *pathname;
     size_t pathname_len;
+    size_t pathname_size;
 };
 
+/* A stub owns everything it compiles, stubs on different threads 
+ * share nothing but the read only tables of the front end */
 int mf_stub_create(struct multiple_error *err, void **stub_out, \
         char *pathname_dst, int type_dst, \
         char *pathname_src, int type_src);
+/* Compile 'len' bytes at 'code' without copying them, they stay the 
+ * caller's and must not change until the stub is destroyed or reset, 
+ * 'pathname' only names the source and may be NULL */
+int mf_stub_create_mem(struct multiple_error *err, void **stub_out, \
+        const char *code, size_t len, const char *pathname);
+/* Next source for the same stub, its options and buffers are kept, 
+ * what was compiled from the previous one is dropped */
+int mf_stub_reset(struct multiple_error *err, void *stub, \
+        const char *code, size_t len, const char *pathname);
 int mf_stub_destroy(void *stub);
 int mf_stub_debug_info_set(void *stub, int debug_info);
+/* The level is used by 'mf_stub_irgen' and 'mf_stub_reconstruct' as 
+ * well, the same as by false-run. It is 0 unless set, so the icode 
+ * the Multiple VM asks for without setting it stays unoptimized */
 int mf_stub_optimize_set(void *stub, int optimize);
+int mf_stub_threads_set(void *stub, size_t threads);
 int mf_stub_tokens_print(struct multiple_error *err, void *stub);
 int mf_stub_reconstruct(struct multiple_error *err, struct multiple_ir **ir, void *stub);
 int mf_stub_irgen(struct multiple_error *err, struct multiple_ir **ir, void *stub);
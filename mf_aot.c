@@ -0,0 +1,570 @@
+/* Multiple False Programming Language : Ahead-of-time Compiler
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+#include "mf_rt.h"
+#include "mf_aot.h"
+
+struct mf_aot_buf
+{
+    char *data;
+    size_t len;
+    size_t capacity;
+    int oom;
+};
+
+/* Running out of memory is remembered and checked once at the end */
+static void mf_aot_printf(struct mf_aot_buf *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+    char *new_data;
+    size_t new_capacity;
+
+    if (buf->oom != 0) return;
+    for (;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(buf->data + buf->len, buf->capacity - buf->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) { buf->oom = 1; return; }
+        if (buf->len + (size_t)n < buf->capacity) break;
+
+        new_capacity = (buf->capacity == 0) ? 4096 : buf->capacity;
+        while (buf->len + (size_t)n >= new_capacity) new_capacity *= 2;
+        if ((new_data = (char *)realloc(buf->data, new_capacity)) == NULL)
+        {
+            buf->oom = 1;
+            return;
+        }
+        buf->data = new_data;
+        buf->capacity = new_capacity;
+    }
+    buf->len += (size_t)n;
+}
+
+/* Octal escapes leave no room for trigraphs either */
+static void mf_aot_str(struct mf_aot_buf *buf, const char *str, size_t len)
+{
+    size_t idx;
+    unsigned char ch;
+
+    mf_aot_printf(buf, "\"");
+    for (idx = 0; idx != len; idx++)
+    {
+        ch = (unsigned char)str[idx];
+        if ((ch >= 0x20) && (ch < 0x7F) && (ch != '"') && (ch != '\\') && (ch != '?'))
+        { mf_aot_printf(buf, "%c", ch); }
+        else
+        { mf_aot_printf(buf, "\\%03o", ch); }
+    }
+    mf_aot_printf(buf, "\"");
+}
+
+static void mf_aot_prelude(struct mf_aot_buf *buf, const struct mf_prog *prog)
+{
+    int error;
+    size_t idx;
+
+    mf_aot_printf(buf, \
+            "/* Generated by the False compiler of Multiple */\n" \
+            "\n" \
+            "#include <stdio.h>\n" \
+            "#include <stdint.h>\n" \
+            "#include <string.h>\n" \
+            "#include <setjmp.h>\n" \
+            "#include <unistd.h>\n" \
+            "\n" \
+            "#ifndef MF_STACK_SIZE\n" \
+            "#define MF_STACK_SIZE %d\n" \
+            "#endif\n" \
+            "#define MF_DEPTH_MAX %d\n" \
+            "#define MF_IO_SIZE %d\n" \
+            "\n", \
+            MF_RT_STACK_SIZE_DEFAULT, MF_RT_DEPTH_MAX_DEFAULT, \
+            MF_RT_IO_OUTPUT_BUFFER_SIZE_DEFAULT);
+
+    mf_aot_printf(buf, "static const char *const mf_errors[] =\n{\n");
+    for (error = MF_RT_OK; error <= MF_RT_ERR_IO; error++)
+    { mf_aot_printf(buf, "    \"%s\",\n", mf_rt_error_str(error)); }
+    mf_aot_printf(buf, "};\n\n");
+
+    mf_aot_printf(buf, \
+            "static int32_t mf_stack[MF_STACK_SIZE];\n" \
+            "static int32_t mf_vars[%u];\n" \
+            "static uint32_t mf_depth;\n" \
+            "static jmp_buf mf_fail_jmp;\n" \
+            "\n" \
+            "static char mf_out[MF_IO_SIZE];\n" \
+            "static size_t mf_out_len;\n" \
+            "static unsigned char mf_in[MF_IO_SIZE];\n" \
+            "static size_t mf_in_pos, mf_in_len;\n" \
+            "\n", \
+            (unsigned int)((prog->vars_count == 0) ? 1 : prog->vars_count));
+
+    for (idx = 0; idx != prog->strs_count; idx++)
+    {
+        mf_aot_printf(buf, "static const char mf_str_%u[] = ", (unsigned int)idx);
+        mf_aot_str(buf, prog->strs[idx].str, prog->strs[idx].len);
+        mf_aot_printf(buf, ";\n");
+    }
+    if (prog->strs_count != 0) mf_aot_printf(buf, "\n");
+
+    mf_aot_printf(buf, \
+            "static void mf_fail(int error)\n" \
+            "{\n" \
+            "    longjmp(mf_fail_jmp, error);\n" \
+            "}\n" \
+            "\n" \
+            "static int mf_flush(void)\n" \
+            "{\n" \
+            "    size_t done = 0;\n" \
+            "    ssize_t n;\n" \
+            "\n" \
+            "    while (done != mf_out_len)\n" \
+            "    {\n" \
+            "        if ((n = write(1, mf_out + done, mf_out_len - done)) <= 0) return -1;\n" \
+            "        done += (size_t)n;\n" \
+            "    }\n" \
+            "    mf_out_len = 0;\n" \
+            "    return 0;\n" \
+            "}\n" \
+            "\n" \
+            "static void mf_write(const char *data, size_t len)\n" \
+            "{\n" \
+            "    if (mf_out_len + len > MF_IO_SIZE)\n" \
+            "    {\n" \
+            "        if (mf_flush() != 0) mf_fail(%d);\n" \
+            "        if (len > MF_IO_SIZE)\n" \
+            "        {\n" \
+            "            while (len != 0)\n" \
+            "            {\n" \
+            "                ssize_t n = write(1, data, len);\n" \
+            "                if (n <= 0) mf_fail(%d);\n" \
+            "                data += n;\n" \
+            "                len -= (size_t)n;\n" \
+            "            }\n" \
+            "            mf_out_len = 0;\n" \
+            "            return;\n" \
+            "        }\n" \
+            "    }\n" \
+            "    memcpy(mf_out + mf_out_len, data, len);\n" \
+            "    mf_out_len += len;\n" \
+            "}\n" \
+            "\n" \
+            "static void mf_putc(int32_t value)\n" \
+            "{\n" \
+            "    char ch = (char)value;\n" \
+            "    mf_write(&ch, 1);\n" \
+            "}\n" \
+            "\n" \
+            "static void mf_print_int(int32_t value)\n" \
+            "{\n" \
+            "    char digits[16];\n" \
+            "    mf_write(digits, (size_t)sprintf(digits, \"%%d\", (int)value));\n" \
+            "}\n" \
+            "\n" \
+            "/* Pending output is written before waiting for input */\n" \
+            "static int32_t mf_getc(void)\n" \
+            "{\n" \
+            "    ssize_t n;\n" \
+            "\n" \
+            "    if (mf_in_pos == mf_in_len)\n" \
+            "    {\n" \
+            "        if (mf_flush() != 0) mf_fail(%d);\n" \
+            "        if ((n = read(0, mf_in, MF_IO_SIZE)) <= 0) return -1;\n" \
+            "        mf_in_pos = 0;\n" \
+            "        mf_in_len = (size_t)n;\n" \
+            "    }\n" \
+            "    return (int32_t)mf_in[mf_in_pos++];\n" \
+            "}\n" \
+            "\n" \
+            "#define NEED(n) do { if (sp - mf_stack < (n)) mf_fail(%d); } while (0)\n" \
+            "#define ROOM(n) do { if (mf_stack + MF_STACK_SIZE - sp < (n)) mf_fail(%d); } while (0)\n" \
+            "\n", \
+            MF_RT_ERR_IO, MF_RT_ERR_IO, MF_RT_ERR_IO, \
+            MF_RT_ERR_UNDERFLOW, MF_RT_ERR_OVERFLOW);
+
+    for (idx = 0; idx != prog->lambdas_count; idx++)
+    { mf_aot_printf(buf, "static int32_t *mf_lambda_%u(int32_t *sp);\n", (unsigned int)idx); }
+    mf_aot_printf(buf, "\nstatic int32_t *(*const mf_lambdas[])(int32_t *) =\n{\n");
+    for (idx = 0; idx != prog->lambdas_count; idx++)
+    { mf_aot_printf(buf, "    mf_lambda_%u,\n", (unsigned int)idx); }
+    mf_aot_printf(buf, "};\n\n");
+
+    mf_aot_printf(buf, \
+            "static int32_t *mf_call(int32_t *sp, int32_t lambda)\n" \
+            "{\n" \
+            "    if ((uint32_t)lambda >= %uU) mf_fail(%d);\n" \
+            "    return mf_lambdas[lambda](sp);\n" \
+            "}\n" \
+            "\n", \
+            (unsigned int)prog->lambdas_count, MF_RT_ERR_LAMBDA);
+}
+
+/* Lambda pushed right before the instruction at 'pc', or -1 */
+static int64_t mf_aot_known_lambda(const struct mf_prog *prog, \
+        const struct mf_prog_lambda *lambda, size_t pc, size_t back)
+{
+    const struct mf_prog_ins *ins;
+
+    if (pc < back) return -1;
+    ins = &lambda->ins[pc - back];
+    if ((ins->op != MF_PROG_OP_LAMBDA) || \
+            (ins->operand < 0) || \
+            ((size_t)ins->operand >= prog->lambdas_count))
+    { return -1; }
+    return (int64_t)ins->operand;
+}
+
+/* The lambda is called by one of the next two instructions by name */
+static int mf_aot_lambda_consumed(const struct mf_prog *prog, \
+        const struct mf_prog_lambda *lambda, size_t pc)
+{
+    size_t next;
+
+    for (next = pc + 1; (next != pc + 3) && (next < lambda->size); next++)
+    {
+        switch (lambda->ins[next].op)
+        {
+            case MF_PROG_OP_APPLY:
+            case MF_PROG_OP_IF:
+                return ((next == pc + 1) && \
+                        (mf_aot_known_lambda(prog, lambda, next, 1) >= 0)) ? 1 : 0;
+            case MF_PROG_OP_WHILE:
+                return ((mf_aot_known_lambda(prog, lambda, next, 2) >= 0) && \
+                        (mf_aot_known_lambda(prog, lambda, next, 1) >= 0)) ? 1 : 0;
+            case MF_PROG_OP_LAMBDA:
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
+static void mf_aot_binary(struct mf_aot_buf *buf, const char *expr)
+{
+    mf_aot_printf(buf, "    sp--; { int32_t a = sp[-1], b = sp[0]; sp[-1] = %s; }\n", expr);
+}
+
+/* Instructions of the lambda, up to the return */
+static void mf_aot_body(struct mf_aot_buf *buf, \
+        const struct mf_prog *prog, const struct mf_prog_lambda *lambda, \
+        int checked)
+{
+    const struct mf_prog_ins *ins;
+    size_t pc;
+    int64_t known, known_cond;
+    /* Stack checks of every operation */
+    const char *need = checked ? "NEED" : "";
+    const char *room = checked ? "ROOM" : "";
+
+#define CHECK(check, n) \
+    do { if (check[0] != '\0') mf_aot_printf(buf, "    %s(%d);\n", check, (int)(n)); } while (0)
+
+    for (pc = 0; pc != lambda->size; pc++)
+    {
+        ins = &lambda->ins[pc];
+        switch (ins->op)
+        {
+            case MF_PROG_OP_LAMBDA:
+                if (mf_aot_lambda_consumed(prog, lambda, pc) != 0) break;
+                /* fall through */
+            case MF_PROG_OP_PUSH:
+                CHECK(room, 1);
+                mf_aot_printf(buf, "    *sp++ = %ld;\n", (long)ins->operand);
+                break;
+            case MF_PROG_OP_PRINT_STR:
+                mf_aot_printf(buf, "    mf_write(mf_str_%u, %lu);\n", \
+                        (unsigned int)ins->operand, \
+                        (unsigned long)prog->strs[ins->operand].len);
+                break;
+
+            case MF_PROG_OP_ADD:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "(int32_t)((uint32_t)a + (uint32_t)b)");
+                break;
+            case MF_PROG_OP_SUB:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "(int32_t)((uint32_t)a - (uint32_t)b)");
+                break;
+            case MF_PROG_OP_MUL:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "(int32_t)((uint32_t)a * (uint32_t)b)");
+                break;
+            case MF_PROG_OP_DIV:
+                CHECK(need, 2);
+                mf_aot_printf(buf, \
+                        "    if (sp[-1] == 0) mf_fail(%d);\n", \
+                        MF_RT_ERR_DIV_ZERO);
+                mf_aot_binary(buf, "(b == -1) ? (int32_t)(0U - (uint32_t)a) : a / b");
+                break;
+            case MF_PROG_OP_EQ:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "(a == b) ? -1 : 0");
+                break;
+            case MF_PROG_OP_G:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "(a > b) ? -1 : 0");
+                break;
+            case MF_PROG_OP_L:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "(a < b) ? -1 : 0");
+                break;
+            case MF_PROG_OP_AND:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "((a != 0) && (b != 0)) ? -1 : 0");
+                break;
+            case MF_PROG_OP_OR:
+                CHECK(need, 2);
+                mf_aot_binary(buf, "((a != 0) || (b != 0)) ? -1 : 0");
+                break;
+            case MF_PROG_OP_NEG:
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    sp[-1] = (int32_t)(0U - (uint32_t)sp[-1]);\n");
+                break;
+            case MF_PROG_OP_NOT:
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    sp[-1] = (sp[-1] == 0) ? -1 : 0;\n");
+                break;
+
+            case MF_PROG_OP_DUP:
+                CHECK(need, 1);
+                CHECK(room, 1);
+                mf_aot_printf(buf, "    sp[0] = sp[-1]; sp++;\n");
+                break;
+            case MF_PROG_OP_DROP:
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    sp--;\n");
+                break;
+            case MF_PROG_OP_SWAP:
+                CHECK(need, 2);
+                mf_aot_printf(buf, "    { int32_t a = sp[-1]; sp[-1] = sp[-2]; sp[-2] = a; }\n");
+                break;
+            case MF_PROG_OP_ROT:
+                CHECK(need, 3);
+                mf_aot_printf(buf, "    { int32_t a = sp[-3]; sp[-3] = sp[-2]; sp[-2] = sp[-1]; sp[-1] = a; }\n");
+                break;
+            case MF_PROG_OP_COPY:
+                CHECK(need, ins->operand + 1);
+                CHECK(room, 1);
+                mf_aot_printf(buf, "    sp[0] = sp[%ld]; sp++;\n", -1L - (long)ins->operand);
+                break;
+            case MF_PROG_OP_PICK:
+                CHECK(need, 1);
+                mf_aot_printf(buf, \
+                        "    { int32_t a = sp[-1]; if ((a < 0) || (a >= sp - mf_stack - 1)) mf_fail(%d); sp[-1] = sp[-2 - a]; }\n", \
+                        MF_RT_ERR_PICK);
+                break;
+
+            case MF_PROG_OP_LOAD:
+                CHECK(room, 1);
+                mf_aot_printf(buf, "    *sp++ = mf_vars[%ld]; /* %c */\n", \
+                        (long)ins->operand, prog->vars[ins->operand]);
+                break;
+            case MF_PROG_OP_STORE:
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    mf_vars[%ld] = *--sp; /* %c */\n", \
+                        (long)ins->operand, prog->vars[ins->operand]);
+                break;
+
+            case MF_PROG_OP_APPLY:
+                if ((known = mf_aot_known_lambda(prog, lambda, pc, 1)) >= 0)
+                {
+                    mf_aot_printf(buf, "    sp = mf_lambda_%u(sp);\n", (unsigned int)known);
+                    break;
+                }
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    { int32_t a = *--sp; sp = mf_call(sp, a); }\n");
+                break;
+            case MF_PROG_OP_IF:
+                if ((known = mf_aot_known_lambda(prog, lambda, pc, 1)) >= 0)
+                {
+                    CHECK(need, 1);
+                    mf_aot_printf(buf, "    if (*--sp != 0) sp = mf_lambda_%u(sp);\n", (unsigned int)known);
+                    break;
+                }
+                CHECK(need, 2);
+                mf_aot_printf(buf, "    { int32_t a = *--sp; if (*--sp != 0) sp = mf_call(sp, a); }\n");
+                break;
+            case MF_PROG_OP_WHILE:
+                /* What the condition leaves is never known here */
+                known_cond = mf_aot_known_lambda(prog, lambda, pc, 2);
+                known = mf_aot_known_lambda(prog, lambda, pc, 1);
+                if ((known_cond >= 0) && (known >= 0))
+                {
+                    mf_aot_printf(buf, \
+                            "    for (;;)\n" \
+                            "    {\n" \
+                            "        sp = mf_lambda_%u(sp);\n" \
+                            "        NEED(1);\n" \
+                            "        if (*--sp == 0) break;\n" \
+                            "        sp = mf_lambda_%u(sp);\n" \
+                            "    }\n", \
+                            (unsigned int)known_cond, (unsigned int)known);
+                    break;
+                }
+                CHECK(need, 2);
+                mf_aot_printf(buf, \
+                        "    {\n" \
+                        "        int32_t body = *--sp, cond = *--sp;\n" \
+                        "        for (;;)\n" \
+                        "        {\n" \
+                        "            sp = mf_call(sp, cond);\n" \
+                        "            NEED(1);\n" \
+                        "            if (*--sp == 0) break;\n" \
+                        "            sp = mf_call(sp, body);\n" \
+                        "        }\n" \
+                        "    }\n");
+                break;
+
+            case MF_PROG_OP_PRINT_INT:
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    mf_print_int(*--sp);\n");
+                break;
+            case MF_PROG_OP_PRINT_CHAR:
+                CHECK(need, 1);
+                mf_aot_printf(buf, "    mf_putc(*--sp);\n");
+                break;
+            case MF_PROG_OP_READ_CHAR:
+                CHECK(room, 1);
+                mf_aot_printf(buf, "    *sp++ = mf_getc();\n");
+                break;
+            case MF_PROG_OP_FLUSH:
+                mf_aot_printf(buf, "    if (mf_flush() != 0) mf_fail(%d);\n", MF_RT_ERR_IO);
+                break;
+
+            case MF_PROG_OP_RETURN:
+                mf_aot_printf(buf, "    mf_depth--;\n    return sp;\n");
+                break;
+        }
+    }
+
+#undef CHECK
+}
+
+static void mf_aot_lambda(struct mf_aot_buf *buf, \
+        const struct mf_prog *prog, size_t lambda_idx)
+{
+    const struct mf_prog_lambda *lambda = &prog->lambdas[lambda_idx];
+
+    mf_aot_printf(buf, "static int32_t *mf_lambda_%u(int32_t *sp)\n{\n", (unsigned int)lambda_idx);
+    if (lambda_idx == prog->main_idx) mf_aot_printf(buf, "    /* main */\n");
+    mf_aot_printf(buf, "    if (mf_depth == MF_DEPTH_MAX) mf_fail(%d);\n", MF_RT_ERR_DEPTH);
+    mf_aot_printf(buf, "    mf_depth++;\n");
+
+    /* A safe lambda runs without checks once the bounds of its deepest
+     * path are met, otherwise it fails where the interpreter would */
+    if (lambda->stack_safe)
+    {
+        mf_aot_printf(buf, \
+                "    if ((sp - mf_stack < %u) || (mf_stack + MF_STACK_SIZE - sp < %u)) goto checked;\n", \
+                (unsigned int)lambda->stack_need_max, (unsigned int)lambda->stack_max);
+        mf_aot_body(buf, prog, lambda, 0);
+        mf_aot_printf(buf, "checked:\n");
+    }
+    mf_aot_body(buf, prog, lambda, 1);
+    mf_aot_printf(buf, "}\n\n");
+}
+
+static void mf_aot_epilogue(struct mf_aot_buf *buf, const struct mf_prog *prog)
+{
+    mf_aot_printf(buf, \
+            "int mf_main(void)\n" \
+            "{\n" \
+            "    int ret;\n" \
+            "\n" \
+            "    memset(mf_vars, 0, sizeof(mf_vars));\n" \
+            "    mf_depth = 0;\n" \
+            "    mf_out_len = 0;\n" \
+            "    mf_in_pos = mf_in_len = 0;\n" \
+            "\n" \
+            "    /* Not every program needs every helper */\n" \
+            "    (void)mf_errors; (void)mf_call;\n" \
+            "    (void)mf_putc; (void)mf_print_int; (void)mf_getc;\n" \
+            "\n" \
+            "    if ((ret = setjmp(mf_fail_jmp)) == 0)\n" \
+            "    {\n" \
+            "        mf_lambda_%u(mf_stack);\n" \
+            "    }\n" \
+            "    if ((mf_flush() != 0) && (ret == 0)) ret = %d;\n" \
+            "\n" \
+            "    return ret;\n" \
+            "}\n" \
+            "\n" \
+            "#ifndef MF_AOT_NO_MAIN\n" \
+            "int main(void)\n" \
+            "{\n" \
+            "    int ret = mf_main();\n" \
+            "\n" \
+            "    if (ret != 0) fprintf(stderr, \"error: %%s\\n\", mf_errors[ret]);\n" \
+            "    return (ret == 0) ? 0 : 1;\n" \
+            "}\n" \
+            "#endif\n", \
+            (unsigned int)prog->main_idx, MF_RT_ERR_IO);
+}
+
+int mf_aot_c(struct multiple_error *err, \
+        char **src_out, size_t *src_len_out, \
+        const struct mf_prog *prog)
+{
+    int ret = 0;
+    struct mf_aot_buf buf;
+    size_t idx;
+
+    buf.data = NULL;
+    buf.len = 0;
+    buf.capacity = 0;
+    buf.oom = 0;
+
+    mf_aot_prelude(&buf, prog);
+    for (idx = 0; idx != prog->lambdas_count; idx++)
+    { mf_aot_lambda(&buf, prog, idx); }
+    mf_aot_epilogue(&buf, prog);
+
+    if (buf.oom != 0)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+
+    *src_out = buf.data;
+    *src_len_out = buf.len;
+    buf.data = NULL;
+
+    goto done;
+fail:
+done:
+    if (buf.data != NULL) free(buf.data);
+    return ret;
+}
+
@@ -0,0 +1,40 @@
+/* Multiple False Programming Language : Ahead-of-time Compiler
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_AOT_H_
+#define _MF_AOT_H_
+
+#include <stdio.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+
+/* Translate the program into a self-contained C translation unit.
+ *
+ * The unit defines 'int mf_main(void)', which returns one of
+ * MF_RT_ERR_*, and a 'main' unless it is compiled with
+ * -DMF_AOT_NO_MAIN, so it can be built into an executable as well as
+ * into a shared object. The source is NUL terminated. */
+int mf_aot_c(struct multiple_error *err, \
+        char **src_out, size_t *src_len_out, \
+        const struct mf_prog *prog);
+
+#endif
+
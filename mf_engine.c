@@ -0,0 +1,1565 @@
+/* Multiple False Programming Language : Execution Engine
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_rt.h"
+#include "mf_engine.h"
+
+/* Instructions of the engine beyond those of the program */
+enum
+{
+    /* Leaves the engine once 'main' returns, always at 0 */
+    MF_ENGINE_OP_HALT = MF_PROG_OP_COUNT,
+    /* Lambdas pushed right before '!' and '?', operand = entry */
+    MF_ENGINE_OP_CALL,
+    MF_ENGINE_OP_IF_CALL,
+    /* '#' takes three steps so that a loop never stays on the C stack */
+    MF_ENGINE_OP_WHILE_BEGIN,
+    MF_ENGINE_OP_WHILE_COND,
+    MF_ENGINE_OP_WHILE_TEST,
+    /* Only in traces, a guard pops the top when it is the one recorded 
+     * and otherwise leaves the trace for the image, stack untouched */
+    MF_ENGINE_OP_GUARD_TRUE,
+    MF_ENGINE_OP_GUARD_FALSE,
+    MF_ENGINE_OP_GUARD_LAMBDA,
+    /* The test of the loop at the end of a trace */
+    MF_ENGINE_OP_TRACE_LOOP,
+
+    /* Superinstructions, each one stands for a sequence found frequent 
+     * by the profiler, the instructions of the sequence stay in place 
+     * for their operands and for calls returning in the middle */
+    MF_ENGINE_OP_PUSH_ADD,
+    MF_ENGINE_OP_PUSH_SUB,
+    MF_ENGINE_OP_PUSH_MUL,
+    MF_ENGINE_OP_PUSH_DIV,
+    MF_ENGINE_OP_PUSH_EQ,
+    MF_ENGINE_OP_PUSH_G,
+    MF_ENGINE_OP_PUSH_L,
+    MF_ENGINE_OP_PUSH_NEG,
+    MF_ENGINE_OP_EQ_NOT,
+    MF_ENGINE_OP_G_NOT,
+    MF_ENGINE_OP_L_NOT,
+    MF_ENGINE_OP_PUSH_EQ_NOT,
+    MF_ENGINE_OP_PUSH_G_NOT,
+    MF_ENGINE_OP_PUSH_L_NOT,
+    MF_ENGINE_OP_LOAD_PUSH,
+    MF_ENGINE_OP_LOAD_LOAD,
+    MF_ENGINE_OP_DUP_PUSH,
+    MF_ENGINE_OP_LOAD_PUSH_ADD_STORE,
+    MF_ENGINE_OP_STORE_RETURN,
+    MF_ENGINE_OP_NOT_RETURN,
+
+    MF_ENGINE_OP_COUNT,
+};
+
+#define MF_ENGINE_SUPER_LEN_MAX 4
+
+struct mf_engine_super
+{
+    uint32_t op;
+    size_t len;
+    uint32_t seq[MF_ENGINE_SUPER_LEN_MAX];
+};
+
+/* Tried in order, longer sequences go first */
+static const struct mf_engine_super mf_engine_supers[] =
+{
+    { MF_ENGINE_OP_LOAD_PUSH_ADD_STORE, 4, \
+        { MF_PROG_OP_LOAD, MF_PROG_OP_PUSH, MF_PROG_OP_ADD, MF_PROG_OP_STORE } },
+    { MF_ENGINE_OP_PUSH_EQ_NOT, 3, { MF_PROG_OP_PUSH, MF_PROG_OP_EQ, MF_PROG_OP_NOT } },
+    { MF_ENGINE_OP_PUSH_G_NOT, 3, { MF_PROG_OP_PUSH, MF_PROG_OP_G, MF_PROG_OP_NOT } },
+    { MF_ENGINE_OP_PUSH_L_NOT, 3, { MF_PROG_OP_PUSH, MF_PROG_OP_L, MF_PROG_OP_NOT } },
+    { MF_ENGINE_OP_PUSH_ADD, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_ADD } },
+    { MF_ENGINE_OP_PUSH_SUB, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_SUB } },
+    { MF_ENGINE_OP_PUSH_MUL, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_MUL } },
+    { MF_ENGINE_OP_PUSH_DIV, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_DIV } },
+    { MF_ENGINE_OP_PUSH_EQ, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_EQ } },
+    { MF_ENGINE_OP_PUSH_G, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_G } },
+    { MF_ENGINE_OP_PUSH_L, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_L } },
+    { MF_ENGINE_OP_PUSH_NEG, 2, { MF_PROG_OP_PUSH, MF_PROG_OP_NEG } },
+    { MF_ENGINE_OP_EQ_NOT, 2, { MF_PROG_OP_EQ, MF_PROG_OP_NOT } },
+    { MF_ENGINE_OP_G_NOT, 2, { MF_PROG_OP_G, MF_PROG_OP_NOT } },
+    { MF_ENGINE_OP_L_NOT, 2, { MF_PROG_OP_L, MF_PROG_OP_NOT } },
+    { MF_ENGINE_OP_LOAD_PUSH, 2, { MF_PROG_OP_LOAD, MF_PROG_OP_PUSH } },
+    { MF_ENGINE_OP_LOAD_LOAD, 2, { MF_PROG_OP_LOAD, MF_PROG_OP_LOAD } },
+    { MF_ENGINE_OP_DUP_PUSH, 2, { MF_PROG_OP_DUP, MF_PROG_OP_PUSH } },
+    { MF_ENGINE_OP_STORE_RETURN, 2, { MF_PROG_OP_STORE, MF_PROG_OP_RETURN } },
+    { MF_ENGINE_OP_NOT_RETURN, 2, { MF_PROG_OP_NOT, MF_PROG_OP_RETURN } },
+};
+
+static const char *const mf_engine_op_names[MF_ENGINE_OP_COUNT] =
+{
+    [MF_PROG_OP_PUSH] = "push",
+    [MF_PROG_OP_LAMBDA] = "lambda",
+    [MF_PROG_OP_PRINT_STR] = "print_str",
+    [MF_PROG_OP_ADD] = "add",
+    [MF_PROG_OP_SUB] = "sub",
+    [MF_PROG_OP_MUL] = "mul",
+    [MF_PROG_OP_DIV] = "div",
+    [MF_PROG_OP_NEG] = "neg",
+    [MF_PROG_OP_EQ] = "eq",
+    [MF_PROG_OP_G] = "g",
+    [MF_PROG_OP_L] = "l",
+    [MF_PROG_OP_AND] = "and",
+    [MF_PROG_OP_OR] = "or",
+    [MF_PROG_OP_NOT] = "not",
+    [MF_PROG_OP_DUP] = "dup",
+    [MF_PROG_OP_DROP] = "drop",
+    [MF_PROG_OP_SWAP] = "swap",
+    [MF_PROG_OP_ROT] = "rot",
+    [MF_PROG_OP_COPY] = "copy",
+    [MF_PROG_OP_PICK] = "pick",
+    [MF_PROG_OP_LOAD] = "load",
+    [MF_PROG_OP_STORE] = "store",
+    [MF_PROG_OP_APPLY] = "apply",
+    [MF_PROG_OP_IF] = "if",
+    [MF_PROG_OP_WHILE] = "while",
+    [MF_PROG_OP_PRINT_INT] = "print_int",
+    [MF_PROG_OP_PRINT_CHAR] = "print_char",
+    [MF_PROG_OP_READ_CHAR] = "read_char",
+    [MF_PROG_OP_FLUSH] = "flush",
+    [MF_PROG_OP_RETURN] = "return",
+    [MF_ENGINE_OP_HALT] = "halt",
+    [MF_ENGINE_OP_CALL] = "call",
+    [MF_ENGINE_OP_IF_CALL] = "if_call",
+    [MF_ENGINE_OP_WHILE_BEGIN] = "while_begin",
+    [MF_ENGINE_OP_WHILE_COND] = "while_cond",
+    [MF_ENGINE_OP_WHILE_TEST] = "while_test",
+    [MF_ENGINE_OP_GUARD_TRUE] = "guard_true",
+    [MF_ENGINE_OP_GUARD_FALSE] = "guard_false",
+    [MF_ENGINE_OP_GUARD_LAMBDA] = "guard_lambda",
+    [MF_ENGINE_OP_TRACE_LOOP] = "trace_loop",
+    [MF_ENGINE_OP_PUSH_ADD] = "push_add",
+    [MF_ENGINE_OP_PUSH_SUB] = "push_sub",
+    [MF_ENGINE_OP_PUSH_MUL] = "push_mul",
+    [MF_ENGINE_OP_PUSH_DIV] = "push_div",
+    [MF_ENGINE_OP_PUSH_EQ] = "push_eq",
+    [MF_ENGINE_OP_PUSH_G] = "push_g",
+    [MF_ENGINE_OP_PUSH_L] = "push_l",
+    [MF_ENGINE_OP_PUSH_NEG] = "push_neg",
+    [MF_ENGINE_OP_EQ_NOT] = "eq_not",
+    [MF_ENGINE_OP_G_NOT] = "g_not",
+    [MF_ENGINE_OP_L_NOT] = "l_not",
+    [MF_ENGINE_OP_PUSH_EQ_NOT] = "push_eq_not",
+    [MF_ENGINE_OP_PUSH_G_NOT] = "push_g_not",
+    [MF_ENGINE_OP_PUSH_L_NOT] = "push_l_not",
+    [MF_ENGINE_OP_LOAD_PUSH] = "load_push",
+    [MF_ENGINE_OP_LOAD_LOAD] = "load_load",
+    [MF_ENGINE_OP_DUP_PUSH] = "dup_push",
+    [MF_ENGINE_OP_LOAD_PUSH_ADD_STORE] = "load_push_add_store",
+    [MF_ENGINE_OP_STORE_RETURN] = "store_return",
+    [MF_ENGINE_OP_NOT_RETURN] = "not_return",
+};
+
+static int mf_engine_exec(struct mf_engine *engine, const void *const **labels_out);
+
+/* Profile */
+
+#define MF_ENGINE_PROFILE_N_MAX 3
+
+struct mf_engine_profile
+{
+    /* Indexed by the instructions of the sequence in base 
+     * MF_ENGINE_OP_COUNT, one table for each length */
+    uint64_t *counts[MF_ENGINE_PROFILE_N_MAX];
+
+    /* The two instructions executed before */
+    const struct mf_engine_ins *last[2];
+};
+
+int mf_engine_profile_new(struct mf_engine_profile **profile_out)
+{
+    struct mf_engine_profile *new_profile;
+    size_t idx, size = 1;
+
+    *profile_out = NULL;
+
+    new_profile = (struct mf_engine_profile *)malloc(sizeof(struct mf_engine_profile));
+    if (new_profile == NULL) return -MULTIPLE_ERR_MALLOC;
+    for (idx = 0; idx != MF_ENGINE_PROFILE_N_MAX; idx++)
+    {
+        size *= MF_ENGINE_OP_COUNT;
+        if ((new_profile->counts[idx] = (uint64_t *)calloc(size, sizeof(uint64_t))) == NULL)
+        {
+            mf_engine_profile_destroy(new_profile);
+            return -MULTIPLE_ERR_MALLOC;
+        }
+    }
+    new_profile->last[0] = new_profile->last[1] = NULL;
+
+    *profile_out = new_profile;
+
+    return 0;
+}
+
+int mf_engine_profile_destroy(struct mf_engine_profile *profile)
+{
+    size_t idx;
+
+    if (profile == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    for (idx = 0; idx != MF_ENGINE_PROFILE_N_MAX; idx++)
+    {
+        if (profile->counts[idx] != NULL) free(profile->counts[idx]);
+    }
+    free(profile);
+
+    return 0;
+}
+
+/* Only a sequence laid out in order could be fused */
+static void mf_engine_profile_record(struct mf_engine_profile *profile, \
+        const struct mf_engine_ins *ip)
+{
+    const struct mf_engine_ins *last0 = profile->last[0];
+    const struct mf_engine_ins *last1 = profile->last[1];
+
+    profile->counts[0][ip->op]++;
+    if (last0 == ip - 1)
+    {
+        profile->counts[1][last0->op * MF_ENGINE_OP_COUNT + ip->op]++;
+        if (last1 == ip - 2)
+        {
+            profile->counts[2][(last1->op * MF_ENGINE_OP_COUNT + last0->op) * \
+                MF_ENGINE_OP_COUNT + ip->op]++;
+        }
+    }
+    profile->last[1] = last0;
+    profile->last[0] = ip;
+}
+
+struct mf_engine_profile_item
+{
+    size_t seq;
+    uint64_t count;
+};
+
+static int mf_engine_profile_item_cmp(const void *a, const void *b)
+{
+    const struct mf_engine_profile_item *item_a = (const struct mf_engine_profile_item *)a;
+    const struct mf_engine_profile_item *item_b = (const struct mf_engine_profile_item *)b;
+
+    if (item_a->count != item_b->count) return (item_a->count < item_b->count) ? 1 : -1;
+    return (item_a->seq < item_b->seq) ? -1 : 1;
+}
+
+int mf_engine_profile_report(FILE *fp, \
+        const struct mf_engine_profile *profile, size_t top)
+{
+    struct mf_engine_profile_item *items = NULL;
+    size_t n, idx, items_count, size = 1, seq, op_idx;
+    size_t ops[MF_ENGINE_PROFILE_N_MAX];
+    uint64_t total = 0;
+
+    for (idx = 0; idx != MF_ENGINE_OP_COUNT; idx++) total += profile->counts[0][idx];
+    fprintf(fp, "instructions executed: %llu\n", (unsigned long long)total);
+    if (total == 0) return 0;
+
+    for (n = 0; n != MF_ENGINE_PROFILE_N_MAX; n++)
+    {
+        size *= MF_ENGINE_OP_COUNT;
+        items = (struct mf_engine_profile_item *)malloc( \
+                sizeof(struct mf_engine_profile_item) * size);
+        if (items == NULL) return -MULTIPLE_ERR_MALLOC;
+        items_count = 0;
+        for (idx = 0; idx != size; idx++)
+        {
+            if (profile->counts[n][idx] == 0) continue;
+            items[items_count].seq = idx;
+            items[items_count].count = profile->counts[n][idx];
+            items_count++;
+        }
+        qsort(items, items_count, sizeof(struct mf_engine_profile_item), \
+                mf_engine_profile_item_cmp);
+
+        fprintf(fp, "\n%u-grams:\n", (unsigned int)(n + 1));
+        for (idx = 0; (idx != items_count) && (idx != top); idx++)
+        {
+            seq = items[idx].seq;
+            for (op_idx = n + 1; op_idx-- != 0;)
+            {
+                ops[op_idx] = seq % MF_ENGINE_OP_COUNT;
+                seq /= MF_ENGINE_OP_COUNT;
+            }
+            fprintf(fp, "%12llu %6.2f%% ", \
+                    (unsigned long long)items[idx].count, \
+                    100.0 * (double)items[idx].count / (double)total);
+            for (op_idx = 0; op_idx != n + 1; op_idx++)
+            {
+                fprintf(fp, " %s", mf_engine_op_names[ops[op_idx]]);
+            }
+            fprintf(fp, "\n");
+        }
+        free(items);
+    }
+
+    return 0;
+}
+
+/* Image */
+
+static int mf_engine_image_append(struct mf_engine_image *image, \
+        size_t *capacity, uint32_t op, int32_t operand)
+{
+    struct mf_engine_ins *new_code;
+    size_t new_capacity;
+
+    if (image->size == *capacity)
+    {
+        new_capacity = (*capacity == 0) ? 256 : (*capacity * 2);
+        new_code = (struct mf_engine_ins *)realloc(image->code, \
+                sizeof(struct mf_engine_ins) * new_capacity);
+        if (new_code == NULL) return -MULTIPLE_ERR_MALLOC;
+        image->code = new_code;
+        *capacity = new_capacity;
+    }
+    image->code[image->size].handler = NULL;
+    image->code[image->size].op = op;
+    image->code[image->size].operand = operand;
+    image->size++;
+
+    return 0;
+}
+
+/* Lambda pushed right before the instruction at 'pc', or -1 */
+static int32_t mf_engine_known_lambda(const struct mf_prog *prog, \
+        const struct mf_prog_lambda *lambda, size_t pc)
+{
+    const struct mf_prog_ins *ins;
+
+    if (pc == 0) return -1;
+    ins = &lambda->ins[pc - 1];
+    if ((ins->op != MF_PROG_OP_LAMBDA) || \
+            (ins->operand < 0) || \
+            ((size_t)ins->operand >= prog->lambdas_count))
+    { return -1; }
+    return ins->operand;
+}
+
+static void mf_engine_image_fuse(struct mf_engine_image *image)
+{
+    const struct mf_engine_super *super;
+    size_t pc, idx, super_idx;
+
+    pc = 0;
+    while (pc != image->size)
+    {
+        for (super_idx = 0; \
+                super_idx != sizeof(mf_engine_supers) / sizeof(mf_engine_supers[0]); \
+                super_idx++)
+        {
+            super = &mf_engine_supers[super_idx];
+            if (pc + super->len > image->size) continue;
+            for (idx = 0; idx != super->len; idx++)
+            {
+                if (image->code[pc + idx].op != super->seq[idx]) break;
+            }
+            if (idx == super->len) break;
+        }
+        if (super_idx == sizeof(mf_engine_supers) / sizeof(mf_engine_supers[0]))
+        {
+            pc++;
+            continue;
+        }
+        image->code[pc].op = super->op;
+        pc += super->len;
+    }
+}
+
+int mf_engine_image_new(struct mf_engine_image **image_out, \
+        const struct mf_prog *prog, int flags)
+{
+    int ret = 0;
+    struct mf_engine_image *new_image = NULL;
+    const struct mf_prog_lambda *lambda;
+    const struct mf_prog_ins *ins;
+    const void *const *labels = NULL;
+    size_t capacity = 0;
+    size_t idx, pc;
+    int32_t known, loop;
+
+    *image_out = NULL;
+
+    if ((new_image = (struct mf_engine_image *)malloc(sizeof(struct mf_engine_image))) == NULL)
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    new_image->prog = prog;
+    new_image->flags = flags;
+    new_image->code = NULL;
+    new_image->size = 0;
+    new_image->lambdas_count = prog->lambdas_count;
+    new_image->loops_count = 0;
+    new_image->code_hook = NULL;
+    new_image->entries = (uint32_t *)malloc(sizeof(uint32_t) * (prog->lambdas_count + 1));
+    if (new_image->entries == NULL) { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    if ((ret = mf_engine_image_append(new_image, &capacity, MF_ENGINE_OP_HALT, 0)) != 0)
+    { goto fail; }
+
+    for (idx = 0; idx != prog->lambdas_count; idx++)
+    {
+        lambda = &prog->lambdas[idx];
+        new_image->entries[idx] = (uint32_t)new_image->size;
+        for (pc = 0; pc != lambda->size; pc++)
+        {
+            ins = &lambda->ins[pc];
+            switch (ins->op)
+            {
+                case MF_PROG_OP_APPLY:
+                case MF_PROG_OP_IF:
+                    /* Replaces the push of the lambda, the entry is 
+                     * filled once every lambda has been placed */
+                    if ((known = mf_engine_known_lambda(prog, lambda, pc)) >= 0)
+                    {
+                        new_image->code[new_image->size - 1].op = \
+                                (ins->op == MF_PROG_OP_APPLY) ? MF_ENGINE_OP_CALL : MF_ENGINE_OP_IF_CALL;
+                        break;
+                    }
+                    ret = mf_engine_image_append(new_image, &capacity, ins->op, ins->operand);
+                    break;
+                case MF_PROG_OP_WHILE:
+                    loop = (int32_t)new_image->loops_count++;
+                    if (((ret = mf_engine_image_append(new_image, &capacity, \
+                                            MF_ENGINE_OP_WHILE_BEGIN, 0)) != 0) || \
+                            ((ret = mf_engine_image_append(new_image, &capacity, \
+                                            MF_ENGINE_OP_WHILE_COND, loop)) != 0))
+                    { goto fail; }
+                    ret = mf_engine_image_append(new_image, &capacity, \
+                            MF_ENGINE_OP_WHILE_TEST, loop);
+                    break;
+                default:
+                    ret = mf_engine_image_append(new_image, &capacity, ins->op, ins->operand);
+                    break;
+            }
+            if (ret != 0) goto fail;
+        }
+    }
+
+    for (pc = 0; pc != new_image->size; pc++)
+    {
+        if ((new_image->code[pc].op == MF_ENGINE_OP_CALL) || \
+                (new_image->code[pc].op == MF_ENGINE_OP_IF_CALL))
+        {
+            new_image->code[pc].operand = \
+                    (int32_t)new_image->entries[new_image->code[pc].operand];
+        }
+    }
+
+    if ((flags & MF_ENGINE_IMAGE_FLAG_NO_SUPER) == 0)
+    { mf_engine_image_fuse(new_image); }
+
+#if MF_ENGINE_THREADED
+    /* Every instruction goes by the profiler first */
+    mf_engine_exec(NULL, &labels);
+    for (pc = 0; pc != new_image->size; pc++)
+    {
+        new_image->code[pc].handler = ((flags & MF_ENGINE_IMAGE_FLAG_PROFILE) != 0) ? \
+            labels[MF_ENGINE_OP_COUNT] : labels[new_image->code[pc].op];
+    }
+    /* The recorder switches to the copy while a loop is recorded, 
+     * the positions are the same */
+    if (((flags & MF_ENGINE_IMAGE_FLAG_TRACE) != 0) && \
+            ((flags & MF_ENGINE_IMAGE_FLAG_PROFILE) == 0))
+    {
+        new_image->code_hook = (struct mf_engine_ins *)malloc( \
+                sizeof(struct mf_engine_ins) * new_image->size);
+        if (new_image->code_hook == NULL) { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+        for (pc = 0; pc != new_image->size; pc++)
+        {
+            new_image->code_hook[pc] = new_image->code[pc];
+            new_image->code_hook[pc].handler = labels[MF_ENGINE_OP_COUNT];
+        }
+    }
+#else
+    (void)labels;
+#endif
+
+    *image_out = new_image;
+    new_image = NULL;
+
+    goto done;
+fail:
+done:
+    if (new_image != NULL) mf_engine_image_destroy(new_image);
+    return ret;
+}
+
+int mf_engine_image_destroy(struct mf_engine_image *image)
+{
+    if (image == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    if (image->code != NULL) free(image->code);
+    if (image->code_hook != NULL) free(image->code_hook);
+    if (image->entries != NULL) free(image->entries);
+    free(image);
+
+    return 0;
+}
+
+/* Traces */
+
+/* Back-edges taken before a loop is recorded */
+#define MF_ENGINE_TRACE_HOT 256
+/* Instructions executed in one recorded iteration */
+#define MF_ENGINE_TRACE_LEN_MAX 1024
+/* Calls inlined into each other, the loop lambda included */
+#define MF_ENGINE_TRACE_DEPTH_MAX 16
+
+struct mf_engine_loop
+{
+    /* Back-edges, stops at MF_ENGINE_TRACE_HOT */
+    uint32_t count;
+    struct mf_engine_trace *trace;
+};
+
+struct mf_engine_recorder
+{
+    int active;
+    uint32_t loop;
+    /* The test of the loop, where the recording starts and ends */
+    uint32_t anchor;
+    int32_t cond, body;
+
+    /* Position of each instruction executed and the top of the 
+     * stack right before, which tells the lambda applied and the 
+     * branch taken */
+    uint32_t pcs[MF_ENGINE_TRACE_LEN_MAX];
+    int32_t tops[MF_ENGINE_TRACE_LEN_MAX];
+    size_t size;
+};
+
+struct mf_engine_trace
+{
+    /* Lambdas of the loop when recorded */
+    int32_t cond, body;
+    uint32_t anchor;
+    /* Most calls inlined at once */
+    uint32_t depth;
+
+    struct mf_engine_ins *code;
+    size_t size;
+
+    /* Where the image goes on when leaving at each instruction, and 
+     * the calls inlined up to there, as an offset in 'frames' of 
+     * their count followed by their return addresses */
+    uint32_t *exit_pcs;
+    uint32_t *exit_frames;
+    uint32_t *frames;
+    size_t frames_size;
+};
+
+static void mf_engine_trace_destroy(struct mf_engine_trace *trace)
+{
+    if (trace->code != NULL) free(trace->code);
+    if (trace->exit_pcs != NULL) free(trace->exit_pcs);
+    if (trace->exit_frames != NULL) free(trace->exit_frames);
+    if (trace->frames != NULL) free(trace->frames);
+    free(trace);
+}
+
+static const struct mf_engine_super *mf_engine_super_find(uint32_t op)
+{
+    size_t idx;
+
+    for (idx = 0; idx != sizeof(mf_engine_supers) / sizeof(mf_engine_supers[0]); idx++)
+    {
+        if (mf_engine_supers[idx].op == op) return &mf_engine_supers[idx];
+    }
+    return NULL;
+}
+
+struct mf_engine_trace_builder
+{
+    struct mf_engine_trace *trace;
+    const void *const *labels;
+    /* Profiled as the image is */
+    int profile;
+
+    /* Return addresses of the calls inlined so far */
+    uint32_t frames[MF_ENGINE_TRACE_DEPTH_MAX];
+    size_t depth;
+    /* Offset of the current frames in the trace, or -1 once changed */
+    ptrdiff_t frames_at;
+};
+
+static int mf_engine_trace_push(struct mf_engine_trace_builder *builder, uint32_t ret_pc)
+{
+    if (builder->depth == MF_ENGINE_TRACE_DEPTH_MAX) return -1;
+    builder->frames[builder->depth++] = ret_pc;
+    if (builder->depth > builder->trace->depth) builder->trace->depth = (uint32_t)builder->depth;
+    builder->frames_at = -1;
+    return 0;
+}
+
+static int mf_engine_trace_pop(struct mf_engine_trace_builder *builder)
+{
+    if (builder->depth == 0) return -1;
+    builder->depth--;
+    builder->frames_at = -1;
+    return 0;
+}
+
+/* Room for each instruction has been made by the caller */
+static void mf_engine_trace_emit(struct mf_engine_trace_builder *builder, \
+        uint32_t op, int32_t operand, uint32_t exit_pc)
+{
+    struct mf_engine_trace *trace = builder->trace;
+    size_t idx;
+
+    if (builder->frames_at < 0)
+    {
+        builder->frames_at = (ptrdiff_t)trace->frames_size;
+        trace->frames[trace->frames_size++] = (uint32_t)builder->depth;
+        for (idx = 0; idx != builder->depth; idx++)
+        { trace->frames[trace->frames_size++] = builder->frames[idx]; }
+    }
+    trace->code[trace->size].handler = (builder->labels == NULL) ? NULL : \
+            builder->labels[builder->profile ? MF_ENGINE_OP_COUNT : op];
+    trace->code[trace->size].op = op;
+    trace->code[trace->size].operand = operand;
+    trace->exit_pcs[trace->size] = exit_pc;
+    trace->exit_frames[trace->size] = (uint32_t)builder->frames_at;
+    trace->size++;
+}
+
+/* Turn the recording into a trace, '*trace_out' stays NULL when
+ * something recorded can not be traced */
+static int mf_engine_trace_compile(struct mf_engine_trace **trace_out, \
+        const struct mf_engine_image *image, \
+        const struct mf_engine_recorder *recorder)
+{
+    int ret = 0;
+    struct mf_engine_trace_builder builder;
+    struct mf_engine_trace *new_trace = NULL;
+    const struct mf_engine_ins *ins;
+    const struct mf_engine_super *super;
+    size_t idx, k, capacity;
+    uint32_t pc;
+
+    *trace_out = NULL;
+
+    if ((new_trace = (struct mf_engine_trace *)malloc(sizeof(struct mf_engine_trace))) == NULL)
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    new_trace->cond = recorder->cond;
+    new_trace->body = recorder->body;
+    new_trace->anchor = recorder->anchor;
+    new_trace->depth = 0;
+    new_trace->size = 0;
+    new_trace->frames_size = 0;
+    /* A superinstruction is copied with the instructions it stands for */
+    capacity = recorder->size * MF_ENGINE_SUPER_LEN_MAX;
+    new_trace->code = (struct mf_engine_ins *)malloc(sizeof(struct mf_engine_ins) * capacity);
+    new_trace->exit_pcs = (uint32_t *)malloc(sizeof(uint32_t) * capacity);
+    new_trace->exit_frames = (uint32_t *)malloc(sizeof(uint32_t) * capacity);
+    new_trace->frames = (uint32_t *)malloc(sizeof(uint32_t) * \
+            recorder->size * (MF_ENGINE_TRACE_DEPTH_MAX + 1));
+    if ((new_trace->code == NULL) || (new_trace->exit_pcs == NULL) || \
+            (new_trace->exit_frames == NULL) || (new_trace->frames == NULL))
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    builder.trace = new_trace;
+    builder.depth = 0;
+    builder.frames_at = -1;
+    builder.profile = ((image->flags & MF_ENGINE_IMAGE_FLAG_PROFILE) != 0) ? 1 : 0;
+    mf_engine_exec(NULL, &builder.labels);
+
+    /* Starts in the body called by the test */
+    if (mf_engine_trace_push(&builder, recorder->anchor - 1) != 0) goto fail;
+
+    for (idx = 1; idx != recorder->size; idx++)
+    {
+        pc = recorder->pcs[idx];
+        ins = &image->code[pc];
+
+        if (idx == recorder->size - 1)
+        {
+            /* Back to the test with nothing left inlined */
+            if (builder.depth != 0) goto fail;
+            mf_engine_trace_emit(&builder, MF_ENGINE_OP_TRACE_LOOP, 0, pc);
+            break;
+        }
+
+        switch (ins->op)
+        {
+            case MF_ENGINE_OP_WHILE_COND:
+                if (mf_engine_trace_push(&builder, pc + 1) != 0) goto fail;
+                break;
+            case MF_ENGINE_OP_CALL:
+                if (mf_engine_trace_push(&builder, pc + 1) != 0) goto fail;
+                break;
+            case MF_ENGINE_OP_IF_CALL:
+                if (recorder->tops[idx] != 0)
+                {
+                    mf_engine_trace_emit(&builder, MF_ENGINE_OP_GUARD_TRUE, 0, pc);
+                    if (mf_engine_trace_push(&builder, pc + 1) != 0) goto fail;
+                }
+                else
+                {
+                    mf_engine_trace_emit(&builder, MF_ENGINE_OP_GUARD_FALSE, 0, pc);
+                }
+                break;
+            case MF_PROG_OP_APPLY:
+                mf_engine_trace_emit(&builder, MF_ENGINE_OP_GUARD_LAMBDA, recorder->tops[idx], pc);
+                if (mf_engine_trace_push(&builder, pc + 1) != 0) goto fail;
+                break;
+            case MF_PROG_OP_RETURN:
+                if (mf_engine_trace_pop(&builder) != 0) goto fail;
+                break;
+            case MF_ENGINE_OP_HALT:
+            case MF_PROG_OP_IF:
+            case MF_PROG_OP_WHILE:
+            case MF_ENGINE_OP_WHILE_BEGIN:
+            case MF_ENGINE_OP_WHILE_TEST:
+                goto fail;
+            default:
+                if ((super = mf_engine_super_find(ins->op)) == NULL)
+                {
+                    mf_engine_trace_emit(&builder, ins->op, ins->operand, pc);
+                }
+                else if (super->seq[super->len - 1] == MF_PROG_OP_RETURN)
+                {
+                    /* The parts before the return one by one */
+                    for (k = 0; k != super->len - 1; k++)
+                    {
+                        mf_engine_trace_emit(&builder, super->seq[k], \
+                                ins[k].operand, pc + (uint32_t)k);
+                    }
+                    if (mf_engine_trace_pop(&builder) != 0) goto fail;
+                }
+                else
+                {
+                    mf_engine_trace_emit(&builder, ins->op, ins->operand, pc);
+                    for (k = 1; k != super->len; k++)
+                    {
+                        mf_engine_trace_emit(&builder, ins[k].op, \
+                                ins[k].operand, pc + (uint32_t)k);
+                    }
+                }
+                break;
+        }
+    }
+
+    *trace_out = new_trace;
+    new_trace = NULL;
+
+    goto done;
+fail:
+done:
+    if (new_trace != NULL) mf_engine_trace_destroy(new_trace);
+    return ret;
+}
+
+static void mf_engine_trace_start(struct mf_engine *engine, \
+        uint32_t loop, uint32_t anchor, int32_t cond, int32_t body)
+{
+    struct mf_engine_recorder *recorder = engine->recorder;
+
+    recorder->active = 1;
+    recorder->loop = loop;
+    recorder->anchor = anchor;
+    recorder->cond = cond;
+    recorder->body = body;
+    recorder->size = 0;
+}
+
+/* Called before each instruction while recording, nonzero once 
+ * the recording is over */
+static int mf_engine_trace_record(struct mf_engine *engine, uint32_t pc, int32_t top)
+{
+    struct mf_engine_recorder *recorder = engine->recorder;
+    struct mf_engine_trace *trace;
+    uint32_t op = engine->image->code[pc].op;
+
+    if (recorder->size == MF_ENGINE_TRACE_LEN_MAX) goto stop;
+    recorder->pcs[recorder->size] = pc;
+    recorder->tops[recorder->size] = top;
+    recorder->size++;
+    if (recorder->size == 1) return 0;
+
+    if (pc == recorder->anchor)
+    {
+        /* Without memory the loop simply stays in the image */
+        if ((mf_engine_trace_compile(&trace, engine->image, recorder) == 0) && \
+                (trace != NULL))
+        { engine->loops[recorder->loop].trace = trace; }
+        goto stop;
+    }
+
+    switch (op)
+    {
+        case MF_ENGINE_OP_HALT:
+        case MF_PROG_OP_IF:
+        case MF_ENGINE_OP_WHILE_BEGIN:
+        case MF_ENGINE_OP_WHILE_TEST:
+            goto stop;
+        case MF_ENGINE_OP_WHILE_COND:
+            if (pc != recorder->anchor - 1) goto stop;
+            break;
+    }
+
+    return 0;
+stop:
+    recorder->active = 0;
+    return 1;
+}
+
+/* Engine */
+
+int mf_engine_init(struct mf_engine *engine, \
+        const struct mf_engine_image *image, \
+        struct mf_rt_io *io, \
+        size_t stack_size)
+{
+    int ret;
+    size_t rstack_size;
+
+    engine->image = image;
+    engine->rstack = NULL;
+    engine->loops = NULL;
+    engine->recorder = NULL;
+    if ((ret = mf_rt_init(&engine->rt, image->prog, io, stack_size)) != 0)
+    { return ret; }
+
+    /* Each level of calls holds a return address and at most one 
+     * pending loop, its condition and its body */
+    rstack_size = ((size_t)engine->rt.depth_max + 1) * 3;
+    engine->rstack = (uint32_t *)malloc(sizeof(uint32_t) * rstack_size);
+    if (engine->rstack == NULL)
+    {
+        mf_engine_uninit(engine);
+        return -MULTIPLE_ERR_MALLOC;
+    }
+    engine->rstack_end = engine->rstack + rstack_size;
+
+    if (((image->flags & MF_ENGINE_IMAGE_FLAG_TRACE) != 0) && (image->loops_count != 0))
+    {
+        engine->loops = (struct mf_engine_loop *)calloc(image->loops_count, \
+                sizeof(struct mf_engine_loop));
+        engine->recorder = (struct mf_engine_recorder *)malloc( \
+                sizeof(struct mf_engine_recorder));
+        if ((engine->loops == NULL) || (engine->recorder == NULL))
+        {
+            mf_engine_uninit(engine);
+            return -MULTIPLE_ERR_MALLOC;
+        }
+        engine->recorder->active = 0;
+    }
+
+    /* 'main' returns to the halt */
+    engine->rstack[0] = 0;
+    engine->rsp = engine->rstack + 1;
+    engine->rt.depth = 1;
+    engine->pc = image->entries[image->prog->main_idx];
+    engine->slice = 0;
+    engine->fuel = MF_ENGINE_FUEL_UNLIMITED;
+    engine->profile = NULL;
+
+    return 0;
+}
+
+int mf_engine_uninit(struct mf_engine *engine)
+{
+    size_t idx;
+
+    if (engine->rstack != NULL)
+    {
+        free(engine->rstack);
+        engine->rstack = NULL;
+    }
+    if (engine->loops != NULL)
+    {
+        for (idx = 0; idx != engine->image->loops_count; idx++)
+        {
+            if (engine->loops[idx].trace != NULL)
+            { mf_engine_trace_destroy(engine->loops[idx].trace); }
+        }
+        free(engine->loops);
+        engine->loops = NULL;
+    }
+    if (engine->recorder != NULL)
+    {
+        free(engine->recorder);
+        engine->recorder = NULL;
+    }
+    mf_rt_uninit(&engine->rt);
+
+    return 0;
+}
+
+#if MF_ENGINE_THREADED
+#define CASE(op) L_##op:
+#define NEXT() goto *ip->handler
+/* The same instruction again, without the hook */
+#define REDO() goto *labels[ip->op]
+#else
+#define CASE(op) case op:
+#define NEXT() goto dispatch
+#define REDO() goto execute
+#endif
+
+/* Ticks between two looks at the slice when running without one */
+#define MF_ENGINE_TICKS_MAX 0xffffffffU
+
+/* Ticks handed out to the next stretch of the run */
+static uint32_t mf_engine_ticks(const struct mf_engine *engine)
+{
+    uint32_t ticks = (engine->slice != 0) ? engine->slice : MF_ENGINE_TICKS_MAX;
+
+    if (engine->fuel < (uint64_t)ticks) ticks = (uint32_t)engine->fuel;
+    return ticks;
+}
+
+#define FAIL(error) do { ret = (error); goto fail; } while (0)
+/* Stop with the state kept to go on from 'ip' */
+#define YIELD(reason) do { ret = (reason); goto yield; } while (0)
+/* Counted at each call and loop iteration, before anything is done */
+#define TICK() do { if (ticks-- == 0) goto tick; } while (0)
+/* Non-blocking output is always taken, the run only stops after it */
+#define OUTPUT(expr) \
+    do { \
+        if ((status = (expr)) != 0) \
+        { \
+            if (status != MF_RT_IO_AGAIN) FAIL(MF_RT_ERR_IO); \
+            ip++; \
+            YIELD(MF_RT_WAIT_OUT); \
+        } \
+        ip++; \
+    } while (0)
+#define NEED(n) do { if (sp - stack < (n)) FAIL(MF_RT_ERR_UNDERFLOW); } while (0)
+#define ROOM(n) do { if (stack_end - sp < (n)) FAIL(MF_RT_ERR_OVERFLOW); } while (0)
+#define TOP(n) (sp[-1 - (n)])
+
+#define CALL(lambda, ret_pc) \
+    do { \
+        callee = (uint32_t)(lambda); \
+        if (callee >= lambdas_count) FAIL(MF_RT_ERR_LAMBDA); \
+        if (rt->depth == rt->depth_max) FAIL(MF_RT_ERR_DEPTH); \
+        rt->depth++; \
+        *rsp++ = (uint32_t)(ret_pc); \
+        ip = code + entries[callee]; \
+    } while (0)
+
+/* Back into the image at the instruction a trace leaves from, with 
+ * the calls inlined up to there made real */
+#define TRACE_LEAVE() \
+    do { \
+        idx = (size_t)(ip - trace->code); \
+        frames = trace->frames + trace->exit_frames[idx]; \
+        for (n = 1; n <= frames[0]; n++) *rsp++ = frames[n]; \
+        rt->depth += frames[0]; \
+        ip = code + trace->exit_pcs[idx]; \
+        trace = NULL; \
+    } while (0)
+
+#define HOOK() \
+    do { \
+        if (profiling) mf_engine_profile_record(engine->profile, ip); \
+        if ((recorder != NULL) && (recorder->active != 0) && \
+                (mf_engine_trace_record(engine, (uint32_t)(ip - code), \
+                                        (sp > stack) ? TOP(0) : 0) != 0)) \
+        { \
+            ip = image->code + (ip - code); \
+            code = image->code; \
+            HOOKED(profiling); \
+        } \
+    } while (0)
+
+#define BINARY(expr) \
+    do { \
+        NEED(2); \
+        b = TOP(0); \
+        a = TOP(1); \
+        sp--; \
+        TOP(0) = (expr); \
+        ip++; \
+    } while (0)
+
+/* A push of the operand followed by a binary operation */
+#define BINARY_K(expr, len) \
+    do { \
+        NEED(1); \
+        ROOM(1); \
+        a = TOP(0); \
+        b = ip->operand; \
+        TOP(0) = (expr); \
+        ip += (len); \
+    } while (0)
+
+/* Interpret from 'engine->pc', or only hand out the labels of the 
+ * handlers when 'labels_out' is given */
+static int mf_engine_exec(struct mf_engine *engine, const void *const **labels_out)
+{
+#if MF_ENGINE_THREADED
+#define LABEL(op) [op] = &&L_##op
+    /* One more for the hook of the profiler and the recorder */
+    static const void *const labels[MF_ENGINE_OP_COUNT + 1] =
+    {
+        LABEL(MF_PROG_OP_PUSH),
+        LABEL(MF_PROG_OP_LAMBDA),
+        LABEL(MF_PROG_OP_PRINT_STR),
+        LABEL(MF_PROG_OP_ADD),
+        LABEL(MF_PROG_OP_SUB),
+        LABEL(MF_PROG_OP_MUL),
+        LABEL(MF_PROG_OP_DIV),
+        LABEL(MF_PROG_OP_NEG),
+        LABEL(MF_PROG_OP_EQ),
+        LABEL(MF_PROG_OP_G),
+        LABEL(MF_PROG_OP_L),
+        LABEL(MF_PROG_OP_AND),
+        LABEL(MF_PROG_OP_OR),
+        LABEL(MF_PROG_OP_NOT),
+        LABEL(MF_PROG_OP_DUP),
+        LABEL(MF_PROG_OP_DROP),
+        LABEL(MF_PROG_OP_SWAP),
+        LABEL(MF_PROG_OP_ROT),
+        LABEL(MF_PROG_OP_COPY),
+        LABEL(MF_PROG_OP_PICK),
+        LABEL(MF_PROG_OP_LOAD),
+        LABEL(MF_PROG_OP_STORE),
+        LABEL(MF_PROG_OP_APPLY),
+        LABEL(MF_PROG_OP_IF),
+        LABEL(MF_PROG_OP_WHILE),
+        LABEL(MF_PROG_OP_PRINT_INT),
+        LABEL(MF_PROG_OP_PRINT_CHAR),
+        LABEL(MF_PROG_OP_READ_CHAR),
+        LABEL(MF_PROG_OP_FLUSH),
+        LABEL(MF_PROG_OP_RETURN),
+        LABEL(MF_ENGINE_OP_HALT),
+        LABEL(MF_ENGINE_OP_CALL),
+        LABEL(MF_ENGINE_OP_IF_CALL),
+        LABEL(MF_ENGINE_OP_WHILE_BEGIN),
+        LABEL(MF_ENGINE_OP_WHILE_COND),
+        LABEL(MF_ENGINE_OP_WHILE_TEST),
+        LABEL(MF_ENGINE_OP_GUARD_TRUE),
+        LABEL(MF_ENGINE_OP_GUARD_FALSE),
+        LABEL(MF_ENGINE_OP_GUARD_LAMBDA),
+        LABEL(MF_ENGINE_OP_TRACE_LOOP),
+        LABEL(MF_ENGINE_OP_PUSH_ADD),
+        LABEL(MF_ENGINE_OP_PUSH_SUB),
+        LABEL(MF_ENGINE_OP_PUSH_MUL),
+        LABEL(MF_ENGINE_OP_PUSH_DIV),
+        LABEL(MF_ENGINE_OP_PUSH_EQ),
+        LABEL(MF_ENGINE_OP_PUSH_G),
+        LABEL(MF_ENGINE_OP_PUSH_L),
+        LABEL(MF_ENGINE_OP_PUSH_NEG),
+        LABEL(MF_ENGINE_OP_EQ_NOT),
+        LABEL(MF_ENGINE_OP_G_NOT),
+        LABEL(MF_ENGINE_OP_L_NOT),
+        LABEL(MF_ENGINE_OP_PUSH_EQ_NOT),
+        LABEL(MF_ENGINE_OP_PUSH_G_NOT),
+        LABEL(MF_ENGINE_OP_PUSH_L_NOT),
+        LABEL(MF_ENGINE_OP_LOAD_PUSH),
+        LABEL(MF_ENGINE_OP_LOAD_LOAD),
+        LABEL(MF_ENGINE_OP_DUP_PUSH),
+        LABEL(MF_ENGINE_OP_LOAD_PUSH_ADD_STORE),
+        LABEL(MF_ENGINE_OP_STORE_RETURN),
+        LABEL(MF_ENGINE_OP_NOT_RETURN),
+        [MF_ENGINE_OP_COUNT] = &&L_HOOK,
+    };
+#undef LABEL
+#endif
+    int ret = MF_RT_OK;
+    struct mf_rt *rt;
+    const struct mf_engine_image *image;
+    const struct mf_engine_ins *code, *ip;
+    const uint32_t *entries;
+    uint32_t lambdas_count;
+    const struct mf_prog_str *str;
+    int32_t *stack, *stack_end, *sp;
+    uint32_t *rsp;
+    uint32_t callee;
+    int32_t a, b;
+    int profiling;
+    struct mf_engine_recorder *recorder;
+    struct mf_engine_loop *loop;
+    const struct mf_engine_trace *trace = NULL;
+    const uint32_t *frames;
+    size_t idx;
+    uint32_t n;
+    uint32_t ticks, chunk;
+    int status;
+#if MF_ENGINE_THREADED
+    /* The handlers of the copy already go by the hook */
+#define HOOKED(on) do { } while (0)
+#else
+    int hooked;
+#define HOOKED(on) do { hooked = (on); } while (0)
+#endif
+
+    if (labels_out != NULL)
+    {
+#if MF_ENGINE_THREADED
+        *labels_out = labels;
+#else
+        *labels_out = NULL;
+#endif
+        return 0;
+    }
+
+    rt = &engine->rt;
+    image = engine->image;
+    code = image->code;
+    entries = image->entries;
+    lambdas_count = (uint32_t)image->lambdas_count;
+    stack = rt->stack;
+    stack_end = rt->stack_end;
+    sp = rt->sp;
+    rsp = engine->rsp;
+    recorder = engine->recorder;
+    profiling = (((image->flags & MF_ENGINE_IMAGE_FLAG_PROFILE) != 0) && \
+            (engine->profile != NULL)) ? 1 : 0;
+    HOOKED(profiling);
+    if ((recorder != NULL) && (recorder->active != 0))
+    {
+        if (image->code_hook != NULL) code = image->code_hook;
+        HOOKED(1);
+    }
+    ip = code + engine->pc;
+    ticks = chunk = mf_engine_ticks(engine);
+
+#if MF_ENGINE_THREADED
+    NEXT();
+
+L_HOOK:
+    HOOK();
+    goto *labels[ip->op];
+#else
+dispatch:
+    if (hooked) HOOK();
+execute:
+    switch (ip->op)
+    {
+#endif
+
+        CASE(MF_PROG_OP_PUSH)
+        CASE(MF_PROG_OP_LAMBDA)
+            ROOM(1);
+            *sp++ = ip->operand;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_PRINT_STR)
+            str = &rt->prog->strs[ip->operand];
+            OUTPUT(mf_rt_io_write(rt->io, str->str, str->len));
+            NEXT();
+
+        CASE(MF_PROG_OP_ADD)
+            BINARY((int32_t)((uint32_t)a + (uint32_t)b));
+            NEXT();
+        CASE(MF_PROG_OP_SUB)
+            BINARY((int32_t)((uint32_t)a - (uint32_t)b));
+            NEXT();
+        CASE(MF_PROG_OP_MUL)
+            BINARY((int32_t)((uint32_t)a * (uint32_t)b));
+            NEXT();
+        CASE(MF_PROG_OP_DIV)
+            NEED(2);
+            if (TOP(0) == 0) FAIL(MF_RT_ERR_DIV_ZERO);
+            BINARY((b == -1) ? (int32_t)(0U - (uint32_t)a) : a / b);
+            NEXT();
+        CASE(MF_PROG_OP_EQ)
+            BINARY((a == b) ? -1 : 0);
+            NEXT();
+        CASE(MF_PROG_OP_G)
+            BINARY((a > b) ? -1 : 0);
+            NEXT();
+        CASE(MF_PROG_OP_L)
+            BINARY((a < b) ? -1 : 0);
+            NEXT();
+        CASE(MF_PROG_OP_AND)
+            BINARY(((a != 0) && (b != 0)) ? -1 : 0);
+            NEXT();
+        CASE(MF_PROG_OP_OR)
+            BINARY(((a != 0) || (b != 0)) ? -1 : 0);
+            NEXT();
+        CASE(MF_PROG_OP_NEG)
+            NEED(1);
+            TOP(0) = (int32_t)(0U - (uint32_t)TOP(0));
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_NOT)
+            NEED(1);
+            TOP(0) = (TOP(0) == 0) ? -1 : 0;
+            ip++;
+            NEXT();
+
+        CASE(MF_PROG_OP_DUP)
+            NEED(1);
+            ROOM(1);
+            sp[0] = TOP(0);
+            sp++;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_DROP)
+            NEED(1);
+            sp--;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_SWAP)
+            NEED(2);
+            a = TOP(0);
+            TOP(0) = TOP(1);
+            TOP(1) = a;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_ROT)
+            NEED(3);
+            a = TOP(2);
+            TOP(2) = TOP(1);
+            TOP(1) = TOP(0);
+            TOP(0) = a;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_COPY)
+            NEED(ip->operand + 1);
+            ROOM(1);
+            sp[0] = TOP(ip->operand);
+            sp++;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_PICK)
+            NEED(1);
+            a = TOP(0);
+            if ((a < 0) || (a >= sp - stack - 1)) FAIL(MF_RT_ERR_PICK);
+            TOP(0) = TOP(a + 1);
+            ip++;
+            NEXT();
+
+        CASE(MF_PROG_OP_LOAD)
+            ROOM(1);
+            *sp++ = rt->vars[ip->operand];
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_STORE)
+            NEED(1);
+            rt->vars[ip->operand] = *--sp;
+            ip++;
+            NEXT();
+
+        CASE(MF_PROG_OP_APPLY)
+            TICK();
+            NEED(1);
+            a = *--sp;
+            CALL(a, ip + 1 - code);
+            NEXT();
+        CASE(MF_PROG_OP_IF)
+            TICK();
+            NEED(2);
+            b = *--sp;
+            a = *--sp;
+            if (a != 0) { CALL(b, ip + 1 - code); } else { ip++; }
+            NEXT();
+        CASE(MF_PROG_OP_WHILE)
+            /* Always split up when the image is built */
+            FAIL(MF_RT_ERR_LAMBDA);
+
+        CASE(MF_PROG_OP_PRINT_INT)
+            NEED(1);
+            OUTPUT(mf_rt_io_print_int(rt->io, *--sp));
+            NEXT();
+        CASE(MF_PROG_OP_PRINT_CHAR)
+            NEED(1);
+            a = *--sp;
+            OUTPUT(mf_rt_io_putchar(rt->io, a));
+            NEXT();
+        CASE(MF_PROG_OP_READ_CHAR)
+            ROOM(1);
+            if ((a = (int32_t)mf_rt_io_getchar(rt->io)) == MF_RT_IO_AGAIN)
+            { YIELD(MF_RT_WAIT_IN); }
+            *sp++ = a;
+            ip++;
+            NEXT();
+        CASE(MF_PROG_OP_FLUSH)
+            OUTPUT(mf_rt_io_flush(rt->io));
+            NEXT();
+
+        CASE(MF_PROG_OP_RETURN)
+            rt->depth--;
+            ip = code + *--rsp;
+            NEXT();
+
+        CASE(MF_ENGINE_OP_HALT)
+            goto done;
+        CASE(MF_ENGINE_OP_CALL)
+            TICK();
+            if (rt->depth == rt->depth_max) FAIL(MF_RT_ERR_DEPTH);
+            rt->depth++;
+            *rsp++ = (uint32_t)(ip + 1 - code);
+            ip = code + ip->operand;
+            NEXT();
+        CASE(MF_ENGINE_OP_IF_CALL)
+            TICK();
+            NEED(1);
+            if (*--sp == 0) { ip++; NEXT(); }
+            if (rt->depth == rt->depth_max) FAIL(MF_RT_ERR_DEPTH);
+            rt->depth++;
+            *rsp++ = (uint32_t)(ip + 1 - code);
+            ip = code + ip->operand;
+            NEXT();
+        CASE(MF_ENGINE_OP_WHILE_BEGIN)
+            NEED(2);
+            rsp[1] = (uint32_t)*--sp;
+            rsp[0] = (uint32_t)*--sp;
+            rsp += 2;
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_WHILE_COND)
+            /* Every iteration goes by here */
+            TICK();
+            CALL(rsp[-2], ip + 1 - code);
+            NEXT();
+        CASE(MF_ENGINE_OP_WHILE_TEST)
+            NEED(1);
+            if (*--sp == 0)
+            {
+                rsp -= 2;
+                ip++;
+                NEXT();
+            }
+            if (engine->loops != NULL)
+            {
+                loop = &engine->loops[ip->operand];
+                if (loop->trace != NULL)
+                {
+                    /* The lambdas may have changed since recorded */
+                    if ((loop->trace->cond == (int32_t)rsp[-2]) && \
+                            (loop->trace->body == (int32_t)rsp[-1]) && \
+                            (rt->depth + loop->trace->depth <= rt->depth_max))
+                    {
+                        trace = loop->trace;
+                        ip = trace->code;
+                        NEXT();
+                    }
+                }
+                else if ((loop->count != MF_ENGINE_TRACE_HOT) && \
+                        (++loop->count == MF_ENGINE_TRACE_HOT) && \
+                        (recorder->active == 0))
+                {
+                    /* Once more through the hook, recorded this time */
+                    mf_engine_trace_start(engine, (uint32_t)ip->operand, \
+                            (uint32_t)(ip - code), (int32_t)rsp[-2], (int32_t)rsp[-1]);
+                    sp++;
+                    if (image->code_hook != NULL) code = image->code_hook;
+                    ip = code + recorder->anchor;
+                    HOOKED(1);
+                    NEXT();
+                }
+            }
+            CALL(rsp[-1], ip - 1 - code);
+            NEXT();
+
+        CASE(MF_ENGINE_OP_GUARD_TRUE)
+            if ((sp == stack) || (TOP(0) == 0)) goto trace_exit;
+            sp--;
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_GUARD_FALSE)
+            if ((sp == stack) || (TOP(0) != 0)) goto trace_exit;
+            sp--;
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_GUARD_LAMBDA)
+            if ((sp == stack) || (TOP(0) != ip->operand)) goto trace_exit;
+            sp--;
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_TRACE_LOOP)
+            /* Leaving here goes back to the test of the loop */
+            TICK();
+            NEED(1);
+            if (*--sp == 0)
+            {
+                rsp -= 2;
+                ip = code + trace->anchor + 1;
+                trace = NULL;
+                NEXT();
+            }
+            ip = trace->code;
+            NEXT();
+
+        /* Superinstructions, the operand of the push is the one of
+         * the first instruction */
+        CASE(MF_ENGINE_OP_PUSH_ADD)
+            BINARY_K((int32_t)((uint32_t)a + (uint32_t)b), 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_SUB)
+            BINARY_K((int32_t)((uint32_t)a - (uint32_t)b), 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_MUL)
+            BINARY_K((int32_t)((uint32_t)a * (uint32_t)b), 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_DIV)
+            NEED(1);
+            if (ip->operand == 0) FAIL(MF_RT_ERR_DIV_ZERO);
+            BINARY_K((b == -1) ? (int32_t)(0U - (uint32_t)a) : a / b, 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_EQ)
+            BINARY_K((a == b) ? -1 : 0, 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_G)
+            BINARY_K((a > b) ? -1 : 0, 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_L)
+            BINARY_K((a < b) ? -1 : 0, 2);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_NEG)
+            ROOM(1);
+            *sp++ = (int32_t)(0U - (uint32_t)ip->operand);
+            ip += 2;
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_EQ_NOT)
+            BINARY_K((a != b) ? -1 : 0, 3);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_G_NOT)
+            BINARY_K((a <= b) ? -1 : 0, 3);
+            NEXT();
+        CASE(MF_ENGINE_OP_PUSH_L_NOT)
+            BINARY_K((a >= b) ? -1 : 0, 3);
+            NEXT();
+        CASE(MF_ENGINE_OP_EQ_NOT)
+            BINARY((a != b) ? -1 : 0);
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_G_NOT)
+            BINARY((a <= b) ? -1 : 0);
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_L_NOT)
+            BINARY((a >= b) ? -1 : 0);
+            ip++;
+            NEXT();
+        CASE(MF_ENGINE_OP_LOAD_PUSH)
+            ROOM(2);
+            sp[0] = rt->vars[ip[0].operand];
+            sp[1] = ip[1].operand;
+            sp += 2;
+            ip += 2;
+            NEXT();
+        CASE(MF_ENGINE_OP_LOAD_LOAD)
+            ROOM(2);
+            sp[0] = rt->vars[ip[0].operand];
+            sp[1] = rt->vars[ip[1].operand];
+            sp += 2;
+            ip += 2;
+            NEXT();
+        CASE(MF_ENGINE_OP_DUP_PUSH)
+            NEED(1);
+            ROOM(2);
+            sp[0] = TOP(0);
+            sp[1] = ip[1].operand;
+            sp += 2;
+            ip += 2;
+            NEXT();
+        CASE(MF_ENGINE_OP_LOAD_PUSH_ADD_STORE)
+            ROOM(2);
+            rt->vars[ip[3].operand] = (int32_t)((uint32_t)rt->vars[ip[0].operand] + \
+                    (uint32_t)ip[1].operand);
+            ip += 4;
+            NEXT();
+        CASE(MF_ENGINE_OP_STORE_RETURN)
+            NEED(1);
+            rt->vars[ip->operand] = *--sp;
+            rt->depth--;
+            ip = code + *--rsp;
+            NEXT();
+        CASE(MF_ENGINE_OP_NOT_RETURN)
+            NEED(1);
+            TOP(0) = (TOP(0) == 0) ? -1 : 0;
+            rt->depth--;
+            ip = code + *--rsp;
+            NEXT();
+
+#if !MF_ENGINE_THREADED
+        default:
+            FAIL(MF_RT_ERR_LAMBDA);
+    }
+#endif
+
+trace_exit:
+    TRACE_LEAVE();
+    NEXT();
+
+tick:
+    /* The ticks handed out are used up */
+    ticks = 0;
+    if (engine->fuel != MF_ENGINE_FUEL_UNLIMITED)
+    {
+        engine->fuel -= chunk;
+        chunk = 0;
+        if (engine->fuel == 0) YIELD(MF_RT_FUEL);
+    }
+    if (engine->slice != 0) YIELD(MF_RT_YIELD);
+    ticks = chunk = mf_engine_ticks(engine);
+    REDO();
+yield:
+    /* A recording would see the instruction twice */
+    if (recorder != NULL) recorder->active = 0;
+fail:
+    /* The error is reported where the image would have stopped, 
+     * and a paused run goes on from there */
+    if (trace != NULL) TRACE_LEAVE();
+done:
+    /* Everything needed to go on is back in the engine */
+    if (engine->fuel != MF_ENGINE_FUEL_UNLIMITED) engine->fuel -= chunk - ticks;
+    rt->sp = sp;
+    engine->rsp = rsp;
+    engine->pc = (uint32_t)(ip - code);
+    return ret;
+}
+
+#undef CASE
+#undef NEXT
+#undef REDO
+#undef FAIL
+#undef YIELD
+#undef TICK
+#undef OUTPUT
+#undef NEED
+#undef ROOM
+#undef TOP
+#undef CALL
+#undef BINARY
+#undef BINARY_K
+#undef TRACE_LEAVE
+#undef HOOK
+#undef HOOKED
+
+int mf_engine_run(struct mf_engine *engine)
+{
+    int ret;
+    int status;
+
+    ret = mf_engine_exec(engine, NULL);
+    if (MF_RT_IS_PAUSED(ret)) return ret;
+    /* What non-blocking output is left stays in the buffer */
+    status = mf_rt_io_flush(engine->rt.io);
+    if ((status != 0) && (status != MF_RT_IO_AGAIN) && (ret == MF_RT_OK)) ret = MF_RT_ERR_IO;
+
+    return ret;
+}
+
@@ -0,0 +1,144 @@
+/* Multiple False Programming Language : Execution Engine
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ENGINE_H_
+#define _MF_ENGINE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_rt.h"
+
+/* Direct threading needs the labels as values extension */
+#if defined(__GNUC__) && !defined(MF_ENGINE_NO_THREADING)
+#define MF_ENGINE_THREADED 1
+#else
+#define MF_ENGINE_THREADED 0
+#endif
+
+struct mf_engine_ins
+{
+    /* Address of the handler when threaded */
+    const void *handler;
+    uint32_t op;
+    int32_t operand;
+};
+
+/* Options of 'mf_engine_image_new' */
+/* Count the sequences of instructions executed, see 'mf_engine_profile' */
+#define MF_ENGINE_IMAGE_FLAG_PROFILE 1
+/* Keep every instruction on its own, profiling with it finds the 
+ * sequences worth a superinstruction */
+#define MF_ENGINE_IMAGE_FLAG_NO_SUPER 2
+/* Record the hot loops and run them as traces, see 'mf_engine_trace' */
+#define MF_ENGINE_IMAGE_FLAG_TRACE 4
+
+/* Code of all the lambdas laid out in one array, read only once 
+ * built and never tied to a single run */
+struct mf_engine_image
+{
+    const struct mf_prog *prog;
+    int flags;
+
+    struct mf_engine_ins *code;
+    size_t size;
+
+    /* Position of each lambda in 'code' */
+    uint32_t *entries;
+    size_t lambdas_count;
+
+    /* Number of '#', each has an id in its instructions */
+    size_t loops_count;
+    /* Same as 'code' with every handler going by the recorder of 
+     * traces first, only when threaded and tracing */
+    struct mf_engine_ins *code_hook;
+};
+
+int mf_engine_image_new(struct mf_engine_image **image_out, \
+        const struct mf_prog *prog, int flags);
+int mf_engine_image_destroy(struct mf_engine_image *image);
+
+/* Occurrences of every sequence of up to three instructions which 
+ * ran one right after the other, the candidates of superinstructions */
+struct mf_engine_profile;
+
+int mf_engine_profile_new(struct mf_engine_profile **profile_out);
+int mf_engine_profile_destroy(struct mf_engine_profile *profile);
+/* Print the 'top' most frequent sequences of each length */
+int mf_engine_profile_report(FILE *fp, \
+        const struct mf_engine_profile *profile, size_t top);
+
+/* A loop which got hot is recorded through one iteration, the 
+ * instructions executed in its condition and body become a straight 
+ * trace with the calls inlined, guarded where the path taken may 
+ * differ, and the next iterations run the trace until a guard fails */
+struct mf_engine_trace;
+struct mf_engine_loop;
+struct mf_engine_recorder;
+
+#define MF_ENGINE_FUEL_UNLIMITED UINT64_MAX
+
+/* A run of an image. Calls never recurse on the C stack, the return 
+ * addresses and the lambdas of pending loops are on 'rstack', so 
+ * the whole state is in this structure */
+struct mf_engine
+{
+    const struct mf_engine_image *image;
+
+    /* Operand stack, variables and i/o */
+    struct mf_rt rt;
+
+    uint32_t *rstack;
+    uint32_t *rsp;
+    uint32_t *rstack_end;
+
+    /* Next instruction */
+    uint32_t pc;
+
+    /* Calls and loop iterations run before yielding, 0 to go on 
+     * until the end */
+    uint32_t slice;
+    /* Calls and loop iterations left before MF_RT_FUEL, given more 
+     * the run goes on from there */
+    uint64_t fuel;
+
+    /* Filled while running an image built for profiling */
+    struct mf_engine_profile *profile;
+
+    /* One for each loop of the image, when tracing */
+    struct mf_engine_loop *loops;
+    struct mf_engine_recorder *recorder;
+};
+
+int mf_engine_init(struct mf_engine *engine, \
+        const struct mf_engine_image *image, \
+        struct mf_rt_io *io, \
+        size_t stack_size);
+int mf_engine_uninit(struct mf_engine *engine);
+
+/* Run until 'main' returns, returns one of MF_RT_ERR_*, or one of 
+ * MF_RT_YIELD, MF_RT_WAIT_IN and MF_RT_WAIT_OUT with a slice or 
+ * non-blocking i/o, MF_RT_FUEL with a budget of fuel, and running 
+ * again goes on from there */
+int mf_engine_run(struct mf_engine *engine);
+
+#endif
+
@@ -19,6 +19,7 @@
 
 #include "selfcheck.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +38,14 @@
 #include "mf_lexer.h"
 #include "mf_icg_fcb.h"
 #include "mf_icg_context.h"
+#include "mf_icg_literal.h"
+#include "mf_icg_stack.h"
+#include "mf_icg_opt.h"
+#include "mf_icg_peval.h"
+#include "mf_icg_ssa.h"
+#include "mf_icg_par.h"
+#include "mf_prog.h"
+#include "mf_aot.h"
 #include "mf_icg.h"
 
 /* Declarations */
@@ -45,6 +54,24 @@ static int mf_icodegen_generic(struct multiple_error *err, \
         struct mf_icg_fcb_block *icg_fcb_block, \
         struct token **token_cur_in_out);
 
+/* Stack shuffles, each one is lowered into a fixed-depth sequence 
+ * without going through the assembler. The host VM has no opcodes 
+ * for SWAP, ROT or OVER, so each is a 'PUSH' of the depth and one 
+ * operation; 'mf_prog' turns the same tokens into single operations 
+ * for the engines of false-run */
+enum
+{
+    MF_ICG_SHUFFLE_SWAP = 0, /* a b -> b a */
+    MF_ICG_SHUFFLE_ROT,      /* a b c -> b c a */
+    MF_ICG_SHUFFLE_COPY,     /* copy the element at the given depth, 
+                                0 for DUP, 1 for OVER */
+};
+
+static int mf_icodegen_shuffle(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        int shuffle, uint32_t depth);
+
 static int mf_icg_fcb_block_append_from_precompiled_pic_text( \
         struct mf_icg_fcb_block *icg_fcb_block, \
         struct multiply_text_precompiled *icg_text_precompiled)
@@ -66,78 +93,110 @@ fail:
     return ret;
 }
 
-static int mf_icodegen_constant(struct multiple_error *err, \
+/* Literals printed right away, they are written with a single 
+ * precomputed string instead of one operation for each */
+#define IS_TOKEN_LITERAL_OUTPUT(x) \
+    MF_ICG_IS_LITERAL_OUTPUT(x)
+static int mf_icodegen_literal_output(struct multiple_error *err, \
         struct mf_icg_context *context, \
         struct mf_icg_fcb_block *icg_fcb_block, \
         struct token **token_cur_in_out)
 {
     int ret = 0;
-    struct token *token_cur = *token_cur_in_out;
-    char *buffer_str = NULL;
-    size_t buffer_str_len;
+    struct mf_icg_literal_output output;
     uint32_t id;
-    int value_int;
 
-    switch (token_cur->value)
+    mf_icg_literal_output_init(&output);
+
+    if ((ret = mf_icg_literal_output_scan(err, &output, *token_cur_in_out)) != 0)
+    { goto fail; }
+
+    if (output.putchar != 0)
     {
-        case TOKEN_CONSTANT_STRING:
-            /* String */
-            buffer_str_len = token_cur->len;
-            buffer_str = (char *)malloc(sizeof(char) * (buffer_str_len + 1));
-            if (buffer_str == NULL)
-            {
-                MULTIPLE_ERROR_MALLOC();
-                ret = -MULTIPLE_ERR_MALLOC;
-                goto fail; 
-            }
-            memcpy(buffer_str, token_cur->str, token_cur->len);
-            buffer_str[buffer_str_len] = '\0';
-            multiply_replace_escape_chars(buffer_str, &buffer_str_len);
-
-            if ((ret = multiply_resource_get_str( \
-                            err, \
-                            context->icode, \
-                            context->res_id, \
-                            &id, \
-                            buffer_str, \
-                            buffer_str_len)) != 0)
-            { goto fail; }
-            if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0) 
-            { goto fail; }
-            if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PRINT, 0)) != 0) 
-            { goto fail; }
+        if ((ret = mf_icg_context_res_int(err, \
+                        context, \
+                        &id, \
+                        output.putchar_value)) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0) 
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, \
+                        OP_FASTLIB, OP_FASTLIB_PUTCHAR)) != 0)
+        { goto fail; }
+    }
+    else if (output.len != 0)
+    {
+        if ((ret = mf_icg_context_res_str(err, \
+                        context, \
+                        &id, \
+                        output.str, \
+                        output.len)) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0) 
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PRINT, 0)) != 0) 
+        { goto fail; }
+    }
 
-            free(buffer_str);
-            buffer_str = NULL;
-            break;
+    *token_cur_in_out = output.token_last;
 
-        default:
-            if (multiply_convert_str_to_int(&value_int, \
-                        token_cur->str, 
-                        token_cur->len) != 0)
-            {
-                multiple_error_update(err, -MULTIPLE_ERR_ICODEGEN, \
-                        "\'%s\' is an invalid integer", \
-                        token_cur->str);
-                ret = -MULTIPLE_ERR_ICODEGEN; 
-                goto fail; 
-            }
+    goto done;
+fail:
+done:
+    mf_icg_literal_output_uninit(&output);
+    return ret;
+}
 
-            if ((ret = multiply_resource_get_int( \
-                            err, \
-                            context->icode, \
-                            context->res_id, \
-                            &id, \
-                            value_int)) != 0)
-            { goto fail; }
-            if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0) { goto fail; }
+#define IS_TOKEN_LITERAL(x) \
+    (((x)==TOKEN_CHAR)||(IS_TOKEN_CONSTANT(x)))
+static int mf_icodegen_constant(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct token **token_cur_in_out)
+{
+    int ret = 0;
+    struct token *token_cur = *token_cur_in_out;
+    uint32_t id;
+    int value_int;
 
-            break;
+    if ((ret = mf_icg_literal_value(err, token_cur, &value_int)) != 0)
+    { goto fail; }
+
+    /* 'Nø' with literal index copies at a fixed depth */
+    if ((token_cur->value != TOKEN_CHAR) && \
+            (value_int >= 0) && \
+            (token_cur->next != NULL) && \
+            (token_cur->next->value == TOKEN_OP_PICK))
+    {
+        /* 'PICKCP' takes the index plus one as an 'int' */
+        if (value_int > INT_MAX - 1)
+        {
+            multiple_error_update(err, -MULTIPLE_ERR_ICODEGEN, \
+                    "%d:%d: error: pick index %d is too large", \
+                    token_cur->pos_ln, token_cur->pos_col, value_int);
+            ret = -MULTIPLE_ERR_ICODEGEN;
+            goto fail;
+        }
+        if ((ret = mf_icodegen_shuffle(err, \
+                        context, \
+                        icg_fcb_block, \
+                        MF_ICG_SHUFFLE_COPY, \
+                        (uint32_t)value_int)) != 0)
+        { goto fail; }
+        /* Skip "ø" */
+        token_cur = token_cur->next;
+        goto done;
     }
 
+    if ((ret = mf_icg_context_res_int(err, \
+                    context, \
+                    &id, \
+                    value_int)) != 0)
+    { goto fail; }
+    if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0) { goto fail; }
+
     goto done;
 fail:
-    if (buffer_str != NULL) free(buffer_str);
 done:
     *token_cur_in_out = token_cur;
     return ret;
@@ -235,6 +294,23 @@ done:
     return ret;
 }
 
+/* Output of the host VM is flushed by the host itself, so the
+ * flush is only a mark for the runtimes working on the blocks */
+#define IS_TOKEN_FLUSH(x) \
+    ((x)==TOKEN_OP_FLUSH)
+static int mf_icodegen_flush(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct token *token_cur)
+{
+    (void)err;
+    (void)context;
+    (void)token_cur;
+
+    return mf_icg_fcb_block_append_with_configure_type(icg_fcb_block, \
+            0, 0, MF_ICG_FCB_LINE_TYPE_PSEUDO);
+}
+
 #define IS_TOKEN_CMP(x) \
     (((x)==TOKEN_OP_EQ)|| \
      ((x)==TOKEN_OP_L)|| \
@@ -427,41 +503,69 @@ done:
 }
 
 
-#define IS_TOKEN_SWAP(x) \
-    ((x)==TOKEN_OP_SWAP)
-static int mf_icodegen_swap(struct multiple_error *err, \
+static int mf_icodegen_shuffle(struct multiple_error *err, \
         struct mf_icg_context *context, \
         struct mf_icg_fcb_block *icg_fcb_block, \
-        struct token *token_cur)
+        int shuffle, uint32_t depth)
 {
     int ret = 0;
-    struct multiply_text_precompiled *new_text_precompiled = NULL;
-
-    (void)token_cur;
+    uint32_t id;
+    uint32_t depth_operand = 0, op = 0;
 
-    if ((ret = multiply_asm_precompile(err, \
-                    context->icode, \
-                    context->res_id, \
-                    &new_text_precompiled, \
+    switch (shuffle)
+    {
+        case MF_ICG_SHUFFLE_SWAP:
+            depth_operand = 2; op = OP_REVERSE;
+            break;
+        case MF_ICG_SHUFFLE_ROT:
+            depth_operand = 3; op = OP_PICK;
+            break;
+        case MF_ICG_SHUFFLE_COPY:
+            if (depth == 0)
+            {
+                /* DUP */
+                if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_DUP, 0)) != 0)
+                { goto fail; }
+                goto done;
+            }
+            /* OVER and deeper copies, 'PICKCP' counts from 1 */
+            depth_operand = depth + 1; op = OP_PICKCP;
+            break;
+        default:
+            MULTIPLE_ERROR_INTERNAL();
+            ret = -MULTIPLE_ERR_INTERNAL;
+            goto fail;
+    }
 
-                    MULTIPLY_ASM_OP_INT , OP_PUSH    , 2          , 
-                    MULTIPLY_ASM_OP     , OP_REVERSE , 
-                    MULTIPLY_ASM_FINISH)) != 0)
+    if ((ret = mf_icg_context_res_int(err, \
+                    context, \
+                    &id, \
+                    (int)depth_operand)) != 0)
     { goto fail; }
-
-    if ((ret = mf_icg_fcb_block_append_from_precompiled_pic_text( \
-                    icg_fcb_block, \
-                    new_text_precompiled)) != 0)
+    if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0)
+    { goto fail; }
+    if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, op, 0)) != 0)
     { goto fail; }
 
     goto done;
 fail:
 done:
-    if (new_text_precompiled != NULL)
-    { multiply_text_precompiled_destroy(new_text_precompiled); }
     return ret;
 }
 
+#define IS_TOKEN_SWAP(x) \
+    ((x)==TOKEN_OP_SWAP)
+static int mf_icodegen_swap(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct token *token_cur)
+{
+    (void)token_cur;
+
+    return mf_icodegen_shuffle(err, context, icg_fcb_block, \
+            MF_ICG_SHUFFLE_SWAP, 0);
+}
+
 #define IS_TOKEN_ROTATE3(x) \
     ((x)==TOKEN_OP_ROTATE3)
 static int mf_icodegen_rotate3(struct multiple_error *err, \
@@ -469,34 +573,14 @@ static int mf_icodegen_rotate3(struct multiple_error *err, \
         struct mf_icg_fcb_block *icg_fcb_block, \
         struct token *token_cur)
 {
-    int ret = 0;
-    struct multiply_text_precompiled *new_text_precompiled = NULL;
-
     (void)token_cur;
 
-    if ((ret = multiply_asm_precompile(err, \
-                    context->icode, \
-                    context->res_id, \
-                    &new_text_precompiled, \
-
-                    MULTIPLY_ASM_OP_INT , OP_PUSH    , 3          , 
-                    MULTIPLY_ASM_OP     , OP_PICK    , 
-                    MULTIPLY_ASM_FINISH)) != 0)
-    { goto fail; }
-
-    if ((ret = mf_icg_fcb_block_append_from_precompiled_pic_text( \
-                    icg_fcb_block, \
-                    new_text_precompiled)) != 0)
-    { goto fail; }
-
-    goto done;
-fail:
-done:
-    if (new_text_precompiled != NULL)
-    { multiply_text_precompiled_destroy(new_text_precompiled); }
-    return ret;
+    return mf_icodegen_shuffle(err, context, icg_fcb_block, \
+            MF_ICG_SHUFFLE_ROT, 0);
 }
 
+/* Index on the top of stack is only known at runtime,
+ * constant index has been handled in 'mf_icodegen_constant' */
 #define IS_TOKEN_PICK(x) \
     ((x)==TOKEN_OP_PICK)
 static int mf_icodegen_pick(struct multiple_error *err, \
@@ -514,6 +598,9 @@ static int mf_icodegen_pick(struct multiple_error *err, \
                     context->res_id, \
                     &new_text_precompiled, \
 
+                    /* 'ø' counts from 0 while 'PICKCP' counts from 1 */
+                    MULTIPLY_ASM_OP_INT , OP_PUSH    , 1          , 
+                    MULTIPLY_ASM_OP     , OP_ADD     , 
                     MULTIPLY_ASM_OP     , OP_PICKCP  , 
                     MULTIPLY_ASM_FINISH)) != 0)
     { goto fail; }
@@ -567,10 +654,8 @@ static int mf_icodegen_global_variables(struct multiple_error *err, \
     }
     token_op = token_cur; 
 
-    if ((ret = multiply_resource_get_id( \
-                    err, \
-                    context->icode, \
-                    context->res_id, \
+    if ((ret = mf_icg_context_res_id(err, \
+                    context, \
                     &id, \
                     token_var->str, \
                     token_var->len)) != 0)
@@ -603,23 +688,142 @@ done:
     return ret;
 }
 
+/* Lambdas capture nothing, so the ones nested in other lambdas are
+ * made only once in the prologue of 'main' and referenced through a
+ * hidden variable, rather than being made again on every run */
+static int mf_icodegen_lambda_ref(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_block *icg_fcb_block_lambda, \
+        uint32_t lambda_idx)
+{
+    int ret = 0;
+
+    if (context->lambda_depth == 0)
+    {
+        /* Only run once */
+        if ((ret = mf_icg_fcb_block_append_with_configure_type(icg_fcb_block, \
+                        OP_LAMBDAMK, lambda_idx, MF_ICG_FCB_LINE_TYPE_LAMBDA_MK)) != 0)
+        { goto fail; }
+        goto done;
+    }
+
+    if ((ret = mf_icg_context_lambda_hoist(err, \
+                    context, \
+                    icg_fcb_block_lambda, \
+                    lambda_idx)) != 0)
+    { goto fail; }
+
+    if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, \
+                    OP_PUSHM, icg_fcb_block_lambda->hoist_id)) != 0)
+    { goto fail; }
+    if ((ret = mf_icg_fcb_line_attr_append(icg_fcb_block->end, \
+                    MF_ICG_FCB_LINE_ATTR_LAMBDA, lambda_idx)) != 0)
+    { goto fail; }
+    if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, \
+                    OP_SLV, 0)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+/* Make the hoisted lambdas and store them into the hidden variables */
+static int mf_icodegen_lambda_prologue(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block_main)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block *new_icg_fcb_block_prologue = NULL;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    uint32_t lambda_idx = 0;
+
+    (void)err;
+
+    new_icg_fcb_block_prologue = mf_icg_fcb_block_new();
+    if (new_icg_fcb_block_prologue == NULL)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+
+    icg_fcb_block_cur = context->icg_fcb_block_list->begin;
+    while (icg_fcb_block_cur != NULL)
+    {
+        if (icg_fcb_block_cur->hoisted != 0)
+        {
+            if ((ret = mf_icg_fcb_block_append_with_configure_type(new_icg_fcb_block_prologue, \
+                            OP_LAMBDAMK, lambda_idx, MF_ICG_FCB_LINE_TYPE_LAMBDA_MK)) != 0)
+            { goto fail; }
+            if ((ret = mf_icg_fcb_block_append_with_configure(new_icg_fcb_block_prologue, \
+                            OP_POPM, icg_fcb_block_cur->hoist_id)) != 0)
+            { goto fail; }
+        }
+        lambda_idx++;
+        icg_fcb_block_cur = icg_fcb_block_cur->next;
+    }
+
+    if ((ret = mf_icg_fcb_block_prepend(icg_fcb_block_main, \
+                    new_icg_fcb_block_prologue)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
+    if (new_icg_fcb_block_prologue != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block_prologue);
+    return ret;
+}
+
 #define IS_TOKEN_FUNC_DEFINE(x) \
     ((x)==TOKEN_OP_LEFT_BRACKET)
-static int mf_icodegen_func_define(struct multiple_error *err, \
+
+/* A lambda whose body is still being generated, the frames live on the 
+ * heap so the nesting depth of "[" never reaches the C stack */
+struct mf_icodegen_frame
+{
+    struct mf_icg_fcb_block *icg_fcb_block_parent;
+    struct mf_icg_fcb_line *icg_fcb_line_last;
+    struct token *token_first;
+
+    struct mf_icg_fcb_block *icg_fcb_block;
+    struct multiple_ir_export_section_item *export_section_item;
+};
+
+struct mf_icodegen_frames
+{
+    struct mf_icodegen_frame *frames;
+    size_t size;
+    size_t capacity;
+};
+
+/* Open a lambda at "[" */
+static int mf_icodegen_func_begin(struct multiple_error *err, \
         struct mf_icg_context *context, \
+        struct mf_icodegen_frames *frames, \
         struct mf_icg_fcb_block *icg_fcb_block, \
-        struct token **token_cur_in_out)
+        struct mf_icg_fcb_line *icg_fcb_line_last, \
+        struct token *token_first)
 {
     int ret = 0;
-    struct multiply_text_precompiled *new_text_precompiled = NULL;
-    struct token *token_cur = *token_cur_in_out;
-
+    struct mf_icodegen_frame *new_frames, *frame;
     struct mf_icg_fcb_block *new_icg_fcb_block = NULL;
     struct multiple_ir_export_section_item *new_export_section_item = NULL;
+    size_t new_capacity;
     uint32_t id;
 
-    /* Skip "[" */
-    token_cur = token_cur->next; 
+    if (frames->size == frames->capacity)
+    {
+        new_capacity = (frames->capacity == 0) ? 16 : frames->capacity * 2;
+        new_frames = (struct mf_icodegen_frame *)realloc(frames->frames, \
+                sizeof(struct mf_icodegen_frame) * new_capacity);
+        if (new_frames == NULL)
+        { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+        frames->frames = new_frames;
+        frames->capacity = new_capacity;
+    }
 
     new_icg_fcb_block = mf_icg_fcb_block_new();
     if (new_icg_fcb_block == NULL)
@@ -639,10 +843,8 @@ static int mf_icodegen_func_define(struct multiple_error *err, \
     new_export_section_item->blank = 1;
 
     /* Argument */
-    if ((ret = multiply_resource_get_id( \
-                    err, \
-                    context->icode, \
-                    context->res_id, \
+    if ((ret = mf_icg_context_res_id(err, \
+                    context, \
                     &id, \
                     "arg", \
                     3)) != 0)
@@ -650,20 +852,79 @@ static int mf_icodegen_func_define(struct multiple_error *err, \
     if ((ret = mf_icg_fcb_block_append_with_configure(new_icg_fcb_block, OP_ARGC, id)) != 0) { goto fail; }
     if ((ret = mf_icg_fcb_block_append_with_configure(new_icg_fcb_block, OP_PUSH, id)) != 0) { goto fail; }
 
+    frame = &frames->frames[frames->size];
+    frame->icg_fcb_block_parent = icg_fcb_block;
+    frame->icg_fcb_line_last = icg_fcb_line_last;
+    frame->token_first = token_first;
+    frame->icg_fcb_block = new_icg_fcb_block;
+    frame->export_section_item = new_export_section_item;
+    frames->size += 1;
+    new_icg_fcb_block = NULL;
+    new_export_section_item = NULL;
+
     /* Body */
-    if ((ret = mf_icodegen_generic(err, \
-                    context, \
-                    new_icg_fcb_block, \
-                    &token_cur)) != 0)
-    { goto fail; }
+    context->lambda_depth += 1;
+
+    goto done;
+fail:
+    if (new_icg_fcb_block != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block);
+    if (new_export_section_item != NULL) multiple_ir_export_section_item_destroy(new_export_section_item);
+done:
+    return ret;
+}
+
+/* Close the lambda on top at "]", the frame is popped either way */
+static int mf_icodegen_func_end(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icodegen_frames *frames)
+{
+    int ret = 0;
+    struct mf_icodegen_frame *frame = &frames->frames[frames->size - 1];
+    struct mf_icg_fcb_block *new_icg_fcb_block = frame->icg_fcb_block;
+    struct multiple_ir_export_section_item *new_export_section_item = frame->export_section_item;
+    struct mf_icg_fcb_block *icg_fcb_block_shared = NULL;
+    uint32_t hash, lambda_idx;
+
+    frames->size -= 1;
+    context->lambda_depth -= 1;
 
     /* Return */
     if ((ret = mf_icg_fcb_block_append_with_configure(new_icg_fcb_block, OP_RETURN, 0)) != 0)
     { goto fail; }
 
+    /* Share the identical lambda generated before */
+    hash = mf_icg_fcb_block_hash(new_icg_fcb_block);
+    if (mf_icg_lambda_table_lookup(context->lambda_table, \
+                new_icg_fcb_block, hash, \
+                &icg_fcb_block_shared, &lambda_idx) == 0)
+    {
+        mf_icg_fcb_block_destroy(new_icg_fcb_block);
+        new_icg_fcb_block = NULL;
+        multiple_ir_export_section_item_destroy(new_export_section_item);
+        new_export_section_item = NULL;
+
+        if ((ret = mf_icodegen_lambda_ref(err, \
+                        context, \
+                        frame->icg_fcb_block_parent, \
+                        icg_fcb_block_shared, \
+                        lambda_idx)) != 0)
+        { goto fail; }
+        goto done;
+    }
+    lambda_idx = (uint32_t)(context->icg_fcb_block_list->size);
+    if ((ret = mf_icg_lambda_table_register(context->lambda_table, \
+                    new_icg_fcb_block, hash, lambda_idx)) != 0)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        goto fail;
+    }
+
     /* Make Lambda */
-    if ((ret = mf_icg_fcb_block_append_with_configure_type(icg_fcb_block, \
-                    OP_LAMBDAMK, (uint32_t)(context->icg_fcb_block_list->size), MF_ICG_FCB_LINE_TYPE_LAMBDA_MK)) != 0)
+    if ((ret = mf_icodegen_lambda_ref(err, \
+                    context, \
+                    frame->icg_fcb_block_parent, \
+                    new_icg_fcb_block, \
+                    lambda_idx)) != 0)
     { goto fail; }
 
     /* Append block */
@@ -672,6 +933,7 @@ static int mf_icodegen_func_define(struct multiple_error *err, \
         MULTIPLE_ERROR_INTERNAL();
         goto fail;
     }
+    new_icg_fcb_block = NULL;
 
     /* Append blank export section */
     if ((ret = multiple_ir_export_section_append(context->icode->export_section, new_export_section_item)) != 0)
@@ -679,15 +941,59 @@ static int mf_icodegen_func_define(struct multiple_error *err, \
         MULTIPLE_ERROR_INTERNAL();
         goto fail;
     }
+    new_export_section_item = NULL;
 
     goto done;
 fail:
     if (new_icg_fcb_block != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block);
     if (new_export_section_item != NULL) multiple_ir_export_section_item_destroy(new_export_section_item);
 done:
-    if (new_text_precompiled != NULL)
-    { multiply_text_precompiled_destroy(new_text_precompiled); }
-    *token_cur_in_out = token_cur;
+    return ret;
+}
+
+/* Drop the lambdas left open by a failure */
+static void mf_icodegen_frames_destroy(struct mf_icg_context *context, \
+        struct mf_icodegen_frames *frames)
+{
+    struct mf_icodegen_frame *frame;
+
+    while (frames->size != 0)
+    {
+        frames->size -= 1;
+        frame = &frames->frames[frames->size];
+        mf_icg_fcb_block_destroy(frame->icg_fcb_block);
+        multiple_ir_export_section_item_destroy(frame->export_section_item);
+        context->lambda_depth -= 1;
+    }
+    if (frames->frames != NULL) free(frames->frames);
+}
+
+/* Reference a lambda generated ahead on the pool */
+static int mf_icodegen_func_pooled(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_par_job *job)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block *icg_fcb_block_shared = NULL;
+    uint32_t lambda_idx;
+
+    if ((ret = mf_icg_par_merge(err, \
+                    context, \
+                    job, \
+                    &icg_fcb_block_shared, \
+                    &lambda_idx)) != 0)
+    { goto fail; }
+    if ((ret = mf_icodegen_lambda_ref(err, \
+                    context, \
+                    icg_fcb_block, \
+                    icg_fcb_block_shared, \
+                    lambda_idx)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
     return ret;
 }
 
@@ -884,91 +1190,164 @@ done:
     return ret;
 }
 
-static int mf_icodegen_generic(struct multiple_error *err, \
+/* Walk the tokens into the given block until an unmatched "]" or the 
+ * end, nested lambdas are kept on a work stack instead of recursing. 
+ * With 'lambda_only' the walk starts at a "[" and stops on its "]" */
+static int mf_icodegen_walk(struct multiple_error *err, \
         struct mf_icg_context *context, \
         struct mf_icg_fcb_block *icg_fcb_block, \
-        struct token **token_cur_in_out)
+        struct token **token_cur_in_out, \
+        int lambda_only)
 {
     int ret = 0;
     struct token *token_cur = *token_cur_in_out;
+    struct token *token_first;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    struct mf_icg_fcb_line *icg_fcb_line_last;
+    struct mf_icodegen_frames frames;
+    struct mf_icodegen_frame *frame;
+    struct mf_icg_par_job *job;
 
-    while ((token_cur != NULL) && (token_cur->value != TOKEN_FINISH))
+    frames.frames = NULL;
+    frames.size = 0;
+    frames.capacity = 0;
+
+    if (lambda_only != 0)
     {
-        if (token_cur->value == TOKEN_OP_RIGHT_BRACKET)
+        if ((ret = mf_icodegen_func_begin(err, context, &frames, \
+                        icg_fcb_block, icg_fcb_block->end, token_cur)) != 0)
+        { goto fail; }
+        token_cur = token_cur->next;
+    }
+
+    for (;;)
+    {
+        if ((token_cur == NULL) || \
+                (token_cur->value == TOKEN_FINISH) || \
+                (token_cur->value == TOKEN_OP_RIGHT_BRACKET))
         {
-            break;
+            if (frames.size == 0) break;
+
+            /* End of the innermost lambda, an unclosed one ends with the tokens */
+            frame = &frames.frames[frames.size - 1];
+            icg_fcb_block_cur = frame->icg_fcb_block_parent;
+            icg_fcb_line_last = frame->icg_fcb_line_last;
+            token_first = frame->token_first;
+            if ((ret = mf_icodegen_func_end(err, context, &frames)) != 0)
+            { goto fail; }
+            if ((lambda_only != 0) && (frames.size == 0)) break;
+
+            if ((ret = mf_icg_fcb_block_stamp_token(icg_fcb_block_cur, \
+                            icg_fcb_line_last, token_first)) != 0)
+            { goto fail; }
+            if ((token_cur != NULL) && (token_cur->value == TOKEN_OP_RIGHT_BRACKET))
+            { token_cur = token_cur->next; }
+            continue;
+        }
+
+        icg_fcb_block_cur = (frames.size == 0) ? icg_fcb_block : \
+                             frames.frames[frames.size - 1].icg_fcb_block;
+        token_first = token_cur;
+        icg_fcb_line_last = icg_fcb_block_cur->end;
+
+        if (IS_TOKEN_LITERAL_OUTPUT(token_cur))
+        {
+            if ((ret = mf_icodegen_literal_output(err, \
+                            context, \
+                            icg_fcb_block_cur, \
+                            &token_cur)) != 0)
+            { goto fail; }
         }
-        else if (IS_TOKEN_CONSTANT(token_cur->value))
+        else if (IS_TOKEN_LITERAL(token_cur->value))
         {
             if ((ret = mf_icodegen_constant(err, \
                             context, \
-                            icg_fcb_block, \
+                            icg_fcb_block_cur, \
                             &token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_NORMAL(token_cur->value))
         {
-            if ((ret = mf_icodegen_normal(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_normal(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_PRINT_READ_CHAR(token_cur->value))
         {
-            if ((ret = mf_icodegen_print_char(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_print_char(err, context, icg_fcb_block_cur, token_cur)) != 0)
+            { goto fail; }
+        }
+        else if (IS_TOKEN_FLUSH(token_cur->value))
+        {
+            if ((ret = mf_icodegen_flush(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_CMP(token_cur->value))
         {
-            if ((ret = mf_icodegen_cmp(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_cmp(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_LOGICAL_AND_OR(token_cur->value))
         {
-            if ((ret = mf_icodegen_logical_and_or(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_logical_and_or(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_LOGICAL_NOT(token_cur->value))
         {
-            if ((ret = mf_icodegen_logical_not(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_logical_not(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_SWAP(token_cur->value))
         {
-            if ((ret = mf_icodegen_swap(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_swap(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_ROTATE3(token_cur->value))
         {
-            if ((ret = mf_icodegen_rotate3(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_rotate3(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_PICK(token_cur->value))
         {
-            if ((ret = mf_icodegen_pick(err, context, icg_fcb_block, token_cur)) != 0)
+            if ((ret = mf_icodegen_pick(err, context, icg_fcb_block_cur, token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_GLOBAL_VAR(token_cur->value))
         {
-            if ((ret = mf_icodegen_global_variables(err, context, icg_fcb_block, &token_cur)) != 0)
+            if ((ret = mf_icodegen_global_variables(err, context, icg_fcb_block_cur, &token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_FUNC_DEFINE(token_cur->value))
         {
-            if ((ret = mf_icodegen_func_define(err, context, icg_fcb_block, &token_cur)) != 0)
-            { goto fail; }
+            /* Generated ahead on the pool */
+            if ((context->lambda_depth == 0) && (context->par != NULL) && \
+                    (mf_icg_par_lookup(context->par, token_cur, &job) == 0))
+            {
+                if ((ret = mf_icodegen_func_pooled(err, context, icg_fcb_block_cur, job)) != 0)
+                { goto fail; }
+                token_cur = job->token_end;
+            }
+            else
+            {
+                if ((ret = mf_icodegen_func_begin(err, context, &frames, \
+                                icg_fcb_block_cur, icg_fcb_line_last, token_first)) != 0)
+                { goto fail; }
+                token_cur = token_cur->next;
+                continue;
+            }
         }
         else if (IS_TOKEN_FUNC_APPLY(token_cur->value))
         {
-            if ((ret = mf_icodegen_func_apply(err, context, icg_fcb_block, &token_cur)) != 0)
+            if ((ret = mf_icodegen_func_apply(err, context, icg_fcb_block_cur, &token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_IF(token_cur->value))
         {
-            if ((ret = mf_icodegen_if(err, context, icg_fcb_block, &token_cur)) != 0)
+            if ((ret = mf_icodegen_if(err, context, icg_fcb_block_cur, &token_cur)) != 0)
             { goto fail; }
         }
         else if (IS_TOKEN_WHILE(token_cur->value))
         {
-            if ((ret = mf_icodegen_while(err, context, icg_fcb_block, &token_cur)) != 0)
+            if ((ret = mf_icodegen_while(err, context, icg_fcb_block_cur, &token_cur)) != 0)
             { goto fail; }
         }
         else
@@ -978,16 +1357,39 @@ static int mf_icodegen_generic(struct multiple_error *err, \
             goto fail;
         }
 
+        /* Remember where the lines came from */
+        if ((ret = mf_icg_fcb_block_stamp_token(icg_fcb_block_cur, \
+                        icg_fcb_line_last, token_first)) != 0)
+        { goto fail; }
+
         token_cur = token_cur->next;
     }
 
     goto done;
 fail:
 done:
+    mf_icodegen_frames_destroy(context, &frames);
     *token_cur_in_out = token_cur;
     return ret;
 }
 
+static int mf_icodegen_generic(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct token **token_cur_in_out)
+{
+    return mf_icodegen_walk(err, context, icg_fcb_block, token_cur_in_out, 0);
+}
+
+/* Generate one lambda from its "[", leaving the token on the "]" */
+static int mf_icodegen_func_define(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct token **token_cur_in_out)
+{
+    return mf_icodegen_walk(err, context, icg_fcb_block, token_cur_in_out, 1);
+}
+
 static int mf_icodegen_merge_blocks(struct multiple_error *err, \
         struct mf_icg_context *context)
 {
@@ -1052,6 +1454,9 @@ static int mf_icodegen_merge_blocks(struct multiple_error *err, \
                                     icg_fcb_line_cur->opcode, icg_fcb_line_cur->operand)) != 0)
                     { goto fail; }
                     break;
+                case MF_ICG_FCB_LINE_TYPE_PSEUDO:
+                    icg_fcb_line_cur = icg_fcb_line_cur->next;
+                    continue;
             }
 
             fcb_size += 1;
@@ -1076,6 +1481,11 @@ static int mf_icodegen_merge_blocks(struct multiple_error *err, \
         icg_fcb_line_cur = icg_fcb_block_cur->begin;
         while (icg_fcb_line_cur != NULL)
         {
+            if (icg_fcb_line_cur->type == MF_ICG_FCB_LINE_TYPE_PSEUDO)
+            {
+                icg_fcb_line_cur = icg_fcb_line_cur->next;
+                continue;
+            }
             if (icg_fcb_line_cur->type == MF_ICG_FCB_LINE_TYPE_LAMBDA_MK)
             {
                 /* Locate to the export section item */
@@ -1107,27 +1517,66 @@ done:
     return ret;
 }
 
-int mf_irgen(struct multiple_error *err, \
-        struct multiple_ir **icode_out, \
+/* Operations written by the optimizer in False source */
+static int mf_icodegen_snippet(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        const char *src, size_t len)
+{
+    int ret = 0;
+    struct mf_icg_snippet *new_snippets, *snippet;
+    struct token *token_cur;
+    size_t new_capacity;
+
+    if (context->snippets_count == context->snippets_capacity)
+    {
+        new_capacity = (context->snippets_capacity == 0) ? 16 : context->snippets_capacity * 2;
+        new_snippets = (struct mf_icg_snippet *)realloc(context->snippets, \
+                sizeof(struct mf_icg_snippet) * new_capacity);
+        if (new_snippets == NULL)
+        { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+        context->snippets = new_snippets;
+        context->snippets_capacity = new_capacity;
+    }
+
+    /* The tokens could point into the source */
+    snippet = &context->snippets[context->snippets_count];
+    snippet->tokens = NULL;
+    if ((snippet->src = (char *)malloc(len + 1)) == NULL)
+    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    memcpy(snippet->src, src, len);
+    snippet->src[len] = '\0';
+    context->snippets_count += 1;
+
+    if ((ret = mf_tokenize(err, &snippet->tokens, snippet->src, len)) != 0)
+    { goto fail; }
+
+    token_cur = snippet->tokens->begin;
+    if ((ret = mf_icodegen_generic(err, \
+                    context, \
+                    icg_fcb_block, \
+                    &token_cur)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+/* Generate all the floating code blocks, with 'main' as the last one */
+static int mf_icodegen_blocks(struct multiple_error *err, \
+        struct mf_icg_context *context, \
         struct token_list *tokens, \
-        int verbose)
+        int optimize, \
+        size_t threads)
 {
     int ret = 0;
-    struct mf_icg_context context;
-    struct mf_icg_fcb_block_list *new_icg_fcb_block_list = NULL;
     struct mf_icg_fcb_block *new_icg_fcb_block_main = NULL;
-    uint32_t id;
-    uint32_t id_null;
     struct multiple_ir_export_section_item *new_export_section_item = NULL;
-    struct multiple_ir *new_icode = NULL;
-    struct multiply_resource_id_pool *new_res_id = NULL;
     struct token *token_cur = tokens->begin;
-
-    (void)verbose;
-
-    new_icg_fcb_block_list = mf_icg_fcb_block_list_new();
-    if (new_icg_fcb_block_list == NULL) 
-    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    uint32_t id;
+    uint32_t id_null;
 
     new_icg_fcb_block_main = mf_icg_fcb_block_new();
     if (new_icg_fcb_block_main == NULL) 
@@ -1141,30 +1590,37 @@ int mf_irgen(struct multiple_error *err, \
     new_export_section_item->args = NULL;
     new_export_section_item->args_types = NULL;
 
-    new_icode = multiple_ir_new();
-    if (new_icode == NULL)
-    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
-    new_res_id = multiply_resource_id_pool_new();
-    if (new_res_id == NULL)
-    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    if ((ret = mf_icg_context_res_reserve(err, \
+                    context)) != 0)
+    { goto fail; }
 
-    mf_icg_context_init(&context);
-    context.icg_fcb_block_list = new_icg_fcb_block_list;
-    context.icode = new_icode;
-    context.res_id = new_res_id;
+    /* Lambdas of 'main' */
+    if (threads > 1)
+    {
+        if ((ret = mf_icg_par_new(err, &context->par, token_cur)) != 0)
+        { goto fail; }
+        if ((context->par != NULL) && \
+                ((ret = mf_icg_par_run(context->par, \
+                                       threads, \
+                                       mf_icodegen_func_define)) != 0))
+        { goto fail; }
+    }
 
     /* Generating icode for 'main' */
-    if ((ret = mf_icodegen_generic(err, \
-                    &context, \
-                    new_icg_fcb_block_main, \
-                    &token_cur)) != 0)
-    { goto fail; }
+    ret = mf_icodegen_generic(err, \
+            context, \
+            new_icg_fcb_block_main, \
+            &token_cur);
+    if (context->par != NULL)
+    {
+        mf_icg_par_destroy(context->par);
+        context->par = NULL;
+    }
+    if (ret != 0) { goto fail; }
 
     /* Return */
-    if ((ret = multiply_resource_get_none( \
-                    err, \
-                    new_icode, \
-                    new_res_id, \
+    if ((ret = mf_icg_context_res_none(err, \
+                    context, \
                     &id_null)) != 0) 
     { goto fail; }
     if ((ret = mf_icg_fcb_block_append_with_configure(new_icg_fcb_block_main, OP_PUSH, id_null)) != 0)
@@ -1172,8 +1628,14 @@ int mf_irgen(struct multiple_error *err, \
     if ((ret = mf_icg_fcb_block_append_with_configure(new_icg_fcb_block_main, OP_RETURN, 0)) != 0)
     { goto fail; }
 
+    /* Hoisted lambdas */
+    if ((ret = mf_icodegen_lambda_prologue(err, \
+                    context, \
+                    new_icg_fcb_block_main)) != 0)
+    { goto fail; }
+
     /* Append block */
-    if ((ret = mf_icg_fcb_block_list_append(new_icg_fcb_block_list, new_icg_fcb_block_main)) != 0)
+    if ((ret = mf_icg_fcb_block_list_append(context->icg_fcb_block_list, new_icg_fcb_block_main)) != 0)
     {
         MULTIPLE_ERROR_INTERNAL();
         goto fail;
@@ -1181,39 +1643,181 @@ int mf_irgen(struct multiple_error *err, \
     new_icg_fcb_block_main = NULL;
 
     /* Append export section item */
-    if ((ret = multiply_resource_get_id( \
-                    err, \
-                    new_icode, \
-                    new_res_id, \
+    if ((ret = mf_icg_context_res_id(err, \
+                    context, \
                     &id, \
                     "main", 4)) != 0)
     { goto fail; }
 
     new_export_section_item->name = id;
-    new_export_section_item->instrument_number = (uint32_t)new_icode->export_section->size;
-    if ((ret = multiple_ir_export_section_append(new_icode->export_section, new_export_section_item)) != 0)
+    new_export_section_item->instrument_number = (uint32_t)context->icode->export_section->size;
+    if ((ret = multiple_ir_export_section_append(context->icode->export_section, new_export_section_item)) != 0)
     {
         MULTIPLE_ERROR_INTERNAL();
         goto fail;
     }
     new_export_section_item = NULL;
 
+    /* Optimize */
+    if (optimize != 0)
+    {
+        if ((ret = mf_icg_opt_inline_lambda_vars(err, \
+                        context)) != 0)
+        { goto fail; }
+    }
+
+    /* Stack effect */
+    if ((ret = mf_icg_stack_analyze(err, \
+                    context)) != 0)
+    { goto fail; }
+
+    /* Constants, copies and dead code over the SSA form */
+    if (optimize >= 2)
+    {
+        if ((ret = mf_icg_ssa_optimize(err, \
+                        context, \
+                        mf_icodegen_snippet)) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_stack_analyze(err, \
+                        context)) != 0)
+        { goto fail; }
+    }
+
+    goto done;
+fail:
+    if (context->par != NULL)
+    {
+        mf_icg_par_destroy(context->par);
+        context->par = NULL;
+    }
+    if (new_icg_fcb_block_main != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block_main);
+    if (new_export_section_item != NULL) multiple_ir_export_section_item_destroy(new_export_section_item);
+done:
+    return ret;
+}
+
+int mf_irgen(struct multiple_error *err, \
+        struct multiple_ir **icode_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        int verbose)
+{
+    return mf_irgen_parallel(err, icode_out, tokens, optimize, verbose, 1);
+}
+
+int mf_irgen_parallel(struct multiple_error *err, \
+        struct multiple_ir **icode_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        int verbose, \
+        size_t threads)
+{
+    int ret = 0;
+    struct mf_icg_context context;
+
+    (void)verbose;
+
+    if ((ret = mf_icg_context_setup(&context)) != 0)
+    { MULTIPLE_ERROR_MALLOC(); goto fail; }
+
+    if ((ret = mf_icodegen_blocks(err, \
+                    &context, \
+                    tokens, \
+                    optimize, \
+                    threads)) != 0)
+    { goto fail; }
+
+    /* Precompute what comes before the input */
+    if (optimize >= 2)
+    {
+        if ((ret = mf_icg_peval(err, \
+                        &context, \
+                        MF_ICG_PEVAL_BUDGET_DEFAULT)) != 0)
+        { goto fail; }
+    }
+
     /* Merge blocks */
     if ((ret = mf_icodegen_merge_blocks(err, \
                     &context)) != 0)
     { goto fail; }
 
-    *icode_out = new_icode;
+    *icode_out = context.icode;
+    context.icode = NULL;
 
     ret = 0;
     goto done;
 fail:
-    if (new_icode != NULL) multiple_ir_destroy(new_icode);
-    if (new_icg_fcb_block_main != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block_main);
-    if (new_export_section_item != NULL) multiple_ir_export_section_item_destroy(new_export_section_item);
 done:
-    if (new_res_id != NULL) multiply_resource_id_pool_destroy(new_res_id);
-    if (new_icg_fcb_block_list != NULL) mf_icg_fcb_block_list_destroy(new_icg_fcb_block_list);
+    mf_icg_context_teardown(&context);
+    return ret;
+}
+
+int mf_progen(struct multiple_error *err, \
+        struct mf_prog **prog_out, \
+        struct token_list *tokens, \
+        int optimize)
+{
+    return mf_progen_parallel(err, prog_out, tokens, optimize, 1);
+}
+
+int mf_progen_parallel(struct multiple_error *err, \
+        struct mf_prog **prog_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        size_t threads)
+{
+    int ret = 0;
+    struct mf_icg_context context;
+
+    if ((ret = mf_icg_context_setup(&context)) != 0)
+    { MULTIPLE_ERROR_MALLOC(); goto fail; }
+
+    if ((ret = mf_icodegen_blocks(err, \
+                    &context, \
+                    tokens, \
+                    optimize, \
+                    threads)) != 0)
+    { goto fail; }
+
+    if ((ret = mf_prog_new_from_blocks(err, \
+                    prog_out, \
+                    context.icg_fcb_block_list)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
+    mf_icg_context_teardown(&context);
+    return ret;
+}
+
+int mf_aotgen(struct multiple_error *err, \
+        char **src_out, size_t *src_len_out, \
+        struct token_list *tokens, \
+        int optimize)
+{
+    return mf_aotgen_parallel(err, src_out, src_len_out, tokens, optimize, 1);
+}
+
+int mf_aotgen_parallel(struct multiple_error *err, \
+        char **src_out, size_t *src_len_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        size_t threads)
+{
+    int ret = 0;
+    struct mf_prog *prog = NULL;
+
+    if ((ret = mf_progen_parallel(err, &prog, tokens, optimize, threads)) != 0)
+    { goto fail; }
+
+    if ((ret = mf_aot_c(err, src_out, src_len_out, prog)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
+    if (prog != NULL) mf_prog_destroy(prog);
     return ret;
 }
 
@@ -23,11 +23,50 @@
 #include "multiple_ir.h"
 
 #include "mf_lexer.h"
+#include "mf_prog.h"
 
+/* Every generator below keeps its state in a context of its own and 
+ * only reads the token list, so distinct calls may run on distinct 
+ * threads as long as each one passes its own 'err' */
 int mf_irgen(struct multiple_error *err, \
         struct multiple_ir **icode_out, \
         struct token_list *tokens, \
+        int optimize, \
         int verbose);
 
+/* The lambdas written in 'main' are generated on 'threads' threads,
+ * the result is the same whatever the number, see 'mf_icg_par' */
+int mf_irgen_parallel(struct multiple_error *err, \
+        struct multiple_ir **icode_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        int verbose, \
+        size_t threads);
+
+/* The same blocks decoded into a program for the runtimes in this 
+ * tree instead of the icode of the virtual machine. At 'optimize' 2 
+ * and above these get the SSA passes but not 'mf_icg_peval', which 
+ * only the icode gets */
+int mf_progen(struct multiple_error *err, \
+        struct mf_prog **prog_out, \
+        struct token_list *tokens, \
+        int optimize);
+int mf_progen_parallel(struct multiple_error *err, \
+        struct mf_prog **prog_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        size_t threads);
+
+/* A C translation unit of the program, see 'mf_aot_c' */
+int mf_aotgen(struct multiple_error *err, \
+        char **src_out, size_t *src_len_out, \
+        struct token_list *tokens, \
+        int optimize);
+int mf_aotgen_parallel(struct multiple_error *err, \
+        char **src_out, size_t *src_len_out, \
+        struct token_list *tokens, \
+        int optimize, \
+        size_t threads);
+
 #endif
 
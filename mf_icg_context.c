@@ -18,26 +18,401 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>. 
    */
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "multiple_ir.h"
+#include "multiple_err.h"
 
+#include "multiply.h"
+
+#include "mf_lexer.h"
 #include "mf_icg_fcb.h"
 #include "mf_icg_context.h"
 
+struct mf_icg_lambda_table *mf_icg_lambda_table_new(void)
+{
+    struct mf_icg_lambda_table *new_table = NULL;
+    size_t idx;
+
+    new_table = (struct mf_icg_lambda_table *)malloc(sizeof(struct mf_icg_lambda_table));
+    if (new_table == NULL) { goto fail; }
+    for (idx = 0; idx != MF_ICG_LAMBDA_TABLE_BUCKETS_COUNT; idx++)
+    { new_table->buckets[idx] = NULL; }
+    new_table->size = 0;
+
+fail:
+    return new_table;
+}
+
+int mf_icg_lambda_table_destroy(struct mf_icg_lambda_table *table)
+{
+    struct mf_icg_lambda_table_item *item_cur, *item_next;
+    size_t idx;
+
+    if (table == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    for (idx = 0; idx != MF_ICG_LAMBDA_TABLE_BUCKETS_COUNT; idx++)
+    {
+        item_cur = table->buckets[idx];
+        while (item_cur != NULL)
+        {
+            item_next = item_cur->next;
+            free(item_cur);
+            item_cur = item_next;
+        }
+    }
+    free(table);
+
+    return 0;
+}
+
+int mf_icg_lambda_table_lookup(struct mf_icg_lambda_table *table, \
+        struct mf_icg_fcb_block *icg_fcb_block, uint32_t hash, \
+        struct mf_icg_fcb_block **icg_fcb_block_out, \
+        uint32_t *lambda_idx_out)
+{
+    struct mf_icg_lambda_table_item *item_cur;
+
+    item_cur = table->buckets[hash % MF_ICG_LAMBDA_TABLE_BUCKETS_COUNT];
+    while (item_cur != NULL)
+    {
+        if ((item_cur->hash == hash) && \
+                (mf_icg_fcb_block_equal(item_cur->icg_fcb_block, icg_fcb_block) != 0))
+        {
+            *icg_fcb_block_out = item_cur->icg_fcb_block;
+            *lambda_idx_out = item_cur->lambda_idx;
+            return 0;
+        }
+        item_cur = item_cur->next;
+    }
+
+    return -1;
+}
+
+int mf_icg_lambda_table_register(struct mf_icg_lambda_table *table, \
+        struct mf_icg_fcb_block *icg_fcb_block, uint32_t hash, \
+        uint32_t lambda_idx)
+{
+    struct mf_icg_lambda_table_item *new_item = NULL;
+    size_t bucket = hash % MF_ICG_LAMBDA_TABLE_BUCKETS_COUNT;
+
+    new_item = (struct mf_icg_lambda_table_item *)malloc(sizeof(struct mf_icg_lambda_table_item));
+    if (new_item == NULL) return -MULTIPLE_ERR_MALLOC;
+    new_item->hash = hash;
+    new_item->lambda_idx = lambda_idx;
+    new_item->icg_fcb_block = icg_fcb_block;
+    new_item->next = table->buckets[bucket];
+    table->buckets[bucket] = new_item;
+    table->size += 1;
+
+    return 0;
+}
+
+struct mf_icg_res_log *mf_icg_res_log_new(void)
+{
+    struct mf_icg_res_log *new_log = NULL;
+
+    new_log = (struct mf_icg_res_log *)malloc(sizeof(struct mf_icg_res_log));
+    if (new_log == NULL) { goto fail; }
+    new_log->items = NULL;
+    new_log->size = 0;
+    new_log->capacity = 0;
+    new_log->slots = NULL;
+    new_log->slots_count = 0;
+
+fail:
+    return new_log;
+}
+
+int mf_icg_res_log_destroy(struct mf_icg_res_log *log)
+{
+    size_t idx;
+
+    if (log == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    for (idx = 0; idx != log->size; idx++)
+    {
+        if (log->items[idx].str != NULL) free(log->items[idx].str);
+    }
+    if (log->items != NULL) free(log->items);
+    if (log->slots != NULL) free(log->slots);
+    free(log);
+
+    return 0;
+}
+
+#define MF_ICG_RES_LOG_SLOT(id, slots_count) \
+    ((size_t)((id) * 2654435761u) & ((slots_count) - 1))
+
+int mf_icg_res_log_lookup(struct mf_icg_res_log *log, uint32_t id, \
+        struct mf_icg_res_log_item **item_out)
+{
+    size_t slot;
+
+    if (log->slots_count == 0) return -1;
+
+    slot = MF_ICG_RES_LOG_SLOT(id, log->slots_count);
+    while (log->slots[slot] != 0)
+    {
+        if (log->items[log->slots[slot] - 1].id == id)
+        {
+            *item_out = &log->items[log->slots[slot] - 1];
+            return 0;
+        }
+        slot = (slot + 1) & (log->slots_count - 1);
+    }
+
+    return -1;
+}
+
+/* Keep the slots at most half full */
+static int mf_icg_res_log_rehash(struct mf_icg_res_log *log)
+{
+    size_t *new_slots;
+    size_t new_slots_count = (log->slots_count == 0) ? 64 : log->slots_count * 2;
+    size_t idx, slot;
+
+    new_slots = (size_t *)calloc(new_slots_count, sizeof(size_t));
+    if (new_slots == NULL) return -MULTIPLE_ERR_MALLOC;
+    for (idx = 0; idx != log->size; idx++)
+    {
+        slot = MF_ICG_RES_LOG_SLOT(log->items[idx].id, new_slots_count);
+        while (new_slots[slot] != 0) slot = (slot + 1) & (new_slots_count - 1);
+        new_slots[slot] = idx + 1;
+    }
+    if (log->slots != NULL) free(log->slots);
+    log->slots = new_slots;
+    log->slots_count = new_slots_count;
+
+    return 0;
+}
+
+static int mf_icg_res_log_append(struct mf_icg_res_log *log, uint32_t id, \
+        int kind, int value, const char *str, size_t len)
+{
+    int ret;
+    struct mf_icg_res_log_item *item, *new_items;
+    size_t new_capacity, slot;
+
+    /* The pool hands out the same ID for the same resource */
+    if (mf_icg_res_log_lookup(log, id, &item) == 0) return 0;
+
+    if ((log->size + 1) * 2 > log->slots_count)
+    {
+        if ((ret = mf_icg_res_log_rehash(log)) != 0) return ret;
+    }
+    if (log->size == log->capacity)
+    {
+        new_capacity = (log->capacity == 0) ? 32 : log->capacity * 2;
+        new_items = (struct mf_icg_res_log_item *)realloc(log->items, \
+                sizeof(struct mf_icg_res_log_item) * new_capacity);
+        if (new_items == NULL) return -MULTIPLE_ERR_MALLOC;
+        log->items = new_items;
+        log->capacity = new_capacity;
+    }
+
+    item = &log->items[log->size];
+    item->kind = kind;
+    item->value = value;
+    item->str = NULL;
+    item->len = len;
+    item->id = id;
+    item->id_moved = 0;
+    item->moved = 0;
+    item->hoist = 0;
+    item->lambda_idx = 0;
+    if (str != NULL)
+    {
+        if ((item->str = (char *)malloc(len + 1)) == NULL) return -MULTIPLE_ERR_MALLOC;
+        memcpy(item->str, str, len);
+        item->str[len] = '\0';
+    }
+
+    slot = MF_ICG_RES_LOG_SLOT(id, log->slots_count);
+    while (log->slots[slot] != 0) slot = (slot + 1) & (log->slots_count - 1);
+    log->slots[slot] = log->size + 1;
+    log->size += 1;
+
+    return 0;
+}
+
 int mf_icg_context_init(struct mf_icg_context *context)
 {
     context->icg_fcb_block_list = NULL;
     context->icode = NULL;
     context->res_id = NULL;
+    context->lambda_depth = 0;
+    context->lambda_table = NULL;
+    context->snippets = NULL;
+    context->snippets_count = 0;
+    context->snippets_capacity = 0;
+    context->res_log = NULL;
+    context->par = NULL;
     return 0;
 }
 
 int mf_icg_context_uninit(struct mf_icg_context *context)
 {
-    (void)context;
+    if (context->lambda_table != NULL)
+    {
+        mf_icg_lambda_table_destroy(context->lambda_table);
+        context->lambda_table = NULL;
+    }
+    if (context->snippets != NULL)
+    {
+        while (context->snippets_count != 0)
+        {
+            context->snippets_count -= 1;
+            if (context->snippets[context->snippets_count].tokens != NULL)
+            { token_list_destroy(context->snippets[context->snippets_count].tokens); }
+            free(context->snippets[context->snippets_count].src);
+        }
+        free(context->snippets);
+        context->snippets = NULL;
+        context->snippets_capacity = 0;
+    }
+    return 0;
+}
+
+int mf_icg_context_setup(struct mf_icg_context *context)
+{
+    mf_icg_context_init(context);
+
+    if ((context->icg_fcb_block_list = mf_icg_fcb_block_list_new()) == NULL) goto fail;
+    if ((context->icode = multiple_ir_new()) == NULL) goto fail;
+    if ((context->res_id = multiply_resource_id_pool_new()) == NULL) goto fail;
+    if ((context->lambda_table = mf_icg_lambda_table_new()) == NULL) goto fail;
+
+    return 0;
+fail:
+    return -MULTIPLE_ERR_MALLOC;
+}
+
+void mf_icg_context_teardown(struct mf_icg_context *context)
+{
+    mf_icg_context_uninit(context);
+    if (context->icode != NULL) multiple_ir_destroy(context->icode);
+    if (context->res_id != NULL) multiply_resource_id_pool_destroy(context->res_id);
+    if (context->icg_fcb_block_list != NULL) mf_icg_fcb_block_list_destroy(context->icg_fcb_block_list);
+    if (context->res_log != NULL) mf_icg_res_log_destroy(context->res_log);
+    context->icode = NULL;
+    context->res_id = NULL;
+    context->icg_fcb_block_list = NULL;
+    context->res_log = NULL;
+}
+
+int mf_icg_context_res(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        uint32_t *id_out, \
+        int kind, int value, const char *str, size_t len)
+{
+    int ret = 0;
+
+    switch (kind)
+    {
+        case MF_ICG_RES_INT:
+            ret = multiply_resource_get_int(err, context->icode, context->res_id, \
+                    id_out, value);
+            break;
+        case MF_ICG_RES_STR:
+            ret = multiply_resource_get_str(err, context->icode, context->res_id, \
+                    id_out, str, len);
+            break;
+        case MF_ICG_RES_ID:
+            ret = multiply_resource_get_id(err, context->icode, context->res_id, \
+                    id_out, str, len);
+            break;
+        case MF_ICG_RES_NONE:
+            ret = multiply_resource_get_none(err, context->icode, context->res_id, \
+                    id_out);
+            break;
+        default:
+            MULTIPLE_ERROR_INTERNAL();
+            return -MULTIPLE_ERR_INTERNAL;
+    }
+    if (ret != 0) return ret;
+
+    if (context->res_log != NULL)
+    {
+        if ((ret = mf_icg_res_log_append(context->res_log, *id_out, \
+                        kind, value, str, len)) != 0)
+        { MULTIPLE_ERROR_MALLOC(); return ret; }
+    }
+
+    return 0;
+}
+
+int mf_icg_context_res_int(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out, int value)
+{
+    return mf_icg_context_res(err, context, id_out, MF_ICG_RES_INT, value, NULL, 0);
+}
+
+int mf_icg_context_res_str(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out, \
+        const char *str, size_t len)
+{
+    return mf_icg_context_res(err, context, id_out, MF_ICG_RES_STR, 0, str, len);
+}
+
+int mf_icg_context_res_id(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out, \
+        const char *str, size_t len)
+{
+    return mf_icg_context_res(err, context, id_out, MF_ICG_RES_ID, 0, str, len);
+}
+
+int mf_icg_context_res_none(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out)
+{
+    return mf_icg_context_res(err, context, id_out, MF_ICG_RES_NONE, 0, NULL, 0);
+}
+
+int mf_icg_context_res_reserve(struct multiple_error *err, \
+        struct mf_icg_context *context)
+{
+    int ret;
+    uint32_t id;
+    int value;
+
+    if ((ret = mf_icg_context_res_none(err, context, &id)) != 0) return ret;
+    for (value = 0; value <= MF_ICG_RES_ASM_INT_MAX; value++)
+    {
+        if ((ret = mf_icg_context_res_int(err, context, &id, value)) != 0) return ret;
+    }
+
+    return 0;
+}
+
+int mf_icg_context_lambda_hoist(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        uint32_t lambda_idx)
+{
+    int ret;
+    char name[sizeof(MF_ICG_LAMBDA_HOIST_PREFIX) + 10];
+    struct mf_icg_res_log_item *item;
+
+    if (icg_fcb_block->hoisted != 0) return 0;
+
+    sprintf(name, "%s%u", MF_ICG_LAMBDA_HOIST_PREFIX, (unsigned int)lambda_idx);
+    if ((ret = mf_icg_context_res_id(err, context, \
+                    &icg_fcb_block->hoist_id, name, strlen(name))) != 0)
+    { return ret; }
+    icg_fcb_block->hoisted = 1;
+
+    /* The name depends on the index, which a private context only 
+     * knows for itself, so the request is marked to be made again */
+    if ((context->res_log != NULL) && \
+            (mf_icg_res_log_lookup(context->res_log, icg_fcb_block->hoist_id, &item) == 0))
+    {
+        item->hoist = 1;
+        item->lambda_idx = lambda_idx;
+    }
+
     return 0;
 }
 
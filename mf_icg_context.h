@@ -22,21 +22,160 @@
 #define _MF_ICG_CONTEXT_H_
 
 #include "multiple_ir.h"
+#include "multiple_err.h"
 
 #include "multiply.h"
 
 #include "mf_icg_fcb.h"
 
+struct token_list;
+struct mf_icg_par;
+
+/* Lambda bodies generated so far, for sharing identical ones */
+
+#define MF_ICG_LAMBDA_TABLE_BUCKETS_COUNT 1024
+
+struct mf_icg_lambda_table_item
+{
+    uint32_t hash;
+    uint32_t lambda_idx;
+    struct mf_icg_fcb_block *icg_fcb_block;
+
+    struct mf_icg_lambda_table_item *next;
+};
+
+struct mf_icg_lambda_table
+{
+    struct mf_icg_lambda_table_item *buckets[MF_ICG_LAMBDA_TABLE_BUCKETS_COUNT];
+    size_t size;
+};
+
+struct mf_icg_lambda_table *mf_icg_lambda_table_new(void);
+int mf_icg_lambda_table_destroy(struct mf_icg_lambda_table *table);
+/* Returns 0 if an identical block has been registered */
+int mf_icg_lambda_table_lookup(struct mf_icg_lambda_table *table, \
+        struct mf_icg_fcb_block *icg_fcb_block, uint32_t hash, \
+        struct mf_icg_fcb_block **icg_fcb_block_out, \
+        uint32_t *lambda_idx_out);
+int mf_icg_lambda_table_register(struct mf_icg_lambda_table *table, \
+        struct mf_icg_fcb_block *icg_fcb_block, uint32_t hash, \
+        uint32_t lambda_idx);
+
+/* Source and tokens of operations rewritten by the optimizer,
+ * the lines refer to them until the context is uninitialized */
+struct mf_icg_snippet
+{
+    char *src;
+    struct token_list *tokens;
+};
+
+/* Resources taken by a private context, for asking the pool of 
+ * another context for the same ones when its lines are moved there */
+
+enum
+{
+    MF_ICG_RES_INT = 0,
+    MF_ICG_RES_STR,
+    MF_ICG_RES_ID,
+    MF_ICG_RES_NONE,
+};
+
+struct mf_icg_res_log_item
+{
+    int kind;
+    int value;
+    char *str;
+    size_t len;
+
+    /* Resource ID in the private pool, and in the pool moved to */
+    uint32_t id;
+    uint32_t id_moved;
+    int moved;
+
+    /* Hidden variable of the lambda at 'lambda_idx' */
+    int hoist;
+    uint32_t lambda_idx;
+};
+
+struct mf_icg_res_log
+{
+    struct mf_icg_res_log_item *items;
+    size_t size;
+    size_t capacity;
+
+    /* Index + 1 of the item of each ID, open addressing */
+    size_t *slots;
+    size_t slots_count;
+};
+
+struct mf_icg_res_log *mf_icg_res_log_new(void);
+int mf_icg_res_log_destroy(struct mf_icg_res_log *log);
+/* Returns 0 if 'id' has been logged */
+int mf_icg_res_log_lookup(struct mf_icg_res_log *log, uint32_t id, \
+        struct mf_icg_res_log_item **item_out);
+
+/* Name prefix of the hidden variables holding hoisted lambdas,
+ * which could never be a variable name in False */
+#define MF_ICG_LAMBDA_HOIST_PREFIX "__lambda"
+
 struct mf_icg_context
 {
     struct mf_icg_fcb_block_list *icg_fcb_block_list;
     struct multiple_ir *icode;
     struct multiply_resource_id_pool *res_id;
+
+    /* Nesting level of the lambda being generated, 0 for 'main' */
+    uint32_t lambda_depth;
+
+    struct mf_icg_lambda_table *lambda_table;
+
+    struct mf_icg_snippet *snippets;
+    size_t snippets_count;
+    size_t snippets_capacity;
+
+    /* Only for the private contexts of 'mf_icg_par' */
+    struct mf_icg_res_log *res_log;
+
+    /* Lambdas of 'main' generated ahead, see 'mf_icg_par' */
+    struct mf_icg_par *par;
 };
 
 int mf_icg_context_init(struct mf_icg_context *context);
 int mf_icg_context_uninit(struct mf_icg_context *context);
 
+/* Allocate and release the block list, icode and pools as well */
+int mf_icg_context_setup(struct mf_icg_context *context);
+void mf_icg_context_teardown(struct mf_icg_context *context);
+
+/* Resources of the icode, logged if the context has a log */
+int mf_icg_context_res(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        uint32_t *id_out, \
+        int kind, int value, const char *str, size_t len);
+int mf_icg_context_res_int(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out, int value);
+int mf_icg_context_res_str(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out, \
+        const char *str, size_t len);
+int mf_icg_context_res_id(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out, \
+        const char *str, size_t len);
+int mf_icg_context_res_none(struct multiple_error *err, \
+        struct mf_icg_context *context, uint32_t *id_out);
+
+/* The assembler takes the integers of its templates from the pool 
+ * itself, so they and the none are taken before anything else and 
+ * their IDs never depend on where a template is first used */
+#define MF_ICG_RES_ASM_INT_MAX 3
+int mf_icg_context_res_reserve(struct multiple_error *err, \
+        struct mf_icg_context *context);
+
+/* Give the lambda block a hidden variable if it has none yet */
+int mf_icg_context_lambda_hoist(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        uint32_t lambda_idx);
+
 #endif
 
 
@@ -117,6 +117,7 @@ struct mf_icg_fcb_line *mf_icg_fcb_line_new(void)
     new_icg_fcb_line->opcode = new_icg_fcb_line->operand = 0;
     new_icg_fcb_line->type = MF_ICG_FCB_LINE_TYPE_NORMAL;
     new_icg_fcb_line->attrs = NULL;
+    new_icg_fcb_line->token = NULL;
     new_icg_fcb_line->prev = new_icg_fcb_line->next = NULL;
     goto done;
 fail:
@@ -170,6 +171,84 @@ struct mf_icg_fcb_line *mf_icg_fcb_line_new_with_configure_type(uint32_t opcode,
     return mf_icg_fcb_line_new_with_configure_raw(opcode, operand, type);
 }
 
+int mf_icg_fcb_line_attr_append(struct mf_icg_fcb_line *icg_fcb_line, \
+        uint32_t attr_id, uint32_t res_id)
+{
+    if (icg_fcb_line == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    if (icg_fcb_line->attrs == NULL)
+    {
+        icg_fcb_line->attrs = mf_icg_fcb_line_attr_list_new();
+        if (icg_fcb_line->attrs == NULL) return -MULTIPLE_ERR_MALLOC;
+    }
+
+    return mf_icg_fcb_line_attr_list_append_with_configure(icg_fcb_line->attrs, \
+            attr_id, res_id);
+}
+
+int mf_icg_fcb_line_attr_lookup(struct mf_icg_fcb_line *icg_fcb_line, \
+        uint32_t attr_id, uint32_t *res_id_out)
+{
+    struct mf_icg_fcb_line_attr *attr_cur;
+
+    if (icg_fcb_line->attrs == NULL) return -1;
+    attr_cur = icg_fcb_line->attrs->begin;
+    while (attr_cur != NULL)
+    {
+        if (attr_cur->attr_id == attr_id)
+        {
+            *res_id_out = attr_cur->res_id;
+            return 0;
+        }
+        attr_cur = attr_cur->next;
+    }
+    return -1;
+}
+
+int mf_icg_fcb_line_lambda_idx(struct mf_icg_fcb_line *icg_fcb_line, \
+        uint32_t *lambda_idx_out)
+{
+    if (icg_fcb_line->type == MF_ICG_FCB_LINE_TYPE_LAMBDA_MK)
+    {
+        *lambda_idx_out = icg_fcb_line->operand;
+        return 0;
+    }
+    return mf_icg_fcb_line_attr_lookup(icg_fcb_line, \
+            MF_ICG_FCB_LINE_ATTR_LAMBDA, lambda_idx_out);
+}
+
+struct mf_icg_fcb_line *mf_icg_fcb_line_clone(struct mf_icg_fcb_line *icg_fcb_line)
+{
+    struct mf_icg_fcb_line *new_icg_fcb_line = NULL;
+    struct mf_icg_fcb_line_attr *attr_cur;
+
+    new_icg_fcb_line = mf_icg_fcb_line_new_with_configure_raw(icg_fcb_line->opcode, \
+            icg_fcb_line->operand, icg_fcb_line->type);
+    if (new_icg_fcb_line == NULL) { goto fail; }
+    new_icg_fcb_line->token = icg_fcb_line->token;
+    if (icg_fcb_line->attrs != NULL)
+    {
+        attr_cur = icg_fcb_line->attrs->begin;
+        while (attr_cur != NULL)
+        {
+            if (mf_icg_fcb_line_attr_append(new_icg_fcb_line, \
+                        attr_cur->attr_id, attr_cur->res_id) != 0)
+            { goto fail; }
+            attr_cur = attr_cur->next;
+        }
+    }
+
+    goto done;
+fail:
+    if (new_icg_fcb_line != NULL)
+    {
+        mf_icg_fcb_line_destroy(new_icg_fcb_line);
+        new_icg_fcb_line = NULL;
+    }
+done:
+    return new_icg_fcb_line;
+}
+
 struct mf_icg_fcb_block *mf_icg_fcb_block_new(void)
 {
     struct mf_icg_fcb_block *new_icg_fcb_block = NULL;
@@ -179,6 +258,15 @@ struct mf_icg_fcb_block *mf_icg_fcb_block_new(void)
     new_icg_fcb_block->begin = new_icg_fcb_block->end = NULL;
     new_icg_fcb_block->prev = new_icg_fcb_block->next = NULL;
     new_icg_fcb_block->size = 0;
+    new_icg_fcb_block->stack_known = 0;
+    new_icg_fcb_block->stack_safe = 0;
+    new_icg_fcb_block->stack_returns = 0;
+    new_icg_fcb_block->stack_need = 0;
+    new_icg_fcb_block->stack_need_max = 0;
+    new_icg_fcb_block->stack_net = 0;
+    new_icg_fcb_block->stack_max = 0;
+    new_icg_fcb_block->hoisted = 0;
+    new_icg_fcb_block->hoist_id = 0;
     goto done;
 fail:
     if (new_icg_fcb_block != NULL) { free(new_icg_fcb_block); }
@@ -394,6 +482,161 @@ int mf_icg_fcb_block_link(struct mf_icg_fcb_block *icg_fcb_block, \
     }
 }
 
+/* FNV-1a */
+#define MF_ICG_FCB_HASH_INIT 2166136261U
+#define MF_ICG_FCB_HASH_PRIME 16777619U
+#define MF_ICG_FCB_HASH_UPDATE(hash, value) \
+    do { (hash) = ((hash) ^ (uint32_t)(value)) * MF_ICG_FCB_HASH_PRIME; } while (0)
+
+static uint32_t mf_icg_fcb_line_lambda_attr(struct mf_icg_fcb_line *icg_fcb_line)
+{
+    uint32_t res_id;
+
+    if (mf_icg_fcb_line_attr_lookup(icg_fcb_line, MF_ICG_FCB_LINE_ATTR_LAMBDA, &res_id) != 0)
+    { return (uint32_t)(-1); }
+    return res_id;
+}
+
+uint32_t mf_icg_fcb_block_hash(struct mf_icg_fcb_block *icg_fcb_block)
+{
+    uint32_t hash = MF_ICG_FCB_HASH_INIT;
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        MF_ICG_FCB_HASH_UPDATE(hash, icg_fcb_line_cur->opcode);
+        MF_ICG_FCB_HASH_UPDATE(hash, icg_fcb_line_cur->operand);
+        MF_ICG_FCB_HASH_UPDATE(hash, icg_fcb_line_cur->type);
+        MF_ICG_FCB_HASH_UPDATE(hash, mf_icg_fcb_line_lambda_attr(icg_fcb_line_cur));
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+
+    return hash;
+}
+
+int mf_icg_fcb_block_equal(struct mf_icg_fcb_block *icg_fcb_block_a, \
+        struct mf_icg_fcb_block *icg_fcb_block_b)
+{
+    struct mf_icg_fcb_line *icg_fcb_line_a, *icg_fcb_line_b;
+
+    if (icg_fcb_block_a->size != icg_fcb_block_b->size) return 0;
+
+    icg_fcb_line_a = icg_fcb_block_a->begin;
+    icg_fcb_line_b = icg_fcb_block_b->begin;
+    while ((icg_fcb_line_a != NULL) && (icg_fcb_line_b != NULL))
+    {
+        if ((icg_fcb_line_a->opcode != icg_fcb_line_b->opcode) || \
+                (icg_fcb_line_a->operand != icg_fcb_line_b->operand) || \
+                (icg_fcb_line_a->type != icg_fcb_line_b->type) || \
+                (mf_icg_fcb_line_lambda_attr(icg_fcb_line_a) != mf_icg_fcb_line_lambda_attr(icg_fcb_line_b)))
+        { return 0; }
+        icg_fcb_line_a = icg_fcb_line_a->next;
+        icg_fcb_line_b = icg_fcb_line_b->next;
+    }
+
+    return ((icg_fcb_line_a == NULL) && (icg_fcb_line_b == NULL)) ? 1 : 0;
+}
+
+int mf_icg_fcb_block_prepend(struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_block *icg_fcb_block_src)
+{
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+    uint32_t shift = (uint32_t)icg_fcb_block_src->size;
+
+    if (icg_fcb_block_src->begin == NULL) return 0;
+
+    /* Fix */
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        if (icg_fcb_line_cur->type == MF_ICG_FCB_LINE_TYPE_PC)
+        {
+            icg_fcb_line_cur->operand += shift;
+        }
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+
+    /* Link */
+    if (icg_fcb_block->begin == NULL)
+    {
+        icg_fcb_block->end = icg_fcb_block_src->end;
+    }
+    else
+    {
+        icg_fcb_block_src->end->next = icg_fcb_block->begin;
+        icg_fcb_block->begin->prev = icg_fcb_block_src->end;
+    }
+    icg_fcb_block->begin = icg_fcb_block_src->begin;
+    icg_fcb_block->size += icg_fcb_block_src->size;
+
+    icg_fcb_block_src->begin = icg_fcb_block_src->end = NULL;
+    icg_fcb_block_src->size = 0;
+
+    return 0;
+}
+
+int mf_icg_fcb_block_replace(struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_line *icg_fcb_line_begin, \
+        struct mf_icg_fcb_line *icg_fcb_line_end, \
+        struct mf_icg_fcb_block *icg_fcb_block_src)
+{
+    struct mf_icg_fcb_line *icg_fcb_line_prev, *icg_fcb_line_cur, *icg_fcb_line_next;
+
+    if ((icg_fcb_block == NULL) || (icg_fcb_line_begin == NULL)) return -MULTIPLE_ERR_NULL_PTR;
+
+    /* Remove */
+    icg_fcb_line_prev = icg_fcb_line_begin->prev;
+    icg_fcb_line_cur = icg_fcb_line_begin;
+    while (icg_fcb_line_cur != icg_fcb_line_end)
+    {
+        icg_fcb_line_next = icg_fcb_line_cur->next;
+        mf_icg_fcb_line_destroy(icg_fcb_line_cur);
+        icg_fcb_block->size -= 1;
+        icg_fcb_line_cur = icg_fcb_line_next;
+    }
+
+    /* Link */
+    if (icg_fcb_block_src->begin == NULL)
+    {
+        if (icg_fcb_line_prev == NULL) icg_fcb_block->begin = icg_fcb_line_end;
+        else icg_fcb_line_prev->next = icg_fcb_line_end;
+        if (icg_fcb_line_end == NULL) icg_fcb_block->end = icg_fcb_line_prev;
+        else icg_fcb_line_end->prev = icg_fcb_line_prev;
+        return 0;
+    }
+    if (icg_fcb_line_prev == NULL) icg_fcb_block->begin = icg_fcb_block_src->begin;
+    else icg_fcb_line_prev->next = icg_fcb_block_src->begin;
+    icg_fcb_block_src->begin->prev = icg_fcb_line_prev;
+    if (icg_fcb_line_end == NULL) icg_fcb_block->end = icg_fcb_block_src->end;
+    else icg_fcb_line_end->prev = icg_fcb_block_src->end;
+    icg_fcb_block_src->end->next = icg_fcb_line_end;
+    icg_fcb_block->size += icg_fcb_block_src->size;
+
+    icg_fcb_block_src->begin = icg_fcb_block_src->end = NULL;
+    icg_fcb_block_src->size = 0;
+
+    return 0;
+}
+
+int mf_icg_fcb_block_stamp_token(struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_line *icg_fcb_line_last, \
+        struct token *token)
+{
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+
+    if (icg_fcb_block == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    icg_fcb_line_cur = (icg_fcb_line_last == NULL) ? icg_fcb_block->begin : icg_fcb_line_last->next;
+    while (icg_fcb_line_cur != NULL)
+    {
+        icg_fcb_line_cur->token = token;
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+
+    return 0;
+}
+
 struct mf_icg_fcb_block_list *mf_icg_fcb_block_list_new(void)
 {
     struct mf_icg_fcb_block_list *new_icg_fcb_block_list = NULL;
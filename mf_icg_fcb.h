@@ -24,8 +24,16 @@
 #include <stdio.h>
 #include <stdint.h>
 
+struct token;
+
 /* Attributes for each line */
 
+enum
+{
+    /* res_id = index of the lambda block referenced by the line */
+    MF_ICG_FCB_LINE_ATTR_LAMBDA = 0,
+};
+
 struct mf_icg_fcb_line_attr
 {
     uint32_t attr_id;
@@ -66,6 +74,10 @@ enum
     /* operand = global_offsets_of_built_in_proces[res_id] 
      * At the beginning of __init__ */
     MF_ICG_FCB_LINE_TYPE_BLTIN_PROC_MK = 3, 
+
+    /* Not emitted into the icode, only kept for the runtimes 
+     * which work on the blocks directly */
+    MF_ICG_FCB_LINE_TYPE_PSEUDO = 4,
 };
 
 struct mf_icg_fcb_line
@@ -75,6 +87,9 @@ struct mf_icg_fcb_line
     int type;
     struct mf_icg_fcb_line_attr_list *attrs;
 
+    /* The first source token of the operation which produced this line */
+    struct token *token;
+
     struct mf_icg_fcb_line *prev;
     struct mf_icg_fcb_line *next;
 };
@@ -82,6 +97,14 @@ struct mf_icg_fcb_line *mf_icg_fcb_line_new(void);
 int mf_icg_fcb_line_destroy(struct mf_icg_fcb_line *icg_fcb_line);
 struct mf_icg_fcb_line *mf_icg_fcb_line_new_with_configure(uint32_t opcode, uint32_t operand);
 struct mf_icg_fcb_line *mf_icg_fcb_line_new_with_configure_type(uint32_t opcode, uint32_t operand, int type);
+int mf_icg_fcb_line_attr_append(struct mf_icg_fcb_line *icg_fcb_line, \
+        uint32_t attr_id, uint32_t res_id);
+int mf_icg_fcb_line_attr_lookup(struct mf_icg_fcb_line *icg_fcb_line, \
+        uint32_t attr_id, uint32_t *res_id_out);
+/* Returns 0 if the line makes or references a lambda */
+int mf_icg_fcb_line_lambda_idx(struct mf_icg_fcb_line *icg_fcb_line, \
+        uint32_t *lambda_idx_out);
+struct mf_icg_fcb_line *mf_icg_fcb_line_clone(struct mf_icg_fcb_line *icg_fcb_line);
 
 struct mf_icg_fcb_block
 {
@@ -89,6 +112,20 @@ struct mf_icg_fcb_block
     struct mf_icg_fcb_line *end;
     size_t size;
 
+    /* Stack effect (filled by 'mf_icg_stack_analyze') */
+    int stack_known; /* net effect and bounds are statically known */
+    int stack_safe; /* no underflow once entered with 'stack_need_max' elements */
+    int stack_returns; /* returns whenever entered, no loop on the way */
+    uint32_t stack_need; /* elements required on entry by every run */
+    uint32_t stack_need_max; /* elements required on entry by some path */
+    int32_t stack_net; /* depth difference between entry and exit */
+    uint32_t stack_max; /* maximum growth above the entry depth */
+
+    /* Lambda made once at the beginning of 'main' and referenced
+     * through a hidden variable */
+    int hoisted;
+    uint32_t hoist_id;
+
     struct mf_icg_fcb_block *prev;
     struct mf_icg_fcb_block *next;
 };
@@ -115,6 +152,28 @@ int mf_icg_fcb_block_insert_with_configure_type(struct mf_icg_fcb_block *icg_fcb
 int mf_icg_fcb_block_link(struct mf_icg_fcb_block *icg_fcb_block, \
         uint32_t instrument_number_from, uint32_t instrument_number_to);
 
+/* Structural hash and comparison, the source tokens are ignored */
+uint32_t mf_icg_fcb_block_hash(struct mf_icg_fcb_block *icg_fcb_block);
+int mf_icg_fcb_block_equal(struct mf_icg_fcb_block *icg_fcb_block_a, \
+        struct mf_icg_fcb_block *icg_fcb_block_b);
+
+/* Move all lines of 'icg_fcb_block_src' to the front of 'icg_fcb_block' */
+int mf_icg_fcb_block_prepend(struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_block *icg_fcb_block_src);
+
+/* Replace lines in [begin, end) with all lines of 'icg_fcb_block_src',
+ * only for blocks without absolute PC lines */
+int mf_icg_fcb_block_replace(struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_line *icg_fcb_line_begin, \
+        struct mf_icg_fcb_line *icg_fcb_line_end, \
+        struct mf_icg_fcb_block *icg_fcb_block_src);
+
+/* Mark the lines after 'icg_fcb_line_last' (or all lines if NULL) 
+ * as produced by 'token' */
+int mf_icg_fcb_block_stamp_token(struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_fcb_line *icg_fcb_line_last, \
+        struct token *token);
+
 struct mf_icg_fcb_block_list
 {
     struct mf_icg_fcb_block *begin;
@@ -0,0 +1,199 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Literals
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "multiply_str_aux.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_literal.h"
+
+int mf_icg_literal_value(struct multiple_error *err, \
+        struct token *token, int *value_out)
+{
+    const unsigned char *p;
+    size_t len;
+    int value;
+
+    if (token->value != TOKEN_CHAR)
+    {
+        if (multiply_convert_str_to_int(value_out, \
+                    token->str, 
+                    token->len) != 0)
+        {
+            /* Tokens are not terminated, the source may be borrowed */
+            multiple_error_update(err, -MULTIPLE_ERR_ICODEGEN, \
+                    "\'%.*s\' is an invalid integer", \
+                    (int)token->len, token->str);
+            return -MULTIPLE_ERR_ICODEGEN; 
+        }
+        return 0;
+    }
+
+    /* `c, the character might be encoded in UTF-8 */
+    p = (const unsigned char *)token->str + 1;
+    len = token->len - 1;
+    if ((len == 0) || (len > 4))
+    {
+        MULTIPLE_ERROR_INTERNAL();
+        return -MULTIPLE_ERR_INTERNAL;
+    }
+    if (len == 1)
+    { value = p[0]; }
+    else
+    {
+        value = p[0] & (0x7F >> len);
+        while (--len != 0) { value = (value << 6) | (*++p & 0x3F); }
+    }
+    *value_out = value;
+
+    return 0;
+}
+
+void mf_icg_literal_output_init(struct mf_icg_literal_output *output)
+{
+    output->str = NULL;
+    output->len = 0;
+    output->size = 0;
+    output->putchar = 0;
+    output->putchar_value = 0;
+    output->token_last = NULL;
+}
+
+void mf_icg_literal_output_uninit(struct mf_icg_literal_output *output)
+{
+    if (output->str != NULL)
+    {
+        free(output->str);
+        output->str = NULL;
+    }
+    output->len = output->size = 0;
+}
+
+static int mf_icg_literal_output_append(struct multiple_error *err, \
+        struct mf_icg_literal_output *output, \
+        const char *str, size_t len)
+{
+    char *new_str;
+    size_t new_size;
+
+    if (output->len + len + 1 > output->size)
+    {
+        new_size = (output->size == 0) ? 64 : output->size;
+        while (output->len + len + 1 > new_size) new_size *= 2;
+        new_str = (char *)realloc(output->str, sizeof(char) * new_size);
+        if (new_str == NULL)
+        {
+            MULTIPLE_ERROR_MALLOC();
+            return -MULTIPLE_ERR_MALLOC;
+        }
+        output->str = new_str;
+        output->size = new_size;
+    }
+    memcpy(output->str + output->len, str, len);
+    output->len += len;
+    output->str[output->len] = '\0';
+
+    return 0;
+}
+
+int mf_icg_literal_output_scan(struct multiple_error *err, \
+        struct mf_icg_literal_output *output, \
+        struct token *token)
+{
+    int ret = 0;
+    char *literal_str = NULL;
+    size_t literal_str_len;
+    char buffer_int[16];
+    char ch;
+    int value_int;
+
+    while ((token != NULL) && MF_ICG_IS_LITERAL_OUTPUT(token))
+    {
+        if (token->value == TOKEN_CONSTANT_STRING)
+        {
+            literal_str_len = token->len;
+            literal_str = (char *)malloc(sizeof(char) * (literal_str_len + 1));
+            if (literal_str == NULL)
+            {
+                MULTIPLE_ERROR_MALLOC();
+                ret = -MULTIPLE_ERR_MALLOC;
+                goto fail; 
+            }
+            memcpy(literal_str, token->str, token->len);
+            literal_str[literal_str_len] = '\0';
+            multiply_replace_escape_chars(literal_str, &literal_str_len);
+            if ((ret = mf_icg_literal_output_append(err, output, \
+                            literal_str, literal_str_len)) != 0)
+            { goto fail; }
+            free(literal_str);
+            literal_str = NULL;
+
+            output->token_last = token;
+            token = token->next;
+            continue;
+        }
+
+        if ((ret = mf_icg_literal_value(err, token, &value_int)) != 0)
+        { goto fail; }
+
+        if (token->next->value == TOKEN_OP_PRINT_INT)
+        {
+            sprintf(buffer_int, "%d", value_int);
+            if ((ret = mf_icg_literal_output_append(err, output, \
+                            buffer_int, strlen(buffer_int))) != 0)
+            { goto fail; }
+        }
+        else if ((value_int > 0) && (value_int <= 0xFF))
+        {
+            ch = (char)value_int;
+            if ((ret = mf_icg_literal_output_append(err, output, &ch, 1)) != 0)
+            { goto fail; }
+        }
+        else if (output->token_last == NULL)
+        {
+            /* Not a byte, kept as it is */
+            output->putchar = 1;
+            output->putchar_value = value_int;
+            output->token_last = token->next;
+            break;
+        }
+        else
+        {
+            break;
+        }
+
+        output->token_last = token->next;
+        token = token->next->next;
+    }
+
+    goto done;
+fail:
+done:
+    if (literal_str != NULL) free(literal_str);
+    return ret;
+}
+
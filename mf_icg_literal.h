@@ -0,0 +1,65 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Literals
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ICG_LITERAL_H_
+#define _MF_ICG_LITERAL_H_
+
+#include <stdio.h>
+
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+
+/* Value of an integer or character literal */
+int mf_icg_literal_value(struct multiple_error *err, \
+        struct token *token, int *value_out);
+
+/* Literals printed right away */
+#define MF_ICG_IS_LITERAL_OUTPUT(x) \
+    (((x)->value==TOKEN_CONSTANT_STRING)|| \
+     ((((x)->value==TOKEN_CHAR)||(IS_TOKEN_CONSTANT((x)->value))) && \
+      ((x)->next != NULL) && \
+      (((x)->next->value==TOKEN_OP_PRINT_CHAR)||((x)->next->value==TOKEN_OP_PRINT_INT))))
+
+struct mf_icg_literal_output
+{
+    /* Text of the whole run */
+    char *str;
+    size_t len;
+    size_t size;
+
+    /* A ',' of a value which is not a byte, it is never merged */
+    int putchar;
+    int putchar_value;
+
+    /* The last token of the run */
+    struct token *token_last;
+};
+
+void mf_icg_literal_output_init(struct mf_icg_literal_output *output);
+void mf_icg_literal_output_uninit(struct mf_icg_literal_output *output);
+
+/* Collect the run of literal output starting at 'token' */
+int mf_icg_literal_output_scan(struct multiple_error *err, \
+        struct mf_icg_literal_output *output, \
+        struct token *token);
+
+#endif
+
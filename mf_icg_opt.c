@@ -0,0 +1,340 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Optimization
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+#include "mf_icg_opt.h"
+
+/* Bodies with more lines than this are still called */
+#define MF_ICG_OPT_INLINE_SIZE_MAX 32
+
+/* The first line after the group of lines produced by one operation */
+static struct mf_icg_fcb_line *mf_icg_opt_group_end(struct mf_icg_fcb_line *icg_fcb_line)
+{
+    struct token *token = icg_fcb_line->token;
+
+    while ((icg_fcb_line != NULL) && (icg_fcb_line->token == token))
+    { icg_fcb_line = icg_fcb_line->next; }
+    return icg_fcb_line;
+}
+
+static int mf_icg_opt_group_is_var(struct mf_icg_fcb_line *icg_fcb_line, int op)
+{
+    struct token *token = icg_fcb_line->token;
+
+    return ((token != NULL) && \
+            (token->value == TOKEN_VARIABLE) && \
+            (token->next != NULL) && \
+            (token->next->value == op)) ? 1 : 0;
+}
+
+/* 'a' is written before 'b' in the source */
+static int mf_icg_opt_token_before(const struct token *a, const struct token *b)
+{
+    return ((a->pos_ln < b->pos_ln) || \
+            ((a->pos_ln == b->pos_ln) && (a->pos_col < b->pos_col))) ? 1 : 0;
+}
+
+/* Global variables */
+
+struct mf_icg_opt_var
+{
+    uint32_t id;
+    size_t assign_count;
+    /* The only assignment is a lambda literal */
+    int lambda_known;
+    uint32_t lambda_idx;
+    /* ... made in 'main' itself, so it runs once and before anything 
+     * written after it, unlike one in a lambda, a '?' or a '#' */
+    int assign_main;
+    struct token *assign_token;
+
+    struct mf_icg_opt_var *next;
+};
+
+static struct mf_icg_opt_var *mf_icg_opt_var_lookup(struct mf_icg_opt_var *vars, uint32_t id)
+{
+    while (vars != NULL)
+    {
+        if (vars->id == id) return vars;
+        vars = vars->next;
+    }
+    return NULL;
+}
+
+static void mf_icg_opt_vars_destroy(struct mf_icg_opt_var *vars)
+{
+    struct mf_icg_opt_var *var_next;
+
+    while (vars != NULL)
+    {
+        var_next = vars->next;
+        free(vars);
+        vars = var_next;
+    }
+}
+
+/* Record every assignment and what is assigned, 'main' is the last 
+ * block */
+static int mf_icg_opt_vars_collect(struct mf_icg_opt_var **vars_out, \
+        struct mf_icg_fcb_block_list *icg_fcb_block_list)
+{
+    int ret = 0;
+    struct mf_icg_opt_var *vars = NULL, *var_cur;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    struct mf_icg_fcb_line *icg_fcb_line_cur, *icg_fcb_line_prev_group, *icg_fcb_line_scan;
+    uint32_t lambda_idx;
+    int lambda_known;
+
+    icg_fcb_block_cur = icg_fcb_block_list->begin;
+    while (icg_fcb_block_cur != NULL)
+    {
+        icg_fcb_line_prev_group = NULL;
+        icg_fcb_line_cur = icg_fcb_block_cur->begin;
+        while (icg_fcb_line_cur != NULL)
+        {
+            if (mf_icg_opt_group_is_var(icg_fcb_line_cur, TOKEN_OP_ASSIGN))
+            {
+                /* '[...]' right before ':' */
+                lambda_known = 0;
+                lambda_idx = 0;
+                if ((icg_fcb_line_prev_group != NULL) && \
+                        (icg_fcb_line_prev_group->token != NULL) && \
+                        (icg_fcb_line_prev_group->token->value == TOKEN_OP_LEFT_BRACKET))
+                {
+                    for (icg_fcb_line_scan = icg_fcb_line_prev_group; \
+                            icg_fcb_line_scan != icg_fcb_line_cur; \
+                            icg_fcb_line_scan = icg_fcb_line_scan->next)
+                    {
+                        if (mf_icg_fcb_line_lambda_idx(icg_fcb_line_scan, &lambda_idx) == 0)
+                        { lambda_known = 1; break; }
+                    }
+                }
+
+                if ((var_cur = mf_icg_opt_var_lookup(vars, icg_fcb_line_cur->operand)) == NULL)
+                {
+                    var_cur = (struct mf_icg_opt_var *)malloc(sizeof(struct mf_icg_opt_var));
+                    if (var_cur == NULL)
+                    {
+                        ret = -MULTIPLE_ERR_MALLOC;
+                        goto fail;
+                    }
+                    var_cur->id = icg_fcb_line_cur->operand;
+                    var_cur->assign_count = 0;
+                    var_cur->lambda_known = 0;
+                    var_cur->lambda_idx = 0;
+                    var_cur->assign_main = 0;
+                    var_cur->assign_token = NULL;
+                    var_cur->next = vars;
+                    vars = var_cur;
+                }
+                var_cur->assign_count += 1;
+                var_cur->lambda_known = lambda_known;
+                var_cur->lambda_idx = lambda_idx;
+                var_cur->assign_main = (icg_fcb_block_cur == icg_fcb_block_list->end) ? 1 : 0;
+                var_cur->assign_token = icg_fcb_line_cur->token;
+            }
+
+            icg_fcb_line_prev_group = icg_fcb_line_cur;
+            icg_fcb_line_cur = mf_icg_opt_group_end(icg_fcb_line_cur);
+        }
+        icg_fcb_block_cur = icg_fcb_block_cur->next;
+    }
+
+    *vars_out = vars;
+    vars = NULL;
+
+    goto done;
+fail:
+done:
+    mf_icg_opt_vars_destroy(vars);
+    return ret;
+}
+
+/* Body lines without the prologue and epilogue of the lambda */
+static int mf_icg_opt_inline_body(struct mf_icg_fcb_block **icg_fcb_block_out, \
+        struct mf_icg_fcb_block *icg_fcb_block_lambda)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block *new_icg_fcb_block = NULL;
+    struct mf_icg_fcb_line *icg_fcb_line_cur, *new_icg_fcb_line;
+    size_t size = 0;
+
+    *icg_fcb_block_out = NULL;
+
+    icg_fcb_line_cur = icg_fcb_block_lambda->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        if (icg_fcb_line_cur->token != NULL) size++;
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+    if (size > MF_ICG_OPT_INLINE_SIZE_MAX) goto done;
+
+    if ((new_icg_fcb_block = mf_icg_fcb_block_new()) == NULL)
+    {
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+    icg_fcb_line_cur = icg_fcb_block_lambda->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        if (icg_fcb_line_cur->token != NULL)
+        {
+            if ((new_icg_fcb_line = mf_icg_fcb_line_clone(icg_fcb_line_cur)) == NULL)
+            {
+                ret = -MULTIPLE_ERR_MALLOC;
+                goto fail;
+            }
+            mf_icg_fcb_block_append(new_icg_fcb_block, new_icg_fcb_line);
+        }
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+    /* Without a token the pseudo line ends the copy, two copies next
+     * to each other are not taken as a single operation */
+    if ((ret = mf_icg_fcb_block_append_with_configure_type(new_icg_fcb_block, \
+                    0, 0, MF_ICG_FCB_LINE_TYPE_PSEUDO)) != 0)
+    { goto fail; }
+
+    *icg_fcb_block_out = new_icg_fcb_block;
+    new_icg_fcb_block = NULL;
+
+    goto done;
+fail:
+done:
+    if (new_icg_fcb_block != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block);
+    return ret;
+}
+
+static int mf_icg_opt_inline_lambda_vars_block(struct mf_icg_opt_var *vars, \
+        struct mf_icg_fcb_block **blocks, size_t blocks_count, \
+        size_t block_idx)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block *icg_fcb_block = blocks[block_idx];
+    struct mf_icg_fcb_block *new_icg_fcb_block_body = NULL;
+    struct mf_icg_fcb_line *icg_fcb_line_cur, *icg_fcb_line_apply, *icg_fcb_line_next;
+    struct mf_icg_opt_var *var_cur;
+
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        icg_fcb_line_apply = mf_icg_opt_group_end(icg_fcb_line_cur);
+        icg_fcb_line_next = icg_fcb_line_apply;
+
+        /* f;! */
+        if ((icg_fcb_line_apply != NULL) && \
+                (icg_fcb_line_apply->token != NULL) && \
+                (icg_fcb_line_apply->token->value == TOKEN_OP_APPLY) && \
+                mf_icg_opt_group_is_var(icg_fcb_line_cur, TOKEN_OP_GET_VALUE) && \
+                ((var_cur = mf_icg_opt_var_lookup(vars, icg_fcb_line_cur->operand)) != NULL) && \
+                (var_cur->assign_count == 1) && \
+                (var_cur->lambda_known != 0) && \
+                (var_cur->assign_main != 0) && \
+                mf_icg_opt_token_before(var_cur->assign_token, icg_fcb_line_cur->token) && \
+                ((size_t)var_cur->lambda_idx < blocks_count) && \
+                ((size_t)var_cur->lambda_idx != block_idx))
+        {
+            icg_fcb_line_next = mf_icg_opt_group_end(icg_fcb_line_apply);
+            if ((ret = mf_icg_opt_inline_body(&new_icg_fcb_block_body, \
+                            blocks[var_cur->lambda_idx])) != 0)
+            { goto fail; }
+            if (new_icg_fcb_block_body != NULL)
+            {
+                if ((ret = mf_icg_fcb_block_replace(icg_fcb_block, \
+                                icg_fcb_line_cur, icg_fcb_line_next, \
+                                new_icg_fcb_block_body)) != 0)
+                { goto fail; }
+                mf_icg_fcb_block_destroy(new_icg_fcb_block_body);
+                new_icg_fcb_block_body = NULL;
+            }
+        }
+
+        icg_fcb_line_cur = icg_fcb_line_next;
+    }
+
+    goto done;
+fail:
+done:
+    if (new_icg_fcb_block_body != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block_body);
+    return ret;
+}
+
+int mf_icg_opt_inline_lambda_vars(struct multiple_error *err, \
+        struct mf_icg_context *context)
+{
+    int ret = 0;
+    struct mf_icg_opt_var *vars = NULL;
+    struct mf_icg_fcb_block **blocks = NULL;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    size_t blocks_count = context->icg_fcb_block_list->size;
+    size_t idx;
+
+    if (blocks_count == 0) return 0;
+
+    if ((ret = mf_icg_opt_vars_collect(&vars, context->icg_fcb_block_list)) != 0)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        goto fail;
+    }
+
+    blocks = (struct mf_icg_fcb_block **)malloc(sizeof(struct mf_icg_fcb_block *) * blocks_count);
+    if (blocks == NULL)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+    idx = 0;
+    icg_fcb_block_cur = context->icg_fcb_block_list->begin;
+    while (icg_fcb_block_cur != NULL)
+    {
+        blocks[idx++] = icg_fcb_block_cur;
+        icg_fcb_block_cur = icg_fcb_block_cur->next;
+    }
+
+    /* The inlined lines are never scanned again, so a recursive 
+     * lambda is expanded at most once at each call site */
+    for (idx = 0; idx != blocks_count; idx++)
+    {
+        if ((ret = mf_icg_opt_inline_lambda_vars_block(vars, \
+                        blocks, blocks_count, idx)) != 0)
+        {
+            MULTIPLE_ERROR_MALLOC();
+            goto fail;
+        }
+    }
+
+    goto done;
+fail:
+done:
+    if (blocks != NULL) free(blocks);
+    mf_icg_opt_vars_destroy(vars);
+    return ret;
+}
+
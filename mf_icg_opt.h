@@ -0,0 +1,35 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Optimization
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ICG_OPT_H_
+#define _MF_ICG_OPT_H_
+
+#include "multiple_err.h"
+
+#include "mf_icg_context.h"
+
+/* Inline the calls 'f;!' where 'f' is assigned only once in the
+ * whole program with a lambda literal, in 'main' itself and written 
+ * before the call */
+int mf_icg_opt_inline_lambda_vars(struct multiple_error *err, \
+        struct mf_icg_context *context);
+
+#endif
+
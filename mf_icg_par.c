@@ -0,0 +1,545 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Parallel Lambdas
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef MF_ICG_NO_THREADS
+#include <pthread.h>
+#endif
+
+#include "multiple_ir.h"
+#include "multiple_err.h"
+
+#include "vm_opcode.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+#include "mf_icg_par.h"
+
+int mf_icg_par_new(struct multiple_error *err, \
+        struct mf_icg_par **par_out, struct token *token_begin)
+{
+    int ret = 0;
+    struct mf_icg_par *new_par = NULL;
+    struct token *token_cur;
+    size_t jobs_count = 0, depth = 0;
+
+    *par_out = NULL;
+
+    /* Brackets of the lambdas in 'main', an unbalanced one leaves the 
+     * rest to be generated in place where it gets reported */
+    for (token_cur = token_begin; \
+            (token_cur != NULL) && (token_cur->value != TOKEN_FINISH); \
+            token_cur = token_cur->next)
+    {
+        if (token_cur->value == TOKEN_OP_LEFT_BRACKET)
+        {
+            if (depth == 0) jobs_count += 1;
+            depth += 1;
+        }
+        else if (token_cur->value == TOKEN_OP_RIGHT_BRACKET)
+        {
+            if (depth == 0) break;
+            depth -= 1;
+        }
+    }
+    if (depth != 0) jobs_count -= 1;
+    if (jobs_count == 0) goto done;
+
+    if ((new_par = (struct mf_icg_par *)malloc(sizeof(struct mf_icg_par))) == NULL)
+    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    new_par->jobs_count = 0;
+    new_par->next = 0;
+    if ((new_par->jobs = (struct mf_icg_par_job *)malloc( \
+                    sizeof(struct mf_icg_par_job) * jobs_count)) == NULL)
+    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    depth = 0;
+    for (token_cur = token_begin; \
+            new_par->jobs_count != jobs_count; \
+            token_cur = token_cur->next)
+    {
+        if (token_cur->value == TOKEN_OP_LEFT_BRACKET)
+        {
+            if (depth == 0)
+            {
+                new_par->jobs[new_par->jobs_count].token_begin = token_cur;
+                new_par->jobs[new_par->jobs_count].token_end = NULL;
+                new_par->jobs[new_par->jobs_count].icg_fcb_block_ref = NULL;
+                new_par->jobs[new_par->jobs_count].ret = -MULTIPLE_ERR_INTERNAL;
+                mf_icg_context_init(&new_par->jobs[new_par->jobs_count].context);
+                new_par->jobs_count += 1;
+            }
+            depth += 1;
+        }
+        else if (token_cur->value == TOKEN_OP_RIGHT_BRACKET)
+        {
+            depth -= 1;
+        }
+    }
+
+    *par_out = new_par;
+    new_par = NULL;
+
+    goto done;
+fail:
+    if (new_par != NULL) mf_icg_par_destroy(new_par);
+done:
+    return ret;
+}
+
+int mf_icg_par_destroy(struct mf_icg_par *par)
+{
+    size_t idx;
+
+    if (par == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    if (par->jobs != NULL)
+    {
+        for (idx = 0; idx != par->jobs_count; idx++)
+        {
+            if (par->jobs[idx].icg_fcb_block_ref != NULL)
+            { mf_icg_fcb_block_destroy(par->jobs[idx].icg_fcb_block_ref); }
+            mf_icg_context_teardown(&par->jobs[idx].context);
+        }
+        free(par->jobs);
+    }
+    free(par);
+
+    return 0;
+}
+
+static int mf_icg_par_job_generate(struct mf_icg_par_job *job, \
+        mf_icg_par_generate_t generate)
+{
+    int ret = 0;
+    struct multiple_error *err = NULL;
+    struct token *token_cur = job->token_begin;
+
+    /* Errors are only reported by the generation in place */
+    if ((err = multiple_error_new()) == NULL)
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    if ((ret = mf_icg_context_setup(&job->context)) != 0) { goto fail; }
+    if ((job->context.res_log = mf_icg_res_log_new()) == NULL)
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    if ((job->icg_fcb_block_ref = mf_icg_fcb_block_new()) == NULL)
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    /* Taken through the log like the shared context does */
+    if ((ret = mf_icg_context_res_reserve(err, &job->context)) != 0)
+    { goto fail; }
+
+    if ((ret = generate(err, \
+                    &job->context, \
+                    job->icg_fcb_block_ref, \
+                    &token_cur)) != 0)
+    { goto fail; }
+    job->token_end = token_cur;
+
+    goto done;
+fail:
+done:
+    if (err != NULL) multiple_error_destroy(err);
+    job->ret = ret;
+    return ret;
+}
+
+/* Pool */
+
+struct mf_icg_par_pool
+{
+    struct mf_icg_par *par;
+    mf_icg_par_generate_t generate;
+
+    /* Next job to be taken */
+    size_t next;
+#ifndef MF_ICG_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+static void *mf_icg_par_worker(void *data)
+{
+    struct mf_icg_par_pool *pool = (struct mf_icg_par_pool *)data;
+    size_t idx;
+
+    for (;;)
+    {
+#ifndef MF_ICG_NO_THREADS
+        pthread_mutex_lock(&pool->lock);
+#endif
+        idx = pool->next;
+        if (idx < pool->par->jobs_count) pool->next += 1;
+#ifndef MF_ICG_NO_THREADS
+        pthread_mutex_unlock(&pool->lock);
+#endif
+        if (idx >= pool->par->jobs_count) break;
+
+        mf_icg_par_job_generate(&pool->par->jobs[idx], pool->generate);
+    }
+
+    return NULL;
+}
+
+int mf_icg_par_run(struct mf_icg_par *par, size_t threads, \
+        mf_icg_par_generate_t generate)
+{
+    struct mf_icg_par_pool pool;
+#ifndef MF_ICG_NO_THREADS
+    pthread_t *workers = NULL;
+    size_t workers_count = 0, idx;
+#endif
+
+    if (threads > par->jobs_count) threads = par->jobs_count;
+
+    pool.par = par;
+    pool.generate = generate;
+    pool.next = 0;
+
+#ifndef MF_ICG_NO_THREADS
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) return -MULTIPLE_ERR_INTERNAL;
+    if (threads > 1)
+    {
+        /* Fewer workers if some could not be created */
+        if ((workers = (pthread_t *)malloc(sizeof(pthread_t) * (threads - 1))) != NULL)
+        {
+            for (idx = 0; idx != threads - 1; idx++)
+            {
+                if (pthread_create(&workers[workers_count], NULL, mf_icg_par_worker, &pool) != 0) break;
+                workers_count++;
+            }
+        }
+    }
+#else
+    (void)threads;
+#endif
+
+    /* The calling thread works as well */
+    mf_icg_par_worker(&pool);
+
+#ifndef MF_ICG_NO_THREADS
+    for (idx = 0; idx != workers_count; idx++) pthread_join(workers[idx], NULL);
+    if (workers != NULL) free(workers);
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    return 0;
+}
+
+int mf_icg_par_lookup(struct mf_icg_par *par, struct token *token, \
+        struct mf_icg_par_job **job_out)
+{
+    struct mf_icg_par_job *job;
+
+    if (par->next == par->jobs_count) return -1;
+    job = &par->jobs[par->next];
+    if (job->token_begin != token) return -1;
+    par->next += 1;
+    if (job->ret != 0) return -1;
+
+    *job_out = job;
+    return 0;
+}
+
+/* Lines carrying a resource ID of the icode */
+#define MF_ICG_PAR_LINE_RES(line) \
+    (((line)->type == MF_ICG_FCB_LINE_TYPE_NORMAL) && \
+     (((line)->opcode == OP_PUSH) || \
+      ((line)->opcode == OP_PUSHM) || \
+      ((line)->opcode == OP_POPM) || \
+      ((line)->opcode == OP_ARGC)))
+
+static int mf_icg_par_merge_res_item(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_res_log_item *item)
+{
+    int ret;
+
+    if (item->moved != 0) return 0;
+    if ((ret = mf_icg_context_res(err, context, &item->id_moved, \
+                    item->kind, item->value, item->str, item->len)) != 0)
+    { return ret; }
+    item->moved = 1;
+
+    return 0;
+}
+
+static int mf_icg_par_merge_res(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_par_job *job, \
+        struct mf_icg_fcb_block *icg_fcb_block)
+{
+    int ret = 0;
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+    struct mf_icg_res_log_item *item;
+    uint32_t lambda_idx;
+
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        /* Hidden variables of lambdas are named after the index */
+        if (MF_ICG_PAR_LINE_RES(icg_fcb_line_cur) && \
+                (mf_icg_fcb_line_lambda_idx(icg_fcb_line_cur, &lambda_idx) != 0))
+        {
+            if (mf_icg_res_log_lookup(job->context.res_log, \
+                        icg_fcb_line_cur->operand, &item) != 0)
+            {
+                MULTIPLE_ERROR_INTERNAL();
+                ret = -MULTIPLE_ERR_INTERNAL;
+                goto fail;
+            }
+            if ((ret = mf_icg_par_merge_res_item(err, context, item)) != 0)
+            { goto fail; }
+            icg_fcb_line_cur->operand = item->id_moved;
+        }
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+static int mf_icg_par_merge_lambda_refs(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        uint32_t *lambda_idx_map, \
+        struct mf_icg_fcb_block **icg_fcb_block_map)
+{
+    int ret = 0;
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+    struct mf_icg_fcb_line_attr *attr_cur;
+    uint32_t lambda_idx;
+
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        if (mf_icg_fcb_line_lambda_idx(icg_fcb_line_cur, &lambda_idx) == 0)
+        {
+            if (icg_fcb_line_cur->type == MF_ICG_FCB_LINE_TYPE_LAMBDA_MK)
+            { icg_fcb_line_cur->operand = lambda_idx_map[lambda_idx]; }
+            else
+            {
+                for (attr_cur = icg_fcb_line_cur->attrs->begin; attr_cur != NULL; attr_cur = attr_cur->next)
+                {
+                    if (attr_cur->attr_id == MF_ICG_FCB_LINE_ATTR_LAMBDA)
+                    { attr_cur->res_id = lambda_idx_map[lambda_idx]; }
+                }
+                if (icg_fcb_line_cur->opcode == OP_PUSHM)
+                {
+                    if ((ret = mf_icg_context_lambda_hoist(err, \
+                                    context, \
+                                    icg_fcb_block_map[lambda_idx], \
+                                    lambda_idx_map[lambda_idx])) != 0)
+                    { goto fail; }
+                    icg_fcb_line_cur->operand = icg_fcb_block_map[lambda_idx]->hoist_id;
+                }
+            }
+        }
+        icg_fcb_line_cur = icg_fcb_line_cur->next;
+    }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+/* Move the block at 'lambda_idx' of the job, or drop it for the 
+ * same one already in 'context' */
+static int mf_icg_par_merge_block(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_par_job *job, \
+        struct mf_icg_fcb_block **icg_fcb_blocks, \
+        uint32_t lambda_idx, \
+        uint32_t *lambda_idx_map, \
+        struct mf_icg_fcb_block **icg_fcb_block_map)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block *icg_fcb_block_cur = icg_fcb_blocks[lambda_idx];
+    struct mf_icg_fcb_block *icg_fcb_block_shared;
+    struct multiple_ir_export_section_item *new_export_section_item = NULL;
+    uint32_t hash;
+
+    icg_fcb_block_cur->hoisted = 0;
+    icg_fcb_block_cur->hoist_id = 0;
+
+    if ((ret = mf_icg_par_merge_res(err, \
+                    context, \
+                    job, \
+                    icg_fcb_block_cur)) != 0)
+    { goto fail; }
+    if ((ret = mf_icg_par_merge_lambda_refs(err, \
+                    context, \
+                    icg_fcb_block_cur, \
+                    lambda_idx_map, \
+                    icg_fcb_block_map)) != 0)
+    { goto fail; }
+
+    hash = mf_icg_fcb_block_hash(icg_fcb_block_cur);
+    if (mf_icg_lambda_table_lookup(context->lambda_table, \
+                icg_fcb_block_cur, hash, \
+                &icg_fcb_block_shared, &lambda_idx_map[lambda_idx]) == 0)
+    {
+        mf_icg_fcb_block_destroy(icg_fcb_block_cur);
+        icg_fcb_blocks[lambda_idx] = NULL;
+        icg_fcb_block_map[lambda_idx] = icg_fcb_block_shared;
+        goto done;
+    }
+
+    new_export_section_item = multiple_ir_export_section_item_new();
+    if (new_export_section_item == NULL)
+    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    new_export_section_item->blank = 1;
+
+    lambda_idx_map[lambda_idx] = (uint32_t)(context->icg_fcb_block_list->size);
+    icg_fcb_block_map[lambda_idx] = icg_fcb_block_cur;
+    if ((ret = mf_icg_lambda_table_register(context->lambda_table, \
+                    icg_fcb_block_cur, hash, lambda_idx_map[lambda_idx])) != 0)
+    { MULTIPLE_ERROR_MALLOC(); goto fail; }
+    if ((ret = mf_icg_fcb_block_list_append(context->icg_fcb_block_list, icg_fcb_block_cur)) != 0)
+    { MULTIPLE_ERROR_INTERNAL(); goto fail; }
+    icg_fcb_blocks[lambda_idx] = NULL;
+    if ((ret = multiple_ir_export_section_append(context->icode->export_section, new_export_section_item)) != 0)
+    { MULTIPLE_ERROR_INTERNAL(); goto fail; }
+    new_export_section_item = NULL;
+
+    goto done;
+fail:
+    if (new_export_section_item != NULL) multiple_ir_export_section_item_destroy(new_export_section_item);
+done:
+    return ret;
+}
+
+int mf_icg_par_merge(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_par_job *job, \
+        struct mf_icg_fcb_block **icg_fcb_block_out, \
+        uint32_t *lambda_idx_out)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block_list *icg_fcb_block_list = job->context.icg_fcb_block_list;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    struct mf_icg_fcb_block **icg_fcb_blocks = NULL;
+    struct mf_icg_res_log *res_log = job->context.res_log;
+    struct mf_icg_res_log_item *item;
+    uint32_t *lambda_idx_map = NULL;
+    struct mf_icg_fcb_block **icg_fcb_block_map = NULL;
+    uint32_t lambda_idx, lambda_idx_ref, merged = 0;
+    size_t count = icg_fcb_block_list->size, idx;
+
+    if ((job->icg_fcb_block_ref->begin == NULL) || \
+            (mf_icg_fcb_line_lambda_idx(job->icg_fcb_block_ref->begin, &lambda_idx_ref) != 0) || \
+            (lambda_idx_ref >= count))
+    {
+        MULTIPLE_ERROR_INTERNAL();
+        ret = -MULTIPLE_ERR_INTERNAL;
+        goto fail;
+    }
+
+    lambda_idx_map = (uint32_t *)malloc(sizeof(uint32_t) * count);
+    icg_fcb_block_map = (struct mf_icg_fcb_block **)malloc(sizeof(struct mf_icg_fcb_block *) * count);
+    icg_fcb_blocks = (struct mf_icg_fcb_block **)malloc(sizeof(struct mf_icg_fcb_block *) * count);
+    if ((lambda_idx_map == NULL) || (icg_fcb_block_map == NULL) || (icg_fcb_blocks == NULL))
+    { MULTIPLE_ERROR_MALLOC(); ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    /* Nested lambdas come before the ones referencing them, which 
+     * is the order they are appended in when generated in place */
+    icg_fcb_block_cur = icg_fcb_block_list->begin;
+    for (lambda_idx = 0; lambda_idx != count; lambda_idx++)
+    {
+        icg_fcb_blocks[lambda_idx] = icg_fcb_block_cur;
+        icg_fcb_block_cur = icg_fcb_block_cur->next;
+        icg_fcb_blocks[lambda_idx]->prev = icg_fcb_blocks[lambda_idx]->next = NULL;
+    }
+    icg_fcb_block_list->begin = icg_fcb_block_list->end = NULL;
+    icg_fcb_block_list->size = 0;
+
+    /* Resources are requested again in the order of the log, which is 
+     * the order the generation in place requests them in, so the IDs 
+     * come out the same. A hidden variable is requested right after 
+     * its lambda has been made, as it is in place */
+    for (idx = 0; idx != res_log->size; idx++)
+    {
+        item = &res_log->items[idx];
+        if (item->hoist == 0)
+        {
+            if ((ret = mf_icg_par_merge_res_item(err, context, item)) != 0)
+            { goto fail; }
+            continue;
+        }
+
+        if (item->lambda_idx >= count)
+        {
+            MULTIPLE_ERROR_INTERNAL();
+            ret = -MULTIPLE_ERR_INTERNAL;
+            goto fail;
+        }
+        for (; merged <= item->lambda_idx; merged++)
+        {
+            if ((ret = mf_icg_par_merge_block(err, context, job, \
+                            icg_fcb_blocks, merged, \
+                            lambda_idx_map, icg_fcb_block_map)) != 0)
+            { goto fail; }
+        }
+        if ((ret = mf_icg_context_lambda_hoist(err, \
+                        context, \
+                        icg_fcb_block_map[item->lambda_idx], \
+                        lambda_idx_map[item->lambda_idx])) != 0)
+        { goto fail; }
+        item->id_moved = icg_fcb_block_map[item->lambda_idx]->hoist_id;
+        item->moved = 1;
+    }
+    for (; merged != count; merged++)
+    {
+        if ((ret = mf_icg_par_merge_block(err, context, job, \
+                        icg_fcb_blocks, merged, \
+                        lambda_idx_map, icg_fcb_block_map)) != 0)
+        { goto fail; }
+    }
+
+    *icg_fcb_block_out = icg_fcb_block_map[lambda_idx_ref];
+    *lambda_idx_out = lambda_idx_map[lambda_idx_ref];
+
+    goto done;
+fail:
+    /* The blocks not moved yet */
+    if (icg_fcb_blocks != NULL)
+    {
+        for (lambda_idx = merged; lambda_idx < count; lambda_idx++)
+        {
+            if (icg_fcb_blocks[lambda_idx] != NULL)
+            { mf_icg_fcb_block_destroy(icg_fcb_blocks[lambda_idx]); }
+        }
+    }
+done:
+    if (icg_fcb_blocks != NULL) free(icg_fcb_blocks);
+    if (lambda_idx_map != NULL) free(lambda_idx_map);
+    if (icg_fcb_block_map != NULL) free(icg_fcb_block_map);
+    return ret;
+}
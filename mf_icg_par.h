@@ -0,0 +1,109 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Parallel Lambdas
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ICG_PAR_H_
+#define _MF_ICG_PAR_H_
+
+#include <stdint.h>
+
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+
+/* The lambdas written directly in 'main' are found first and each 
+ * one is generated on a pool of threads into a private context, with 
+ * private resource IDs. When the generation of 'main' reaches one of 
+ * them its blocks are moved into the shared context, with resources, 
+ * lambda indices and sharing worked out again there, so the result 
+ * only depends on the source and not on the number of threads. 
+ * Without pthreads define MF_ICG_NO_THREADS and the lambdas are 
+ * generated one after another before 'main' */
+
+/* Host calls made on the threads, assumed and not verified to be 
+ * thread-safe as long as each thread works on objects of its own: 
+ * - multiply_asm_precompile and multiply_text_precompiled_destroy, 
+ *   which only work on their arguments; 
+ * - multiple_ir_new, multiple_ir_export_section_*, 
+ *   multiply_resource_id_pool_new and multiply_resource_get_*, 
+ *   every job has its own icode and pool; 
+ * - multiple_error_new, multiple_error_update and 
+ *   multiple_error_destroy, every job has its own error object; 
+ * - multiply_convert_str_to_int and multiply_replace_escape_chars. 
+ * The token list is shared and only read, and the tables of the 
+ * front end are const. The stubs of 'false_batch.h' make the same 
+ * calls plus the ones of the lexer and 'mf_stub_create', each on its 
+ * own stub. tests/thread_tsan.sh checks the front end with 
+ * 'false-run -x' under -fsanitize=thread, and the host library too 
+ * only when that is built the same way */
+
+/* 'mf_icodegen_func_define' */
+typedef int (*mf_icg_par_generate_t)(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct token **token_cur_in_out);
+
+struct mf_icg_par_job
+{
+    /* "[" of the lambda */
+    struct token *token_begin;
+
+    /* Blocks of the lambda and the ones nested in it, referenced 
+     * from the only line of 'icg_fcb_block_ref' */
+    struct mf_icg_context context;
+    struct mf_icg_fcb_block *icg_fcb_block_ref;
+
+    /* Failed jobs are generated again in place, so the error is 
+     * reported through the caller */
+    int ret;
+    struct token *token_end;
+};
+
+struct mf_icg_par
+{
+    struct mf_icg_par_job *jobs;
+    size_t jobs_count;
+
+    /* Jobs are looked up in the order of the source */
+    size_t next;
+};
+
+/* No lambda in 'main' gives NULL */
+int mf_icg_par_new(struct multiple_error *err, \
+        struct mf_icg_par **par_out, struct token *token_begin);
+int mf_icg_par_destroy(struct mf_icg_par *par);
+
+int mf_icg_par_run(struct mf_icg_par *par, size_t threads, \
+        mf_icg_par_generate_t generate);
+
+/* Returns 0 if the lambda beginning with 'token' has been generated */
+int mf_icg_par_lookup(struct mf_icg_par *par, struct token *token, \
+        struct mf_icg_par_job **job_out);
+
+/* Move the blocks of the job into 'context' */
+int mf_icg_par_merge(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_par_job *job, \
+        struct mf_icg_fcb_block **icg_fcb_block_out, \
+        uint32_t *lambda_idx_out);
+
+#endif
+
@@ -0,0 +1,514 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Partial Evaluation
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_ir.h"
+#include "multiple_err.h"
+
+#include "vm_opcode.h"
+
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+#include "mf_prog.h"
+#include "mf_icg_peval.h"
+
+/* Limits of the state which is worth being precomputed */
+#define MF_ICG_PEVAL_STACK_MAX 65536
+#define MF_ICG_PEVAL_STATE_MAX 4096
+#define MF_ICG_PEVAL_OUTPUT_MAX (1024 * 1024)
+#define MF_ICG_PEVAL_DEPTH_MAX 1024
+
+/* Evaluation stopped, not an error */
+#define MF_ICG_PEVAL_STOP 1
+
+struct mf_icg_peval_value
+{
+    int32_t value;
+    int lambda; /* 'value' is the index of a lambda */
+};
+
+struct mf_icg_peval_machine
+{
+    struct mf_prog *prog;
+
+    struct mf_icg_peval_value *stack;
+    size_t sp;
+
+    struct mf_icg_peval_value vars[MF_PROG_VARS_MAX];
+    int vars_set[MF_PROG_VARS_MAX];
+
+    char *output;
+    size_t output_len;
+
+    size_t budget;
+    size_t depth;
+};
+
+static void mf_icg_peval_machine_reset(struct mf_icg_peval_machine *machine, \
+        size_t budget)
+{
+    size_t idx;
+
+    machine->sp = 0;
+    for (idx = 0; idx != MF_PROG_VARS_MAX; idx++) machine->vars_set[idx] = 0;
+    machine->output_len = 0;
+    machine->budget = budget;
+    machine->depth = 0;
+}
+
+#define PUSH_INT(x) \
+    do { \
+        if (machine->sp == MF_ICG_PEVAL_STACK_MAX) return MF_ICG_PEVAL_STOP; \
+        machine->stack[machine->sp].value = (x); \
+        machine->stack[machine->sp].lambda = 0; \
+        machine->sp++; \
+    } while (0)
+
+#define PUSH_VALUE(x) \
+    do { \
+        if (machine->sp == MF_ICG_PEVAL_STACK_MAX) return MF_ICG_PEVAL_STOP; \
+        machine->stack[machine->sp++] = (x); \
+    } while (0)
+
+#define NEED(n) \
+    do { if (machine->sp < (n)) return MF_ICG_PEVAL_STOP; } while (0)
+
+#define NEED_INT(n) \
+    do { \
+        NEED(n); \
+        for (count = 1; count <= (n); count++) \
+        { if (machine->stack[machine->sp - count].lambda != 0) return MF_ICG_PEVAL_STOP; } \
+    } while (0)
+
+#define TOP(n) (machine->stack[machine->sp - 1 - (n)])
+
+static int mf_icg_peval_output(struct mf_icg_peval_machine *machine, \
+        const char *str, size_t len)
+{
+    if (machine->output_len + len > MF_ICG_PEVAL_OUTPUT_MAX) return MF_ICG_PEVAL_STOP;
+    memcpy(machine->output + machine->output_len, str, len);
+    machine->output_len += len;
+    return 0;
+}
+
+static int mf_icg_peval_exec(struct mf_icg_peval_machine *machine, \
+        int32_t lambda_idx);
+
+static int mf_icg_peval_step(struct mf_icg_peval_machine *machine, \
+        struct mf_prog_ins *ins)
+{
+    int ret;
+    struct mf_icg_peval_value value;
+    int32_t a, b, cond, body;
+    size_t count;
+    char buffer_int[16];
+    char ch;
+
+    if (machine->budget == 0) return MF_ICG_PEVAL_STOP;
+    machine->budget -= 1;
+
+    switch (ins->op)
+    {
+        case MF_PROG_OP_PUSH:
+            PUSH_INT(ins->operand);
+            break;
+        case MF_PROG_OP_LAMBDA:
+            value.value = ins->operand;
+            value.lambda = 1;
+            PUSH_VALUE(value);
+            break;
+        case MF_PROG_OP_PRINT_STR:
+            return mf_icg_peval_output(machine, \
+                    machine->prog->strs[ins->operand].str, \
+                    machine->prog->strs[ins->operand].len);
+
+        case MF_PROG_OP_ADD:
+        case MF_PROG_OP_SUB:
+        case MF_PROG_OP_MUL:
+        case MF_PROG_OP_DIV:
+        case MF_PROG_OP_EQ:
+        case MF_PROG_OP_G:
+        case MF_PROG_OP_L:
+        case MF_PROG_OP_AND:
+        case MF_PROG_OP_OR:
+            NEED_INT(2);
+            b = TOP(0).value;
+            a = TOP(1).value;
+            switch (ins->op)
+            {
+                case MF_PROG_OP_ADD: a = (int32_t)((uint32_t)a + (uint32_t)b); break;
+                case MF_PROG_OP_SUB: a = (int32_t)((uint32_t)a - (uint32_t)b); break;
+                case MF_PROG_OP_MUL: a = (int32_t)((uint32_t)a * (uint32_t)b); break;
+                case MF_PROG_OP_DIV: 
+                    /* Leave the failure to the runtime */
+                    if (b == 0) return MF_ICG_PEVAL_STOP;
+                    a = (b == -1) ? (int32_t)(0U - (uint32_t)a) : a / b;
+                    break;
+                case MF_PROG_OP_EQ: a = (a == b) ? -1 : 0; break;
+                case MF_PROG_OP_G: a = (a > b) ? -1 : 0; break;
+                case MF_PROG_OP_L: a = (a < b) ? -1 : 0; break;
+                case MF_PROG_OP_AND: a = ((a != 0) && (b != 0)) ? -1 : 0; break;
+                case MF_PROG_OP_OR: a = ((a != 0) || (b != 0)) ? -1 : 0; break;
+            }
+            machine->sp -= 1;
+            TOP(0).value = a;
+            break;
+
+        case MF_PROG_OP_NEG:
+            NEED_INT(1);
+            TOP(0).value = (int32_t)(0U - (uint32_t)TOP(0).value);
+            break;
+        case MF_PROG_OP_NOT:
+            NEED_INT(1);
+            TOP(0).value = (TOP(0).value == 0) ? -1 : 0;
+            break;
+
+        case MF_PROG_OP_DUP:
+            NEED(1);
+            value = TOP(0);
+            PUSH_VALUE(value);
+            break;
+        case MF_PROG_OP_DROP:
+            NEED(1);
+            machine->sp -= 1;
+            break;
+        case MF_PROG_OP_SWAP:
+            NEED(2);
+            value = TOP(0);
+            TOP(0) = TOP(1);
+            TOP(1) = value;
+            break;
+        case MF_PROG_OP_ROT:
+            NEED(3);
+            value = TOP(2);
+            TOP(2) = TOP(1);
+            TOP(1) = TOP(0);
+            TOP(0) = value;
+            break;
+        case MF_PROG_OP_COPY:
+            NEED((size_t)ins->operand + 1);
+            value = TOP(ins->operand);
+            PUSH_VALUE(value);
+            break;
+        case MF_PROG_OP_PICK:
+            NEED_INT(1);
+            a = TOP(0).value;
+            if ((a < 0) || ((size_t)a + 1 >= machine->sp)) return MF_ICG_PEVAL_STOP;
+            TOP(0) = TOP(a + 1);
+            break;
+
+        case MF_PROG_OP_LOAD:
+            if (machine->vars_set[ins->operand] == 0) return MF_ICG_PEVAL_STOP;
+            PUSH_VALUE(machine->vars[ins->operand]);
+            break;
+        case MF_PROG_OP_STORE:
+            NEED(1);
+            machine->vars[ins->operand] = TOP(0);
+            machine->vars_set[ins->operand] = 1;
+            machine->sp -= 1;
+            break;
+
+        case MF_PROG_OP_APPLY:
+            NEED(1);
+            if (TOP(0).lambda == 0) return MF_ICG_PEVAL_STOP;
+            body = TOP(0).value;
+            machine->sp -= 1;
+            return mf_icg_peval_exec(machine, body);
+        case MF_PROG_OP_IF:
+            NEED(2);
+            if ((TOP(0).lambda == 0) || (TOP(1).lambda != 0)) return MF_ICG_PEVAL_STOP;
+            body = TOP(0).value;
+            cond = TOP(1).value;
+            machine->sp -= 2;
+            if (cond != 0) return mf_icg_peval_exec(machine, body);
+            break;
+        case MF_PROG_OP_WHILE:
+            NEED(2);
+            if ((TOP(0).lambda == 0) || (TOP(1).lambda == 0)) return MF_ICG_PEVAL_STOP;
+            body = TOP(0).value;
+            cond = TOP(1).value;
+            machine->sp -= 2;
+            for (;;)
+            {
+                if ((ret = mf_icg_peval_exec(machine, cond)) != 0) return ret;
+                NEED_INT(1);
+                a = TOP(0).value;
+                machine->sp -= 1;
+                if (a == 0) break;
+                if ((ret = mf_icg_peval_exec(machine, body)) != 0) return ret;
+            }
+            break;
+
+        case MF_PROG_OP_PRINT_INT:
+            NEED_INT(1);
+            sprintf(buffer_int, "%d", (int)TOP(0).value);
+            machine->sp -= 1;
+            return mf_icg_peval_output(machine, buffer_int, strlen(buffer_int));
+        case MF_PROG_OP_PRINT_CHAR:
+            NEED_INT(1);
+            /* Only bytes could be merged into the string */
+            if ((TOP(0).value <= 0) || (TOP(0).value > 0xFF)) return MF_ICG_PEVAL_STOP;
+            ch = (char)TOP(0).value;
+            machine->sp -= 1;
+            return mf_icg_peval_output(machine, &ch, 1);
+
+        case MF_PROG_OP_READ_CHAR:
+            /* The input is where the evaluation ends */
+            return MF_ICG_PEVAL_STOP;
+        case MF_PROG_OP_FLUSH:
+            break;
+
+        default:
+            return MF_ICG_PEVAL_STOP;
+    }
+
+    return 0;
+}
+
+static int mf_icg_peval_exec(struct mf_icg_peval_machine *machine, \
+        int32_t lambda_idx)
+{
+    int ret = 0;
+    struct mf_prog_lambda *lambda;
+    size_t pc;
+
+    if (((size_t)lambda_idx >= machine->prog->lambdas_count) || \
+            (machine->depth == MF_ICG_PEVAL_DEPTH_MAX))
+    { return MF_ICG_PEVAL_STOP; }
+    lambda = &machine->prog->lambdas[lambda_idx];
+
+    machine->depth += 1;
+    for (pc = 0; lambda->ins[pc].op != MF_PROG_OP_RETURN; pc++)
+    {
+        if ((ret = mf_icg_peval_step(machine, &lambda->ins[pc])) != 0) break;
+    }
+    machine->depth -= 1;
+
+    return ret;
+}
+
+/* Run at most 'ops_max' operations of 'main', 'ops_done' receives 
+ * the last boundary between operations with a small enough state */
+static int mf_icg_peval_run_main(struct mf_icg_peval_machine *machine, \
+        size_t ops_max, size_t *ops_done)
+{
+    int ret = 0;
+    struct mf_prog_lambda *lambda = &machine->prog->lambdas[machine->prog->main_idx];
+    size_t pc, ops = 0, idx, state_size;
+
+    *ops_done = 0;
+    for (pc = 0; ; pc++)
+    {
+        if (mf_prog_ins_is_op_begin(lambda, pc))
+        {
+            state_size = machine->sp;
+            for (idx = 0; idx != machine->prog->vars_count; idx++)
+            { if (machine->vars_set[idx] != 0) state_size++; }
+            if (state_size <= MF_ICG_PEVAL_STATE_MAX) *ops_done = ops;
+
+            if ((lambda->ins[pc].op == MF_PROG_OP_RETURN) || (ops == ops_max)) break;
+            ops++;
+        }
+        if ((ret = mf_icg_peval_step(machine, &lambda->ins[pc])) != 0) break;
+    }
+
+    return (ret == MF_ICG_PEVAL_STOP) ? 0 : ret;
+}
+
+static int mf_icg_peval_push_value(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        struct mf_icg_peval_value *value)
+{
+    int ret;
+    uint32_t id;
+
+    if (value->lambda != 0)
+    {
+        return mf_icg_fcb_block_append_with_configure_type(icg_fcb_block, \
+                OP_LAMBDAMK, (uint32_t)value->value, MF_ICG_FCB_LINE_TYPE_LAMBDA_MK);
+    }
+
+    if ((ret = mf_icg_context_res_int(err, \
+                    context, \
+                    &id, \
+                    (int)value->value)) != 0)
+    { return ret; }
+    return mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id);
+}
+
+/* Lines which rebuild the state reached by the machine */
+static int mf_icg_peval_state_block(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_peval_machine *machine, \
+        struct mf_icg_fcb_block *icg_fcb_block)
+{
+    int ret = 0;
+    uint32_t id;
+    size_t idx;
+
+    if (machine->output_len != 0)
+    {
+        if ((ret = mf_icg_context_res_str(err, \
+                        context, \
+                        &id, \
+                        machine->output, \
+                        machine->output_len)) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PUSH, id)) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_PRINT, 0)) != 0)
+        { goto fail; }
+    }
+
+    for (idx = 0; idx != machine->prog->vars_count; idx++)
+    {
+        if (machine->vars_set[idx] == 0) continue;
+        if ((ret = mf_icg_peval_push_value(err, context, icg_fcb_block, \
+                        &machine->vars[idx])) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_context_res_id(err, \
+                        context, \
+                        &id, \
+                        &machine->prog->vars[idx], \
+                        1)) != 0)
+        { goto fail; }
+        if ((ret = mf_icg_fcb_block_append_with_configure(icg_fcb_block, OP_POPM, id)) != 0)
+        { goto fail; }
+    }
+
+    for (idx = 0; idx != machine->sp; idx++)
+    {
+        if ((ret = mf_icg_peval_push_value(err, context, icg_fcb_block, \
+                        &machine->stack[idx])) != 0)
+        { goto fail; }
+    }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+int mf_icg_peval(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        size_t budget)
+{
+    int ret = 0;
+    struct mf_prog *prog = NULL;
+    struct mf_prog_lambda *lambda_main;
+    struct mf_icg_fcb_block *icg_fcb_block_main = context->icg_fcb_block_list->end;
+    struct mf_icg_fcb_block *new_icg_fcb_block_state = NULL;
+    struct mf_icg_fcb_line *icg_fcb_line_begin, *icg_fcb_line_end, *icg_fcb_line_cur;
+    struct mf_icg_peval_machine machine;
+    size_t ops_done, ops_done_again, pc, ops;
+
+    machine.stack = NULL;
+    machine.output = NULL;
+
+    if (icg_fcb_block_main == NULL) return 0;
+
+    if ((ret = mf_prog_new_from_blocks(err, &prog, context->icg_fcb_block_list)) != 0)
+    { goto fail; }
+    lambda_main = &prog->lambdas[prog->main_idx];
+    if (lambda_main->size <= 1) goto done;
+
+    machine.prog = prog;
+    machine.stack = (struct mf_icg_peval_value *)malloc( \
+            sizeof(struct mf_icg_peval_value) * MF_ICG_PEVAL_STACK_MAX);
+    machine.output = (char *)malloc(sizeof(char) * MF_ICG_PEVAL_OUTPUT_MAX);
+    if ((machine.stack == NULL) || (machine.output == NULL))
+    {
+        MULTIPLE_ERROR_MALLOC();
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+
+    /* Find where to stop, and run again to get the state right there
+     * since the evaluation is deterministic before the input */
+    mf_icg_peval_machine_reset(&machine, budget);
+    if ((ret = mf_icg_peval_run_main(&machine, (size_t)-1, &ops_done)) != 0)
+    { goto fail; }
+    if (ops_done == 0) goto done;
+    mf_icg_peval_machine_reset(&machine, budget);
+    if ((ret = mf_icg_peval_run_main(&machine, ops_done, &ops_done_again)) != 0)
+    { goto fail; }
+    if (ops_done_again != ops_done)
+    {
+        MULTIPLE_ERROR_INTERNAL();
+        ret = -MULTIPLE_ERR_INTERNAL;
+        goto fail;
+    }
+
+    /* Lines of the finished operations */
+    icg_fcb_line_begin = lambda_main->lines[0];
+    icg_fcb_line_end = NULL;
+    ops = 0;
+    for (pc = 0; pc != lambda_main->size; pc++)
+    {
+        if (!mf_prog_ins_is_op_begin(lambda_main, pc)) continue;
+        if (ops == ops_done)
+        {
+            icg_fcb_line_end = lambda_main->lines[pc];
+            break;
+        }
+        ops++;
+    }
+    if (icg_fcb_line_end == NULL)
+    {
+        /* Everything has finished, keep the epilogue */
+        icg_fcb_line_cur = icg_fcb_block_main->begin;
+        while (icg_fcb_line_cur != NULL)
+        {
+            if (icg_fcb_line_cur->token != NULL) icg_fcb_line_end = icg_fcb_line_cur->next;
+            icg_fcb_line_cur = icg_fcb_line_cur->next;
+        }
+    }
+
+    if ((new_icg_fcb_block_state = mf_icg_fcb_block_new()) == NULL)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+    if ((ret = mf_icg_peval_state_block(err, context, &machine, \
+                    new_icg_fcb_block_state)) != 0)
+    { goto fail; }
+    if ((ret = mf_icg_fcb_block_replace(icg_fcb_block_main, \
+                    icg_fcb_line_begin, icg_fcb_line_end, \
+                    new_icg_fcb_block_state)) != 0)
+    { goto fail; }
+
+    goto done;
+fail:
+done:
+    if (new_icg_fcb_block_state != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block_state);
+    if (machine.stack != NULL) free(machine.stack);
+    if (machine.output != NULL) free(machine.output);
+    if (prog != NULL) mf_prog_destroy(prog);
+    return ret;
+}
+
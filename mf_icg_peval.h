@@ -0,0 +1,43 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Partial Evaluation
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ICG_PEVAL_H_
+#define _MF_ICG_PEVAL_H_
+
+#include <stdio.h>
+
+#include "multiple_err.h"
+
+#include "mf_icg_context.h"
+
+/* Instructions allowed to run at compile time */
+#define MF_ICG_PEVAL_BUDGET_DEFAULT (1024 * 1024)
+
+/* Run 'main' until it first reads the input, fails or exhausts 
+ * the budget, then replace the operations which have finished 
+ * with their output and the resulting stack and variables. Only 
+ * 'mf_irgen' runs it: the lines written have no tokens, which 
+ * 'mf_prog' needs to decode them */
+int mf_icg_peval(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        size_t budget);
+
+#endif
+
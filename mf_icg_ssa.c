@@ -0,0 +1,1107 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Static Single Assignment
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+#include "mf_prog.h"
+#include "mf_icg_ssa.h"
+
+/* Rewriting stops after this many rounds even if something changed */
+#define MF_ICG_SSA_ROUNDS_MAX 8
+
+/* Drops and a literal */
+#define MF_ICG_SSA_SNIPPET_MAX 32
+
+/* Lambdas reaching deeper below their entry are left as they are, 
+ * a literal pick index would name that many elements */
+#define MF_ICG_SSA_REACH_MAX 4096
+
+/* Values and blocks */
+
+static int mf_icg_ssa_value_new(struct mf_icg_ssa_fn *fn, \
+        uint32_t op, int32_t imm, uint32_t args_count, \
+        uint32_t *value_out)
+{
+    struct mf_icg_ssa_value *new_values, *value;
+    size_t new_capacity;
+
+    if (fn->values_count == fn->values_capacity)
+    {
+        new_capacity = (fn->values_capacity == 0) ? 64 : fn->values_capacity * 2;
+        new_values = (struct mf_icg_ssa_value *)realloc(fn->values, \
+                sizeof(struct mf_icg_ssa_value) * new_capacity);
+        if (new_values == NULL) return -MULTIPLE_ERR_MALLOC;
+        fn->values = new_values;
+        fn->values_capacity = new_capacity;
+    }
+
+    value = &fn->values[fn->values_count];
+    value->args = NULL;
+    if (args_count != 0)
+    {
+        value->args = (uint32_t *)malloc(sizeof(uint32_t) * args_count);
+        if (value->args == NULL) return -MULTIPLE_ERR_MALLOC;
+    }
+    value->op = op;
+    value->imm = imm;
+    value->args_count = args_count;
+    value->block = (uint32_t)(fn->blocks_count - 1);
+    value->copy_of = (uint32_t)fn->values_count;
+    value->known = 0;
+    value->value = 0;
+    value->live = 0;
+
+    *value_out = (uint32_t)fn->values_count;
+    fn->values_count += 1;
+    fn->blocks[fn->blocks_count - 1].values_end = (uint32_t)fn->values_count;
+
+    return 0;
+}
+
+static int mf_icg_ssa_block_new(struct mf_icg_ssa_fn *fn, \
+        uint32_t kind, uint32_t pred0, uint32_t pred1, uint32_t branch)
+{
+    struct mf_icg_ssa_block *new_blocks, *block;
+    size_t new_capacity;
+
+    if (fn->blocks_count == fn->blocks_capacity)
+    {
+        new_capacity = (fn->blocks_capacity == 0) ? 4 : fn->blocks_capacity * 2;
+        new_blocks = (struct mf_icg_ssa_block *)realloc(fn->blocks, \
+                sizeof(struct mf_icg_ssa_block) * new_capacity);
+        if (new_blocks == NULL) return -MULTIPLE_ERR_MALLOC;
+        fn->blocks = new_blocks;
+        fn->blocks_capacity = new_capacity;
+    }
+
+    block = &fn->blocks[fn->blocks_count++];
+    block->kind = kind;
+    block->preds[0] = pred0;
+    block->preds[1] = pred1;
+    block->branch = branch;
+    block->values_begin = block->values_end = (uint32_t)fn->values_count;
+    block->reachable = 0;
+
+    return 0;
+}
+
+void mf_icg_ssa_destroy(struct mf_icg_ssa_fn *fn)
+{
+    size_t idx;
+
+    if (fn->values != NULL)
+    {
+        for (idx = 0; idx != fn->values_count; idx++)
+        {
+            if (fn->values[idx].args != NULL) free(fn->values[idx].args);
+        }
+        free(fn->values);
+    }
+    if (fn->blocks != NULL) free(fn->blocks);
+    if (fn->ops != NULL) free(fn->ops);
+    free(fn);
+}
+
+/* Building */
+
+struct mf_icg_ssa_builder
+{
+    struct mf_icg_ssa_fn *fn;
+    struct mf_prog *prog;
+
+    /* 'stack[0]' is the element in the slot 'bottom', the slots
+     * below the entry of the region are negative */
+    uint32_t *stack;
+    size_t stack_capacity;
+    int32_t bottom;
+    int32_t depth;
+    uint32_t region;
+
+    /* Value last stored to or loaded from each variable */
+    uint32_t vars[MF_PROG_VARS_MAX];
+};
+
+#define MF_ICG_SSA_ENTRIES(builder) ((uint32_t)((builder)->depth - (builder)->bottom))
+#define MF_ICG_SSA_PEEK(builder, n) \
+    ((builder)->stack[MF_ICG_SSA_ENTRIES(builder) - 1 - (n)])
+
+static int mf_icg_ssa_stack_reserve(struct mf_icg_ssa_builder *builder, size_t count)
+{
+    uint32_t *new_stack;
+    size_t new_capacity;
+
+    if (count <= builder->stack_capacity) return 0;
+    new_capacity = (builder->stack_capacity == 0) ? 64 : builder->stack_capacity;
+    while (new_capacity < count) new_capacity *= 2;
+    new_stack = (uint32_t *)realloc(builder->stack, sizeof(uint32_t) * new_capacity);
+    if (new_stack == NULL) return -MULTIPLE_ERR_MALLOC;
+    builder->stack = new_stack;
+    builder->stack_capacity = new_capacity;
+    return 0;
+}
+
+/* Name the elements which were on the stack before the region */
+static int mf_icg_ssa_materialize(struct mf_icg_ssa_builder *builder, uint32_t count)
+{
+    int ret;
+    uint32_t entries, value;
+
+    if (count > MF_ICG_SSA_REACH_MAX) return 1;
+    while ((entries = MF_ICG_SSA_ENTRIES(builder)) < count)
+    {
+        if ((ret = mf_icg_ssa_stack_reserve(builder, entries + 1)) != 0) return ret;
+        if ((ret = mf_icg_ssa_value_new(builder->fn, MF_ICG_SSA_OP_ARG, \
+                        builder->bottom - 1, 0, &value)) != 0)
+        { return ret; }
+        memmove(builder->stack + 1, builder->stack, sizeof(uint32_t) * entries);
+        builder->stack[0] = value;
+        builder->bottom -= 1;
+    }
+    return 0;
+}
+
+static int mf_icg_ssa_push(struct mf_icg_ssa_builder *builder, uint32_t value)
+{
+    int ret;
+
+    if ((ret = mf_icg_ssa_stack_reserve(builder, MF_ICG_SSA_ENTRIES(builder) + 1)) != 0)
+    { return ret; }
+    builder->stack[MF_ICG_SSA_ENTRIES(builder)] = value;
+    builder->depth += 1;
+    return 0;
+}
+
+static void mf_icg_ssa_forget_vars(struct mf_icg_ssa_builder *builder)
+{
+    size_t idx;
+
+    for (idx = 0; idx != MF_PROG_VARS_MAX; idx++) builder->vars[idx] = MF_ICG_SSA_NONE;
+}
+
+/* The lambda 'value' holds if it is known with a known stack effect */
+static struct mf_prog_lambda *mf_icg_ssa_callee(struct mf_icg_ssa_builder *builder, \
+        uint32_t value)
+{
+    struct mf_icg_ssa_value *values = builder->fn->values;
+
+    while (values[value].op == MF_ICG_SSA_OP_COPY) value = values[value].args[0];
+    if (values[value].op != MF_ICG_SSA_OP_LAMBDA) return NULL;
+    if ((values[value].imm < 0) || \
+            ((size_t)values[value].imm >= builder->prog->lambdas_count)) return NULL;
+    if (!builder->prog->lambdas[values[value].imm].stack_known) return NULL;
+    return &builder->prog->lambdas[values[value].imm];
+}
+
+/* Callees of unknown stack effect could use every element and
+ * leave anything, a new region starts */
+static int mf_icg_ssa_call_unknown(struct mf_icg_ssa_builder *builder, \
+        struct mf_icg_ssa_op *op, \
+        uint32_t *callee_args, uint32_t callee_args_count)
+{
+    int ret;
+    uint32_t call, idx, entries = MF_ICG_SSA_ENTRIES(builder);
+
+    if ((ret = mf_icg_ssa_value_new(builder->fn, MF_ICG_SSA_OP_CALL, -1, \
+                    callee_args_count + entries, &call)) != 0)
+    { return ret; }
+    for (idx = 0; idx != callee_args_count; idx++)
+    { builder->fn->values[call].args[idx] = callee_args[idx]; }
+    for (idx = 0; idx != entries; idx++)
+    { builder->fn->values[call].args[callee_args_count + idx] = builder->stack[idx]; }
+
+    op->reach = MF_ICG_SSA_REACH_ANY;
+    builder->region += 1;
+    builder->depth = 0;
+    builder->bottom = 0;
+    mf_icg_ssa_forget_vars(builder);
+
+    return 0;
+}
+
+/* The callees reach 'need' elements and leave 'need + net' ones */
+static int mf_icg_ssa_call_known(struct mf_icg_ssa_builder *builder, \
+        struct mf_icg_ssa_op *op, \
+        uint32_t *callee_args, uint32_t callee_args_count, \
+        uint32_t need, int32_t net)
+{
+    int ret;
+    uint32_t call, value, idx;
+    int32_t count;
+
+    if ((ret = mf_icg_ssa_materialize(builder, need)) != 0) return ret;
+    if ((ret = mf_icg_ssa_value_new(builder->fn, MF_ICG_SSA_OP_CALL, 0, \
+                    callee_args_count + need, &call)) != 0)
+    { return ret; }
+    for (idx = 0; idx != callee_args_count; idx++)
+    { builder->fn->values[call].args[idx] = callee_args[idx]; }
+    for (idx = 0; idx != need; idx++)
+    { builder->fn->values[call].args[callee_args_count + idx] = MF_ICG_SSA_PEEK(builder, idx); }
+
+    op->reach = builder->depth - (int32_t)need;
+    builder->depth -= (int32_t)need;
+    for (count = 0; count < (int32_t)need + net; count++)
+    {
+        if ((ret = mf_icg_ssa_value_new(builder->fn, MF_ICG_SSA_OP_RESULT, count, 1, &value)) != 0)
+        { return ret; }
+        builder->fn->values[value].args[0] = call;
+        if ((ret = mf_icg_ssa_push(builder, value)) != 0) return ret;
+    }
+    mf_icg_ssa_forget_vars(builder);
+
+    return 0;
+}
+
+/* c f ? with a callee leaving the depth unchanged,
+ * the elements it reaches are merged after the call */
+static int mf_icg_ssa_call_if(struct mf_icg_ssa_builder *builder, \
+        struct mf_icg_ssa_op *op, \
+        uint32_t cond, uint32_t callee, uint32_t need)
+{
+    int ret = 0;
+    struct mf_icg_ssa_fn *fn = builder->fn;
+    uint32_t *skipped = NULL;
+    uint32_t branch, block_entry, block_taken, phi, idx;
+    uint32_t args[2];
+
+    if ((ret = mf_icg_ssa_materialize(builder, need)) != 0) goto fail;
+    if (need != 0)
+    {
+        skipped = (uint32_t *)malloc(sizeof(uint32_t) * need);
+        if (skipped == NULL) { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+        for (idx = 0; idx != need; idx++) skipped[idx] = MF_ICG_SSA_PEEK(builder, idx);
+    }
+
+    if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_BRANCH, 0, 2, &branch)) != 0) goto fail;
+    fn->values[branch].args[0] = cond;
+    fn->values[branch].args[1] = callee;
+    block_entry = (uint32_t)(fn->blocks_count - 1);
+
+    if ((ret = mf_icg_ssa_block_new(fn, MF_ICG_SSA_BLOCK_TAKEN, \
+                    block_entry, MF_ICG_SSA_NONE, branch)) != 0)
+    { goto fail; }
+    block_taken = (uint32_t)(fn->blocks_count - 1);
+    args[0] = callee;
+    if ((ret = mf_icg_ssa_call_known(builder, op, args, 1, need, 0)) != 0) goto fail;
+
+    if ((ret = mf_icg_ssa_block_new(fn, MF_ICG_SSA_BLOCK_JOIN, \
+                    block_entry, block_taken, branch)) != 0)
+    { goto fail; }
+    for (idx = 0; idx != need; idx++)
+    {
+        if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_PHI, 0, 2, &phi)) != 0) goto fail;
+        fn->values[phi].args[0] = skipped[idx];
+        fn->values[phi].args[1] = MF_ICG_SSA_PEEK(builder, idx);
+        MF_ICG_SSA_PEEK(builder, idx) = phi;
+    }
+
+    goto done;
+fail:
+done:
+    if (skipped != NULL) free(skipped);
+    return ret;
+}
+
+static int mf_icg_ssa_build_ins(struct multiple_error *err, \
+        struct mf_icg_ssa_builder *builder, \
+        struct mf_prog_ins *ins, struct mf_icg_ssa_op *op)
+{
+    int ret;
+    struct mf_icg_ssa_fn *fn = builder->fn;
+    struct mf_prog_lambda *callee, *callee_cond;
+    uint32_t value, args[2], count, idx;
+
+    switch (ins->op)
+    {
+        case MF_PROG_OP_PUSH:
+        case MF_PROG_OP_LAMBDA:
+            if ((ret = mf_icg_ssa_value_new(fn, \
+                            (ins->op == MF_PROG_OP_PUSH) ? MF_ICG_SSA_OP_CONST : MF_ICG_SSA_OP_LAMBDA, \
+                            ins->operand, 0, &value)) != 0)
+            { return ret; }
+            op->result = value;
+            return mf_icg_ssa_push(builder, value);
+
+        case MF_PROG_OP_PRINT_STR:
+        case MF_PROG_OP_FLUSH:
+            return mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_OUTPUT, (int32_t)ins->op, 0, &value);
+
+        case MF_PROG_OP_ADD:
+        case MF_PROG_OP_SUB:
+        case MF_PROG_OP_MUL:
+        case MF_PROG_OP_DIV:
+        case MF_PROG_OP_EQ:
+        case MF_PROG_OP_G:
+        case MF_PROG_OP_L:
+        case MF_PROG_OP_AND:
+        case MF_PROG_OP_OR:
+        case MF_PROG_OP_NEG:
+        case MF_PROG_OP_NOT:
+            count = ((ins->op == MF_PROG_OP_NEG) || (ins->op == MF_PROG_OP_NOT)) ? 1 : 2;
+            if ((ret = mf_icg_ssa_materialize(builder, count)) != 0) return ret;
+            if ((ret = mf_icg_ssa_value_new(fn, \
+                            (count == 1) ? MF_ICG_SSA_OP_UNARY : MF_ICG_SSA_OP_BINARY, \
+                            (int32_t)ins->op, count, &value)) != 0)
+            { return ret; }
+            for (idx = 0; idx != count; idx++)
+            { fn->values[value].args[idx] = MF_ICG_SSA_PEEK(builder, count - 1 - idx); }
+            op->input = MF_ICG_SSA_PEEK(builder, 0);
+            op->result = value;
+            op->reach = builder->depth - (int32_t)count;
+            builder->depth -= (int32_t)count;
+            return mf_icg_ssa_push(builder, value);
+
+        case MF_PROG_OP_DUP:
+        case MF_PROG_OP_COPY:
+            count = (ins->op == MF_PROG_OP_DUP) ? 0 : (uint32_t)ins->operand;
+            if ((ret = mf_icg_ssa_materialize(builder, count + 1)) != 0) return ret;
+            if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_COPY, 0, 1, &value)) != 0)
+            { return ret; }
+            fn->values[value].args[0] = MF_ICG_SSA_PEEK(builder, count);
+            op->result = value;
+            op->reach = builder->depth - (int32_t)count - 1;
+            return mf_icg_ssa_push(builder, value);
+
+        case MF_PROG_OP_DROP:
+            if ((ret = mf_icg_ssa_materialize(builder, 1)) != 0) return ret;
+            op->input = MF_ICG_SSA_PEEK(builder, 0);
+            op->reach = builder->depth - 1;
+            builder->depth -= 1;
+            return 0;
+
+        case MF_PROG_OP_SWAP:
+            if ((ret = mf_icg_ssa_materialize(builder, 2)) != 0) return ret;
+            value = MF_ICG_SSA_PEEK(builder, 0);
+            MF_ICG_SSA_PEEK(builder, 0) = MF_ICG_SSA_PEEK(builder, 1);
+            MF_ICG_SSA_PEEK(builder, 1) = value;
+            op->reach = builder->depth - 2;
+            return 0;
+
+        case MF_PROG_OP_ROT:
+            /* a b c -> b c a */
+            if ((ret = mf_icg_ssa_materialize(builder, 3)) != 0) return ret;
+            value = MF_ICG_SSA_PEEK(builder, 2);
+            MF_ICG_SSA_PEEK(builder, 2) = MF_ICG_SSA_PEEK(builder, 1);
+            MF_ICG_SSA_PEEK(builder, 1) = MF_ICG_SSA_PEEK(builder, 0);
+            MF_ICG_SSA_PEEK(builder, 0) = value;
+            op->reach = builder->depth - 3;
+            return 0;
+
+        case MF_PROG_OP_PICK:
+            if ((ret = mf_icg_ssa_materialize(builder, 1)) != 0) return ret;
+            if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_PICK, 0, 1, &value)) != 0)
+            { return ret; }
+            fn->values[value].args[0] = MF_ICG_SSA_PEEK(builder, 0);
+            op->input = MF_ICG_SSA_PEEK(builder, 0);
+            op->result = value;
+            op->reach = MF_ICG_SSA_REACH_ANY;
+            builder->depth -= 1;
+            return mf_icg_ssa_push(builder, value);
+
+        case MF_PROG_OP_LOAD:
+            /* Forwarded from the last access of the variable */
+            if (builder->vars[ins->operand] != MF_ICG_SSA_NONE)
+            {
+                if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_COPY, 0, 1, &value)) != 0)
+                { return ret; }
+                fn->values[value].args[0] = builder->vars[ins->operand];
+            }
+            else
+            {
+                if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_LOAD, ins->operand, 0, &value)) != 0)
+                { return ret; }
+                builder->vars[ins->operand] = value;
+            }
+            op->result = value;
+            return mf_icg_ssa_push(builder, value);
+
+        case MF_PROG_OP_STORE:
+            if ((ret = mf_icg_ssa_materialize(builder, 1)) != 0) return ret;
+            if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_STORE, ins->operand, 1, &value)) != 0)
+            { return ret; }
+            fn->values[value].args[0] = MF_ICG_SSA_PEEK(builder, 0);
+            builder->vars[ins->operand] = MF_ICG_SSA_PEEK(builder, 0);
+            op->input = MF_ICG_SSA_PEEK(builder, 0);
+            op->reach = builder->depth - 1;
+            builder->depth -= 1;
+            return 0;
+
+        case MF_PROG_OP_APPLY:
+            if ((ret = mf_icg_ssa_materialize(builder, 1)) != 0) return ret;
+            args[0] = MF_ICG_SSA_PEEK(builder, 0);
+            op->input = args[0];
+            builder->depth -= 1;
+            if ((callee = mf_icg_ssa_callee(builder, args[0])) == NULL)
+            { return mf_icg_ssa_call_unknown(builder, op, args, 1); }
+            return mf_icg_ssa_call_known(builder, op, args, 1, \
+                    callee->stack_need_max, callee->stack_net);
+
+        case MF_PROG_OP_IF:
+            if ((ret = mf_icg_ssa_materialize(builder, 2)) != 0) return ret;
+            args[0] = MF_ICG_SSA_PEEK(builder, 1);
+            args[1] = MF_ICG_SSA_PEEK(builder, 0);
+            op->input = args[0];
+            builder->depth -= 2;
+            callee = mf_icg_ssa_callee(builder, args[1]);
+            if ((callee == NULL) || (callee->stack_net != 0))
+            { return mf_icg_ssa_call_unknown(builder, op, args, 2); }
+            return mf_icg_ssa_call_if(builder, op, args[0], args[1], callee->stack_need_max);
+
+        case MF_PROG_OP_WHILE:
+            if ((ret = mf_icg_ssa_materialize(builder, 2)) != 0) return ret;
+            args[0] = MF_ICG_SSA_PEEK(builder, 1);
+            args[1] = MF_ICG_SSA_PEEK(builder, 0);
+            builder->depth -= 2;
+            callee_cond = mf_icg_ssa_callee(builder, args[0]);
+            callee = mf_icg_ssa_callee(builder, args[1]);
+            if ((callee_cond == NULL) || (callee == NULL) || \
+                    (callee_cond->stack_net != 1) || (callee->stack_net != 0))
+            { return mf_icg_ssa_call_unknown(builder, op, args, 2); }
+            /* Every iteration leaves the depth unchanged */
+            return mf_icg_ssa_call_known(builder, op, args, 2, \
+                    (callee_cond->stack_need_max > callee->stack_need_max) ? \
+                    callee_cond->stack_need_max : callee->stack_need_max, 0);
+
+        case MF_PROG_OP_PRINT_INT:
+        case MF_PROG_OP_PRINT_CHAR:
+            if ((ret = mf_icg_ssa_materialize(builder, 1)) != 0) return ret;
+            if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_OUTPUT, (int32_t)ins->op, 1, &value)) != 0)
+            { return ret; }
+            fn->values[value].args[0] = MF_ICG_SSA_PEEK(builder, 0);
+            op->input = MF_ICG_SSA_PEEK(builder, 0);
+            op->reach = builder->depth - 1;
+            builder->depth -= 1;
+            return 0;
+
+        case MF_PROG_OP_READ_CHAR:
+            if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_READ, 0, 0, &value)) != 0)
+            { return ret; }
+            op->result = value;
+            return mf_icg_ssa_push(builder, value);
+
+        case MF_PROG_OP_RETURN:
+            count = MF_ICG_SSA_ENTRIES(builder);
+            if ((ret = mf_icg_ssa_value_new(fn, MF_ICG_SSA_OP_RETURN, 0, count, &value)) != 0)
+            { return ret; }
+            for (idx = 0; idx != count; idx++) fn->values[value].args[idx] = builder->stack[idx];
+            return 0;
+    }
+
+    MULTIPLE_ERROR_INTERNAL();
+    return -MULTIPLE_ERR_INTERNAL;
+}
+
+int mf_icg_ssa_build(struct multiple_error *err, \
+        struct mf_icg_ssa_fn **fn_out, \
+        struct mf_prog *prog, size_t lambda_idx)
+{
+    int ret = 0;
+    struct mf_prog_lambda *lambda = &prog->lambdas[lambda_idx];
+    struct mf_icg_ssa_fn *new_fn = NULL;
+    struct mf_icg_ssa_builder builder;
+    struct mf_icg_ssa_op *op;
+    size_t pc;
+
+    builder.stack = NULL;
+    builder.stack_capacity = 0;
+
+    new_fn = (struct mf_icg_ssa_fn *)malloc(sizeof(struct mf_icg_ssa_fn));
+    if (new_fn == NULL) goto fail_malloc;
+    new_fn->values = NULL;
+    new_fn->values_count = new_fn->values_capacity = 0;
+    new_fn->blocks = NULL;
+    new_fn->blocks_count = new_fn->blocks_capacity = 0;
+    new_fn->ops_count = 0;
+    new_fn->ops = (struct mf_icg_ssa_op *)malloc(sizeof(struct mf_icg_ssa_op) * lambda->size);
+    if (new_fn->ops == NULL) goto fail_malloc;
+    new_fn->ops_count = lambda->size;
+
+    if (mf_icg_ssa_block_new(new_fn, MF_ICG_SSA_BLOCK_ENTRY, \
+                MF_ICG_SSA_NONE, MF_ICG_SSA_NONE, MF_ICG_SSA_NONE) != 0)
+    { goto fail_malloc; }
+
+    builder.fn = new_fn;
+    builder.prog = prog;
+    builder.bottom = 0;
+    builder.depth = 0;
+    builder.region = 0;
+    mf_icg_ssa_forget_vars(&builder);
+
+    for (pc = 0; pc != lambda->size; pc++)
+    {
+        op = &new_fn->ops[pc];
+        op->region = builder.region;
+        op->depth = builder.depth;
+        op->reach = builder.depth;
+        op->input = MF_ICG_SSA_NONE;
+        op->result = MF_ICG_SSA_NONE;
+        op->single = ((lambda->lines[pc] != NULL) && \
+                mf_prog_ins_is_op_begin(lambda, pc) && \
+                ((pc + 1 == lambda->size) || mf_prog_ins_is_op_begin(lambda, pc + 1))) ? 1 : 0;
+        if ((ret = mf_icg_ssa_build_ins(err, &builder, &lambda->ins[pc], op)) != 0)
+        {
+            if (ret == -MULTIPLE_ERR_MALLOC) goto fail_malloc;
+            /* Too deep */
+            if (ret > 0) { ret = 0; *fn_out = NULL; goto done; }
+            goto fail;
+        }
+    }
+
+    *fn_out = new_fn;
+    new_fn = NULL;
+
+    goto done;
+fail_malloc:
+    MULTIPLE_ERROR_MALLOC();
+    ret = -MULTIPLE_ERR_MALLOC;
+fail:
+done:
+    if (builder.stack != NULL) free(builder.stack);
+    if (new_fn != NULL) mf_icg_ssa_destroy(new_fn);
+    return ret;
+}
+
+/* Passes */
+
+/* The arguments only refer to the values before, one sweep 
+ * resolves every copy */
+void mf_icg_ssa_copy_propagate(struct mf_icg_ssa_fn *fn)
+{
+    struct mf_icg_ssa_value *value;
+    size_t idx;
+    uint32_t arg_idx;
+
+    for (idx = 0; idx != fn->values_count; idx++)
+    {
+        value = &fn->values[idx];
+        for (arg_idx = 0; arg_idx != value->args_count; arg_idx++)
+        { value->args[arg_idx] = fn->values[value->args[arg_idx]].copy_of; }
+
+        value->copy_of = (uint32_t)idx;
+        if (value->op == MF_ICG_SSA_OP_COPY)
+        { value->copy_of = value->args[0]; }
+        else if ((value->op == MF_ICG_SSA_OP_PHI) && \
+                (value->args[0] == value->args[1]))
+        { value->copy_of = value->args[0]; }
+    }
+}
+
+/* Same results as the runtime, the ones raising errors are not folded */
+static int mf_icg_ssa_fold(int32_t op, int32_t a, int32_t b, int32_t *value_out)
+{
+    switch (op)
+    {
+        case MF_PROG_OP_ADD: *value_out = (int32_t)((uint32_t)a + (uint32_t)b); break;
+        case MF_PROG_OP_SUB: *value_out = (int32_t)((uint32_t)a - (uint32_t)b); break;
+        case MF_PROG_OP_MUL: *value_out = (int32_t)((uint32_t)a * (uint32_t)b); break;
+        case MF_PROG_OP_DIV:
+            if (b == 0) return -1;
+            *value_out = (b == -1) ? (int32_t)(0U - (uint32_t)a) : a / b;
+            break;
+        case MF_PROG_OP_EQ: *value_out = (a == b) ? -1 : 0; break;
+        case MF_PROG_OP_G: *value_out = (a > b) ? -1 : 0; break;
+        case MF_PROG_OP_L: *value_out = (a < b) ? -1 : 0; break;
+        case MF_PROG_OP_AND: *value_out = ((a != 0) && (b != 0)) ? -1 : 0; break;
+        case MF_PROG_OP_OR: *value_out = ((a != 0) || (b != 0)) ? -1 : 0; break;
+        case MF_PROG_OP_NEG: *value_out = (int32_t)(0U - (uint32_t)a); break;
+        case MF_PROG_OP_NOT: *value_out = (a == 0) ? -1 : 0; break;
+        default: return -1;
+    }
+    return 0;
+}
+
+/* Constants only flow along the edges which could be taken */
+void mf_icg_ssa_constant_propagate(struct mf_icg_ssa_fn *fn)
+{
+    struct mf_icg_ssa_block *block;
+    struct mf_icg_ssa_value *value, *arg0, *arg1, *cond;
+    size_t block_idx, idx;
+    int skip_feasible = 0, taken_feasible = 0;
+
+    for (block_idx = 0; block_idx != fn->blocks_count; block_idx++)
+    {
+        block = &fn->blocks[block_idx];
+        if (block->kind == MF_ICG_SSA_BLOCK_ENTRY)
+        { block->reachable = 1; }
+        else
+        {
+            cond = &fn->values[fn->values[block->branch].args[0]];
+            skip_feasible = (fn->blocks[block->preds[0]].reachable && \
+                    !(cond->known && (cond->value != 0))) ? 1 : 0;
+            if (block->kind == MF_ICG_SSA_BLOCK_TAKEN)
+            {
+                block->reachable = (fn->blocks[block->preds[0]].reachable && \
+                        !(cond->known && (cond->value == 0))) ? 1 : 0;
+            }
+            else
+            {
+                taken_feasible = fn->blocks[block->preds[1]].reachable;
+                block->reachable = (skip_feasible || taken_feasible) ? 1 : 0;
+            }
+        }
+
+        for (idx = block->values_begin; idx != block->values_end; idx++)
+        {
+            value = &fn->values[idx];
+            value->known = 0;
+            if (!block->reachable) continue;
+
+            arg0 = (value->args_count >= 1) ? &fn->values[value->args[0]] : NULL;
+            arg1 = (value->args_count >= 2) ? &fn->values[value->args[1]] : NULL;
+            switch (value->op)
+            {
+                case MF_ICG_SSA_OP_CONST:
+                    value->known = 1;
+                    value->value = value->imm;
+                    break;
+
+                case MF_ICG_SSA_OP_COPY:
+                    value->known = arg0->known;
+                    value->value = arg0->value;
+                    break;
+
+                case MF_ICG_SSA_OP_PHI:
+                    if (skip_feasible && taken_feasible)
+                    {
+                        if (arg0->known && arg1->known && (arg0->value == arg1->value))
+                        {
+                            value->known = 1;
+                            value->value = arg0->value;
+                        }
+                    }
+                    else if (skip_feasible)
+                    {
+                        value->known = arg0->known;
+                        value->value = arg0->value;
+                    }
+                    else if (taken_feasible)
+                    {
+                        value->known = arg1->known;
+                        value->value = arg1->value;
+                    }
+                    break;
+
+                case MF_ICG_SSA_OP_UNARY:
+                    if (arg0->known && \
+                            (mf_icg_ssa_fold(value->imm, arg0->value, 0, &value->value) == 0))
+                    { value->known = 1; }
+                    break;
+
+                case MF_ICG_SSA_OP_BINARY:
+                    if (arg0->known && arg1->known && \
+                            (mf_icg_ssa_fold(value->imm, arg0->value, arg1->value, &value->value) == 0))
+                    { value->known = 1; }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/* Whatever reaches an effect, a call or the caller is live */
+void mf_icg_ssa_eliminate_dead(struct mf_icg_ssa_fn *fn)
+{
+    struct mf_icg_ssa_value *value;
+    size_t idx;
+    uint32_t arg_idx;
+
+    for (idx = 0; idx != fn->values_count; idx++) fn->values[idx].live = 0;
+
+    idx = fn->values_count;
+    while (idx-- != 0)
+    {
+        value = &fn->values[idx];
+        if (fn->blocks[value->block].reachable)
+        {
+            switch (value->op)
+            {
+                case MF_ICG_SSA_OP_STORE:
+                case MF_ICG_SSA_OP_PICK:
+                case MF_ICG_SSA_OP_READ:
+                case MF_ICG_SSA_OP_OUTPUT:
+                case MF_ICG_SSA_OP_CALL:
+                case MF_ICG_SSA_OP_BRANCH:
+                case MF_ICG_SSA_OP_RETURN:
+                    value->live = 1;
+                    break;
+                case MF_ICG_SSA_OP_BINARY:
+                    /* Division by zero */
+                    if ((value->imm == MF_PROG_OP_DIV) && (!value->known)) value->live = 1;
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (!value->live) continue;
+        for (arg_idx = 0; arg_idx != value->args_count; arg_idx++)
+        { fn->values[value->args[arg_idx]].live = 1; }
+    }
+}
+
+/* Lowering */
+
+struct mf_icg_ssa_rewrite
+{
+    int rewrite;
+    char src[MF_ICG_SSA_SNIPPET_MAX];
+};
+
+/* Elements an operation pops before pushing its result */
+static uint32_t mf_icg_ssa_pops(uint32_t op)
+{
+    switch (op)
+    {
+        case MF_PROG_OP_ADD:
+        case MF_PROG_OP_SUB:
+        case MF_PROG_OP_MUL:
+        case MF_PROG_OP_DIV:
+        case MF_PROG_OP_EQ:
+        case MF_PROG_OP_G:
+        case MF_PROG_OP_L:
+        case MF_PROG_OP_AND:
+        case MF_PROG_OP_OR:
+            return 2;
+        case MF_PROG_OP_NEG:
+        case MF_PROG_OP_NOT:
+            return 1;
+    }
+    return 0;
+}
+
+/* Removed with the drop of its result, the pops stay */
+static int mf_icg_ssa_removable(struct mf_icg_ssa_fn *fn, \
+        struct mf_prog_ins *ins, struct mf_icg_ssa_op *op)
+{
+    switch (ins->op)
+    {
+        case MF_PROG_OP_PUSH:
+        case MF_PROG_OP_LAMBDA:
+        case MF_PROG_OP_LOAD:
+        case MF_PROG_OP_ADD:
+        case MF_PROG_OP_SUB:
+        case MF_PROG_OP_MUL:
+        case MF_PROG_OP_EQ:
+        case MF_PROG_OP_G:
+        case MF_PROG_OP_L:
+        case MF_PROG_OP_AND:
+        case MF_PROG_OP_OR:
+        case MF_PROG_OP_NEG:
+        case MF_PROG_OP_NOT:
+            return 1;
+        case MF_PROG_OP_DUP:
+        case MF_PROG_OP_COPY:
+            /* Nothing could underflow */
+            return (op->reach >= 0) ? 1 : 0;
+        case MF_PROG_OP_DIV:
+            return fn->values[op->result].known;
+    }
+    return 0;
+}
+
+/* Token which the decoder would see next to an operation,
+ * rewritten ones get fresh tokens */
+static struct token *mf_icg_ssa_neighbor(struct mf_prog_lambda *lambda, \
+        struct mf_icg_ssa_rewrite *rewrites, size_t pc, int forward)
+{
+    for (;;)
+    {
+        if (forward) { if (++pc >= lambda->size) return NULL; }
+        else { if (pc-- == 0) return NULL; }
+        if (lambda->lines[pc] == NULL) return NULL;
+        if (!rewrites[pc].rewrite) return lambda->lines[pc]->token;
+        if (rewrites[pc].src[0] != '\0') return NULL;
+    }
+}
+
+/* Removing the operation must not join two groups of lines from
+ * the same token, which happens with inlined bodies */
+static int mf_icg_ssa_removal_joins(struct mf_prog_lambda *lambda, \
+        struct mf_icg_ssa_rewrite *rewrites, size_t pc)
+{
+    struct token *token_prev = mf_icg_ssa_neighbor(lambda, rewrites, pc, 0);
+    struct token *token_next = mf_icg_ssa_neighbor(lambda, rewrites, pc, 1);
+
+    return ((token_prev != NULL) && (token_prev == token_next)) ? 1 : 0;
+}
+
+static void mf_icg_ssa_drops(char *buf, uint32_t pops)
+{
+    memset(buf, '%', pops);
+    buf[pops] = '\0';
+}
+
+/* An element consumed by '%' or a known condition of '?' is removed
+ * with the operation which pushed it */
+static void mf_icg_ssa_plan_removals(struct mf_icg_ssa_fn *fn, \
+        struct mf_prog_lambda *lambda, \
+        struct mf_icg_ssa_rewrite *rewrites, uint32_t *producers)
+{
+    struct mf_icg_ssa_op *op_consumer, *op;
+    struct mf_icg_ssa_value *value;
+    size_t pc, pc_consumer, pc_producer;
+    int32_t slot;
+
+    for (pc_consumer = 0; pc_consumer != fn->ops_count; pc_consumer++)
+    {
+        op_consumer = &fn->ops[pc_consumer];
+        if ((!op_consumer->single) || (rewrites[pc_consumer].rewrite)) continue;
+        if (op_consumer->input == MF_ICG_SSA_NONE) continue;
+        value = &fn->values[op_consumer->input];
+        switch (lambda->ins[pc_consumer].op)
+        {
+            case MF_PROG_OP_DROP:
+                if (value->live) continue;
+                slot = op_consumer->depth - 1;
+                rewrites[pc_consumer].src[0] = '\0';
+                break;
+            case MF_PROG_OP_IF:
+                if (!value->known) continue;
+                slot = op_consumer->depth - 2;
+                strcpy(rewrites[pc_consumer].src, (value->value == 0) ? "%" : "!");
+                break;
+            default:
+                continue;
+        }
+        if ((pc_producer = producers[op_consumer->input]) == MF_ICG_SSA_NONE) continue;
+        op = &fn->ops[pc_producer];
+        if ((!op->single) || (rewrites[pc_producer].rewrite) || \
+                (op->region != op_consumer->region)) continue;
+        if (!mf_icg_ssa_removable(fn, &lambda->ins[pc_producer], op)) continue;
+
+        /* Nothing in between touches the element */
+        for (pc = pc_producer + 1; pc != pc_consumer; pc++)
+        {
+            if ((fn->ops[pc].region != op_consumer->region) || \
+                    (fn->ops[pc].reach == MF_ICG_SSA_REACH_ANY) || \
+                    (fn->ops[pc].reach <= slot)) break;
+        }
+        if (pc != pc_consumer) continue;
+
+        rewrites[pc_producer].rewrite = 1;
+        mf_icg_ssa_drops(rewrites[pc_producer].src, \
+                mf_icg_ssa_pops(lambda->ins[pc_producer].op));
+        rewrites[pc_consumer].rewrite = 1;
+        if ((mf_icg_ssa_removal_joins(lambda, rewrites, pc_producer)) || \
+                (mf_icg_ssa_removal_joins(lambda, rewrites, pc_consumer)))
+        {
+            rewrites[pc_producer].rewrite = 0;
+            rewrites[pc_consumer].rewrite = 0;
+        }
+    }
+}
+
+static void mf_icg_ssa_plan_constants(struct mf_icg_ssa_fn *fn, \
+        struct mf_prog_lambda *lambda, \
+        struct mf_icg_ssa_rewrite *rewrites)
+{
+    struct mf_icg_ssa_op *op;
+    struct mf_icg_ssa_value *value;
+    size_t pc;
+    uint32_t pops;
+    int32_t k;
+
+    for (pc = 0; pc != fn->ops_count; pc++)
+    {
+        op = &fn->ops[pc];
+        if ((!op->single) || (rewrites[pc].rewrite)) continue;
+
+        switch (lambda->ins[pc].op)
+        {
+            case MF_PROG_OP_IF:
+                /* Known condition */
+                value = &fn->values[op->input];
+                if (!value->known) break;
+                rewrites[pc].rewrite = 1;
+                strcpy(rewrites[pc].src, (value->value == 0) ? "%%" : "\\%!");
+                break;
+
+            case MF_PROG_OP_ADD:
+            case MF_PROG_OP_SUB:
+            case MF_PROG_OP_MUL:
+            case MF_PROG_OP_DIV:
+            case MF_PROG_OP_EQ:
+            case MF_PROG_OP_G:
+            case MF_PROG_OP_L:
+            case MF_PROG_OP_AND:
+            case MF_PROG_OP_OR:
+            case MF_PROG_OP_NEG:
+            case MF_PROG_OP_NOT:
+            case MF_PROG_OP_DUP:
+            case MF_PROG_OP_COPY:
+            case MF_PROG_OP_LOAD:
+                value = &fn->values[op->result];
+                if (!value->known) break;
+                k = value->value;
+                /* Negative literals are '_' anyway */
+                if ((k == INT32_MIN) || ((k < 0) && (lambda->ins[pc].op == MF_PROG_OP_NEG))) break;
+                pops = mf_icg_ssa_pops(lambda->ins[pc].op);
+                rewrites[pc].rewrite = 1;
+                mf_icg_ssa_drops(rewrites[pc].src, pops);
+                sprintf(rewrites[pc].src + pops, (k < 0) ? "%d_" : "%d", (k < 0) ? -k : k);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+static int mf_icg_ssa_lower(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        mf_icg_ssa_codegen_t codegen, \
+        struct mf_icg_ssa_fn *fn, \
+        struct mf_prog_lambda *lambda, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        int *changed)
+{
+    int ret = 0;
+    struct mf_icg_ssa_rewrite *rewrites = NULL;
+    uint32_t *producers = NULL;
+    struct mf_icg_fcb_block *new_icg_fcb_block = NULL;
+    struct mf_icg_fcb_line *icg_fcb_line_begin, *icg_fcb_line_end, *icg_fcb_line_cur;
+    size_t pc, idx;
+
+    if (fn->ops_count == 0) return 0;
+
+    rewrites = (struct mf_icg_ssa_rewrite *)malloc( \
+            sizeof(struct mf_icg_ssa_rewrite) * fn->ops_count);
+    if (rewrites == NULL) goto fail_malloc;
+    for (pc = 0; pc != fn->ops_count; pc++) rewrites[pc].rewrite = 0;
+    producers = (uint32_t *)malloc(sizeof(uint32_t) * (fn->values_count + 1));
+    if (producers == NULL) goto fail_malloc;
+    for (idx = 0; idx != fn->values_count; idx++) producers[idx] = MF_ICG_SSA_NONE;
+    for (pc = 0; pc != fn->ops_count; pc++)
+    {
+        if (fn->ops[pc].result != MF_ICG_SSA_NONE) producers[fn->ops[pc].result] = (uint32_t)pc;
+    }
+
+    mf_icg_ssa_plan_removals(fn, lambda, rewrites, producers);
+    mf_icg_ssa_plan_constants(fn, lambda, rewrites);
+
+    for (pc = 0; pc != fn->ops_count; pc++)
+    {
+        if (!rewrites[pc].rewrite) continue;
+
+        icg_fcb_line_begin = lambda->lines[pc];
+        icg_fcb_line_end = icg_fcb_line_begin;
+        while ((icg_fcb_line_end != NULL) && \
+                (icg_fcb_line_end->token == icg_fcb_line_begin->token))
+        { icg_fcb_line_end = icg_fcb_line_end->next; }
+
+        if ((new_icg_fcb_block = mf_icg_fcb_block_new()) == NULL) goto fail_malloc;
+        if ((ret = codegen(err, context, new_icg_fcb_block, \
+                        rewrites[pc].src, strlen(rewrites[pc].src))) != 0)
+        { goto fail; }
+        /* Diagnostics point at the operation rewritten */
+        for (icg_fcb_line_cur = new_icg_fcb_block->begin; \
+                icg_fcb_line_cur != NULL; \
+                icg_fcb_line_cur = icg_fcb_line_cur->next)
+        {
+            if (icg_fcb_line_cur->token == NULL) continue;
+            icg_fcb_line_cur->token->pos_ln = icg_fcb_line_begin->token->pos_ln;
+            icg_fcb_line_cur->token->pos_col = icg_fcb_line_begin->token->pos_col;
+        }
+        if ((ret = mf_icg_fcb_block_replace(icg_fcb_block, \
+                        icg_fcb_line_begin, icg_fcb_line_end, \
+                        new_icg_fcb_block)) != 0)
+        { goto fail; }
+        mf_icg_fcb_block_destroy(new_icg_fcb_block);
+        new_icg_fcb_block = NULL;
+        *changed = 1;
+    }
+
+    goto done;
+fail_malloc:
+    MULTIPLE_ERROR_MALLOC();
+    ret = -MULTIPLE_ERR_MALLOC;
+fail:
+done:
+    if (new_icg_fcb_block != NULL) mf_icg_fcb_block_destroy(new_icg_fcb_block);
+    if (producers != NULL) free(producers);
+    if (rewrites != NULL) free(rewrites);
+    return ret;
+}
+
+int mf_icg_ssa_optimize(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        mf_icg_ssa_codegen_t codegen)
+{
+    int ret = 0;
+    struct mf_prog *prog = NULL;
+    struct mf_icg_ssa_fn *fn = NULL;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    size_t round, lambda_idx;
+    int changed = 1;
+
+    for (round = 0; (round != MF_ICG_SSA_ROUNDS_MAX) && (changed != 0); round++)
+    {
+        changed = 0;
+
+        /* Decoded again since the operations have been rewritten */
+        if ((ret = mf_prog_new_from_blocks(err, &prog, \
+                        context->icg_fcb_block_list)) != 0)
+        { goto fail; }
+
+        lambda_idx = 0;
+        icg_fcb_block_cur = context->icg_fcb_block_list->begin;
+        while (icg_fcb_block_cur != NULL)
+        {
+            if ((ret = mf_icg_ssa_build(err, &fn, prog, lambda_idx)) != 0)
+            { goto fail; }
+            if (fn != NULL)
+            {
+                mf_icg_ssa_copy_propagate(fn);
+                mf_icg_ssa_constant_propagate(fn);
+                mf_icg_ssa_eliminate_dead(fn);
+                if ((ret = mf_icg_ssa_lower(err, context, codegen, fn, \
+                                &prog->lambdas[lambda_idx], icg_fcb_block_cur, \
+                                &changed)) != 0)
+                { goto fail; }
+                mf_icg_ssa_destroy(fn);
+                fn = NULL;
+            }
+
+            lambda_idx++;
+            icg_fcb_block_cur = icg_fcb_block_cur->next;
+        }
+
+        mf_prog_destroy(prog);
+        prog = NULL;
+    }
+
+    goto done;
+fail:
+done:
+    if (fn != NULL) mf_icg_ssa_destroy(fn);
+    if (prog != NULL) mf_prog_destroy(prog);
+    return ret;
+}
+
@@ -0,0 +1,154 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Static Single Assignment
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ICG_SSA_H_
+#define _MF_ICG_SSA_H_
+
+#include <stdint.h>
+
+#include "multiple_err.h"
+
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+#include "mf_prog.h"
+
+/* Each lambda is turned into values in static single assignment form,
+ * the elements of the stack and the variables are only names of the 
+ * values, the static stack effects of the callees decide how many 
+ * elements a call could reach */
+
+#define MF_ICG_SSA_NONE ((uint32_t)0xFFFFFFFF)
+
+/* The operation could reach any element below */
+#define MF_ICG_SSA_REACH_ANY INT32_MIN
+
+enum
+{
+    MF_ICG_SSA_OP_ARG = 0,      /* imm = slot below the entry of the region */
+    MF_ICG_SSA_OP_CONST,        /* imm = integer */
+    MF_ICG_SSA_OP_LAMBDA,       /* imm = index of lambda */
+    MF_ICG_SSA_OP_COPY,
+    MF_ICG_SSA_OP_PHI,          /* one argument for each predecessor */
+    MF_ICG_SSA_OP_BINARY,       /* imm = MF_PROG_OP_ADD ... MF_PROG_OP_OR */
+    MF_ICG_SSA_OP_UNARY,        /* imm = MF_PROG_OP_NEG or MF_PROG_OP_NOT */
+    MF_ICG_SSA_OP_LOAD,         /* imm = variable slot */
+    MF_ICG_SSA_OP_STORE,        /* imm = variable slot */
+    MF_ICG_SSA_OP_PICK,
+    MF_ICG_SSA_OP_READ,
+    MF_ICG_SSA_OP_OUTPUT,       /* imm = MF_PROG_OP_PRINT_* or MF_PROG_OP_FLUSH */
+    MF_ICG_SSA_OP_CALL,         /* imm = -1 if the stack effect is unknown */
+    MF_ICG_SSA_OP_RESULT,       /* args[0] = call, imm = index */
+    MF_ICG_SSA_OP_BRANCH,       /* args[0] = condition, ends the block */
+    MF_ICG_SSA_OP_RETURN,       /* the elements left to the caller */
+};
+
+struct mf_icg_ssa_value
+{
+    uint32_t op;
+    int32_t imm;
+    uint32_t *args;
+    uint32_t args_count;
+    uint32_t block;
+
+    /* Facts found by the passes */
+    uint32_t copy_of;
+    int known;
+    int32_t value;
+    int live;
+};
+
+/* Blocks only come from conditional calls, the graph is acyclic and
+ * the blocks are in topological order */
+enum
+{
+    MF_ICG_SSA_BLOCK_ENTRY = 0,
+    MF_ICG_SSA_BLOCK_TAKEN,     /* the callee of '?' is called */
+    MF_ICG_SSA_BLOCK_JOIN,      /* preds[0] skipped the call, preds[1] made it */
+};
+
+struct mf_icg_ssa_block
+{
+    uint32_t kind;
+    uint32_t preds[2];
+    /* The 'BRANCH' deciding how the block is entered */
+    uint32_t branch;
+    /* Values are allocated block after block */
+    uint32_t values_begin;
+    uint32_t values_end;
+
+    int reachable;
+};
+
+/* What each instruction of the lambda did to the stack */
+struct mf_icg_ssa_op
+{
+    /* Counted from the entry of the region, which restarts after 
+     * the calls of unknown stack effect */
+    uint32_t region;
+    int32_t depth;
+    int32_t reach;
+    /* The element on the top which was consumed */
+    uint32_t input;
+    uint32_t result;
+    /* The operation decoded into this instruction only */
+    int single;
+};
+
+struct mf_icg_ssa_fn
+{
+    struct mf_icg_ssa_value *values;
+    size_t values_count;
+    size_t values_capacity;
+
+    struct mf_icg_ssa_block *blocks;
+    size_t blocks_count;
+    size_t blocks_capacity;
+
+    /* One for each instruction of the lambda */
+    struct mf_icg_ssa_op *ops;
+    size_t ops_count;
+};
+
+/* '*fn_out' is NULL for a lambda reaching too deep to be rewritten */
+int mf_icg_ssa_build(struct multiple_error *err, \
+        struct mf_icg_ssa_fn **fn_out, \
+        struct mf_prog *prog, size_t lambda_idx);
+void mf_icg_ssa_destroy(struct mf_icg_ssa_fn *fn);
+
+/* Passes */
+void mf_icg_ssa_copy_propagate(struct mf_icg_ssa_fn *fn);
+void mf_icg_ssa_constant_propagate(struct mf_icg_ssa_fn *fn);
+void mf_icg_ssa_eliminate_dead(struct mf_icg_ssa_fn *fn);
+
+/* Generates the operations of the False source 'src' into 'icg_fcb_block' */
+typedef int (*mf_icg_ssa_codegen_t)(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        const char *src, size_t len);
+
+/* Run the passes over every lambda and lower the facts back into the
+ * floating code blocks, each operation is rewritten into one with the
+ * same layout of the stack */
+int mf_icg_ssa_optimize(struct multiple_error *err, \
+        struct mf_icg_context *context, \
+        mf_icg_ssa_codegen_t codegen);
+
+#endif
+
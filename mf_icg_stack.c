@@ -0,0 +1,441 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Stack Effect Analysis
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "multiply_str_aux.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_fcb.h"
+#include "mf_icg_context.h"
+#include "mf_icg_stack.h"
+
+/* Elements on the top of stack tracked for lambda literals */
+#define MF_ICG_STACK_TRACK_SIZE 16
+#define MF_ICG_STACK_NOT_LAMBDA (-1)
+
+struct mf_icg_stack_state
+{
+    int known; /* depth relative to the entry is known */
+    int safe; /* no operation with depth only known at runtime */
+    int sure; /* the current operation is reached by every run */
+    int32_t depth;
+    uint32_t need; /* on every run */
+    uint32_t need_max; /* on some path */
+    uint32_t max;
+
+    /* Block index of the lambda literals on the top of stack */
+    int32_t track[MF_ICG_STACK_TRACK_SIZE];
+    size_t track_size;
+};
+
+static void mf_icg_stack_state_init(struct mf_icg_stack_state *state)
+{
+    state->known = 1;
+    state->safe = 1;
+    state->sure = 1;
+    state->depth = 0;
+    state->need = 0;
+    state->need_max = 0;
+    state->max = 0;
+    state->track_size = 0;
+}
+
+static int32_t mf_icg_stack_track_peek(struct mf_icg_stack_state *state, \
+        size_t depth)
+{
+    if (depth >= state->track_size) return MF_ICG_STACK_NOT_LAMBDA;
+    return state->track[state->track_size - 1 - depth];
+}
+
+static void mf_icg_stack_track_pop(struct mf_icg_stack_state *state, \
+        size_t count)
+{
+    state->track_size = (count >= state->track_size) ? 0 : state->track_size - count;
+}
+
+static void mf_icg_stack_track_push(struct mf_icg_stack_state *state, \
+        int32_t value)
+{
+    if (state->track_size == MF_ICG_STACK_TRACK_SIZE)
+    {
+        /* Forget the deepest one */
+        memmove(&state->track[0], &state->track[1], \
+                sizeof(int32_t) * (MF_ICG_STACK_TRACK_SIZE - 1));
+        state->track_size -= 1;
+    }
+    state->track[state->track_size++] = value;
+}
+
+/* Requires 'need' elements, grows at most 'max' elements above
+ * the current depth and finally changes the depth by 'net' */
+static void mf_icg_stack_apply(struct mf_icg_stack_state *state, \
+        uint32_t need, int32_t net, uint32_t max)
+{
+    int32_t value;
+
+    if (!state->known) return;
+
+    value = (int32_t)need - state->depth;
+    if (value > 0)
+    {
+        if ((state->sure != 0) && ((uint32_t)value > state->need)) state->need = (uint32_t)value;
+        if ((uint32_t)value > state->need_max) state->need_max = (uint32_t)value;
+    }
+    value = state->depth + (int32_t)max;
+    if ((value > 0) && ((uint32_t)value > state->max)) state->max = (uint32_t)value;
+    state->depth += net;
+}
+
+/* Pops 'need' elements and pushes 'need + net' elements */
+static void mf_icg_stack_apply_op(struct mf_icg_stack_state *state, \
+        uint32_t need, int32_t net)
+{
+    int32_t count;
+
+    mf_icg_stack_apply(state, need, net, (net > 0) ? (uint32_t)net : 0);
+    mf_icg_stack_track_pop(state, need);
+    for (count = (int32_t)need + net; count > 0; count--)
+    { mf_icg_stack_track_push(state, MF_ICG_STACK_NOT_LAMBDA); }
+}
+
+static void mf_icg_stack_unknown(struct mf_icg_stack_state *state)
+{
+    state->known = 0;
+    state->safe = 0;
+    state->sure = 0;
+    state->track_size = 0;
+}
+
+static struct mf_icg_fcb_block *mf_icg_stack_callee(struct mf_icg_fcb_block **blocks, \
+        size_t blocks_count, int32_t block_idx)
+{
+    if ((block_idx == MF_ICG_STACK_NOT_LAMBDA) || \
+            ((size_t)block_idx >= blocks_count))
+    { return NULL; }
+    if (!blocks[block_idx]->stack_known) return NULL;
+    return blocks[block_idx];
+}
+
+/* Call the lambda which has already been popped, a callee which
+ * is not 'always' called only adds to the bounds of some path */
+static void mf_icg_stack_apply_callee(struct mf_icg_stack_state *state, \
+        struct mf_icg_fcb_block *callee, int always)
+{
+    int32_t count;
+    int sure = state->sure;
+
+    if (callee == NULL)
+    {
+        mf_icg_stack_unknown(state);
+        return;
+    }
+    if (!callee->stack_safe) state->safe = 0;
+    if (sure != 0)
+    {
+        /* Both bounds of the callee start from the same depth */
+        if (always != 0) mf_icg_stack_apply(state, callee->stack_need, 0, 0);
+        state->sure = 0;
+    }
+    mf_icg_stack_apply(state, callee->stack_need_max, callee->stack_net, callee->stack_max);
+    state->sure = ((sure != 0) && (callee->stack_returns != 0)) ? 1 : 0;
+    /* Anything the callee required could have been shuffled */
+    mf_icg_stack_track_pop(state, callee->stack_need_max);
+    for (count = (int32_t)callee->stack_need_max + callee->stack_net; count > 0; count--)
+    { mf_icg_stack_track_push(state, MF_ICG_STACK_NOT_LAMBDA); }
+}
+
+static void mf_icg_stack_apply_copy(struct mf_icg_stack_state *state, \
+        uint32_t depth)
+{
+    int32_t value = mf_icg_stack_track_peek(state, depth);
+
+    mf_icg_stack_apply(state, depth + 1, 1, 1);
+    mf_icg_stack_track_push(state, value);
+}
+
+static int mf_icg_stack_analyze_group(struct mf_icg_stack_state *state, \
+        struct mf_icg_fcb_block **blocks, size_t blocks_count, \
+        struct token *token, \
+        struct mf_icg_fcb_line *icg_fcb_line_begin, \
+        struct mf_icg_fcb_line *icg_fcb_line_end)
+{
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+    struct mf_icg_fcb_block *callee, *callee_cond;
+    int32_t value0, value1, value2;
+    uint32_t lambda_idx;
+    int value_int;
+
+    switch (token->value)
+    {
+        case TOKEN_CONSTANT_STRING:
+        case TOKEN_OP_FLUSH:
+            break;
+
+        case TOKEN_OP_ADD:
+        case TOKEN_OP_SUB:
+        case TOKEN_OP_MUL:
+        case TOKEN_OP_DIV:
+        case TOKEN_OP_EQ:
+        case TOKEN_OP_G:
+        case TOKEN_OP_L:
+        case TOKEN_OP_AND:
+        case TOKEN_OP_OR:
+            mf_icg_stack_apply_op(state, 2, -1);
+            break;
+
+        case TOKEN_OP_UNARY_MINUS:
+        case TOKEN_OP_NOT:
+            mf_icg_stack_apply_op(state, 1, 0);
+            break;
+
+        case TOKEN_OP_DROP:
+        case TOKEN_OP_PRINT_INT:
+        case TOKEN_OP_PRINT_CHAR:
+            mf_icg_stack_apply_op(state, 1, -1);
+            break;
+
+        case TOKEN_OP_READ_CHAR:
+            mf_icg_stack_apply_op(state, 0, 1);
+            break;
+
+        case TOKEN_OP_DUP:
+            mf_icg_stack_apply_copy(state, 0);
+            break;
+
+        case TOKEN_OP_SWAP:
+            value0 = mf_icg_stack_track_peek(state, 0);
+            value1 = mf_icg_stack_track_peek(state, 1);
+            mf_icg_stack_apply(state, 2, 0, 0);
+            mf_icg_stack_track_pop(state, 2);
+            mf_icg_stack_track_push(state, value0);
+            mf_icg_stack_track_push(state, value1);
+            break;
+
+        case TOKEN_OP_ROTATE3:
+            value0 = mf_icg_stack_track_peek(state, 0);
+            value1 = mf_icg_stack_track_peek(state, 1);
+            value2 = mf_icg_stack_track_peek(state, 2);
+            mf_icg_stack_apply(state, 3, 0, 0);
+            mf_icg_stack_track_pop(state, 3);
+            mf_icg_stack_track_push(state, value1);
+            mf_icg_stack_track_push(state, value0);
+            mf_icg_stack_track_push(state, value2);
+            break;
+
+        case TOKEN_OP_PICK:
+            /* Index only known at runtime */
+            mf_icg_stack_apply_op(state, 1, 0);
+            state->safe = 0;
+            break;
+
+        case TOKEN_VARIABLE:
+            if ((token->next != NULL) && (token->next->value == TOKEN_OP_ASSIGN))
+            { mf_icg_stack_apply_op(state, 1, -1); }
+            else
+            { mf_icg_stack_apply_op(state, 0, 1); }
+            break;
+
+        case TOKEN_OP_LEFT_BRACKET:
+            value0 = MF_ICG_STACK_NOT_LAMBDA;
+            icg_fcb_line_cur = icg_fcb_line_begin;
+            while (icg_fcb_line_cur != icg_fcb_line_end)
+            {
+                if (mf_icg_fcb_line_lambda_idx(icg_fcb_line_cur, &lambda_idx) == 0)
+                { value0 = (int32_t)lambda_idx; }
+                icg_fcb_line_cur = icg_fcb_line_cur->next;
+            }
+            mf_icg_stack_apply(state, 0, 1, 1);
+            mf_icg_stack_track_push(state, value0);
+            break;
+
+        case TOKEN_OP_APPLY:
+            /* f ! */
+            callee = mf_icg_stack_callee(blocks, blocks_count, mf_icg_stack_track_peek(state, 0));
+            mf_icg_stack_apply_op(state, 1, -1);
+            mf_icg_stack_apply_callee(state, callee, 1);
+            break;
+
+        case TOKEN_OP_IF:
+            /* c f ? */
+            callee = mf_icg_stack_callee(blocks, blocks_count, mf_icg_stack_track_peek(state, 0));
+            mf_icg_stack_apply_op(state, 2, -2);
+            if ((callee == NULL) || (callee->stack_net != 0))
+            {
+                /* Depth depends on the condition */
+                mf_icg_stack_unknown(state);
+                break;
+            }
+            mf_icg_stack_apply_callee(state, callee, 0);
+            break;
+
+        case TOKEN_OP_WHILE:
+            /* [c] [f] # */
+            callee = mf_icg_stack_callee(blocks, blocks_count, mf_icg_stack_track_peek(state, 0));
+            callee_cond = mf_icg_stack_callee(blocks, blocks_count, mf_icg_stack_track_peek(state, 1));
+            mf_icg_stack_apply_op(state, 2, -2);
+            if ((callee == NULL) || (callee_cond == NULL) || \
+                    (callee_cond->stack_net != 1) || (callee->stack_net != 0))
+            {
+                /* Depth depends on the iterations */
+                mf_icg_stack_unknown(state);
+                break;
+            }
+            /* Every iteration leaves the depth unchanged, the body
+             * may never run and the loop may never end */
+            mf_icg_stack_apply_callee(state, callee_cond, 1);
+            mf_icg_stack_apply_op(state, 1, -1);
+            mf_icg_stack_apply_callee(state, callee, 0);
+            state->sure = 0;
+            break;
+
+        default:
+            if ((!IS_TOKEN_CONSTANT(token->value)) && (token->value != TOKEN_CHAR))
+            {
+                mf_icg_stack_unknown(state);
+                break;
+            }
+            /* Literal printed in the same group */
+            if ((token->next != NULL) && \
+                    ((token->next->value == TOKEN_OP_PRINT_CHAR) || \
+                     (token->next->value == TOKEN_OP_PRINT_INT)))
+            { break; }
+            /* 'Nø' with literal index */
+            if ((token->value != TOKEN_CHAR) && \
+                    (token->next != NULL) && \
+                    (token->next->value == TOKEN_OP_PICK) && \
+                    (multiply_convert_str_to_int(&value_int, token->str, token->len) == 0) && \
+                    (value_int >= 0))
+            {
+                mf_icg_stack_apply_copy(state, (uint32_t)value_int);
+                break;
+            }
+            mf_icg_stack_apply_op(state, 0, 1);
+            break;
+    }
+
+    return 0;
+}
+
+static int mf_icg_stack_analyze_block(struct multiple_error *err, \
+        struct mf_icg_fcb_block **blocks, size_t blocks_count, \
+        struct mf_icg_fcb_block *icg_fcb_block, \
+        int is_main)
+{
+    int ret = 0;
+    struct mf_icg_stack_state state;
+    struct mf_icg_fcb_line *icg_fcb_line_cur, *icg_fcb_line_begin;
+    struct token *token;
+
+    mf_icg_stack_state_init(&state);
+
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        /* Lines produced by the same operation */
+        token = icg_fcb_line_cur->token;
+        icg_fcb_line_begin = icg_fcb_line_cur;
+        while ((icg_fcb_line_cur != NULL) && (icg_fcb_line_cur->token == token))
+        { icg_fcb_line_cur = icg_fcb_line_cur->next; }
+
+        /* Prologue and epilogue */
+        if (token == NULL) continue;
+
+        if ((ret = mf_icg_stack_analyze_group(&state, \
+                        blocks, blocks_count, \
+                        token, \
+                        icg_fcb_line_begin, icg_fcb_line_cur)) != 0)
+        { goto fail; }
+
+        /* Nothing on the stack at the beginning of the program */
+        if ((is_main != 0) && (state.known != 0) && (state.need != 0))
+        {
+            multiple_error_update(err, -MULTIPLE_ERR_ICODEGEN, \
+                    "%d:%d: error: stack underflow, %u more element(s) required", \
+                    token->pos_ln, token->pos_col, state.need);
+            ret = -MULTIPLE_ERR_ICODEGEN;
+            goto fail;
+        }
+    }
+
+    icg_fcb_block->stack_known = state.known;
+    icg_fcb_block->stack_safe = ((state.known != 0) && (state.safe != 0)) ? 1 : 0;
+    icg_fcb_block->stack_returns = ((state.known != 0) && (state.sure != 0)) ? 1 : 0;
+    icg_fcb_block->stack_need = state.need;
+    icg_fcb_block->stack_need_max = state.need_max;
+    icg_fcb_block->stack_net = state.depth;
+    icg_fcb_block->stack_max = state.max;
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+int mf_icg_stack_analyze(struct multiple_error *err, \
+        struct mf_icg_context *context)
+{
+    int ret = 0;
+    struct mf_icg_fcb_block **blocks = NULL;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    size_t blocks_count = context->icg_fcb_block_list->size;
+    size_t idx;
+
+    if (blocks_count == 0) return 0;
+
+    blocks = (struct mf_icg_fcb_block **)malloc(sizeof(struct mf_icg_fcb_block *) * blocks_count);
+    if (blocks == NULL)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        ret = -MULTIPLE_ERR_MALLOC;
+        goto fail;
+    }
+    idx = 0;
+    icg_fcb_block_cur = context->icg_fcb_block_list->begin;
+    while (icg_fcb_block_cur != NULL)
+    {
+        blocks[idx++] = icg_fcb_block_cur;
+        icg_fcb_block_cur = icg_fcb_block_cur->next;
+    }
+
+    /* Lambdas are always appended before the blocks which make them,
+     * and 'main' is the last one */
+    for (idx = 0; idx != blocks_count; idx++)
+    {
+        if ((ret = mf_icg_stack_analyze_block(err, \
+                        blocks, idx, \
+                        blocks[idx], \
+                        (idx + 1 == blocks_count) ? 1 : 0)) != 0)
+        { goto fail; }
+    }
+
+    goto done;
+fail:
+done:
+    if (blocks != NULL) free(blocks);
+    return ret;
+}
+
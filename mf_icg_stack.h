@@ -0,0 +1,34 @@
+/* Multiple False Programming Language : Intermediate Code Generator
+ * Stack Effect Analysis
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_ICG_STACK_H_
+#define _MF_ICG_STACK_H_
+
+#include "multiple_err.h"
+
+#include "mf_icg_context.h"
+
+/* Compute the stack effect of each floating code block,
+ * the underflows which could be proved are reported as errors */
+int mf_icg_stack_analyze(struct multiple_error *err, \
+        struct mf_icg_context *context);
+
+#endif
+
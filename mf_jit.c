@@ -0,0 +1,967 @@
+/* Multiple False Programming Language : Runtime
+ * x86-64 JIT
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+#include "mf_rt.h"
+#include "mf_jit.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Register usage inside the generated code:
+ *   rbx  runtime
+ *   r12  next free slot of the operand stack
+ *   r13d top of the stack, while it is kept in the register
+ *   r14  bottom of the stack
+ *   r15  end of the stack
+ * All of them are callee saved, so calls into C keep them. */
+
+enum
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+/* Frame of each lambda, the two slots hold the lambdas of a 'while' */
+#define MF_JIT_FRAME_SIZE 24
+/* Slots of the stack are reached with 32-bit displacements */
+#define MF_JIT_SLOTS_MAX ((uint32_t)(INT32_MAX / 4))
+
+#define OFF_SP ((int32_t)offsetof(struct mf_rt, sp))
+#define OFF_STACK ((int32_t)offsetof(struct mf_rt, stack))
+#define OFF_STACK_END ((int32_t)offsetof(struct mf_rt, stack_end))
+#define OFF_VARS ((int32_t)offsetof(struct mf_rt, vars))
+#define OFF_DEPTH ((int32_t)offsetof(struct mf_rt, depth))
+#define OFF_DEPTH_MAX ((int32_t)offsetof(struct mf_rt, depth_max))
+
+/* Code buffer */
+
+struct mf_jit_buf
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    int oom;
+};
+
+static void mf_jit_buf_init(struct mf_jit_buf *buf)
+{
+    buf->data = NULL;
+    buf->size = 0;
+    buf->capacity = 0;
+    buf->oom = 0;
+}
+
+static void mf_jit_buf_uninit(struct mf_jit_buf *buf)
+{
+    if (buf->data != NULL) free(buf->data);
+    buf->data = NULL;
+}
+
+/* Running out of memory is remembered and checked once at the end */
+static void mf_jit_emit(struct mf_jit_buf *buf, const uint8_t *bytes, size_t len)
+{
+    uint8_t *new_data;
+    size_t new_capacity;
+
+    if (buf->oom != 0) return;
+    if (buf->size + len > buf->capacity)
+    {
+        new_capacity = (buf->capacity == 0) ? 4096 : buf->capacity;
+        while (buf->size + len > new_capacity) new_capacity *= 2;
+        if ((new_data = (uint8_t *)realloc(buf->data, new_capacity)) == NULL)
+        {
+            buf->oom = 1;
+            return;
+        }
+        buf->data = new_data;
+        buf->capacity = new_capacity;
+    }
+    memcpy(buf->data + buf->size, bytes, len);
+    buf->size += len;
+}
+
+static void mf_jit_emit_u8(struct mf_jit_buf *buf, uint8_t b)
+{
+    mf_jit_emit(buf, &b, 1);
+}
+
+static void mf_jit_emit_u32(struct mf_jit_buf *buf, uint32_t v)
+{
+    uint8_t bytes[4];
+
+    bytes[0] = (uint8_t)(v);
+    bytes[1] = (uint8_t)(v >> 8);
+    bytes[2] = (uint8_t)(v >> 16);
+    bytes[3] = (uint8_t)(v >> 24);
+    mf_jit_emit(buf, bytes, 4);
+}
+
+static void mf_jit_emit_u64(struct mf_jit_buf *buf, uint64_t v)
+{
+    mf_jit_emit_u32(buf, (uint32_t)v);
+    mf_jit_emit_u32(buf, (uint32_t)(v >> 32));
+}
+
+static void mf_jit_patch_rel32(struct mf_jit_buf *buf, size_t pos, size_t target)
+{
+    uint32_t rel = (uint32_t)((int32_t)target - (int32_t)(pos + 4));
+
+    if (buf->oom != 0) return;
+    buf->data[pos] = (uint8_t)(rel);
+    buf->data[pos + 1] = (uint8_t)(rel >> 8);
+    buf->data[pos + 2] = (uint8_t)(rel >> 16);
+    buf->data[pos + 3] = (uint8_t)(rel >> 24);
+}
+
+/* Instruction encoding */
+
+static void mf_jit_emit_rex(struct mf_jit_buf *buf, int w, int reg, int rm)
+{
+    uint8_t rex = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0));
+    if (rex != 0x40) mf_jit_emit_u8(buf, rex);
+}
+
+/* op reg, rm */
+static void mf_jit_emit_rr(struct mf_jit_buf *buf, int w, \
+        const char *opcode, int reg, int rm)
+{
+    mf_jit_emit_rex(buf, w, reg, rm);
+    mf_jit_emit(buf, (const uint8_t *)opcode, strlen(opcode));
+    mf_jit_emit_u8(buf, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/* op reg, [base + disp] */
+static void mf_jit_emit_rm(struct mf_jit_buf *buf, int w, \
+        const char *opcode, int reg, int base, int32_t disp)
+{
+    mf_jit_emit_rex(buf, w, reg, base);
+    mf_jit_emit(buf, (const uint8_t *)opcode, strlen(opcode));
+    mf_jit_emit_u8(buf, (uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+    /* rsp and r12 need a SIB byte */
+    if ((base & 7) == RSP) mf_jit_emit_u8(buf, 0x24);
+    mf_jit_emit_u32(buf, (uint32_t)disp);
+}
+
+#define OP_MOV_STORE "\x89"
+#define OP_MOV_LOAD "\x8B"
+#define OP_LEA "\x8D"
+#define OP_ADD "\x01"
+#define OP_SUB "\x29"
+#define OP_AND "\x21"
+#define OP_OR "\x09"
+#define OP_CMP "\x39"
+#define OP_TEST "\x85"
+#define OP_IMUL "\x0F\xAF"
+#define OP_GRP_F7 "\xF7"
+#define OP_GRP_FF "\xFF"
+
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+#define CC_L 0xC
+#define CC_G 0xF
+
+static void mf_jit_emit_mov_imm32(struct mf_jit_buf *buf, int reg, uint32_t imm)
+{
+    mf_jit_emit_rex(buf, 0, 0, reg);
+    mf_jit_emit_u8(buf, (uint8_t)(0xB8 | (reg & 7)));
+    mf_jit_emit_u32(buf, imm);
+}
+
+static void mf_jit_emit_mov_imm64(struct mf_jit_buf *buf, int reg, uint64_t imm)
+{
+    mf_jit_emit_rex(buf, 1, 0, reg);
+    mf_jit_emit_u8(buf, (uint8_t)(0xB8 | (reg & 7)));
+    mf_jit_emit_u64(buf, imm);
+}
+
+/* add/sub reg64, imm8 */
+static void mf_jit_emit_add_imm8(struct mf_jit_buf *buf, int reg, int8_t imm)
+{
+    mf_jit_emit_rr(buf, 1, "\x83", (imm < 0) ? 5 : 0, reg);
+    mf_jit_emit_u8(buf, (uint8_t)((imm < 0) ? -imm : imm));
+}
+
+/* reg32 = (flags satisfy cc) ? -1 : 0 */
+static void mf_jit_emit_setcc_bool(struct mf_jit_buf *buf, int cc, int reg)
+{
+    uint8_t bytes[8];
+
+    bytes[0] = 0x0F; bytes[1] = (uint8_t)(0x90 | cc); bytes[2] = 0xC0; /* setcc al */
+    bytes[3] = 0x0F; bytes[4] = 0xB6; bytes[5] = 0xC0; /* movzx eax, al */
+    bytes[6] = 0xF7; bytes[7] = 0xD8; /* neg eax */
+    mf_jit_emit(buf, bytes, 8);
+    if (reg != RAX) mf_jit_emit_rr(buf, 0, OP_MOV_STORE, RAX, reg);
+}
+
+/* Returns the position of the displacement */
+static size_t mf_jit_emit_jcc(struct mf_jit_buf *buf, int cc)
+{
+    mf_jit_emit_u8(buf, 0x0F);
+    mf_jit_emit_u8(buf, (uint8_t)(0x80 | cc));
+    mf_jit_emit_u32(buf, 0);
+    return buf->size - 4;
+}
+
+static size_t mf_jit_emit_jmp(struct mf_jit_buf *buf)
+{
+    mf_jit_emit_u8(buf, 0xE9);
+    mf_jit_emit_u32(buf, 0);
+    return buf->size - 4;
+}
+
+static size_t mf_jit_emit_call(struct mf_jit_buf *buf)
+{
+    mf_jit_emit_u8(buf, 0xE8);
+    mf_jit_emit_u32(buf, 0);
+    return buf->size - 4;
+}
+
+/* Lambda compiler */
+
+/* Shared tails of each function */
+enum
+{
+    MF_JIT_LABEL_ERR_RET = 0,
+    MF_JIT_LABEL_ERR_RET_NO_DEPTH,
+    MF_JIT_LABEL_UNDERFLOW,
+    MF_JIT_LABEL_OVERFLOW,
+    MF_JIT_LABEL_DIV_ZERO,
+    MF_JIT_LABEL_LAMBDA,
+    MF_JIT_LABEL_DEPTH,
+    MF_JIT_LABEL_COUNT,
+};
+
+struct mf_jit_fixup
+{
+    size_t pos;
+    size_t target; /* label or lambda */
+};
+
+struct mf_jit_fixups
+{
+    struct mf_jit_fixup *items;
+    size_t size;
+    size_t capacity;
+};
+
+static int mf_jit_fixups_push(struct mf_jit_fixups *fixups, size_t pos, size_t target)
+{
+    struct mf_jit_fixup *new_items;
+    size_t new_capacity;
+
+    if (fixups->size == fixups->capacity)
+    {
+        new_capacity = (fixups->capacity == 0) ? 64 : fixups->capacity * 2;
+        new_items = (struct mf_jit_fixup *)realloc(fixups->items, \
+                sizeof(struct mf_jit_fixup) * new_capacity);
+        if (new_items == NULL) return -MULTIPLE_ERR_MALLOC;
+        fixups->items = new_items;
+        fixups->capacity = new_capacity;
+    }
+    fixups->items[fixups->size].pos = pos;
+    fixups->items[fixups->size].target = target;
+    fixups->size++;
+
+    return 0;
+}
+
+struct mf_jit_compiler
+{
+    const struct mf_prog *prog;
+    struct mf_jit_buf buf;
+    void **entries;
+
+    /* Calls to other lambdas, resolved after all of them are emitted */
+    struct mf_jit_fixups calls;
+    /* Jumps to the tails of the current lambda */
+    struct mf_jit_fixups jumps;
+
+    /* Whether the top of the stack lives in r13d */
+    int cached;
+    /* Every access checks the bounds of the stack */
+    int checked;
+};
+
+static int mf_jit_jcc_label(struct mf_jit_compiler *jc, int cc, size_t label)
+{
+    return mf_jit_fixups_push(&jc->jumps, mf_jit_emit_jcc(&jc->buf, cc), label);
+}
+
+/* Bring the top of the stack into r13d */
+static int mf_jit_ensure_cached(struct mf_jit_compiler *jc)
+{
+    int ret = 0;
+
+    if (jc->cached != 0) return 0;
+    if (jc->checked != 0)
+    {
+        mf_jit_emit_rr(&jc->buf, 1, OP_CMP, R14, R12);
+        if ((ret = mf_jit_jcc_label(jc, CC_BE, MF_JIT_LABEL_UNDERFLOW)) != 0) return ret;
+    }
+    mf_jit_emit_add_imm8(&jc->buf, R12, -4);
+    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, R13, R12, 0);
+    jc->cached = 1;
+
+    return 0;
+}
+
+/* Pop the element below the cached one into 'reg' */
+static int mf_jit_pop_below(struct mf_jit_compiler *jc, int reg)
+{
+    int ret = 0;
+
+    if (jc->checked != 0)
+    {
+        mf_jit_emit_rr(&jc->buf, 1, OP_CMP, R14, R12);
+        if ((ret = mf_jit_jcc_label(jc, CC_BE, MF_JIT_LABEL_UNDERFLOW)) != 0) return ret;
+    }
+    mf_jit_emit_add_imm8(&jc->buf, R12, -4);
+    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, reg, R12, 0);
+
+    return 0;
+}
+
+/* While the top is cached its slot is already known to be free */
+static void mf_jit_flush(struct mf_jit_compiler *jc)
+{
+    if (jc->cached == 0) return;
+    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, R13, R12, 0);
+    mf_jit_emit_add_imm8(&jc->buf, R12, 4);
+    jc->cached = 0;
+}
+
+/* Make room for a new top in r13d, the old one stays in memory */
+static int mf_jit_push_slot(struct mf_jit_compiler *jc)
+{
+    int ret = 0;
+
+    if (jc->cached != 0)
+    {
+        mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, R13, R12, 0);
+        mf_jit_emit_add_imm8(&jc->buf, R12, 4);
+    }
+    if (jc->checked != 0)
+    {
+        mf_jit_emit_rr(&jc->buf, 1, OP_CMP, R15, R12);
+        if ((ret = mf_jit_jcc_label(jc, CC_AE, MF_JIT_LABEL_OVERFLOW)) != 0) return ret;
+    }
+    jc->cached = 1;
+
+    return 0;
+}
+
+/* Returns non-zero on failure of the callee */
+static int mf_jit_check_call(struct mf_jit_compiler *jc)
+{
+    mf_jit_emit_rr(&jc->buf, 0, OP_TEST, RAX, RAX);
+    return mf_jit_jcc_label(jc, CC_NE, MF_JIT_LABEL_ERR_RET);
+}
+
+static int mf_jit_call_direct(struct mf_jit_compiler *jc, size_t lambda_idx)
+{
+    int ret;
+
+    if ((ret = mf_jit_fixups_push(&jc->calls, mf_jit_emit_call(&jc->buf), lambda_idx)) != 0)
+    { return ret; }
+    return mf_jit_check_call(jc);
+}
+
+/* Call the lambda in ecx through the table of entries */
+static int mf_jit_call_indirect(struct mf_jit_compiler *jc)
+{
+    int ret;
+
+    mf_jit_emit_rr(&jc->buf, 0, "\x81", 7, RCX); /* cmp ecx, imm32 */
+    mf_jit_emit_u32(&jc->buf, (uint32_t)jc->prog->lambdas_count);
+    if ((ret = mf_jit_jcc_label(jc, CC_AE, MF_JIT_LABEL_LAMBDA)) != 0) return ret;
+    mf_jit_emit_mov_imm64(&jc->buf, RAX, (uint64_t)(uintptr_t)jc->entries);
+    mf_jit_emit(&jc->buf, (const uint8_t *)"\xFF\x14\xC8", 3); /* call [rax + rcx * 8] */
+    return mf_jit_check_call(jc);
+}
+
+/* Leave the instruction to the interpreter */
+static int mf_jit_deopt(struct mf_jit_compiler *jc, const struct mf_prog_ins *ins)
+{
+    mf_jit_flush(jc);
+    mf_jit_emit_rm(&jc->buf, 1, OP_MOV_STORE, R12, RBX, OFF_SP);
+    mf_jit_emit_rr(&jc->buf, 1, OP_MOV_STORE, RBX, RDI);
+    mf_jit_emit_mov_imm64(&jc->buf, RSI, (uint64_t)(uintptr_t)ins);
+    mf_jit_emit_mov_imm64(&jc->buf, RAX, (uint64_t)(uintptr_t)mf_rt_exec_ins);
+    mf_jit_emit_rr(&jc->buf, 0, OP_GRP_FF, 2, RAX); /* call rax */
+    mf_jit_emit_rm(&jc->buf, 1, OP_MOV_LOAD, R12, RBX, OFF_SP);
+    return mf_jit_check_call(jc);
+}
+
+static int mf_jit_compile_binary(struct mf_jit_compiler *jc, uint32_t op)
+{
+    int ret;
+    size_t pos;
+
+    /* b in r13d, a in eax */
+    if ((ret = mf_jit_ensure_cached(jc)) != 0) return ret;
+    if ((ret = mf_jit_pop_below(jc, RAX)) != 0) return ret;
+
+    switch (op)
+    {
+        case MF_PROG_OP_ADD:
+            mf_jit_emit_rr(&jc->buf, 0, OP_ADD, RAX, R13);
+            break;
+        case MF_PROG_OP_SUB:
+            mf_jit_emit_rr(&jc->buf, 0, OP_SUB, R13, RAX);
+            mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, RAX, R13);
+            break;
+        case MF_PROG_OP_MUL:
+            mf_jit_emit_rr(&jc->buf, 0, OP_IMUL, R13, RAX);
+            break;
+        case MF_PROG_OP_DIV:
+            mf_jit_emit_rr(&jc->buf, 0, OP_TEST, R13, R13);
+            if ((ret = mf_jit_jcc_label(jc, CC_E, MF_JIT_LABEL_DIV_ZERO)) != 0) return ret;
+            /* INT32_MIN / -1 traps in idiv, a division by -1 is a
+             * negation which wraps like the other operations */
+            mf_jit_emit_rr(&jc->buf, 0, "\x83", 7, R13); /* cmp r13d, -1 */
+            mf_jit_emit_u8(&jc->buf, 0xFF);
+            mf_jit_emit_u8(&jc->buf, 0x70 | CC_NE);
+            mf_jit_emit_u8(&jc->buf, 0);
+            pos = jc->buf.size;
+            mf_jit_emit_rr(&jc->buf, 0, OP_GRP_F7, 3, RAX); /* neg eax */
+            mf_jit_emit_u8(&jc->buf, 0xEB); /* jmp short */
+            mf_jit_emit_u8(&jc->buf, 0);
+            if (jc->buf.oom == 0) jc->buf.data[pos - 1] = (uint8_t)(jc->buf.size - pos);
+            pos = jc->buf.size;
+            mf_jit_emit_u8(&jc->buf, 0x99); /* cdq */
+            mf_jit_emit_rr(&jc->buf, 0, OP_GRP_F7, 7, R13); /* idiv r13d */
+            if (jc->buf.oom == 0) jc->buf.data[pos - 1] = (uint8_t)(jc->buf.size - pos);
+            mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, RAX, R13);
+            break;
+        case MF_PROG_OP_EQ:
+        case MF_PROG_OP_G:
+        case MF_PROG_OP_L:
+            mf_jit_emit_rr(&jc->buf, 0, OP_CMP, R13, RAX);
+            mf_jit_emit_setcc_bool(&jc->buf, \
+                    (op == MF_PROG_OP_EQ) ? CC_E : ((op == MF_PROG_OP_G) ? CC_G : CC_L), R13);
+            break;
+        case MF_PROG_OP_AND:
+            mf_jit_emit_rr(&jc->buf, 0, OP_TEST, RAX, RAX);
+            mf_jit_emit(&jc->buf, (const uint8_t *)"\x0F\x95\xC1", 3); /* setne cl */
+            mf_jit_emit_rr(&jc->buf, 0, OP_TEST, R13, R13);
+            mf_jit_emit(&jc->buf, (const uint8_t *)"\x0F\x95\xC0", 3); /* setne al */
+            mf_jit_emit(&jc->buf, (const uint8_t *)"\x20\xC8", 2); /* and al, cl */
+            mf_jit_emit(&jc->buf, (const uint8_t *)"\x0F\xB6\xC0\xF7\xD8", 5);
+            mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, RAX, R13);
+            break;
+        case MF_PROG_OP_OR:
+            mf_jit_emit_rr(&jc->buf, 0, OP_OR, R13, RAX);
+            mf_jit_emit_setcc_bool(&jc->buf, CC_NE, R13);
+            break;
+    }
+
+    return 0;
+}
+
+/* Lambda pushed right before the instruction at 'pc', or -1 */
+static int64_t mf_jit_known_lambda(const struct mf_jit_compiler *jc, \
+        const struct mf_prog_lambda *lambda, size_t pc, size_t back)
+{
+    const struct mf_prog_ins *ins;
+
+    if (pc < back) return -1;
+    ins = &lambda->ins[pc - back];
+    if ((ins->op != MF_PROG_OP_LAMBDA) || \
+            (ins->operand < 0) || \
+            ((size_t)ins->operand >= jc->prog->lambdas_count))
+    { return -1; }
+    return (int64_t)ins->operand;
+}
+
+/* The lambda is called directly by one of the next two instructions
+ * and never needs to be pushed */
+static int mf_jit_lambda_consumed(const struct mf_jit_compiler *jc, \
+        const struct mf_prog_lambda *lambda, size_t pc)
+{
+    size_t next;
+
+    for (next = pc + 1; (next != pc + 3) && (next < lambda->size); next++)
+    {
+        switch (lambda->ins[next].op)
+        {
+            case MF_PROG_OP_APPLY:
+            case MF_PROG_OP_IF:
+                return ((next == pc + 1) && \
+                        (mf_jit_known_lambda(jc, lambda, next, 1) >= 0)) ? 1 : 0;
+            case MF_PROG_OP_WHILE:
+                return ((mf_jit_known_lambda(jc, lambda, next, 2) >= 0) && \
+                        (mf_jit_known_lambda(jc, lambda, next, 1) >= 0)) ? 1 : 0;
+            case MF_PROG_OP_LAMBDA:
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
+static int mf_jit_compile_while(struct mf_jit_compiler *jc, \
+        int64_t cond_idx, int64_t body_idx)
+{
+    int ret;
+    size_t loop, pos_exit;
+
+    if (cond_idx < 0)
+    {
+        /* Both lambdas are kept in the frame across the calls */
+        if ((ret = mf_jit_ensure_cached(jc)) != 0) return ret;
+        mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, R13, RSP, 4);
+        if ((ret = mf_jit_pop_below(jc, RAX)) != 0) return ret;
+        mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, RAX, RSP, 0);
+        jc->cached = 0;
+    }
+    mf_jit_flush(jc);
+
+    loop = jc->buf.size;
+    if (cond_idx < 0)
+    {
+        mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RCX, RSP, 0);
+        if ((ret = mf_jit_call_indirect(jc)) != 0) return ret;
+    }
+    else
+    {
+        if ((ret = mf_jit_call_direct(jc, (size_t)cond_idx)) != 0) return ret;
+    }
+
+    /* What the condition left is never known here */
+    mf_jit_emit_rr(&jc->buf, 1, OP_CMP, R14, R12);
+    if ((ret = mf_jit_jcc_label(jc, CC_BE, MF_JIT_LABEL_UNDERFLOW)) != 0) return ret;
+    mf_jit_emit_add_imm8(&jc->buf, R12, -4);
+    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RAX, R12, 0);
+    mf_jit_emit_rr(&jc->buf, 0, OP_TEST, RAX, RAX);
+    pos_exit = mf_jit_emit_jcc(&jc->buf, CC_E);
+
+    if (cond_idx < 0)
+    {
+        mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RCX, RSP, 4);
+        if ((ret = mf_jit_call_indirect(jc)) != 0) return ret;
+    }
+    else
+    {
+        if ((ret = mf_jit_call_direct(jc, (size_t)body_idx)) != 0) return ret;
+    }
+    mf_jit_patch_rel32(&jc->buf, mf_jit_emit_jmp(&jc->buf), loop);
+    mf_jit_patch_rel32(&jc->buf, pos_exit, jc->buf.size);
+
+    return 0;
+}
+
+/* Instructions of the lambda, up to the return */
+static int mf_jit_compile_body(struct mf_jit_compiler *jc, \
+        const struct mf_prog_lambda *lambda)
+{
+    int ret = 0;
+    const struct mf_prog_ins *ins;
+    size_t pc, pos, idx;
+    int64_t known, known_cond;
+
+    jc->cached = 0;
+
+    for (pc = 0; pc != lambda->size; pc++)
+    {
+        ins = &lambda->ins[pc];
+        switch (ins->op)
+        {
+            case MF_PROG_OP_PUSH:
+            case MF_PROG_OP_LAMBDA:
+                if ((ins->op == MF_PROG_OP_LAMBDA) && \
+                        (mf_jit_lambda_consumed(jc, lambda, pc) != 0)) break;
+                if ((ret = mf_jit_push_slot(jc)) != 0) goto fail;
+                mf_jit_emit_mov_imm32(&jc->buf, R13, (uint32_t)ins->operand);
+                break;
+
+            case MF_PROG_OP_ADD:
+            case MF_PROG_OP_SUB:
+            case MF_PROG_OP_MUL:
+            case MF_PROG_OP_DIV:
+            case MF_PROG_OP_EQ:
+            case MF_PROG_OP_G:
+            case MF_PROG_OP_L:
+            case MF_PROG_OP_AND:
+            case MF_PROG_OP_OR:
+                if ((ret = mf_jit_compile_binary(jc, ins->op)) != 0) goto fail;
+                break;
+
+            case MF_PROG_OP_NEG:
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                mf_jit_emit_rr(&jc->buf, 0, OP_GRP_F7, 3, R13);
+                break;
+            case MF_PROG_OP_NOT:
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                mf_jit_emit_rr(&jc->buf, 0, OP_TEST, R13, R13);
+                mf_jit_emit_setcc_bool(&jc->buf, CC_E, R13);
+                break;
+
+            case MF_PROG_OP_DUP:
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                if ((ret = mf_jit_push_slot(jc)) != 0) goto fail;
+                break;
+            case MF_PROG_OP_DROP:
+                if (jc->cached != 0) { jc->cached = 0; break; }
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                jc->cached = 0;
+                break;
+            case MF_PROG_OP_SWAP:
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                if ((ret = mf_jit_pop_below(jc, RAX)) != 0) goto fail;
+                mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, R13, R12, 0);
+                mf_jit_emit_add_imm8(&jc->buf, R12, 4);
+                mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, RAX, R13);
+                break;
+            case MF_PROG_OP_ROT:
+            case MF_PROG_OP_COPY:
+                /* Elements below the top are read in place */
+                idx = (ins->op == MF_PROG_OP_ROT) ? 2 : (size_t)ins->operand;
+                /* Deeper than that is left to the interpreter */
+                if (idx > MF_JIT_SLOTS_MAX) { ret = -1; goto fail; }
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                if (idx == 0)
+                {
+                    if ((ret = mf_jit_push_slot(jc)) != 0) goto fail;
+                    break;
+                }
+                if (jc->checked != 0)
+                {
+                    mf_jit_emit_rm(&jc->buf, 1, OP_LEA, RAX, R14, (int32_t)(idx * 4));
+                    mf_jit_emit_rr(&jc->buf, 1, OP_CMP, RAX, R12);
+                    if ((ret = mf_jit_jcc_label(jc, CC_B, MF_JIT_LABEL_UNDERFLOW)) != 0) goto fail;
+                }
+                if (ins->op == MF_PROG_OP_ROT)
+                {
+                    /* a b c -> b c a */
+                    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RAX, R12, -8);
+                    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RCX, R12, -4);
+                    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, RCX, R12, -8);
+                    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, R13, R12, -4);
+                    mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, RAX, R13);
+                }
+                else
+                {
+                    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RAX, R12, -(int32_t)(idx * 4));
+                    if ((ret = mf_jit_push_slot(jc)) != 0) goto fail;
+                    mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, RAX, R13);
+                }
+                break;
+
+            case MF_PROG_OP_LOAD:
+                if ((ret = mf_jit_push_slot(jc)) != 0) goto fail;
+                mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, R13, RBX, \
+                        OFF_VARS + (int32_t)(ins->operand * 4));
+                break;
+            case MF_PROG_OP_STORE:
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                mf_jit_emit_rm(&jc->buf, 0, OP_MOV_STORE, R13, RBX, \
+                        OFF_VARS + (int32_t)(ins->operand * 4));
+                jc->cached = 0;
+                break;
+
+            case MF_PROG_OP_APPLY:
+                if ((known = mf_jit_known_lambda(jc, lambda, pc, 1)) >= 0)
+                {
+                    mf_jit_flush(jc);
+                    if ((ret = mf_jit_call_direct(jc, (size_t)known)) != 0) goto fail;
+                    break;
+                }
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, R13, RCX);
+                jc->cached = 0;
+                if ((ret = mf_jit_call_indirect(jc)) != 0) goto fail;
+                break;
+            case MF_PROG_OP_IF:
+                known = mf_jit_known_lambda(jc, lambda, pc, 1);
+                if (known < 0)
+                {
+                    if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                    mf_jit_emit_rr(&jc->buf, 0, OP_MOV_STORE, R13, RCX);
+                    jc->cached = 0;
+                }
+                if ((ret = mf_jit_ensure_cached(jc)) != 0) goto fail;
+                mf_jit_emit_rr(&jc->buf, 0, OP_TEST, R13, R13);
+                jc->cached = 0;
+                pos = mf_jit_emit_jcc(&jc->buf, CC_E);
+                if (known >= 0)
+                {
+                    if ((ret = mf_jit_call_direct(jc, (size_t)known)) != 0) goto fail;
+                }
+                else
+                {
+                    if ((ret = mf_jit_call_indirect(jc)) != 0) goto fail;
+                }
+                mf_jit_patch_rel32(&jc->buf, pos, jc->buf.size);
+                break;
+            case MF_PROG_OP_WHILE:
+                known_cond = mf_jit_known_lambda(jc, lambda, pc, 2);
+                known = mf_jit_known_lambda(jc, lambda, pc, 1);
+                if ((known_cond < 0) || (known < 0)) known_cond = known = -1;
+                if ((ret = mf_jit_compile_while(jc, known_cond, known)) != 0) goto fail;
+                break;
+
+            case MF_PROG_OP_RETURN:
+                mf_jit_flush(jc);
+                mf_jit_emit_rm(&jc->buf, 0, OP_GRP_FF, 1, RBX, OFF_DEPTH); /* dec */
+                mf_jit_emit_rr(&jc->buf, 0, "\x31", RAX, RAX); /* xor eax, eax */
+                mf_jit_emit_add_imm8(&jc->buf, RSP, MF_JIT_FRAME_SIZE);
+                mf_jit_emit_u8(&jc->buf, 0xC3);
+                break;
+
+            default:
+                if ((ret = mf_jit_deopt(jc, ins)) != 0) goto fail;
+                break;
+        }
+    }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+static int mf_jit_compile_lambda(struct mf_jit_compiler *jc, size_t lambda_idx)
+{
+    int ret = 0;
+    const struct mf_prog_lambda *lambda = &jc->prog->lambdas[lambda_idx];
+    size_t labels[MF_JIT_LABEL_COUNT];
+    size_t pos_need = 0, pos_room = 0, idx;
+
+    jc->jumps.size = 0;
+
+    if ((lambda->stack_need_max > MF_JIT_SLOTS_MAX) || \
+            (lambda->stack_max > MF_JIT_SLOTS_MAX))
+    { return -1; }
+
+    /* Prologue */
+    mf_jit_emit_add_imm8(&jc->buf, RSP, -MF_JIT_FRAME_SIZE);
+    mf_jit_emit_rm(&jc->buf, 0, OP_MOV_LOAD, RAX, RBX, OFF_DEPTH);
+    mf_jit_emit_rm(&jc->buf, 0, OP_CMP, RAX, RBX, OFF_DEPTH_MAX); /* cmp [rbx + max], eax */
+    if ((ret = mf_jit_jcc_label(jc, CC_BE, MF_JIT_LABEL_DEPTH)) != 0) goto fail;
+    mf_jit_emit_rm(&jc->buf, 0, OP_GRP_FF, 0, RBX, OFF_DEPTH); /* inc */
+
+    /* A safe lambda checks the bounds of the stack only once. The
+     * bounds hold on every path, so when they are not met the lambda
+     * may still run, or print before it fails: that case takes a copy
+     * which checks every access */
+    if (lambda->stack_safe)
+    {
+        mf_jit_emit_rm(&jc->buf, 1, OP_LEA, RAX, R14, (int32_t)(lambda->stack_need_max * 4));
+        mf_jit_emit_rr(&jc->buf, 1, OP_CMP, RAX, R12);
+        pos_need = mf_jit_emit_jcc(&jc->buf, CC_B);
+        mf_jit_emit_rm(&jc->buf, 1, OP_LEA, RAX, R12, (int32_t)(lambda->stack_max * 4));
+        mf_jit_emit_rr(&jc->buf, 1, OP_CMP, R15, RAX);
+        pos_room = mf_jit_emit_jcc(&jc->buf, CC_A);
+
+        jc->checked = 0;
+        if ((ret = mf_jit_compile_body(jc, lambda)) != 0) goto fail;
+        mf_jit_patch_rel32(&jc->buf, pos_need, jc->buf.size);
+        mf_jit_patch_rel32(&jc->buf, pos_room, jc->buf.size);
+    }
+    jc->checked = 1;
+    if ((ret = mf_jit_compile_body(jc, lambda)) != 0) goto fail;
+
+    /* Tails */
+    labels[MF_JIT_LABEL_ERR_RET] = jc->buf.size;
+    mf_jit_emit_rm(&jc->buf, 0, OP_GRP_FF, 1, RBX, OFF_DEPTH);
+    labels[MF_JIT_LABEL_ERR_RET_NO_DEPTH] = jc->buf.size;
+    mf_jit_emit_add_imm8(&jc->buf, RSP, MF_JIT_FRAME_SIZE);
+    mf_jit_emit_u8(&jc->buf, 0xC3);
+    for (idx = MF_JIT_LABEL_UNDERFLOW; idx != MF_JIT_LABEL_COUNT; idx++)
+    {
+        labels[idx] = jc->buf.size;
+        switch (idx)
+        {
+            case MF_JIT_LABEL_UNDERFLOW: mf_jit_emit_mov_imm32(&jc->buf, RAX, MF_RT_ERR_UNDERFLOW); break;
+            case MF_JIT_LABEL_OVERFLOW: mf_jit_emit_mov_imm32(&jc->buf, RAX, MF_RT_ERR_OVERFLOW); break;
+            case MF_JIT_LABEL_DIV_ZERO: mf_jit_emit_mov_imm32(&jc->buf, RAX, MF_RT_ERR_DIV_ZERO); break;
+            case MF_JIT_LABEL_LAMBDA: mf_jit_emit_mov_imm32(&jc->buf, RAX, MF_RT_ERR_LAMBDA); break;
+            case MF_JIT_LABEL_DEPTH: mf_jit_emit_mov_imm32(&jc->buf, RAX, MF_RT_ERR_DEPTH); break;
+        }
+        mf_jit_patch_rel32(&jc->buf, mf_jit_emit_jmp(&jc->buf), \
+                labels[(idx == MF_JIT_LABEL_DEPTH) ? \
+                MF_JIT_LABEL_ERR_RET_NO_DEPTH : MF_JIT_LABEL_ERR_RET]);
+    }
+    for (idx = 0; idx != jc->jumps.size; idx++)
+    {
+        mf_jit_patch_rel32(&jc->buf, jc->jumps.items[idx].pos, \
+                labels[jc->jumps.items[idx].target]);
+    }
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+/* enter(rt, entry) */
+static void mf_jit_compile_trampoline(struct mf_jit_buf *buf)
+{
+    mf_jit_emit(buf, (const uint8_t *)"\x53\x55\x41\x54\x41\x55\x41\x56\x41\x57", 10);
+    mf_jit_emit_add_imm8(buf, RSP, -8);
+    mf_jit_emit_rr(buf, 1, OP_MOV_STORE, RDI, RBX);
+    mf_jit_emit_rm(buf, 1, OP_MOV_LOAD, R12, RBX, OFF_SP);
+    mf_jit_emit_rm(buf, 1, OP_MOV_LOAD, R14, RBX, OFF_STACK);
+    mf_jit_emit_rm(buf, 1, OP_MOV_LOAD, R15, RBX, OFF_STACK_END);
+    mf_jit_emit_rr(buf, 0, OP_GRP_FF, 2, RSI); /* call rsi */
+    mf_jit_emit_rm(buf, 1, OP_MOV_STORE, R12, RBX, OFF_SP);
+    mf_jit_emit_add_imm8(buf, RSP, 8);
+    mf_jit_emit(buf, (const uint8_t *)"\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5D\x5B\xC3", 11);
+}
+
+int mf_jit_new(struct mf_jit **jit_out, const struct mf_prog *prog)
+{
+    int ret = 0;
+    struct mf_jit *new_jit = NULL;
+    struct mf_jit_compiler jc;
+    size_t *offsets = NULL;
+    size_t idx, page_size;
+    void *code = MAP_FAILED;
+
+    *jit_out = NULL;
+
+    mf_jit_buf_init(&jc.buf);
+    jc.prog = prog;
+    jc.entries = NULL;
+    jc.calls.items = NULL;
+    jc.calls.size = jc.calls.capacity = 0;
+    jc.jumps.items = NULL;
+    jc.jumps.size = jc.jumps.capacity = 0;
+
+    if ((new_jit = (struct mf_jit *)malloc(sizeof(struct mf_jit))) == NULL)
+    { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    new_jit->prog = prog;
+    new_jit->code = NULL;
+    new_jit->code_size = 0;
+    new_jit->entries = (void **)malloc(sizeof(void *) * (prog->lambdas_count + 1));
+    if (new_jit->entries == NULL) { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    jc.entries = new_jit->entries;
+    offsets = (size_t *)malloc(sizeof(size_t) * (prog->lambdas_count + 1));
+    if (offsets == NULL) { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+
+    mf_jit_compile_trampoline(&jc.buf);
+    for (idx = 0; idx != prog->lambdas_count; idx++)
+    {
+        /* Entries on 16 bytes */
+        while ((jc.buf.size & 15) != 0) mf_jit_emit_u8(&jc.buf, 0xCC);
+        offsets[idx] = jc.buf.size;
+        if ((ret = mf_jit_compile_lambda(&jc, idx)) != 0) goto fail;
+    }
+    if (jc.buf.oom != 0) { ret = -MULTIPLE_ERR_MALLOC; goto fail; }
+    for (idx = 0; idx != jc.calls.size; idx++)
+    {
+        mf_jit_patch_rel32(&jc.buf, jc.calls.items[idx].pos, \
+                offsets[jc.calls.items[idx].target]);
+    }
+
+    /* Written while writable, executed once read only */
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    new_jit->code_size = (jc.buf.size + page_size - 1) / page_size * page_size;
+    code = mmap(NULL, new_jit->code_size, PROT_READ | PROT_WRITE, \
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) { ret = -1; goto fail; }
+    memcpy(code, jc.buf.data, jc.buf.size);
+    if (mprotect(code, new_jit->code_size, PROT_READ | PROT_EXEC) != 0)
+    { ret = -1; goto fail; }
+    new_jit->code = code;
+    code = MAP_FAILED;
+
+    for (idx = 0; idx != prog->lambdas_count; idx++)
+    { new_jit->entries[idx] = (uint8_t *)new_jit->code + offsets[idx]; }
+    *(void **)(&new_jit->enter) = new_jit->code;
+
+    *jit_out = new_jit;
+    new_jit = NULL;
+
+    goto done;
+fail:
+    if (code != MAP_FAILED) munmap(code, new_jit->code_size);
+done:
+    if (new_jit != NULL) mf_jit_destroy(new_jit);
+    if (offsets != NULL) free(offsets);
+    if (jc.calls.items != NULL) free(jc.calls.items);
+    if (jc.jumps.items != NULL) free(jc.jumps.items);
+    mf_jit_buf_uninit(&jc.buf);
+    return ret;
+}
+
+int mf_jit_destroy(struct mf_jit *jit)
+{
+    if (jit == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    if (jit->code != NULL) munmap(jit->code, jit->code_size);
+    if (jit->entries != NULL) free(jit->entries);
+    free(jit);
+
+    return 0;
+}
+
+int mf_jit_run(struct mf_jit *jit, struct mf_rt *rt)
+{
+    return jit->enter(rt, jit->entries[jit->prog->main_idx]);
+}
+
+#else
+
+int mf_jit_new(struct mf_jit **jit_out, const struct mf_prog *prog)
+{
+    (void)prog;
+    *jit_out = NULL;
+    return -1;
+}
+
+int mf_jit_destroy(struct mf_jit *jit)
+{
+    if (jit == NULL) return -MULTIPLE_ERR_NULL_PTR;
+    return 0;
+}
+
+int mf_jit_run(struct mf_jit *jit, struct mf_rt *rt)
+{
+    (void)jit;
+    (void)rt;
+    return MF_RT_ERR_LAMBDA;
+}
+
+#endif
+
@@ -0,0 +1,53 @@
+/* Multiple False Programming Language : Runtime
+ * x86-64 JIT
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_JIT_H_
+#define _MF_JIT_H_
+
+#include <stdio.h>
+
+#include "mf_prog.h"
+
+struct mf_rt;
+
+struct mf_jit
+{
+    const struct mf_prog *prog;
+
+    /* Never writable and executable at the same time */
+    void *code;
+    size_t code_size;
+
+    /* Native entry of each lambda */
+    void **entries;
+
+    int (*enter)(struct mf_rt *rt, void *entry);
+};
+
+/* Returns -1 if native code is not available here, either because 
+ * of the architecture or because executable mappings are denied */
+int mf_jit_new(struct mf_jit **jit_out, const struct mf_prog *prog);
+int mf_jit_destroy(struct mf_jit *jit);
+
+/* Run 'main', returns one of MF_RT_ERR_* */
+int mf_jit_run(struct mf_jit *jit, struct mf_rt *rt);
+
+#endif
+
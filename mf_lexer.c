@@ -63,6 +63,28 @@ enum {
 #define UND(x) do{(x)=LEX_STATUS_ERROR;}while(0);
 #define KEEP() do{}while(0);
 
+/* Western european operator characters (ISO-8859-1 code points) */
+#define WESTERN_CHAR_PICK 0xF8  /* ø */
+#define WESTERN_CHAR_FLUSH 0xDF /* ß */
+
+/* Match a western european character, which could be encoded in either
+ * UTF-8 (2 bytes) or ISO-8859-1 (1 byte), returns the bytes matched */
+static size_t western_char_length(const char *p, const char *endp, const unsigned char latin1)
+{
+    if (((endp - p) >= 2) && \
+            ((unsigned char)p[0] == (0xC0 | (latin1 >> 6))) && \
+            ((unsigned char)p[1] == (0x80 | (latin1 & 0x3F))))
+    { return 2; }
+    if ((unsigned char)p[0] == latin1)
+    {
+        /* A lead byte of UTF-8 followed by continuation byte isn't ISO-8859-1 */
+        if (((endp - p) >= 2) && (((unsigned char)p[1] & 0xC0) == 0x80))
+        { return 0; }
+        return 1;
+    }
+    return 0;
+}
+
 /* Get one token from the char stream */
 static int eat_token(struct multiple_error *err, struct token *new_token, const char *p, const char *endp, uint32_t *pos_col, uint32_t *pos_ln, const int eol_type, size_t *move_on)
 {
@@ -174,8 +196,10 @@ static int eat_token(struct multiple_error *err, struct token *new_token, const
                 { new_token->value = TOKEN_OP_SWAP; FIN(status); }
                 else if (ch == '@')
                 { new_token->value = TOKEN_OP_ROTATE3; FIN(status); }
-                /*else if (ch == 'ø')*/
-                /*{ new_token->value = TOKEN_OP_PICK; FIN(status); }*/
+                else if (ch == 'O')
+                { new_token->value = TOKEN_OP_PICK; FIN(status); }
+                else if ((bytes_number = western_char_length(p, endp, WESTERN_CHAR_PICK)) != 0)
+                { p += bytes_number - 1; new_token->value = TOKEN_OP_PICK; FIN(status); }
                 else if (ch == '?')
                 { new_token->value = TOKEN_OP_IF; FIN(status); }
                 else if (ch == '#')
@@ -186,8 +210,10 @@ static int eat_token(struct multiple_error *err, struct token *new_token, const
                 { new_token->value = TOKEN_OP_PRINT_CHAR; FIN(status); }
                 else if (ch == '^')
                 { new_token->value = TOKEN_OP_READ_CHAR; FIN(status); }
-                /*else if (ch == 'ß')*/
-                /*{ new_token->value = TOKEN_OP_FLUSH; FIN(status); }*/
+                else if (ch == 'B')
+                { new_token->value = TOKEN_OP_FLUSH; FIN(status); }
+                else if ((bytes_number = western_char_length(p, endp, WESTERN_CHAR_FLUSH)) != 0)
+                { p += bytes_number - 1; new_token->value = TOKEN_OP_FLUSH; FIN(status); }
                 else if (IS_ID(ch)) 
                 { new_token->value = TOKEN_VARIABLE; FIN(status); }
                 else if (ch == '0')
@@ -376,6 +402,11 @@ static int eat_token(struct multiple_error *err, struct token *new_token, const
         /* 0b$ and 0x$ */
         p -= 1;
     }
+    if (status == LEX_STATUS_STRING || status == LEX_STATUS_STRING_ESCAPE)
+    {
+        /* No closing quote, an escape already set the value */
+        new_token->value = TOKEN_UNDEFINED;
+    }
 done:
     if (!is_eol)
     {
@@ -434,6 +465,15 @@ int mf_tokenize(struct multiple_error *err, struct token_list **list_out, const
         {
             goto fail;
         }
+        /* Nothing taken at the end, such as a string left open */
+        if (move_on == 0)
+        {
+            multiple_error_update(err, -MULTIPLE_ERR_LEXICAL, \
+                    "%d:%d: incomplete token", \
+                    token_template->pos_ln, token_template->pos_col);
+            ret = -MULTIPLE_ERR_LEXICAL;
+            goto fail;
+        }
         if (token_template->value != TOKEN_WHITESPACE)
         {
             if ((ret = token_list_append_token_with_template(new_list, token_template)) != 0)
@@ -468,7 +508,8 @@ struct token_value_name_tbl_item
     const char *name;
 };
 
-static struct token_value_name_tbl_item token_value_name_tbl_items[] = 
+/* Read only, shared by every thread calling mf_token_name */
+static const struct token_value_name_tbl_item token_value_name_tbl_items[] = 
 {
     { TOKEN_VARIABLE, "variable" },
     { TOKEN_CHAR, "`." },
@@ -492,13 +533,13 @@ static struct token_value_name_tbl_item token_value_name_tbl_items[] =
     { TOKEN_OP_DROP, "%" },
     { TOKEN_OP_SWAP, "\\" },
     { TOKEN_OP_ROTATE3, "@" },
-    { TOKEN_OP_PICK, "pick" },
+    { TOKEN_OP_PICK, "O" },
     { TOKEN_OP_IF, "?" },
     { TOKEN_OP_WHILE, "#" },
     { TOKEN_OP_PRINT_INT, "." },
     { TOKEN_OP_PRINT_CHAR, "," },
     { TOKEN_OP_READ_CHAR, "^" },
-    { TOKEN_OP_FLUSH, "flush" },
+    { TOKEN_OP_FLUSH, "B" },
 };
 #define TOKEN_VALUE_NAME_TBL_ITEMS_COUNT (sizeof(token_value_name_tbl_items)/sizeof(struct token_value_name_tbl_item))
 
@@ -49,19 +49,19 @@ enum
     TOKEN_OP_DROP,         /* % */
     TOKEN_OP_SWAP,         /* \ */
     TOKEN_OP_ROTATE3,      /* @ */
-    TOKEN_OP_PICK,         /* ø (0 slash) */
+    TOKEN_OP_PICK,         /* ø (0 slash) or O */
     TOKEN_OP_IF,           /* ? */
     TOKEN_OP_WHILE,        /* # */
     TOKEN_OP_PRINT_INT,    /* . */
     TOKEN_OP_PRINT_CHAR,   /* , */
     TOKEN_OP_READ_CHAR,    /* ^ */
-    TOKEN_OP_FLUSH,        /* ß (beta) */
+    TOKEN_OP_FLUSH,        /* ß (beta) or B */
 };
 
 /* Get token name */
 int mf_token_name(char **token_name, size_t *token_name_len, const int value);
 
-/* Lexical scan source code */
+/* Lexical scan source code, reentrant: 'data' is only read */
 int mf_tokenize(struct multiple_error *err, struct token_list **list_out, const char *data, const size_t data_len);
 
 #endif
@@ -0,0 +1,369 @@
+/* Multiple False Programming Language : Program
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_lexer.h"
+#include "mf_icg_fcb.h"
+#include "mf_icg_literal.h"
+#include "mf_prog.h"
+
+static int mf_prog_lambda_append(struct mf_prog_lambda *lambda, \
+        uint32_t op, int32_t operand, \
+        struct mf_icg_fcb_line *icg_fcb_line)
+{
+    struct mf_prog_ins *new_ins;
+    struct mf_icg_fcb_line **new_lines;
+    size_t new_capacity;
+
+    if (lambda->size == lambda->capacity)
+    {
+        new_capacity = (lambda->capacity == 0) ? 16 : lambda->capacity * 2;
+        new_ins = (struct mf_prog_ins *)realloc(lambda->ins, \
+                sizeof(struct mf_prog_ins) * new_capacity);
+        if (new_ins == NULL) return -MULTIPLE_ERR_MALLOC;
+        lambda->ins = new_ins;
+        new_lines = (struct mf_icg_fcb_line **)realloc(lambda->lines, \
+                sizeof(struct mf_icg_fcb_line *) * new_capacity);
+        if (new_lines == NULL) return -MULTIPLE_ERR_MALLOC;
+        lambda->lines = new_lines;
+        lambda->capacity = new_capacity;
+    }
+    lambda->ins[lambda->size].op = op;
+    lambda->ins[lambda->size].operand = operand;
+    lambda->lines[lambda->size] = icg_fcb_line;
+    lambda->size += 1;
+
+    return 0;
+}
+
+static int mf_prog_str_append(struct mf_prog *prog, \
+        uint32_t *idx_out, char *str, size_t len)
+{
+    struct mf_prog_str *new_strs;
+    size_t new_capacity;
+
+    if (prog->strs_count == prog->strs_capacity)
+    {
+        new_capacity = (prog->strs_capacity == 0) ? 16 : prog->strs_capacity * 2;
+        new_strs = (struct mf_prog_str *)realloc(prog->strs, \
+                sizeof(struct mf_prog_str) * new_capacity);
+        if (new_strs == NULL) return -MULTIPLE_ERR_MALLOC;
+        prog->strs = new_strs;
+        prog->strs_capacity = new_capacity;
+    }
+    /* Taken over */
+    prog->strs[prog->strs_count].str = str;
+    prog->strs[prog->strs_count].len = len;
+    *idx_out = (uint32_t)prog->strs_count;
+    prog->strs_count += 1;
+
+    return 0;
+}
+
+static uint32_t mf_prog_var_slot(struct mf_prog *prog, char name)
+{
+    size_t idx;
+
+    for (idx = 0; idx != prog->vars_count; idx++)
+    {
+        if (prog->vars[idx] == name) return (uint32_t)idx;
+    }
+    prog->vars[prog->vars_count] = name;
+    return (uint32_t)(prog->vars_count++);
+}
+
+static int mf_prog_decode_literal_output(struct multiple_error *err, \
+        struct mf_prog *prog, \
+        struct mf_prog_lambda *lambda, \
+        struct token *token, \
+        struct mf_icg_fcb_line *icg_fcb_line)
+{
+    int ret = 0;
+    struct mf_icg_literal_output output;
+    uint32_t idx;
+
+    mf_icg_literal_output_init(&output);
+
+    if ((ret = mf_icg_literal_output_scan(err, &output, token)) != 0)
+    { goto fail; }
+
+    if (output.putchar != 0)
+    {
+        if (((ret = mf_prog_lambda_append(lambda, MF_PROG_OP_PUSH, \
+                            output.putchar_value, icg_fcb_line)) != 0) || \
+                ((ret = mf_prog_lambda_append(lambda, MF_PROG_OP_PRINT_CHAR, \
+                            0, icg_fcb_line)) != 0))
+        { MULTIPLE_ERROR_MALLOC(); goto fail; }
+    }
+    else
+    {
+        if ((ret = mf_prog_str_append(prog, &idx, output.str, output.len)) != 0)
+        { MULTIPLE_ERROR_MALLOC(); goto fail; }
+        output.str = NULL;
+        if ((ret = mf_prog_lambda_append(lambda, MF_PROG_OP_PRINT_STR, \
+                        (int32_t)idx, icg_fcb_line)) != 0)
+        { MULTIPLE_ERROR_MALLOC(); goto fail; }
+    }
+
+    goto done;
+fail:
+done:
+    mf_icg_literal_output_uninit(&output);
+    return ret;
+}
+
+/* Decode the operation which produced the lines in [begin, end) */
+static int mf_prog_decode_op(struct multiple_error *err, \
+        struct mf_prog *prog, \
+        struct mf_prog_lambda *lambda, \
+        struct mf_icg_fcb_line *icg_fcb_line_begin, \
+        struct mf_icg_fcb_line *icg_fcb_line_end)
+{
+    int ret = 0;
+    struct token *token = icg_fcb_line_begin->token;
+    struct mf_icg_fcb_line *icg_fcb_line_cur;
+    uint32_t op = MF_PROG_OP_COUNT;
+    int32_t operand = 0;
+    uint32_t lambda_idx;
+    int value_int;
+
+    if (MF_ICG_IS_LITERAL_OUTPUT(token))
+    {
+        return mf_prog_decode_literal_output(err, prog, lambda, \
+                token, icg_fcb_line_begin);
+    }
+
+    switch (token->value)
+    {
+        case TOKEN_OP_ADD: op = MF_PROG_OP_ADD; break;
+        case TOKEN_OP_SUB: op = MF_PROG_OP_SUB; break;
+        case TOKEN_OP_MUL: op = MF_PROG_OP_MUL; break;
+        case TOKEN_OP_DIV: op = MF_PROG_OP_DIV; break;
+        case TOKEN_OP_UNARY_MINUS: op = MF_PROG_OP_NEG; break;
+        case TOKEN_OP_EQ: op = MF_PROG_OP_EQ; break;
+        case TOKEN_OP_G: op = MF_PROG_OP_G; break;
+        case TOKEN_OP_L: op = MF_PROG_OP_L; break;
+        case TOKEN_OP_AND: op = MF_PROG_OP_AND; break;
+        case TOKEN_OP_OR: op = MF_PROG_OP_OR; break;
+        case TOKEN_OP_NOT: op = MF_PROG_OP_NOT; break;
+        case TOKEN_OP_DUP: op = MF_PROG_OP_DUP; break;
+        case TOKEN_OP_DROP: op = MF_PROG_OP_DROP; break;
+        case TOKEN_OP_SWAP: op = MF_PROG_OP_SWAP; break;
+        case TOKEN_OP_ROTATE3: op = MF_PROG_OP_ROT; break;
+        case TOKEN_OP_PICK: op = MF_PROG_OP_PICK; break;
+        case TOKEN_OP_APPLY: op = MF_PROG_OP_APPLY; break;
+        case TOKEN_OP_IF: op = MF_PROG_OP_IF; break;
+        case TOKEN_OP_WHILE: op = MF_PROG_OP_WHILE; break;
+        case TOKEN_OP_PRINT_INT: op = MF_PROG_OP_PRINT_INT; break;
+        case TOKEN_OP_PRINT_CHAR: op = MF_PROG_OP_PRINT_CHAR; break;
+        case TOKEN_OP_READ_CHAR: op = MF_PROG_OP_READ_CHAR; break;
+        case TOKEN_OP_FLUSH: op = MF_PROG_OP_FLUSH; break;
+
+        case TOKEN_VARIABLE:
+            op = ((token->next != NULL) && (token->next->value == TOKEN_OP_ASSIGN)) ? \
+                 MF_PROG_OP_STORE : MF_PROG_OP_LOAD;
+            operand = (int32_t)mf_prog_var_slot(prog, token->str[0]);
+            break;
+
+        case TOKEN_OP_LEFT_BRACKET:
+            for (icg_fcb_line_cur = icg_fcb_line_begin; \
+                    icg_fcb_line_cur != icg_fcb_line_end; \
+                    icg_fcb_line_cur = icg_fcb_line_cur->next)
+            {
+                if (mf_icg_fcb_line_lambda_idx(icg_fcb_line_cur, &lambda_idx) == 0)
+                {
+                    op = MF_PROG_OP_LAMBDA;
+                    operand = (int32_t)lambda_idx;
+                    break;
+                }
+            }
+            break;
+
+        default:
+            if ((token->value != TOKEN_CHAR) && (!IS_TOKEN_CONSTANT(token->value)))
+            { break; }
+            if ((ret = mf_icg_literal_value(err, token, &value_int)) != 0)
+            { return ret; }
+            /* 'Nø' with literal index */
+            if ((token->value != TOKEN_CHAR) && \
+                    (value_int >= 0) && \
+                    (token->next != NULL) && \
+                    (token->next->value == TOKEN_OP_PICK))
+            { op = MF_PROG_OP_COPY; }
+            else
+            { op = MF_PROG_OP_PUSH; }
+            operand = (int32_t)value_int;
+            break;
+    }
+
+    if (op == MF_PROG_OP_COUNT)
+    {
+        MULTIPLE_ERROR_INTERNAL();
+        return -MULTIPLE_ERR_INTERNAL;
+    }
+    if ((ret = mf_prog_lambda_append(lambda, op, operand, icg_fcb_line_begin)) != 0)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        return ret;
+    }
+
+    return 0;
+}
+
+static int mf_prog_decode_block(struct multiple_error *err, \
+        struct mf_prog *prog, \
+        struct mf_prog_lambda *lambda, \
+        struct mf_icg_fcb_block *icg_fcb_block)
+{
+    int ret = 0;
+    struct mf_icg_fcb_line *icg_fcb_line_cur, *icg_fcb_line_begin;
+    struct token *token;
+
+    icg_fcb_line_cur = icg_fcb_block->begin;
+    while (icg_fcb_line_cur != NULL)
+    {
+        token = icg_fcb_line_cur->token;
+        icg_fcb_line_begin = icg_fcb_line_cur;
+        while ((icg_fcb_line_cur != NULL) && (icg_fcb_line_cur->token == token))
+        { icg_fcb_line_cur = icg_fcb_line_cur->next; }
+
+        /* Prologue and epilogue */
+        if (token == NULL) continue;
+
+        if ((ret = mf_prog_decode_op(err, prog, lambda, \
+                        icg_fcb_line_begin, icg_fcb_line_cur)) != 0)
+        { goto fail; }
+    }
+    if ((ret = mf_prog_lambda_append(lambda, MF_PROG_OP_RETURN, 0, NULL)) != 0)
+    {
+        MULTIPLE_ERROR_MALLOC();
+        goto fail;
+    }
+
+    lambda->stack_known = icg_fcb_block->stack_known;
+    lambda->stack_safe = icg_fcb_block->stack_safe;
+    lambda->stack_need = icg_fcb_block->stack_need;
+    lambda->stack_need_max = icg_fcb_block->stack_need_max;
+    lambda->stack_net = icg_fcb_block->stack_net;
+    lambda->stack_max = icg_fcb_block->stack_max;
+
+    goto done;
+fail:
+done:
+    return ret;
+}
+
+int mf_prog_new_from_blocks(struct multiple_error *err, \
+        struct mf_prog **prog_out, \
+        struct mf_icg_fcb_block_list *icg_fcb_block_list)
+{
+    int ret = 0;
+    struct mf_prog *new_prog = NULL;
+    struct mf_icg_fcb_block *icg_fcb_block_cur;
+    size_t idx;
+
+    *prog_out = NULL;
+
+    if (icg_fcb_block_list->size == 0)
+    {
+        MULTIPLE_ERROR_INTERNAL();
+        return -MULTIPLE_ERR_INTERNAL;
+    }
+
+    new_prog = (struct mf_prog *)malloc(sizeof(struct mf_prog));
+    if (new_prog == NULL) { goto fail_malloc; }
+    new_prog->lambdas = NULL;
+    new_prog->lambdas_count = 0;
+    new_prog->main_idx = icg_fcb_block_list->size - 1;
+    new_prog->strs = NULL;
+    new_prog->strs_count = 0;
+    new_prog->strs_capacity = 0;
+    new_prog->vars_count = 0;
+
+    new_prog->lambdas = (struct mf_prog_lambda *)malloc( \
+            sizeof(struct mf_prog_lambda) * icg_fcb_block_list->size);
+    if (new_prog->lambdas == NULL) { goto fail_malloc; }
+    for (idx = 0; idx != icg_fcb_block_list->size; idx++)
+    {
+        new_prog->lambdas[idx].ins = NULL;
+        new_prog->lambdas[idx].lines = NULL;
+        new_prog->lambdas[idx].size = 0;
+        new_prog->lambdas[idx].capacity = 0;
+    }
+    new_prog->lambdas_count = icg_fcb_block_list->size;
+
+    idx = 0;
+    icg_fcb_block_cur = icg_fcb_block_list->begin;
+    while (icg_fcb_block_cur != NULL)
+    {
+        if ((ret = mf_prog_decode_block(err, new_prog, \
+                        &new_prog->lambdas[idx], icg_fcb_block_cur)) != 0)
+        { goto fail; }
+        idx++;
+        icg_fcb_block_cur = icg_fcb_block_cur->next;
+    }
+
+    *prog_out = new_prog;
+    new_prog = NULL;
+
+    goto done;
+fail_malloc:
+    MULTIPLE_ERROR_MALLOC();
+    ret = -MULTIPLE_ERR_MALLOC;
+fail:
+done:
+    if (new_prog != NULL) mf_prog_destroy(new_prog);
+    return ret;
+}
+
+int mf_prog_destroy(struct mf_prog *prog)
+{
+    size_t idx;
+
+    if (prog == NULL) return -MULTIPLE_ERR_NULL_PTR;
+
+    if (prog->lambdas != NULL)
+    {
+        for (idx = 0; idx != prog->lambdas_count; idx++)
+        {
+            if (prog->lambdas[idx].ins != NULL) free(prog->lambdas[idx].ins);
+            if (prog->lambdas[idx].lines != NULL) free(prog->lambdas[idx].lines);
+        }
+        free(prog->lambdas);
+    }
+    if (prog->strs != NULL)
+    {
+        for (idx = 0; idx != prog->strs_count; idx++)
+        {
+            if (prog->strs[idx].str != NULL) free(prog->strs[idx].str);
+        }
+        free(prog->strs);
+    }
+    free(prog);
+
+    return 0;
+}
+
@@ -0,0 +1,135 @@
+/* Multiple False Programming Language : Program
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_PROG_H_
+#define _MF_PROG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "multiple_err.h"
+
+#include "mf_icg_fcb.h"
+
+/* False level instructions, decoded back from the operations 
+ * recorded in the floating code blocks */
+
+enum
+{
+    MF_PROG_OP_PUSH = 0,    /* operand = integer */
+    MF_PROG_OP_LAMBDA,      /* operand = index of lambda */
+    MF_PROG_OP_PRINT_STR,   /* operand = index of string */
+
+    MF_PROG_OP_ADD,
+    MF_PROG_OP_SUB,
+    MF_PROG_OP_MUL,
+    MF_PROG_OP_DIV,
+    MF_PROG_OP_NEG,
+    MF_PROG_OP_EQ,
+    MF_PROG_OP_G,
+    MF_PROG_OP_L,
+    MF_PROG_OP_AND,
+    MF_PROG_OP_OR,
+    MF_PROG_OP_NOT,
+
+    MF_PROG_OP_DUP,
+    MF_PROG_OP_DROP,
+    MF_PROG_OP_SWAP,
+    MF_PROG_OP_ROT,
+    MF_PROG_OP_COPY,        /* operand = depth */
+    MF_PROG_OP_PICK,
+
+    MF_PROG_OP_LOAD,        /* operand = variable slot */
+    MF_PROG_OP_STORE,       /* operand = variable slot */
+
+    MF_PROG_OP_APPLY,
+    MF_PROG_OP_IF,
+    MF_PROG_OP_WHILE,
+
+    MF_PROG_OP_PRINT_INT,
+    MF_PROG_OP_PRINT_CHAR,
+    MF_PROG_OP_READ_CHAR,
+    MF_PROG_OP_FLUSH,
+
+    MF_PROG_OP_RETURN,
+
+    MF_PROG_OP_COUNT,
+};
+
+struct mf_prog_ins
+{
+    uint32_t op;
+    int32_t operand;
+};
+
+struct mf_prog_lambda
+{
+    struct mf_prog_ins *ins;
+    size_t size;
+    size_t capacity;
+
+    /* First line of the operation each instruction was decoded from,
+     * only valid while the blocks live */
+    struct mf_icg_fcb_line **lines;
+
+    /* Stack effect of the block */
+    int stack_known;
+    int stack_safe;
+    uint32_t stack_need;
+    uint32_t stack_need_max;
+    int32_t stack_net;
+    uint32_t stack_max;
+};
+
+struct mf_prog_str
+{
+    char *str;
+    size_t len;
+};
+
+/* Variables are single characters */
+#define MF_PROG_VARS_MAX 256
+
+struct mf_prog
+{
+    /* In the order of the blocks, 'main' is the last one */
+    struct mf_prog_lambda *lambdas;
+    size_t lambdas_count;
+    size_t main_idx;
+
+    struct mf_prog_str *strs;
+    size_t strs_count;
+    size_t strs_capacity;
+
+    /* Name of each variable slot */
+    char vars[MF_PROG_VARS_MAX];
+    size_t vars_count;
+};
+
+int mf_prog_new_from_blocks(struct multiple_error *err, \
+        struct mf_prog **prog_out, \
+        struct mf_icg_fcb_block_list *icg_fcb_block_list);
+int mf_prog_destroy(struct mf_prog *prog);
+
+/* Returns non-zero if the instruction is the first one of an operation */
+#define mf_prog_ins_is_op_begin(lambda, pc) \
+    (((pc) == 0) || ((lambda)->lines[(pc)] != (lambda)->lines[(pc) - 1]))
+
+#endif
+
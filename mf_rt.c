@@ -0,0 +1,297 @@
+/* Multiple False Programming Language : Runtime
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_jit.h"
+#include "mf_rt.h"
+
+int mf_rt_init(struct mf_rt *rt, \
+        const struct mf_prog *prog, \
+        struct mf_rt_io *io, \
+        size_t stack_size)
+{
+    size_t idx;
+
+    if (stack_size == 0) stack_size = MF_RT_STACK_SIZE_DEFAULT;
+
+    rt->prog = prog;
+    rt->stack = (int32_t *)malloc(sizeof(int32_t) * stack_size);
+    if (rt->stack == NULL) return -MULTIPLE_ERR_MALLOC;
+    rt->sp = rt->stack;
+    rt->stack_end = rt->stack + stack_size;
+    for (idx = 0; idx != MF_PROG_VARS_MAX; idx++) rt->vars[idx] = 0;
+    rt->depth = 0;
+    rt->depth_max = MF_RT_DEPTH_MAX_DEFAULT;
+    rt->io = io;
+
+    return 0;
+}
+
+int mf_rt_uninit(struct mf_rt *rt)
+{
+    if (rt->stack != NULL)
+    {
+        free(rt->stack);
+        rt->stack = NULL;
+    }
+    rt->sp = rt->stack_end = NULL;
+
+    return 0;
+}
+
+#define NEED(n) \
+    do { if (rt->sp - rt->stack < (n)) return MF_RT_ERR_UNDERFLOW; } while (0)
+#define ROOM(n) \
+    do { if (rt->stack_end - rt->sp < (n)) return MF_RT_ERR_OVERFLOW; } while (0)
+#define TOP(n) (rt->sp[-1 - (n)])
+
+int mf_rt_exec_ins(struct mf_rt *rt, const struct mf_prog_ins *ins)
+{
+    const struct mf_prog_str *str;
+    int32_t a, b;
+    int ch;
+
+    switch (ins->op)
+    {
+        case MF_PROG_OP_PUSH:
+        case MF_PROG_OP_LAMBDA:
+            ROOM(1);
+            *rt->sp++ = ins->operand;
+            break;
+        case MF_PROG_OP_PRINT_STR:
+            str = &rt->prog->strs[ins->operand];
+            if (mf_rt_io_write(rt->io, str->str, str->len) != 0) return MF_RT_ERR_IO;
+            break;
+
+        case MF_PROG_OP_ADD:
+        case MF_PROG_OP_SUB:
+        case MF_PROG_OP_MUL:
+        case MF_PROG_OP_DIV:
+        case MF_PROG_OP_EQ:
+        case MF_PROG_OP_G:
+        case MF_PROG_OP_L:
+        case MF_PROG_OP_AND:
+        case MF_PROG_OP_OR:
+            NEED(2);
+            b = TOP(0);
+            a = TOP(1);
+            switch (ins->op)
+            {
+                case MF_PROG_OP_ADD: a = (int32_t)((uint32_t)a + (uint32_t)b); break;
+                case MF_PROG_OP_SUB: a = (int32_t)((uint32_t)a - (uint32_t)b); break;
+                case MF_PROG_OP_MUL: a = (int32_t)((uint32_t)a * (uint32_t)b); break;
+                case MF_PROG_OP_DIV: 
+                    if (b == 0) return MF_RT_ERR_DIV_ZERO;
+                    /* INT32_MIN / -1 wraps like the other operations */
+                    a = (b == -1) ? (int32_t)(0U - (uint32_t)a) : a / b;
+                    break;
+                case MF_PROG_OP_EQ: a = (a == b) ? -1 : 0; break;
+                case MF_PROG_OP_G: a = (a > b) ? -1 : 0; break;
+                case MF_PROG_OP_L: a = (a < b) ? -1 : 0; break;
+                case MF_PROG_OP_AND: a = ((a != 0) && (b != 0)) ? -1 : 0; break;
+                case MF_PROG_OP_OR: a = ((a != 0) || (b != 0)) ? -1 : 0; break;
+            }
+            rt->sp -= 1;
+            TOP(0) = a;
+            break;
+
+        case MF_PROG_OP_NEG:
+            NEED(1);
+            TOP(0) = (int32_t)(0U - (uint32_t)TOP(0));
+            break;
+        case MF_PROG_OP_NOT:
+            NEED(1);
+            TOP(0) = (TOP(0) == 0) ? -1 : 0;
+            break;
+
+        case MF_PROG_OP_DUP:
+            NEED(1);
+            ROOM(1);
+            a = TOP(0);
+            *rt->sp++ = a;
+            break;
+        case MF_PROG_OP_DROP:
+            NEED(1);
+            rt->sp -= 1;
+            break;
+        case MF_PROG_OP_SWAP:
+            NEED(2);
+            a = TOP(0);
+            TOP(0) = TOP(1);
+            TOP(1) = a;
+            break;
+        case MF_PROG_OP_ROT:
+            NEED(3);
+            a = TOP(2);
+            TOP(2) = TOP(1);
+            TOP(1) = TOP(0);
+            TOP(0) = a;
+            break;
+        case MF_PROG_OP_COPY:
+            NEED(ins->operand + 1);
+            ROOM(1);
+            a = TOP(ins->operand);
+            *rt->sp++ = a;
+            break;
+        case MF_PROG_OP_PICK:
+            NEED(1);
+            a = TOP(0);
+            if ((a < 0) || (a >= rt->sp - rt->stack - 1)) return MF_RT_ERR_PICK;
+            TOP(0) = TOP(a + 1);
+            break;
+
+        case MF_PROG_OP_LOAD:
+            ROOM(1);
+            *rt->sp++ = rt->vars[ins->operand];
+            break;
+        case MF_PROG_OP_STORE:
+            NEED(1);
+            rt->vars[ins->operand] = *--rt->sp;
+            break;
+
+        case MF_PROG_OP_PRINT_INT:
+            NEED(1);
+            if (mf_rt_io_print_int(rt->io, *--rt->sp) != 0) return MF_RT_ERR_IO;
+            break;
+        case MF_PROG_OP_PRINT_CHAR:
+            NEED(1);
+            if (mf_rt_io_putchar(rt->io, *--rt->sp) != 0) return MF_RT_ERR_IO;
+            break;
+        case MF_PROG_OP_READ_CHAR:
+            ROOM(1);
+            ch = mf_rt_io_getchar(rt->io);
+            *rt->sp++ = (int32_t)ch;
+            break;
+        case MF_PROG_OP_FLUSH:
+            if (mf_rt_io_flush(rt->io) != 0) return MF_RT_ERR_IO;
+            break;
+
+        default:
+            return MF_RT_ERR_LAMBDA;
+    }
+
+    return MF_RT_OK;
+}
+
+int mf_rt_call(struct mf_rt *rt, int32_t lambda_idx)
+{
+    int ret = MF_RT_OK;
+    const struct mf_prog_lambda *lambda;
+    const struct mf_prog_ins *ins;
+    int32_t cond, body;
+
+    if ((lambda_idx < 0) || ((size_t)lambda_idx >= rt->prog->lambdas_count))
+    { return MF_RT_ERR_LAMBDA; }
+    if (rt->depth == rt->depth_max) return MF_RT_ERR_DEPTH;
+    rt->depth += 1;
+
+    lambda = &rt->prog->lambdas[lambda_idx];
+    for (ins = lambda->ins; ins->op != MF_PROG_OP_RETURN; ins++)
+    {
+        switch (ins->op)
+        {
+            case MF_PROG_OP_APPLY:
+                if (rt->sp == rt->stack) { ret = MF_RT_ERR_UNDERFLOW; goto done; }
+                body = *--rt->sp;
+                if ((ret = mf_rt_call(rt, body)) != MF_RT_OK) goto done;
+                break;
+            case MF_PROG_OP_IF:
+                if (rt->sp - rt->stack < 2) { ret = MF_RT_ERR_UNDERFLOW; goto done; }
+                body = *--rt->sp;
+                cond = *--rt->sp;
+                if (cond != 0)
+                {
+                    if ((ret = mf_rt_call(rt, body)) != MF_RT_OK) goto done;
+                }
+                break;
+            case MF_PROG_OP_WHILE:
+                if (rt->sp - rt->stack < 2) { ret = MF_RT_ERR_UNDERFLOW; goto done; }
+                body = *--rt->sp;
+                cond = *--rt->sp;
+                for (;;)
+                {
+                    if ((ret = mf_rt_call(rt, cond)) != MF_RT_OK) goto done;
+                    if (rt->sp == rt->stack) { ret = MF_RT_ERR_UNDERFLOW; goto done; }
+                    if (*--rt->sp == 0) break;
+                    if ((ret = mf_rt_call(rt, body)) != MF_RT_OK) goto done;
+                }
+                break;
+            default:
+                if ((ret = mf_rt_exec_ins(rt, ins)) != MF_RT_OK) goto done;
+                break;
+        }
+    }
+
+done:
+    rt->depth -= 1;
+    return ret;
+}
+
+int mf_rt_run(struct mf_rt *rt, int flags)
+{
+    int ret;
+    struct mf_jit *jit = NULL;
+
+    /* Fall back to the interpreter where native code is not allowed */
+    if (((flags & MF_RT_FLAG_JIT) != 0) && \
+            (mf_jit_new(&jit, rt->prog) == 0))
+    {
+        ret = mf_jit_run(jit, rt);
+        mf_jit_destroy(jit);
+    }
+    else
+    {
+        ret = mf_rt_call(rt, (int32_t)rt->prog->main_idx);
+    }
+
+    if ((mf_rt_io_flush(rt->io) != 0) && (ret == MF_RT_OK)) ret = MF_RT_ERR_IO;
+
+    return ret;
+}
+
+const char *mf_rt_error_str(int error)
+{
+    switch (error)
+    {
+        case MF_RT_OK: return "ok";
+        case MF_RT_ERR_UNDERFLOW: return "stack underflow";
+        case MF_RT_ERR_OVERFLOW: return "stack overflow";
+        case MF_RT_ERR_DIV_ZERO: return "division by zero";
+        case MF_RT_ERR_LAMBDA: return "not a lambda";
+        case MF_RT_ERR_DEPTH: return "calls nested too deeply";
+        case MF_RT_ERR_PICK: return "pick out of range";
+        case MF_RT_ERR_IO: return "i/o error";
+        case MF_RT_YIELD: return "yielded";
+        case MF_RT_WAIT_IN: return "waiting for input";
+        case MF_RT_WAIT_OUT: return "waiting for output";
+        case MF_RT_FUEL: return "out of fuel";
+    }
+    return "unknown error";
+}
+
@@ -0,0 +1,96 @@
+/* Multiple False Programming Language : Runtime
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_RT_H_
+#define _MF_RT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+
+/* Elements of the operand stack */
+#define MF_RT_STACK_SIZE_DEFAULT (1024 * 1024)
+/* Nested lambda calls */
+#define MF_RT_DEPTH_MAX_DEFAULT 16384
+
+/* Runtime errors */
+enum
+{
+    MF_RT_OK = 0,
+    MF_RT_ERR_UNDERFLOW,
+    MF_RT_ERR_OVERFLOW,
+    MF_RT_ERR_DIV_ZERO,
+    MF_RT_ERR_LAMBDA,
+    MF_RT_ERR_DEPTH,
+    MF_RT_ERR_PICK,
+    MF_RT_ERR_IO,
+
+    /* Not errors, the engine stopped where it can go on from: the 
+     * slice is used up, the i/o would block, or no fuel is left */
+    MF_RT_YIELD,
+    MF_RT_WAIT_IN,
+    MF_RT_WAIT_OUT,
+    MF_RT_FUEL,
+};
+
+#define MF_RT_IS_PAUSED(x) ((x) >= MF_RT_YIELD)
+
+/* Options of 'mf_rt_run' */
+#define MF_RT_FLAG_JIT 1
+
+/* Integers and lambdas share the stack unboxed, 
+ * a lambda is the index of its code */
+struct mf_rt
+{
+    const struct mf_prog *prog;
+
+    /* 'sp' points to the next free slot */
+    int32_t *stack;
+    int32_t *sp;
+    int32_t *stack_end;
+
+    int32_t vars[MF_PROG_VARS_MAX];
+
+    uint32_t depth;
+    uint32_t depth_max;
+
+    struct mf_rt_io *io;
+};
+
+int mf_rt_init(struct mf_rt *rt, \
+        const struct mf_prog *prog, \
+        struct mf_rt_io *io, \
+        size_t stack_size);
+int mf_rt_uninit(struct mf_rt *rt);
+
+/* Execute a single instruction which calls no lambda */
+int mf_rt_exec_ins(struct mf_rt *rt, const struct mf_prog_ins *ins);
+
+/* Call a lambda with the reference interpreter */
+int mf_rt_call(struct mf_rt *rt, int32_t lambda_idx);
+
+/* Run 'main', returns one of MF_RT_ERR_* */
+int mf_rt_run(struct mf_rt *rt, int flags);
+
+const char *mf_rt_error_str(int error);
+
+#endif
+
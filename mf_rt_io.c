@@ -0,0 +1,289 @@
+/* Multiple False Programming Language : Runtime I/O
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "multiple_err.h"
+
+#include "mf_rt_io.h"
+
+static int mf_rt_io_write_fd(int fd, const char *data, size_t len)
+{
+    ssize_t written;
+
+    while (len != 0)
+    {
+        written = write(fd, data, len);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+
+    return 0;
+}
+
+/* Write what the descriptor takes and keep the rest at the start 
+ * of the buffer, MF_RT_IO_AGAIN if some is left */
+static int mf_rt_io_flush_some(struct mf_rt_io *io)
+{
+    ssize_t written;
+    size_t done = 0;
+
+    while (done != io->buf_out_used)
+    {
+        written = write(io->fd_out, io->buf_out + done, io->buf_out_used - done);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+            io->buf_out_used = 0;
+            return -1;
+        }
+        done += (size_t)written;
+    }
+
+    memmove(io->buf_out, io->buf_out + done, io->buf_out_used - done);
+    io->buf_out_used -= done;
+
+    return (io->buf_out_used == 0) ? 0 : MF_RT_IO_AGAIN;
+}
+
+/* Non-blocking output is always taken in */
+static int mf_rt_io_write_nonblock(struct mf_rt_io *io, const char *data, size_t len)
+{
+    int ret = 0;
+    char *new_buf_out;
+    size_t new_size;
+
+    if ((len > io->buf_out_size - io->buf_out_used) && \
+            ((ret = mf_rt_io_flush_some(io)) < 0) && (ret != MF_RT_IO_AGAIN))
+    { return ret; }
+
+    if (len > io->buf_out_size - io->buf_out_used)
+    {
+        new_size = (io->buf_out_size == 0) ? 1 : io->buf_out_size;
+        while (new_size - io->buf_out_used < len) new_size *= 2;
+        new_buf_out = (char *)realloc(io->buf_out, sizeof(char) * new_size);
+        if (new_buf_out == NULL) return -MULTIPLE_ERR_MALLOC;
+        io->buf_out = new_buf_out;
+        io->buf_out_size = new_size;
+    }
+    memcpy(io->buf_out + io->buf_out_used, data, len);
+    io->buf_out_used += len;
+
+    return ret;
+}
+
+/* Map the rest of a regular file, 0 on success */
+static int mf_rt_io_map_input(struct mf_rt_io *io)
+{
+    struct stat st;
+    off_t offset;
+    void *map;
+
+    if (fstat(io->fd_in, &st) != 0) return -1;
+    if (!S_ISREG(st.st_mode) || (st.st_size <= 0)) return -1;
+    if ((offset = lseek(io->fd_in, 0, SEEK_CUR)) < 0) return -1;
+    if (offset >= st.st_size) return -1;
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, io->fd_in, 0);
+    if (map == MAP_FAILED) return -1;
+#ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    io->map_in = map;
+    io->map_in_len = (size_t)st.st_size;
+    io->in_p = (const unsigned char *)map + offset;
+    io->in_endp = (const unsigned char *)map + st.st_size;
+
+    return 0;
+}
+
+int mf_rt_io_init(struct mf_rt_io *io, \
+        int fd_in, int fd_out, \
+        size_t buf_in_size, size_t buf_out_size, \
+        int flags)
+{
+    io->fd_in = fd_in;
+    io->eof = 0;
+    io->in_p = io->in_endp = NULL;
+    io->buf_in = NULL;
+    io->buf_in_size = 0;
+    io->map_in = NULL;
+    io->map_in_len = 0;
+
+    io->fd_out = fd_out;
+    io->nonblock = ((flags & MF_RT_IO_FLAG_NONBLOCK) != 0) ? 1 : 0;
+    io->buf_out = NULL;
+    io->buf_out_size = 0;
+    io->buf_out_used = 0;
+    if (buf_out_size != 0)
+    {
+        io->buf_out = (char *)malloc(sizeof(char) * buf_out_size);
+        if (io->buf_out == NULL) return -MULTIPLE_ERR_MALLOC;
+        io->buf_out_size = buf_out_size;
+    }
+
+    if (((flags & MF_RT_IO_FLAG_MMAP_INPUT) != 0) && \
+            (mf_rt_io_map_input(io) == 0))
+    { return 0; }
+
+    if (buf_in_size == 0) buf_in_size = 1;
+    io->buf_in = (unsigned char *)malloc(sizeof(unsigned char) * buf_in_size);
+    if (io->buf_in == NULL)
+    {
+        if (io->buf_out != NULL) { free(io->buf_out); io->buf_out = NULL; }
+        return -MULTIPLE_ERR_MALLOC;
+    }
+    io->buf_in_size = buf_in_size;
+
+    return 0;
+}
+
+int mf_rt_io_uninit(struct mf_rt_io *io)
+{
+    int ret;
+
+    ret = mf_rt_io_flush(io);
+    if (io->buf_out != NULL)
+    {
+        free(io->buf_out);
+        io->buf_out = NULL;
+    }
+    io->buf_out_size = 0;
+
+    if (io->buf_in != NULL)
+    {
+        free(io->buf_in);
+        io->buf_in = NULL;
+    }
+    if (io->map_in != NULL)
+    {
+        munmap(io->map_in, io->map_in_len);
+        io->map_in = NULL;
+    }
+    io->in_p = io->in_endp = NULL;
+
+    return ret;
+}
+
+int mf_rt_io_flush(struct mf_rt_io *io)
+{
+    size_t used = io->buf_out_used;
+
+    if (used == 0) return 0;
+    if (io->nonblock != 0) return mf_rt_io_flush_some(io);
+    io->buf_out_used = 0;
+    return mf_rt_io_write_fd(io->fd_out, io->buf_out, used);
+}
+
+int mf_rt_io_write(struct mf_rt_io *io, const char *data, size_t len)
+{
+    int ret;
+
+    if (len <= io->buf_out_size - io->buf_out_used)
+    {
+        memcpy(io->buf_out + io->buf_out_used, data, len);
+        io->buf_out_used += len;
+        return 0;
+    }
+    if (io->nonblock != 0) return mf_rt_io_write_nonblock(io, data, len);
+
+    if ((ret = mf_rt_io_flush(io)) != 0) return ret;
+    if (len < io->buf_out_size)
+    {
+        memcpy(io->buf_out, data, len);
+        io->buf_out_used = len;
+        return 0;
+    }
+
+    /* Too large to be buffered */
+    return mf_rt_io_write_fd(io->fd_out, data, len);
+}
+
+int mf_rt_io_print_int(struct mf_rt_io *io, int32_t value)
+{
+    char buf[12];
+    char *p = buf + sizeof(buf);
+    uint32_t value_abs = (value < 0) ? (0U - (uint32_t)value) : (uint32_t)value;
+
+    do
+    {
+        *--p = (char)('0' + (value_abs % 10));
+        value_abs /= 10;
+    } while (value_abs != 0);
+    if (value < 0) *--p = '-';
+
+    return mf_rt_io_write(io, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+int mf_rt_io_putchar_slow(struct mf_rt_io *io, int ch)
+{
+    char c = (char)ch;
+
+    return mf_rt_io_write(io, &c, 1);
+}
+
+int mf_rt_io_getchar_slow(struct mf_rt_io *io)
+{
+    int ret;
+    ssize_t len;
+
+    /* Mapped input never grows */
+    if ((io->eof != 0) || (io->map_in != NULL))
+    {
+        io->eof = 1;
+        return -1;
+    }
+
+    /* Prompts should be seen before waiting for input */
+    if (((ret = mf_rt_io_flush(io)) != 0) && (ret != MF_RT_IO_AGAIN)) return -1;
+
+    for (;;)
+    {
+        len = read(io->fd_in, io->buf_in, io->buf_in_size);
+        if (len > 0) break;
+        if ((len < 0) && (errno == EINTR)) continue;
+        if ((len < 0) && (io->nonblock != 0) && \
+                ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        { return MF_RT_IO_AGAIN; }
+        io->eof = 1;
+        return -1;
+    }
+    io->in_p = io->buf_in;
+    io->in_endp = io->buf_in + len;
+
+    return (int)(*io->in_p++);
+}
+
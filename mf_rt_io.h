@@ -0,0 +1,87 @@
+/* Multiple False Programming Language : Runtime I/O
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_RT_IO_H_
+#define _MF_RT_IO_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define MF_RT_IO_OUTPUT_BUFFER_SIZE_DEFAULT (64 * 1024)
+#define MF_RT_IO_INPUT_BUFFER_SIZE_DEFAULT (64 * 1024)
+
+/* Map the input instead of reading it if it is a regular file */
+#define MF_RT_IO_FLAG_MMAP_INPUT 1
+/* The descriptors are non-blocking, nothing waits on them: the output 
+ * is kept in the buffer, grown if needed, and MF_RT_IO_AGAIN tells 
+ * that the descriptor is full, the input returns MF_RT_IO_AGAIN 
+ * when nothing is there yet */
+#define MF_RT_IO_FLAG_NONBLOCK 2
+
+#define MF_RT_IO_AGAIN (-2)
+
+struct mf_rt_io
+{
+    /* Output, flushed when full, by 'ß', before reading and at exit */
+    int fd_out;
+    int nonblock;
+    char *buf_out;
+    size_t buf_out_size; /* 0 for writing through */
+    size_t buf_out_used;
+
+    /* Input, read ahead in large blocks or mapped */
+    int fd_in;
+    int eof;
+    const unsigned char *in_p;
+    const unsigned char *in_endp;
+    unsigned char *buf_in;
+    size_t buf_in_size;
+    void *map_in;
+    size_t map_in_len;
+};
+
+int mf_rt_io_init(struct mf_rt_io *io, \
+        int fd_in, int fd_out, \
+        size_t buf_in_size, size_t buf_out_size, \
+        int flags);
+/* Flush and release */
+int mf_rt_io_uninit(struct mf_rt_io *io);
+
+int mf_rt_io_flush(struct mf_rt_io *io);
+int mf_rt_io_write(struct mf_rt_io *io, const char *data, size_t len);
+int mf_rt_io_print_int(struct mf_rt_io *io, int32_t value);
+int mf_rt_io_putchar_slow(struct mf_rt_io *io, int ch);
+
+/* ',' */
+#define mf_rt_io_putchar(io, ch) \
+    (((io)->buf_out_used < (io)->buf_out_size) ? \
+     ((io)->buf_out[(io)->buf_out_used++] = (char)(ch), 0) : \
+     mf_rt_io_putchar_slow((io), (ch)))
+
+int mf_rt_io_getchar_slow(struct mf_rt_io *io);
+
+/* '^', returns -1 at the end of input, the output is flushed
+ * before blocking on the input, see MF_RT_IO_FLAG_NONBLOCK */
+#define mf_rt_io_getchar(io) \
+    (((io)->in_p != (io)->in_endp) ? \
+     (int)(*(io)->in_p++) : \
+     mf_rt_io_getchar_slow(io))
+
+#endif
+
@@ -0,0 +1,372 @@
+/* Multiple False Programming Language : Execution Snapshot
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiple_err.h"
+
+#include "mf_prog.h"
+#include "mf_rt_io.h"
+#include "mf_rt.h"
+#include "mf_engine.h"
+#include "mf_snap.h"
+
+/* Layout, every number but the hash as a LEB128 varint, the values 
+ * of the operand stack and the variables zigzag encoded:
+ *
+ *   "MFSNAP" version hash(8 bytes, little endian)
+ *   pc depth 
+ *   count stack[count] count vars[count] count rstack[count]
+ *   count output[count] */
+#define MF_SNAP_MAGIC "MFSNAP"
+#define MF_SNAP_MAGIC_LEN 6
+#define MF_SNAP_VERSION 1
+
+#define MF_SNAP_HASH_BASIS 14695981039346656037ULL
+#define MF_SNAP_HASH_PRIME 1099511628211ULL
+
+static uint64_t mf_snap_hash_u32(uint64_t hash, uint32_t value)
+{
+    int idx;
+
+    for (idx = 0; idx != 4; idx++)
+    {
+        hash ^= (uint64_t)((value >> (idx * 8)) & 0xff);
+        hash *= MF_SNAP_HASH_PRIME;
+    }
+    return hash;
+}
+
+/* FNV-1a over what gives a pc its meaning, the handlers differ 
+ * from one process to another and are left out */
+static uint64_t mf_snap_image_hash(const struct mf_engine_image *image)
+{
+    uint64_t hash = MF_SNAP_HASH_BASIS;
+    size_t idx;
+
+    hash = mf_snap_hash_u32(hash, (uint32_t)image->size);
+    hash = mf_snap_hash_u32(hash, (uint32_t)image->lambdas_count);
+    for (idx = 0; idx != image->size; idx++)
+    {
+        hash = mf_snap_hash_u32(hash, image->code[idx].op);
+        hash = mf_snap_hash_u32(hash, (uint32_t)image->code[idx].operand);
+    }
+    for (idx = 0; idx != image->lambdas_count; idx++)
+    {
+        hash = mf_snap_hash_u32(hash, image->entries[idx]);
+    }
+    return hash;
+}
+
+/* Writing */
+
+struct mf_snap_buf
+{
+    unsigned char *data;
+    size_t size;
+    size_t used;
+};
+
+static int mf_snap_put(struct mf_snap_buf *buf, const void *data, size_t len)
+{
+    unsigned char *new_data;
+    size_t new_size;
+
+    if (buf->size - buf->used < len)
+    {
+        new_size = (buf->size == 0) ? 256 : buf->size;
+        while (new_size - buf->used < len) new_size *= 2;
+        new_data = (unsigned char *)realloc(buf->data, new_size);
+        if (new_data == NULL) return -MULTIPLE_ERR_MALLOC;
+        buf->data = new_data;
+        buf->size = new_size;
+    }
+    memcpy(buf->data + buf->used, data, len);
+    buf->used += len;
+
+    return 0;
+}
+
+static int mf_snap_put_uint(struct mf_snap_buf *buf, uint64_t value)
+{
+    unsigned char bytes[10];
+    size_t len = 0;
+
+    while (value >= 0x80)
+    {
+        bytes[len++] = (unsigned char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    bytes[len++] = (unsigned char)value;
+
+    return mf_snap_put(buf, bytes, len);
+}
+
+static int mf_snap_put_int(struct mf_snap_buf *buf, int32_t value)
+{
+    uint32_t zigzag = (value < 0) ? ~((uint32_t)value << 1) : ((uint32_t)value << 1);
+
+    return mf_snap_put_uint(buf, zigzag);
+}
+
+int mf_snap_save(const struct mf_engine *engine, const char *pathname)
+{
+    int ret = 0;
+    const struct mf_rt *rt = &engine->rt;
+    struct mf_snap_buf buf;
+    unsigned char hash_bytes[8];
+    uint64_t hash;
+    size_t idx;
+    FILE *fp = NULL;
+
+    buf.data = NULL;
+    buf.size = 0;
+    buf.used = 0;
+
+    hash = mf_snap_image_hash(engine->image);
+    for (idx = 0; idx != 8; idx++)
+    { hash_bytes[idx] = (unsigned char)((hash >> (idx * 8)) & 0xff); }
+
+    if (((ret = mf_snap_put(&buf, MF_SNAP_MAGIC, MF_SNAP_MAGIC_LEN)) != 0) || \
+            ((ret = mf_snap_put_uint(&buf, MF_SNAP_VERSION)) != 0) || \
+            ((ret = mf_snap_put(&buf, hash_bytes, 8)) != 0) || \
+            ((ret = mf_snap_put_uint(&buf, engine->pc)) != 0) || \
+            ((ret = mf_snap_put_uint(&buf, rt->depth)) != 0))
+    { goto fail; }
+
+    if ((ret = mf_snap_put_uint(&buf, (uint64_t)(rt->sp - rt->stack))) != 0) goto fail;
+    for (idx = 0; idx != (size_t)(rt->sp - rt->stack); idx++)
+    {
+        if ((ret = mf_snap_put_int(&buf, rt->stack[idx])) != 0) goto fail;
+    }
+    if ((ret = mf_snap_put_uint(&buf, MF_PROG_VARS_MAX)) != 0) goto fail;
+    for (idx = 0; idx != MF_PROG_VARS_MAX; idx++)
+    {
+        if ((ret = mf_snap_put_int(&buf, rt->vars[idx])) != 0) goto fail;
+    }
+    if ((ret = mf_snap_put_uint(&buf, (uint64_t)(engine->rsp - engine->rstack))) != 0) goto fail;
+    for (idx = 0; idx != (size_t)(engine->rsp - engine->rstack); idx++)
+    {
+        if ((ret = mf_snap_put_uint(&buf, engine->rstack[idx])) != 0) goto fail;
+    }
+    if (((ret = mf_snap_put_uint(&buf, rt->io->buf_out_used)) != 0) || \
+            ((ret = mf_snap_put(&buf, rt->io->buf_out, rt->io->buf_out_used)) != 0))
+    { goto fail; }
+
+    if (((fp = fopen(pathname, "wb")) == NULL) || \
+            (fwrite(buf.data, buf.used, 1, fp) < 1))
+    { ret = MF_SNAP_ERR_IO; goto fail; }
+    if (fclose(fp) != 0) { fp = NULL; ret = MF_SNAP_ERR_IO; goto fail; }
+    fp = NULL;
+
+    goto done;
+fail:
+    if (fp != NULL) fclose(fp);
+done:
+    if (buf.data != NULL) free(buf.data);
+    return ret;
+}
+
+/* Reading */
+
+struct mf_snap_reader
+{
+    const unsigned char *p;
+    const unsigned char *endp;
+};
+
+static int mf_snap_get_uint(struct mf_snap_reader *reader, uint64_t *value_out)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    unsigned char byte;
+
+    do
+    {
+        if ((reader->p == reader->endp) || (shift > 63)) return MF_SNAP_ERR_FORMAT;
+        byte = *reader->p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) != 0);
+    *value_out = value;
+
+    return 0;
+}
+
+static int mf_snap_get_u32(struct mf_snap_reader *reader, uint32_t *value_out)
+{
+    uint64_t value;
+
+    if (mf_snap_get_uint(reader, &value) != 0) return MF_SNAP_ERR_FORMAT;
+    if (value > UINT32_MAX) return MF_SNAP_ERR_FORMAT;
+    *value_out = (uint32_t)value;
+
+    return 0;
+}
+
+static int mf_snap_get_int(struct mf_snap_reader *reader, int32_t *value_out)
+{
+    uint32_t zigzag;
+
+    if (mf_snap_get_u32(reader, &zigzag) != 0) return MF_SNAP_ERR_FORMAT;
+    *value_out = (int32_t)(((zigzag & 1) != 0) ? ~(zigzag >> 1) : (zigzag >> 1));
+
+    return 0;
+}
+
+static int mf_snap_read_file(const char *pathname, \
+        unsigned char **data_out, size_t *len_out)
+{
+    FILE *fp;
+    unsigned char *data = NULL, *new_data;
+    size_t size = 0, len = 0, n;
+
+    if ((fp = fopen(pathname, "rb")) == NULL) return MF_SNAP_ERR_IO;
+    for (;;)
+    {
+        if (len == size)
+        {
+            size = (size == 0) ? 4096 : size * 2;
+            new_data = (unsigned char *)realloc(data, size);
+            if (new_data == NULL)
+            {
+                if (data != NULL) free(data);
+                fclose(fp);
+                return -MULTIPLE_ERR_MALLOC;
+            }
+            data = new_data;
+        }
+        n = fread(data + len, 1, size - len, fp);
+        len += n;
+        if (n == 0) break;
+    }
+    if (ferror(fp))
+    {
+        free(data);
+        fclose(fp);
+        return MF_SNAP_ERR_IO;
+    }
+    fclose(fp);
+    *data_out = data;
+    *len_out = len;
+
+    return 0;
+}
+
+int mf_snap_load(struct mf_engine *engine, const char *pathname)
+{
+    int ret = 0;
+    struct mf_rt *rt = &engine->rt;
+    struct mf_snap_reader reader;
+    unsigned char *data = NULL;
+    size_t len;
+    uint64_t hash = 0;
+    uint64_t count;
+    uint32_t version, pc, depth, value;
+    size_t idx;
+
+    if ((ret = mf_snap_read_file(pathname, &data, &len)) != 0) return ret;
+    reader.p = data;
+    reader.endp = data + len;
+
+    if ((len < MF_SNAP_MAGIC_LEN) || \
+            (memcmp(data, MF_SNAP_MAGIC, MF_SNAP_MAGIC_LEN) != 0))
+    { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    reader.p += MF_SNAP_MAGIC_LEN;
+    if ((mf_snap_get_u32(&reader, &version) != 0) || (version != MF_SNAP_VERSION) || \
+            (reader.endp - reader.p < 8))
+    { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    for (idx = 0; idx != 8; idx++)
+    { hash |= (uint64_t)reader.p[idx] << (idx * 8); }
+    reader.p += 8;
+    if (hash != mf_snap_image_hash(engine->image))
+    { ret = MF_SNAP_ERR_IMAGE; goto done; }
+
+    if ((mf_snap_get_u32(&reader, &pc) != 0) || (pc >= engine->image->size) || \
+            (mf_snap_get_u32(&reader, &depth) != 0) || (depth == 0))
+    { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    if (depth > rt->depth_max) { ret = MF_SNAP_ERR_SIZE; goto done; }
+
+    if (mf_snap_get_uint(&reader, &count) != 0) { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    if (count > (uint64_t)(rt->stack_end - rt->stack)) { ret = MF_SNAP_ERR_SIZE; goto done; }
+    for (idx = 0; idx != count; idx++)
+    {
+        if (mf_snap_get_int(&reader, &rt->stack[idx]) != 0)
+        { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    }
+    rt->sp = rt->stack + count;
+
+    if ((mf_snap_get_uint(&reader, &count) != 0) || (count != MF_PROG_VARS_MAX))
+    { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    for (idx = 0; idx != MF_PROG_VARS_MAX; idx++)
+    {
+        if (mf_snap_get_int(&reader, &rt->vars[idx]) != 0)
+        { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    }
+
+    /* Return addresses and lambdas, both below the size of the code */
+    if ((mf_snap_get_uint(&reader, &count) != 0) || (count == 0))
+    { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    if (count > (uint64_t)(engine->rstack_end - engine->rstack))
+    { ret = MF_SNAP_ERR_SIZE; goto done; }
+    for (idx = 0; idx != count; idx++)
+    {
+        if ((mf_snap_get_u32(&reader, &value) != 0) || (value >= engine->image->size))
+        { ret = MF_SNAP_ERR_FORMAT; goto done; }
+        engine->rstack[idx] = value;
+    }
+    engine->rsp = engine->rstack + count;
+
+    if ((mf_snap_get_uint(&reader, &count) != 0) || \
+            (count != (uint64_t)(reader.endp - reader.p)))
+    { ret = MF_SNAP_ERR_FORMAT; goto done; }
+    if (count != 0)
+    {
+        ret = mf_rt_io_write(rt->io, (const char *)reader.p, (size_t)count);
+        if ((ret != 0) && (ret != MF_RT_IO_AGAIN)) { ret = MF_SNAP_ERR_IO; goto done; }
+        ret = 0;
+    }
+
+    rt->depth = depth;
+    engine->pc = pc;
+
+done:
+    free(data);
+    return ret;
+}
+
+const char *mf_snap_error_str(int error)
+{
+    switch (error)
+    {
+        case MF_SNAP_OK: return "ok";
+        case MF_SNAP_ERR_IO: return "snapshot i/o error";
+        case MF_SNAP_ERR_FORMAT: return "not a snapshot";
+        case MF_SNAP_ERR_IMAGE: return "snapshot of another program";
+        case MF_SNAP_ERR_SIZE: return "snapshot does not fit the stacks";
+        case -MULTIPLE_ERR_MALLOC: return "out of memory";
+    }
+    return "unknown error";
+}
+
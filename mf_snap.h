@@ -0,0 +1,55 @@
+/* Multiple False Programming Language : Execution Snapshot
+   Copyright(C) 2014 Cheryl Natsu
+
+   This file is part of multiple - Multiple Paradigm Language Interpreter
+
+   multiple is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   multiple is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+#ifndef _MF_SNAP_H_
+#define _MF_SNAP_H_
+
+#include <stdint.h>
+
+#include "mf_engine.h"
+
+/* The state of a paused run, see MF_RT_IS_PAUSED, kept in a file: 
+ * the operand stack, the variables, the return stack, the output 
+ * not written yet and the next instruction. It goes back into a 
+ * run of the same image, built from the same source with the same 
+ * options, in another process as well. What was read ahead of the 
+ * input stays behind, the restored run reads its own */
+
+enum
+{
+    MF_SNAP_OK = 0,
+    MF_SNAP_ERR_IO,
+    MF_SNAP_ERR_FORMAT,
+    /* Saved from another image */
+    MF_SNAP_ERR_IMAGE,
+    /* The stacks of the run are too small for it */
+    MF_SNAP_ERR_SIZE,
+};
+
+/* Returns one of MF_SNAP_ERR_* or -MULTIPLE_ERR_* */
+int mf_snap_save(const struct mf_engine *engine, const char *pathname);
+/* Into a run fresh from 'mf_engine_init', going on from the saved 
+ * instruction with the next 'mf_engine_run', only good for 
+ * 'mf_engine_uninit' when it fails */
+int mf_snap_load(struct mf_engine *engine, const char *pathname);
+
+const char *mf_snap_error_str(int error);
+
+#endif
+
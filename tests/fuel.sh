@@ -0,0 +1,95 @@
+#!/bin/sh
+# Multiple False Programming Language : Fuel tests
+#   Copyright(C) 2014 Cheryl Natsu
+#
+#   This file is part of multiple - Multiple Paradigm Language Interpreter
+#
+#   multiple is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   multiple is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# 'false-run -f' has to stop endless loops wherever the threaded engine
+# runs them, alone, with -T, -S, at every optimization level and with
+# -r, and has to be refused wherever it would not be charged.
+#
+# usage: tests/fuel.sh <false-run>
+
+run="$1"
+failed=0
+
+if [ ! -x "$run" ]; then
+    echo "usage: $0 <false-run>" >&2
+    exit 2
+fi
+tmp=$(mktemp -d) || exit 2
+
+printf '[1][]#' > "$tmp/loop.f"
+printf '[1 .]f: [1][f;!]#' > "$tmp/calls.f"
+printf '1 2+.' > "$tmp/short.f"
+
+# Stops with "out of fuel", or finishes when there is enough
+for options in "" "-T" "-S" "-O 0" "-O 2"; do
+    for src in loop calls; do
+        timeout 10 "$run" $options -f 1000 "$tmp/$src.f" > "$tmp/out" 2>&1 < /dev/null
+        status=$?
+        if [ "$status" -ne 1 ] || ! grep -q "out of fuel" "$tmp/out"; then
+            echo "FAIL $src.f $options -f 1000: exit status $status"
+            failed=$((failed + 1))
+        fi
+    done
+    got=$("$run" $options -f 1000 "$tmp/short.f" 2>&1 < /dev/null)
+    if [ "$got" != "3" ]; then
+        echo "FAIL short.f $options -f 1000: '$got'"
+        failed=$((failed + 1))
+    fi
+done
+
+printf 'x' > "$tmp/input"
+echo "$tmp/input" > "$tmp/list"
+for options in "" "-y 10"; do
+    timeout 10 "$run" -r "$tmp/list" $options -f 1000 "$tmp/loop.f" > "$tmp/out" 2>&1
+    if ! grep -q "out of fuel" "$tmp/out"; then
+        echo "FAIL loop.f -r $options -f 1000"
+        failed=$((failed + 1))
+    fi
+done
+
+# Refused with usage, and nothing run or written
+mkdir "$tmp/c"
+for options in "-e interpreter" "-e jit" "-c $tmp/c" "-x 1" \
+        "-r $tmp/list -e jit"; do
+    timeout 10 "$run" $options -f 1000 "$tmp/loop.f" > "$tmp/out" 2>&1 < /dev/null
+    status=$?
+    if [ "$status" -ne 1 ] || ! grep -q "^usage:" "$tmp/out"; then
+        echo "FAIL $options -f 1000: exit status $status, no usage"
+        failed=$((failed + 1))
+    fi
+done
+if [ -n "$(ls "$tmp/c")" ]; then
+    echo "FAIL -c -f 1000: wrote $(ls "$tmp/c")"
+    failed=$((failed + 1))
+fi
+for fuel in "" "-3" "abc" "10x" "18446744073709551615"; do
+    "$run" -f "$fuel" "$tmp/short.f" > "$tmp/out" 2>&1 < /dev/null
+    status=$?
+    if [ "$status" -ne 1 ] || ! grep -q "^usage:" "$tmp/out"; then
+        echo "FAIL -f '$fuel': exit status $status, no usage"
+        failed=$((failed + 1))
+    fi
+done
+rm -rf "$tmp"
+
+if [ "$failed" -ne 0 ]; then
+    echo "$failed failure(s)"
+    exit 1
+fi
+echo "ok"
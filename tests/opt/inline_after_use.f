@@ -0,0 +1 @@
+[9 .]h: f;! [5 .]f:
@@ -0,0 +1 @@
+[9 .]h: 0[[5 .]f:]? f;!
@@ -0,0 +1 @@
+[9 .]h: 1_ 0 [[5 .]f:]? f;!
@@ -0,0 +1 @@
+[4100ø.]f: 0[$4200<][$1+]# f;!
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Multiple False Programming Language : Optimization regression tests
+#   Copyright(C) 2014 Cheryl Natsu
+#
+#   This file is part of multiple - Multiple Paradigm Language Interpreter
+#
+#   multiple is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   multiple is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Every program in opt/ has to print the same at -O1 and -O2 as at
+# -O0, on every engine and compiled to C with $CC (default cc).
+#
+# usage: tests/opt_same.sh <false-run>
+
+run="$1"
+dir=$(dirname "$0")
+cc="${CC:-cc}"
+failed=0
+
+if [ ! -x "$run" ]; then
+    echo "usage: $0 <false-run>" >&2
+    exit 2
+fi
+tmp=$(mktemp -d) || exit 2
+
+for src in "$dir"/opt/*.f; do
+    for engine in threaded interpreter jit; do
+        want=$("$run" -O 0 -e "$engine" "$src" 2>&1 < /dev/null)
+        for level in 1 2; do
+            got=$("$run" -O "$level" -e "$engine" "$src" 2>&1 < /dev/null)
+            if [ "$got" != "$want" ]; then
+                echo "FAIL $src -O $level -e $engine: '$got', -O 0 gives '$want'"
+                failed=$((failed + 1))
+            fi
+        done
+    done
+
+    for level in 0 1 2; do
+        "$run" -O "$level" -c "$tmp" "$src" > /dev/null 2>&1 && \
+            "$cc" -O1 -o "$tmp/prog" "$tmp/$(basename "$src" .f).c" 2> /dev/null || {
+            echo "FAIL $src -O $level: can not compile to C"
+            failed=$((failed + 1))
+            continue
+        }
+        got=$("$tmp/prog" 2>&1 < /dev/null)
+        if [ "$got" != "$want" ]; then
+            echo "FAIL $src -O $level -c: '$got', -O 0 gives '$want'"
+            failed=$((failed + 1))
+        fi
+    done
+done
+rm -rf "$tmp"
+
+if [ "$failed" -ne 0 ]; then
+    echo "$failed failure(s)"
+    exit 1
+fi
+echo "ok"
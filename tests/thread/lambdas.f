@@ -0,0 +1,7 @@
+[$1>[$1-f;!*]?]f:
+[[$2>][1-]#]g:
+[[1+][1+]a:a;!]h:
+[[1+][1+]b:b;!]i:
+["one"][1+]c:
+[a;!b;!]d:
+10f;!. 5g;!. 1h;!. 2i;!. 3d;!.
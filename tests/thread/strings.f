@@ -0,0 +1,4 @@
+[" a"]p: [" b"]q: [`x,]r: [`y,]s:
+[p;!q;!]t: [r;!s;!]u: [t;!u;!]v:
+[1 2 3+*]w: [w;!w;!+]x: [x;!.v;!]y:
+y;! 0[$3<][$.1+y;!]#%
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Multiple False Programming Language : Thread stress test
+#   Copyright(C) 2014 Cheryl Natsu
+#
+#   This file is part of multiple - Multiple Paradigm Language Interpreter
+#
+#   multiple is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   multiple is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Runs 'false-run -x' over the programs in thread/, opt/ and one with
+# a few hundred lambdas made here, at every optimization level. The
+# false-run given has to be built with -fsanitize=thread; any report
+# or any icode or C that is not the same as on one thread fails.
+#
+# Races inside the host library are only seen if it is built with
+# -fsanitize=thread as well.
+#
+# usage: tests/thread_tsan.sh <false-run> [rounds] [threads]
+
+run="$1"
+rounds="${2:-8}"
+threads="${3:-4}"
+dir=$(dirname "$0")
+failed=0
+
+if [ ! -x "$run" ]; then
+    echo "usage: $0 <false-run> [rounds] [threads]" >&2
+    exit 2
+fi
+if ! grep -q -a __tsan_init "$run"; then
+    echo "$run is not built with -fsanitize=thread" >&2
+    exit 2
+fi
+tmp=$(mktemp -d) || exit 2
+
+# Nested, shared and hoisted lambdas in each lambda of main
+awk 'BEGIN {
+    for (i = 0; i < 300; i++)
+    {
+        printf("[%d[%d 1+][$%d>][1-]#[\"s%d\"]?]%c:\n", \
+                i % 10, i % 7, i % 5, i % 3, 97 + i % 26);
+    }
+    print "1a;!. 2b;!. 3z;!.";
+}' > "$tmp/many.f"
+
+export TSAN_OPTIONS="halt_on_error=1 exitcode=66 $TSAN_OPTIONS"
+for level in 0 1 2; do
+    "$run" -O "$level" -x "$rounds" -j "$threads" \
+        "$dir"/thread/*.f "$dir"/opt/*.f "$tmp/many.f" > "$tmp/out" 2>&1
+    status=$?
+    if [ "$status" -ne 0 ]; then
+        echo "FAIL -O $level, exit status $status:"
+        grep -v "is an invalid integer" "$tmp/out" | head -40
+        failed=$((failed + 1))
+    fi
+done
+rm -rf "$tmp"
+
+if [ "$failed" -ne 0 ]; then
+    echo "$failed failure(s)"
+    exit 1
+fi
+echo "ok"